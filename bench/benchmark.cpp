@@ -0,0 +1,1306 @@
+#include "main/main.h"
+
+#include "core/VisualServer.h"
+#include "core/console_handlers.h"
+#include "core/error_macros.h"
+#include "core/image_decoder.h"
+#include "core/image_utils.h"
+#include "core/ktx2.h"
+#include "core/mapped_file.h"
+#include "core/mesh.h"
+#include "core/print_string.h"
+#include "core/profiler.h"
+#include "core/render_graph.h"
+#include "core/texture.h"
+#include "core/texture_streamer.h"
+#include "core/thread_pool.h"
+#include "core/transcoder.h"
+#include "libs/glm/gtc/random.hpp"
+#include "modules/glfw/glfw_window_server.h"
+#include "modules/vulkan/vulkan_visual_server.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <thread>
+
+// SCENE STRESS BENCHMARK
+//		Renders a parameterized scene for a fixed number of frames and reports
+// the frame time distribution plus the CPU time of each profiled subsystem.
+//
+//		hello_vulkan_benchmark --meshes=500 --geometry=unique --textures=8 --dynamic=0.25
+//
+//		The frame time is measured around the whole game loop iteration
+// (tick + OldVisualServer::step), so in threaded mode it's the time seen by
+// the game thread.
+//
+//		hello_vulkan_benchmark --meshes=1000 --geometry=unique --detail=64 --geometry-residency=discard
+//
+//		The meshes release their geometry once uploaded, the memory report
+// shows the host memory of the mesh category dropping to zero.
+//
+//		hello_vulkan_benchmark --image-allocations=10000 --image-size=64
+//
+//		Measures only the creation and the destruction of many texture images,
+// and how many device memory allocations they need.
+//
+//		hello_vulkan_benchmark --minified --gpu --mipmaps=none
+//		hello_vulkan_benchmark --minified --gpu --mipmaps=gpu
+//
+//		Compares the texture bandwidth of a minified scene: without the mip
+// chain the draw GPU time grows with the texture cache misses, the memory
+// report shows the extra third used by the chain.
+//
+//		hello_vulkan_benchmark --textures=64 --texture=assets/TestText.jpg
+//		hello_vulkan_benchmark --textures=64 --texture=assets/TestText.ktx2
+//
+//		Compares the decoded textures with the cooked ones (scons cooker=yes
+// cook): the KTX2 load has no decode, and the memory report shows the
+// texture category 4-8 times smaller.
+//
+//		hello_vulkan_benchmark --transcode=assets/TestText.universal.ktx2
+//
+//		CPU only, no device is created: transcodes all the levels of the
+// universal texture (scons cooker=yes cook_universal) to each target format,
+// with one thread and with the thread pool, with the SIMD and the scalar
+// paths, and reports the throughput in MB/s of universal blocks.
+//
+//		hello_vulkan_benchmark --decode=64
+//
+//		CPU only, no device is created: decodes the images of the assets 64
+// times, with one thread and with the thread pool, and reports the decode
+// throughput and the utilization of each thread.
+//
+//		hello_vulkan_benchmark --format-report
+//
+//		Loads the images of the assets with their usage and reports the format
+// chosen for each one, and the memory saved compared to RGBA8.
+//
+//		hello_vulkan_benchmark --textures=64 --streamed --minified
+//
+//		The textures are streamed: only the levels wanted by the screen size of
+// the meshes are resident, the streaming report shows the resident bytes.
+//
+//		hello_vulkan_benchmark --streaming-sim --streaming-budget=64
+//
+//		CPU only, no device is created: replays camera paths over a field of
+// objects through the streaming policy, and reports for each path the
+// residency (requests with the wanted level resident) and the thrash rate
+// (levels loaded again soon after their eviction).
+//
+//		hello_vulkan_benchmark --textures=8 --texture-updates=16
+//		hello_vulkan_benchmark --textures=8 --texture-updates=16 --double-buffered
+//
+//		The textures are dynamic and each frame some rectangles of them are
+// written, the transfer report shows the bytes copied by the staging ring.
+//
+//		hello_vulkan_benchmark --headless --frames=100
+//		hello_vulkan_benchmark --headless --reference=headless.ppm
+//
+//		No window: renders in the offscreen target of the headless visual
+// server (also with a software ICD), and reads each frame back while the
+// next one is executed. Every frame is compared with its reference built on
+// the CPU, the first one with the reference file too (written when missing,
+// so a run on a known device records it).
+//		Only the offscreen target is covered: the frames are clears of
+// rectangles, not the scene. The renderer (VulkanServer, with its meshes,
+// pipelines and textures) draws only in the swapchain of a window.
+
+static const uint32_t DYNAMIC_TEXTURE_SIZE = 256;
+static const uint32_t DYNAMIC_RECT_SIZE = 32;
+static const uint32_t HEADLESS_SIZE = 256;
+static const uint32_t HEADLESS_TILE_SIZE = 32;
+
+struct BenchmarkConfig {
+	int meshes;
+	bool uniqueGeometry;
+	int sphereDetail; // Segments of the unique geometry
+	Geometry::Residency geometryResidency;
+	int textures;
+	std::string texturePath;
+	float dynamicFraction;
+	int frames;
+	int warmupFrames;
+	bool threaded;
+	bool vsync;
+	bool gpuProfiling;
+	std::string csvPath;
+	std::string tracePath;
+	int imageAllocations; // When not 0 the image allocation benchmark is run
+	int imageSize;
+	VulkanServer::TextureBinding textureBinding;
+	Texture::MipmapMode mipmapMode;
+	bool minified; // The scene is far from the camera
+	bool textureCache; // The textures are shared by the cache
+	std::string transcodePath; // When not empty the transcoding benchmark is run
+	int transcodeIterations;
+	int transcodeThreads; // 0 one per hardware thread
+	bool formatReport; // When true only the format report is run
+	bool streamed; // The scene textures are streamed
+	bool streamingSim; // When true only the streaming simulation is run
+	int streamingTextures;
+	int streamingBudgetMB;
+	int streamingFrames; // Of each camera path
+	int textureUpdates; // Rectangles written each frame, the textures are dynamic when not 0
+	int decodeCopies; // When not 0 the decoding benchmark is run
+	bool doubleBuffered;
+	bool renderGraphReport; // When true only the render graph report is run
+	bool headless; // When true only the offscreen frames are rendered
+	std::string referencePath; // Of the first headless frame
+
+	BenchmarkConfig() :
+			meshes(50),
+			uniqueGeometry(false),
+			sphereDetail(16),
+			geometryResidency(Geometry::RESIDENCY_KEEP),
+			textures(1),
+			texturePath("assets/TestText.jpg"),
+			dynamicFraction(1),
+			frames(1000),
+			warmupFrames(100),
+			threaded(false),
+			vsync(false),
+			gpuProfiling(false),
+			imageAllocations(0),
+			imageSize(64),
+			textureBinding(VulkanServer::TEXTURE_BINDING_AUTO),
+			mipmapMode(Texture::MIPMAP_GENERATE),
+			minified(false),
+			textureCache(false),
+			transcodeIterations(20),
+			transcodeThreads(0),
+			formatReport(false),
+			streamed(false),
+			streamingSim(false),
+			streamingTextures(256),
+			streamingBudgetMB(64),
+			streamingFrames(600),
+			textureUpdates(0),
+			decodeCopies(0),
+			doubleBuffered(false),
+			renderGraphReport(false),
+			headless(false) {}
+};
+
+static void printUsage() {
+	print_line("Usage: hello_vulkan_benchmark [options]");
+	print_line("  --meshes=N           Number of meshes (default 50)");
+	print_line("  --geometry=G         shared: all meshes are the same cube, unique: each mesh has its own geometry");
+	print_line("  --detail=D           Segments of the unique geometry (default 16)");
+	print_line("  --geometry-residency=R  keep or discard the host geometry once uploaded (default keep)");
+	print_line("  --textures=N         Number of textures, 0 use the default texture (default 1)");
+	print_line("  --texture=PATH       Image loaded by each texture (default assets/TestText.jpg)");
+	print_line("  --texture-binding=B  auto, bindless, array or sets (default auto)");
+	print_line("  --mipmaps=M          gpu (blit, CPU fallback), cpu or none (default gpu)");
+	print_line("  --minified           Move the scene away, so the textures are minified");
+	print_line("  --texture-cache      Acquire the textures from the cache, so they share one image");
+	print_line("  --dynamic=F          Fraction of meshes that move each frame [0, 1] (default 1)");
+	print_line("  --frames=N           Measured frames (default 1000)");
+	print_line("  --warmup=N           Frames not measured (default 100)");
+	print_line("  --threaded           Render in a dedicated thread");
+	print_line("  --vsync              Use FIFO instead of IMMEDIATE");
+	print_line("  --gpu                Collect the GPU times");
+	print_line("  --csv=PATH           Dump the frame times");
+	print_line("  --trace=PATH         Export the CPU zones in chrome trace format");
+	print_line("  --image-allocations=N  Create and destroy N texture images, no scene is rendered");
+	print_line("  --image-size=S       Size of the images (default 64)");
+	print_line("  --transcode=PATH     Transcode the universal KTX2 on the CPU, no scene is rendered");
+	print_line("  --transcode-iterations=N  Transcodes of each format (default 20)");
+	print_line("  --transcode-threads=N     Workers of the pool of --transcode and --decode, 0 one per hardware thread (default 0)");
+	print_line("  --decode=N           Decode N copies of the asset images on the CPU, no scene is rendered");
+	print_line("  --format-report      Load the images of the assets and report their formats, no scene is rendered");
+	print_line("  --streamed           Stream the mip levels of the scene textures");
+	print_line("  --streaming-sim      Replay camera paths through the streaming policy on the CPU, no scene is rendered");
+	print_line("  --streaming-textures=N  Textures of the simulation (default 256)");
+	print_line("  --streaming-budget=MB   Budget of the resident levels (default 64)");
+	print_line("  --streaming-frames=N    Frames of each camera path (default 600)");
+	print_line("  --texture-updates=N  Dynamic textures, N rectangles of 32x32 written each frame");
+	print_line("  --double-buffered    The dynamic textures are double buffered");
+	print_line("  --render-graph-report  Compile and realize a multi pass graph, report the culling and the aliasing, no scene is rendered");
+	print_line("  --headless           Clear rectangles in an offscreen target without a window, read the frames back and compare them, the renderer and the scene are not used");
+	print_line("  --reference=PATH     Image compared with the first headless frame, written as PPM when missing");
+}
+
+static bool parseArgument(const char *p_arg, const char *p_name, std::string &r_value) {
+	const size_t len = strlen(p_name);
+	if (strncmp(p_arg, p_name, len) != 0 || p_arg[len] != '=')
+		return false;
+
+	r_value = p_arg + len + 1;
+	return true;
+}
+
+static bool parseArguments(int argc, char **argv, BenchmarkConfig &r_config) {
+
+	for (int i = 1; i < argc; ++i) {
+		std::string value;
+
+		if (parseArgument(argv[i], "--meshes", value)) {
+			r_config.meshes = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--geometry", value)) {
+			if (value == "unique") {
+				r_config.uniqueGeometry = true;
+			} else if (value == "shared") {
+				r_config.uniqueGeometry = false;
+			} else {
+				print_error("Unknown geometry: " + value);
+				return false;
+			}
+		} else if (parseArgument(argv[i], "--geometry-residency", value)) {
+			// The scene geometry is generated, it has no file to reload
+			if (value == "keep") {
+				r_config.geometryResidency = Geometry::RESIDENCY_KEEP;
+			} else if (value == "discard") {
+				r_config.geometryResidency = Geometry::RESIDENCY_DISCARD;
+			} else {
+				print_error("Unknown geometry residency: " + value);
+				return false;
+			}
+		} else if (parseArgument(argv[i], "--detail", value)) {
+			r_config.sphereDetail = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--textures", value)) {
+			r_config.textures = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--texture", value)) {
+			r_config.texturePath = value;
+		} else if (parseArgument(argv[i], "--texture-binding", value)) {
+			if (value == "auto") {
+				r_config.textureBinding = VulkanServer::TEXTURE_BINDING_AUTO;
+			} else if (value == "bindless") {
+				r_config.textureBinding = VulkanServer::TEXTURE_BINDING_BINDLESS;
+			} else if (value == "array") {
+				r_config.textureBinding = VulkanServer::TEXTURE_BINDING_ARRAY;
+			} else if (value == "sets") {
+				r_config.textureBinding = VulkanServer::TEXTURE_BINDING_SETS;
+			} else {
+				print_error("Unknown texture binding: " + value);
+				return false;
+			}
+		} else if (parseArgument(argv[i], "--mipmaps", value)) {
+			if (value == "gpu") {
+				r_config.mipmapMode = Texture::MIPMAP_GENERATE;
+			} else if (value == "cpu") {
+				r_config.mipmapMode = Texture::MIPMAP_GENERATE_CPU;
+			} else if (value == "none") {
+				r_config.mipmapMode = Texture::MIPMAP_NONE;
+			} else {
+				print_error("Unknown mipmaps mode: " + value);
+				return false;
+			}
+		} else if (parseArgument(argv[i], "--dynamic", value)) {
+			r_config.dynamicFraction = CLAMP(float(atof(value.c_str())), 0.f, 1.f);
+		} else if (parseArgument(argv[i], "--frames", value)) {
+			r_config.frames = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--warmup", value)) {
+			r_config.warmupFrames = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--csv", value)) {
+			r_config.csvPath = value;
+		} else if (parseArgument(argv[i], "--trace", value)) {
+			r_config.tracePath = value;
+		} else if (parseArgument(argv[i], "--image-allocations", value)) {
+			r_config.imageAllocations = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--image-size", value)) {
+			r_config.imageSize = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--transcode", value)) {
+			r_config.transcodePath = value;
+		} else if (parseArgument(argv[i], "--transcode-iterations", value)) {
+			r_config.transcodeIterations = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--transcode-threads", value)) {
+			r_config.transcodeThreads = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--streaming-textures", value)) {
+			r_config.streamingTextures = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--streaming-budget", value)) {
+			r_config.streamingBudgetMB = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--streaming-frames", value)) {
+			r_config.streamingFrames = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--decode", value)) {
+			r_config.decodeCopies = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--texture-updates", value)) {
+			r_config.textureUpdates = atoi(value.c_str());
+		} else if (parseArgument(argv[i], "--reference", value)) {
+			r_config.referencePath = value;
+		} else if (strcmp(argv[i], "--threaded") == 0) {
+			r_config.threaded = true;
+		} else if (strcmp(argv[i], "--vsync") == 0) {
+			r_config.vsync = true;
+		} else if (strcmp(argv[i], "--gpu") == 0) {
+			r_config.gpuProfiling = true;
+		} else if (strcmp(argv[i], "--minified") == 0) {
+			r_config.minified = true;
+		} else if (strcmp(argv[i], "--texture-cache") == 0) {
+			r_config.textureCache = true;
+		} else if (strcmp(argv[i], "--format-report") == 0) {
+			r_config.formatReport = true;
+		} else if (strcmp(argv[i], "--streamed") == 0) {
+			r_config.streamed = true;
+		} else if (strcmp(argv[i], "--streaming-sim") == 0) {
+			r_config.streamingSim = true;
+		} else if (strcmp(argv[i], "--double-buffered") == 0) {
+			r_config.doubleBuffered = true;
+		} else if (strcmp(argv[i], "--render-graph-report") == 0) {
+			r_config.renderGraphReport = true;
+		} else if (strcmp(argv[i], "--headless") == 0) {
+			r_config.headless = true;
+		} else {
+			print_error(std::string("Unknown argument: ") + argv[i]);
+			return false;
+		}
+	}
+
+	if (r_config.meshes < 0 || r_config.textures < 0 || r_config.frames <= 0 || r_config.warmupFrames < 0 || r_config.sphereDetail < 3 ||
+			r_config.imageAllocations < 0 || r_config.imageSize <= 0 || r_config.transcodeIterations <= 0 || r_config.transcodeThreads < 0 ||
+			r_config.streamingTextures <= 0 || r_config.streamingBudgetMB <= 0 || r_config.streamingFrames <= 0 ||
+			r_config.textureUpdates < 0 || r_config.decodeCopies < 0) {
+		print_error("Invalid arguments");
+		return false;
+	}
+
+	if (r_config.imageAllocations && r_config.threaded) {
+		print_error("--image-allocations is not supported with --threaded");
+		return false;
+	}
+
+	if (r_config.formatReport && r_config.threaded) {
+		print_error("--format-report is not supported with --threaded");
+		return false;
+	}
+
+	if (r_config.renderGraphReport && r_config.threaded) {
+		print_error("--render-graph-report is not supported with --threaded");
+		return false;
+	}
+
+	if (r_config.streamed && r_config.textureCache) {
+		// The cache loads the textures fully resident
+		print_error("--streamed is not supported with --texture-cache");
+		return false;
+	}
+
+	if (r_config.textureUpdates && (r_config.streamed || r_config.textureCache)) {
+		print_error("--texture-updates is not supported with --streamed or --texture-cache");
+		return false;
+	}
+
+	if (!r_config.referencePath.empty() && !r_config.headless) {
+		print_error("--reference requires --headless");
+		return false;
+	}
+
+	if (r_config.gpuProfiling && r_config.threaded) {
+		// In threaded mode the VulkanServer is owned by the render thread
+		print_error("--gpu is not supported with --threaded");
+		return false;
+	}
+
+	return true;
+}
+
+/// UV sphere with random jitter, so each mesh has different vertex data
+static void sphereMaker(Geometry *geometry, int p_segments, float p_jitter) {
+	const int rings = MAX(p_segments / 2, 2);
+
+	for (int r = 0; r <= rings; ++r) {
+		const float v = float(r) / rings;
+		const float phi = v * glm::pi<float>();
+
+		for (int s = 0; s <= p_segments; ++s) {
+			const float u = float(s) / p_segments;
+			const float theta = u * glm::two_pi<float>();
+			const float radius = 1.f + glm::linearRand(-p_jitter, p_jitter);
+
+			geometry->vertices.push_back(Vertex({ { radius * std::sin(phi) * std::cos(theta),
+													  radius * std::cos(phi),
+													  radius * std::sin(phi) * std::sin(theta) },
+					{ u, v } }));
+		}
+	}
+
+	for (int r = 0; r < rings; ++r) {
+		for (int s = 0; s < p_segments; ++s) {
+			const uint32_t a = r * (p_segments + 1) + s;
+			const uint32_t b = a + p_segments + 1;
+			geometry->triangles.push_back(Triangle({ a, b, a + 1 }));
+			geometry->triangles.push_back(Triangle({ b, b + 1, a + 1 }));
+		}
+	}
+}
+
+static double percentile(const std::vector<double> &p_sorted, double p_percentile) {
+	// Nearest rank
+	size_t rank = size_t(std::ceil(p_percentile / 100. * p_sorted.size()));
+	rank = CLAMP(rank, size_t(1), p_sorted.size());
+	return p_sorted[rank - 1];
+}
+
+/// A deferred frame with a debug view that nothing reads, so its pass is
+/// culled, and transients whose lifetimes don't overlap, so they share one
+/// allocation. The graph of the renderer has one pass and can't show either.
+/// Returns 1 when the compiler doesn't cull or alias
+static int runRenderGraphReport(VulkanServer *p_vulkanServer) {
+
+	RenderGraph graph;
+
+	const RenderGraph::ResourceId albedo = graph.createImage("albedo", VK_FORMAT_R8G8B8A8_UNORM);
+	const RenderGraph::ResourceId depth = graph.createImage("depth", VK_FORMAT_D16_UNORM);
+	const RenderGraph::ResourceId lit = graph.createImage("lit", VK_FORMAT_R8G8B8A8_UNORM);
+	const RenderGraph::ResourceId debugView = graph.createImage("debug view", VK_FORMAT_R8G8B8A8_UNORM);
+	const RenderGraph::ResourceId tonemapped = graph.createImage("tonemapped", VK_FORMAT_R8G8B8A8_UNORM);
+
+	const VkClearColorValue black = {};
+
+	const RenderGraph::PassId gbufferPass = graph.addPass("gbuffer", RenderGraph::PASS_RASTER, nullptr, nullptr);
+	graph.writeColor(gbufferPass, albedo, VK_ATTACHMENT_LOAD_OP_CLEAR, black);
+	graph.writeDepth(gbufferPass, depth, VK_ATTACHMENT_LOAD_OP_CLEAR);
+
+	const RenderGraph::PassId lightingPass = graph.addPass("lighting", RenderGraph::PASS_RASTER, nullptr, nullptr);
+	graph.readSampled(lightingPass, albedo);
+	graph.readDepth(lightingPass, depth);
+	graph.writeColor(lightingPass, lit, VK_ATTACHMENT_LOAD_OP_CLEAR, black);
+
+	const RenderGraph::PassId debugPass = graph.addPass("debug", RenderGraph::PASS_RASTER, nullptr, nullptr);
+	graph.readSampled(debugPass, albedo);
+	graph.writeColor(debugPass, debugView, VK_ATTACHMENT_LOAD_OP_CLEAR, black);
+
+	// Stands for the present, that has no output in the graph
+	const RenderGraph::PassId tonemapPass = graph.addPass("tonemap", RenderGraph::PASS_RASTER, nullptr, nullptr);
+	graph.readSampled(tonemapPass, lit);
+	graph.writeColor(tonemapPass, tonemapped, VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+	graph.setPassSideEffect(tonemapPass, true);
+
+	if (!graph.compile(p_vulkanServer->getDevice())) {
+		print_error("Render graph compilation failed");
+		return 1;
+	}
+
+	// Without lazily allocated memory, so the transients alias
+	const VkExtent2D extent = { 1280, 720 };
+	if (!graph.realize(p_vulkanServer->getDeviceAllocator(), &p_vulkanServer->getMemoryTracker(), extent, 1, false)) {
+		print_error("Render graph realization failed");
+		graph.releaseCompiled();
+		return 1;
+	}
+
+	graph.printReport();
+
+	const bool culled = graph.isPassCulled(debugPass);
+	// albedo is dead once the lighting is done, when tonemapped is written
+	const bool aliased = graph.getImageAllocation(albedo) == graph.getImageAllocation(tonemapped);
+	const RenderGraph::TransientStats stats = graph.getTransientStats();
+
+	print_line("Pass debug culled: " + std::string(culled ? "yes" : "no"));
+	print_line("Transients albedo and tonemapped share memory: " + std::string(aliased ? "yes" : "no"));
+	print_line("Aliasing saved " + itos((stats.requiredBytes - MIN(stats.allocatedBytes, stats.requiredBytes)) / 1024) + " KiB of " +
+			   itos(stats.requiredBytes / 1024) + " KiB in " + itos(stats.allocationCount) + " allocations");
+
+	graph.releaseCompiled();
+
+	if (!culled || !aliased) {
+		print_error("The render graph didn't cull the unused pass or alias the transients");
+		return 1;
+	}
+	return 0;
+}
+
+static void runImageAllocationBenchmark(const BenchmarkConfig &p_config, VulkanServer *p_vulkanServer) {
+
+	print_line("Image allocation benchmark: " + itos(p_config.imageAllocations) + " images " +
+			   itos(p_config.imageSize) + "x" + itos(p_config.imageSize));
+
+	std::vector<VkImage> images(p_config.imageAllocations, VK_NULL_HANDLE);
+	std::vector<VmaAllocation> allocations(p_config.imageAllocations, VK_NULL_HANDLE);
+
+	const uint64_t createBegin = Profiler::get_time_ns();
+	int created = 0;
+	for (; created < p_config.imageAllocations; ++created) {
+		if (!p_vulkanServer->createImageTexture(p_config.imageSize, p_config.imageSize, images[created], allocations[created])) {
+			print_error("Image creation failed after " + itos(created) + " images");
+			break;
+		}
+	}
+	const double createMs = double(Profiler::get_time_ns() - createBegin) / 1e6;
+
+	const MemoryTracker::CategoryStats stats = p_vulkanServer->getMemoryTracker().getCategoryStats(MemoryTracker::CATEGORY_TEXTURE);
+	p_vulkanServer->printImagePoolReport();
+
+	const uint64_t destroyBegin = Profiler::get_time_ns();
+	for (int i = 0; i < created; ++i) {
+		p_vulkanServer->destroyImageTexture(images[i], allocations[i]);
+	}
+	const double destroyMs = double(Profiler::get_time_ns() - destroyBegin) / 1e6;
+
+	print_line("Created " + itos(created) + " images in " + rtos(createMs) + " ms (" +
+			   rtos(created ? createMs * 1000. / created : 0) + " us per image)");
+	print_line("Destroyed in " + rtos(destroyMs) + " ms");
+	print_line("Texture memory " + itos(stats.liveBytes / 1024) + " KiB");
+}
+
+static std::string getFormatName(VkFormat p_format) {
+	switch (p_format) {
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			return "BC1";
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+			return "BC3";
+		case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+			return "ETC2";
+		case VK_FORMAT_R8_UNORM:
+			return "R8";
+		case VK_FORMAT_R8_SRGB:
+			return "R8 sRGB";
+		case VK_FORMAT_R8G8_UNORM:
+			return "RG8";
+		case VK_FORMAT_R8G8_SRGB:
+			return "RG8 sRGB";
+		case VK_FORMAT_R8G8B8A8_UNORM:
+			return "RGBA8";
+		case VK_FORMAT_R8G8B8A8_SRGB:
+			return "RGBA8 sRGB";
+		default:
+			return itos(p_format);
+	}
+}
+
+static int runTranscodeBenchmark(const BenchmarkConfig &p_config) {
+
+	MappedFile file;
+	KTX2::Header header;
+	if (!file.open(p_config.transcodePath) || !KTX2::parse(file.getData(), file.getSize(), header)) {
+		print_error("Can't load " + p_config.transcodePath);
+		return 1;
+	}
+
+	if (!header.universal) {
+		print_error(p_config.transcodePath + " is not universal, cook it with --format=universal");
+		return 1;
+	}
+
+	uint64_t universalBytes = 0;
+	for (size_t i = 0; i < header.levels.size(); ++i) {
+		universalBytes += header.levels[i].size;
+	}
+
+	ThreadPool threadPool;
+	threadPool.create(p_config.transcodeThreads);
+
+	print_line("Transcoding benchmark: " + itos(header.width) + "x" + itos(header.height) + ", " +
+			   itos(header.levels.size()) + " levels, " + (header.alpha ? "alpha, " : "") +
+			   itos(universalBytes / 1024) + " KiB, " + itos(p_config.transcodeIterations) + " iterations, " +
+			   itos(threadPool.getThreadCount()) + " workers");
+
+	std::vector<VkFormat> formats;
+	Transcoder::getTargetFormats(header.alpha, formats);
+
+	// The level 0 of each path, to check that the SIMD output matches
+	std::vector<uint8_t> reference;
+	bool allMatch = true;
+
+	std::vector<uint8_t> data;
+	for (size_t f = 0; f < formats.size(); ++f) {
+		for (int pooled = 0; pooled < 2; ++pooled) {
+			double scalarSeconds = 0;
+			for (int simd = 0; simd < 2; ++simd) {
+
+				uint64_t outputBytes = 0;
+				const uint64_t begin = Profiler::get_time_ns();
+				for (int iteration = 0; iteration < p_config.transcodeIterations; ++iteration) {
+					for (size_t level = 0; level < header.levels.size(); ++level) {
+						Transcoder::transcodeLevel(
+								pooled ? &threadPool : nullptr,
+								file.getData() + header.levels[level].offset,
+								MAX(header.width >> level, 1u),
+								MAX(header.height >> level, 1u),
+								header.alpha,
+								formats[f],
+								data,
+								simd);
+						outputBytes += data.size();
+					}
+				}
+				const double seconds = double(Profiler::get_time_ns() - begin) / 1e9;
+
+				// The last transcode is the smallest level, check the level 0
+				Transcoder::transcodeLevel(nullptr, file.getData() + header.levels[0].offset, header.width, header.height, header.alpha, formats[f], data, simd);
+				bool matches = true;
+				if (simd) {
+					matches = data == reference;
+					allMatch = allMatch && matches;
+				} else {
+					reference.swap(data);
+					scalarSeconds = seconds;
+				}
+
+				const double inputMB = double(universalBytes) * p_config.transcodeIterations / (1024. * 1024.);
+				print_line("  " + getFormatName(formats[f]) + (pooled ? " pool  " : " single") + (simd ? " simd  " : " scalar") + ": " +
+						   rtos(inputMB / seconds) + " MB/s universal, " +
+						   rtos(double(outputBytes) / (1024. * 1024.) / seconds) + " MB/s written" +
+						   (simd ? ", " + rtos(scalarSeconds / seconds) + "x the scalar" : "") +
+						   (matches ? "" : ", DIFFERS FROM THE SCALAR"));
+			}
+		}
+	}
+
+	threadPool.destroy();
+
+	if (!allMatch) {
+		print_error("The SIMD transcoding differs from the scalar one");
+		return 1;
+	}
+	return 0;
+}
+
+static void runFormatReport(OldVisualServer *p_visualServer) {
+
+	struct Asset {
+		const char *path;
+		Texture::Usage usage;
+	};
+
+	const Asset assets[] = {
+		{ "assets/TestText.jpg", Texture::USAGE_COLOR },
+		{ "assets/default.png", Texture::USAGE_COLOR },
+		{ "assets/ezgif-5-a88ff99709.png", Texture::USAGE_COLOR },
+		{ "assets/deagle/ESe_Material__106_color.png", Texture::USAGE_COLOR },
+		{ "assets/deagle/ESe_Material__106_nmap.png", Texture::USAGE_DATA }
+	};
+	const int assetCount = sizeof(assets) / sizeof(assets[0]);
+
+	print_line("Texture format report:");
+
+	std::vector<Texture *> textures;
+	for (int i = 0; i < assetCount; ++i) {
+		Texture *texture = p_visualServer->getTextureCache().acquire(assets[i].path, Texture::MIPMAP_GENERATE, assets[i].usage);
+		if (!texture) {
+			print_error(std::string("Can't load ") + assets[i].path);
+			continue;
+		}
+		textures.push_back(texture);
+
+		print_line("  " + std::string(assets[i].path) + ": " + getFormatName(texture->getFormat()) + ", " +
+				   itos(texture->getDataSize() / 1024) + " KiB, " + itos(texture->getRGBA8DataSize() / 1024) + " KiB in RGBA8");
+	}
+
+	p_visualServer->getTextureCache().printStats();
+
+	for (size_t i = 0; i < textures.size(); ++i) {
+		p_visualServer->getTextureCache().release(textures[i]);
+	}
+}
+
+static int runStreamingSimulation(const BenchmarkConfig &p_config) {
+
+	struct Object {
+		glm::vec3 position;
+		float radius;
+		uint32_t texture;
+	};
+
+	struct SimTexture {
+		uint32_t size;
+		uint32_t levels;
+		std::vector<uint64_t> levelSizes;
+	};
+
+	// Same field for all the paths
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> coordinate(-100.f, 100.f);
+	std::uniform_real_distribution<float> radius(0.5f, 3.f);
+
+	std::vector<SimTexture> textures(p_config.streamingTextures);
+	uint64_t fullBytes = 0;
+	for (size_t i = 0; i < textures.size(); ++i) {
+		textures[i].size = 512u << (random() % 3);
+		textures[i].levels = computeMipLevels(textures[i].size, textures[i].size);
+		for (uint32_t level = 0; level < textures[i].levels; ++level) {
+			textures[i].levelSizes.push_back(KTX2::getLevelSize(VK_FORMAT_R8G8B8A8_UNORM, textures[i].size, textures[i].size, level));
+			fullBytes += textures[i].levelSizes.back();
+		}
+	}
+
+	std::vector<Object> objects(textures.size() * 4);
+	for (size_t i = 0; i < objects.size(); ++i) {
+		objects[i].position = glm::vec3(coordinate(random), 0.f, coordinate(random));
+		objects[i].radius = radius(random);
+		objects[i].texture = i % textures.size();
+	}
+
+	const float screenHeight = 1080.f;
+	const float fov = glm::radians(60.f);
+	const float pixelsPerUnit = screenHeight / (2.f * std::tan(fov * 0.5f));
+	// Horizontal, 16:9
+	const float cosHalfView = std::cos(std::atan(std::tan(fov * 0.5f) * 16.f / 9.f));
+
+	print_line("Streaming simulation: " + itos(textures.size()) + " textures (" + itos(fullBytes / (1024 * 1024)) + " MiB fully resident), " +
+			   itos(objects.size()) + " objects, " + itos(p_config.streamingBudgetMB) + " MiB budget, " + itos(p_config.streamingFrames) + " frames per path");
+
+	const char *paths[] = { "flythrough", "orbit", "pingpong" };
+	for (int path = 0; path < 3; ++path) {
+
+		TextureStreamer streamer;
+		TextureStreamer::Config streamerConfig;
+		streamerConfig.budget = uint64_t(p_config.streamingBudgetMB) * 1024 * 1024;
+		streamer.setConfig(streamerConfig);
+
+		std::vector<uint32_t> ids(textures.size());
+		for (size_t i = 0; i < textures.size(); ++i) {
+			ids[i] = streamer.addTexture(textures[i].size, textures[i].size, textures[i].levelSizes, nullptr);
+		}
+
+		std::vector<TextureStreamer::Change> changes;
+		const uint64_t begin = Profiler::get_time_ns();
+
+		for (int frame = 0; frame < p_config.streamingFrames; ++frame) {
+			const float t = float(frame) / p_config.streamingFrames;
+
+			glm::vec3 position;
+			glm::vec3 direction;
+			if (0 == path) {
+				// Diagonal line across the field
+				position = glm::mix(glm::vec3(-100.f, 2.f, -100.f), glm::vec3(100.f, 2.f, 100.f), t);
+				direction = glm::normalize(glm::vec3(1.f, 0.f, 1.f));
+			} else if (1 == path) {
+				// Around the center, looking at it
+				const float angle = t * glm::two_pi<float>();
+				position = glm::vec3(std::cos(angle) * 60.f, 2.f, std::sin(angle) * 60.f);
+				direction = glm::normalize(-position * glm::vec3(1.f, 0.f, 1.f));
+			} else {
+				// Back and forth every 120 frames, the same objects come back
+				// after their levels may be evicted
+				const float phase = float(frame % 240) / 120.f;
+				const float x = phase < 1.f ? phase : 2.f - phase;
+				position = glm::vec3(glm::mix(-80.f, 80.f, x), 2.f, 0.f);
+				direction = glm::vec3(phase < 1.f ? 1.f : -1.f, 0.f, 0.f);
+			}
+
+			for (size_t i = 0; i < objects.size(); ++i) {
+				const glm::vec3 toObject = objects[i].position - position;
+				const float distance = glm::length(toObject);
+				if (distance > objects[i].radius && glm::dot(toObject / distance, direction) < cosHalfView)
+					continue;
+
+				const float pixels = distance > objects[i].radius ? 2.f * objects[i].radius * pixelsPerUnit / distance : screenHeight;
+				const SimTexture &texture = textures[objects[i].texture];
+				streamer.request(ids[objects[i].texture], TextureStreamer::computeLevel(texture.size, texture.size, texture.levels, pixels));
+			}
+
+			streamer.update(changes);
+		}
+
+		const double ms = double(Profiler::get_time_ns() - begin) / 1e6;
+		const TextureStreamer::Stats stats = streamer.getStats();
+
+		print_line("  " + std::string(paths[path]) + ": residency " + rtos(stats.getResidencyRate() * 100.f) + "%, thrash " +
+				   rtos(stats.getThrashRate() * 100.f) + "% of " + itos(stats.loads) + " loads, " +
+				   itos(stats.loadedBytes / (1024 * 1024)) + " MiB loaded, " + itos(stats.evictedBytes / (1024 * 1024)) + " MiB evicted, peak " +
+				   itos(stats.peakResidentBytes / (1024 * 1024)) + " MiB, " + itos(stats.overBudgetFrames) + " frames over budget, " +
+				   rtos(ms * 1000. / p_config.streamingFrames) + " us per frame");
+	}
+
+	return 0;
+}
+
+static int runDecodeBenchmark(const BenchmarkConfig &p_config) {
+
+	const char *assets[] = {
+		"assets/TestText.jpg",
+		"assets/default.png",
+		"assets/ezgif-5-a88ff99709.png",
+		"assets/deagle/ESe_Material__106_color.png",
+		"assets/deagle/ESe_Material__106_nmap.png"
+	};
+	const uint32_t assetCount = sizeof(assets) / sizeof(assets[0]);
+
+	ThreadPool threadPool;
+	threadPool.create(p_config.transcodeThreads);
+
+	print_line("Decoding benchmark: " + itos(assetCount) + " images, " + itos(p_config.decodeCopies) + " copies, " +
+			   itos(threadPool.getThreadCount()) + " workers" + (ImageDecoder::isSSSE3Supported() ? ", SSSE3" : ""));
+
+	// Like the textures: RGBA, except the gray images
+	const ImageDecoder::HeaderFunction header = [](const ImageDecoder::Image &p_image, size_t &) {
+		return p_image.sourceChannels <= 2 ? p_image.sourceChannels : 4;
+	};
+
+	for (int pooled = 0; pooled < 2; ++pooled) {
+		ImageDecoder decoder;
+		std::vector<ImageDecoder::Image> images;
+		decoder.decodeAll(
+				pooled ? &threadPool : nullptr,
+				assetCount * p_config.decodeCopies,
+				[&assets, &header](uint32_t p_index, ImageDecoder::Image &r_image) {
+					return ImageDecoder::decodeFile(assets[p_index % assetCount], header, r_image);
+				},
+				images);
+
+		print_line(pooled ? "Thread pool:" : "Single thread:");
+		decoder.printStats();
+	}
+
+	threadPool.destroy();
+	return 0;
+}
+
+static void getHeadlessTileColor(uint32_t p_x, uint32_t p_y, uint8_t r_color[4]) {
+	r_color[0] = uint8_t(p_x * 32);
+	r_color[1] = uint8_t(p_y * 32);
+	r_color[2] = uint8_t(255 - (p_x + p_y) * 16);
+	r_color[3] = 255;
+}
+
+// Changes each frame, so a readback of the wrong frame is detected
+static void getHeadlessBackground(uint64_t p_frame, uint8_t r_color[4]) {
+	const uint8_t gray = uint8_t(p_frame * 7);
+	r_color[0] = r_color[1] = r_color[2] = gray;
+	r_color[3] = 255;
+}
+
+/// Clears the odd tiles of the checkerboard, over the background cleared by
+/// the render pass
+static void recordHeadlessTiles(VkCommandBuffer p_commandBuffer, void *) {
+	const uint32_t tiles = HEADLESS_SIZE / HEADLESS_TILE_SIZE;
+
+	for (uint32_t y = 0; y < tiles; ++y) {
+		for (uint32_t x = 0; x < tiles; ++x) {
+			if (!((x + y) & 1))
+				continue;
+
+			uint8_t color[4];
+			getHeadlessTileColor(x, y, color);
+
+			VkClearAttachment attachment = {};
+			attachment.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			attachment.colorAttachment = 0;
+			for (int c = 0; c < 4; ++c) {
+				attachment.clearValue.color.float32[c] = color[c] / 255.f;
+			}
+
+			VkClearRect rect = {};
+			rect.rect.offset = { int32_t(x * HEADLESS_TILE_SIZE), int32_t(y * HEADLESS_TILE_SIZE) };
+			rect.rect.extent = { HEADLESS_TILE_SIZE, HEADLESS_TILE_SIZE };
+			rect.baseArrayLayer = 0;
+			rect.layerCount = 1;
+
+			vkCmdClearAttachments(p_commandBuffer, 1, &attachment, 1, &rect);
+		}
+	}
+}
+
+/// The frame the GPU should render, RGBA8 rows
+static void buildHeadlessReference(uint64_t p_frame, std::vector<uint8_t> &r_pixels) {
+	uint8_t background[4];
+	getHeadlessBackground(p_frame, background);
+
+	r_pixels.resize(HEADLESS_SIZE * HEADLESS_SIZE * 4);
+	for (uint32_t y = 0; y < HEADLESS_SIZE; ++y) {
+		for (uint32_t x = 0; x < HEADLESS_SIZE; ++x) {
+			const uint32_t tileX = x / HEADLESS_TILE_SIZE;
+			const uint32_t tileY = y / HEADLESS_TILE_SIZE;
+
+			uint8_t tile[4];
+			getHeadlessTileColor(tileX, tileY, tile);
+
+			const uint8_t *color = (tileX + tileY) & 1 ? tile : background;
+			memcpy(&r_pixels[(y * HEADLESS_SIZE + x) * 4], color, 4);
+		}
+	}
+}
+
+/// Pixels with a channel more than 1 away, the devices may round the float
+/// clear colors differently. p_channels of each image are compared
+static uint32_t countMismatchedPixels(const std::vector<uint8_t> &p_pixels, const std::vector<uint8_t> &p_reference, int p_channels) {
+	uint32_t mismatched = 0;
+	for (size_t i = 0; i + 4 <= p_pixels.size() && i + 4 <= p_reference.size(); i += 4) {
+		for (int c = 0; c < p_channels; ++c) {
+			if (std::abs(int(p_pixels[i + c]) - int(p_reference[i + c])) > 1) {
+				++mismatched;
+				break;
+			}
+		}
+	}
+	return mismatched;
+}
+
+/// Compares the RGB of the frame with the file, or writes the file as a
+/// binary PPM when it's missing
+static bool checkReferenceFile(const std::string &p_path, const std::vector<uint8_t> &p_pixels) {
+
+	if (!std::ifstream(p_path).good()) {
+		std::ofstream file(p_path, std::ios::binary);
+		file << "P6\n"
+			 << HEADLESS_SIZE << " " << HEADLESS_SIZE << "\n255\n";
+		for (size_t i = 0; i < p_pixels.size(); i += 4) {
+			file.write(reinterpret_cast<const char *>(&p_pixels[i]), 3);
+		}
+
+		if (!file.good()) {
+			print_error("Can't write the reference: " + p_path);
+			return false;
+		}
+		print_line("Reference written: " + p_path);
+		return true;
+	}
+
+	ImageDecoder::Image reference;
+	const bool decoded = ImageDecoder::decodeFile(p_path, [](const ImageDecoder::Image &, size_t &) { return 4; }, reference);
+	if (!decoded || reference.width != int(HEADLESS_SIZE) || reference.height != int(HEADLESS_SIZE)) {
+		print_error("The reference is not a " + itos(HEADLESS_SIZE) + "x" + itos(HEADLESS_SIZE) + " image: " + p_path);
+		return false;
+	}
+
+	const uint32_t mismatched = countMismatchedPixels(p_pixels, reference.data, 3);
+	print_line("Reference " + p_path + ": " + itos(mismatched) + " pixels differ");
+	return !mismatched;
+}
+
+/// Renders the frames in the offscreen target of a headless visual server,
+/// each readback is fetched after the submission of the next frame so the
+/// CPU checks a frame while the GPU executes the other.
+/// Returns 1 when a frame differs from its reference
+static int runHeadlessBenchmark(const BenchmarkConfig &p_config) {
+
+	VulkanVisualServer *visualServer = new VulkanVisualServer(true);
+	visualServer->init();
+
+	const RID renderTargetRid = visualServer->create_offscreen_render_target(HEADLESS_SIZE, HEADLESS_SIZE, true);
+	OffscreenRenderTarget *renderTarget = visualServer->get_offscreen_render_target(renderTargetRid);
+	CRASH_COND(!renderTarget);
+	renderTarget->set_record_callback(recordHeadlessTiles, nullptr);
+
+	print_line("Headless benchmark: " + itos(HEADLESS_SIZE) + "x" + itos(HEADLESS_SIZE) + " offscreen, " +
+			   itos(p_config.frames) + " frames of cleared tiles read back (not the renderer)");
+
+	std::vector<uint8_t> pixels;
+	std::vector<uint8_t> reference;
+	std::vector<uint8_t> firstFrame;
+	uint32_t mismatchedFrames = 0;
+	uint64_t readbackWaitNs = 0;
+	uint64_t pending = 0;
+
+	const uint64_t begin = Profiler::get_time_ns();
+
+	for (int i = 0; i <= p_config.frames; ++i) {
+		uint64_t submitted = 0;
+		if (i < p_config.frames) {
+			uint8_t background[4];
+			getHeadlessBackground(renderTarget->get_frames_submitted() + 1, background);
+			const float clearColor[4] = { background[0] / 255.f, background[1] / 255.f, background[2] / 255.f, background[3] / 255.f };
+
+			submitted = renderTarget->draw(clearColor);
+			if (!submitted) {
+				print_error("The headless frame submission failed");
+				break;
+			}
+		}
+
+		if (pending) {
+			const uint64_t waitBegin = Profiler::get_time_ns();
+			while (!renderTarget->fetch_readback(pending, pixels)) {
+				std::this_thread::yield();
+			}
+			readbackWaitNs += Profiler::get_time_ns() - waitBegin;
+
+			buildHeadlessReference(pending, reference);
+			if (countMismatchedPixels(pixels, reference, 4))
+				++mismatchedFrames;
+			if (1 == pending)
+				firstFrame = pixels;
+		}
+		pending = submitted;
+	}
+
+	const double totalMs = double(Profiler::get_time_ns() - begin) / 1e6;
+	const uint64_t frames = renderTarget->get_frames_submitted();
+	print_line(itos(frames) + " frames in " + rtos(totalMs) + " ms (" + rtos(frames ? totalMs / frames : 0) + " ms per frame), " +
+			   rtos(double(readbackWaitNs) / 1e6) + " ms waiting the readbacks");
+
+	int result = 0;
+	if (frames != uint64_t(p_config.frames) || mismatchedFrames) {
+		print_error(itos(mismatchedFrames) + " frames differ from their reference");
+		result = 1;
+	} else {
+		print_line("All the frames match their reference");
+	}
+
+	if (!p_config.referencePath.empty() && firstFrame.size() && !checkReferenceFile(p_config.referencePath, firstFrame))
+		result = 1;
+
+	visualServer->terminate();
+	delete visualServer;
+	return result;
+}
+
+static int runBenchmark(const BenchmarkConfig &p_config) {
+
+	if (!p_config.transcodePath.empty())
+		return runTranscodeBenchmark(p_config);
+
+	if (p_config.streamingSim)
+		return runStreamingSimulation(p_config);
+
+	if (p_config.decodeCopies)
+		return runDecodeBenchmark(p_config);
+
+	if (p_config.headless)
+		return runHeadlessBenchmark(p_config);
+
+	WindowServer *windowServer = new GLFWWindowServer;
+	windowServer->init_server();
+
+	OldVisualServer *vm = new OldVisualServer;
+	vm->getVulkanServer()->setTextureBinding(p_config.textureBinding);
+	CRASH_COND(!vm->init(p_config.threaded));
+
+	// Measure the rendering, not the display refresh
+	VulkanServer::LatencyPolicy policy;
+	policy.presentPolicy = p_config.vsync ? VulkanServer::PRESENT_POLICY_FIFO : VulkanServer::PRESENT_POLICY_IMMEDIATE;
+	vm->setLatencyPolicy(policy);
+
+	int meshCount = p_config.meshes;
+	const int maxMeshCount = vm->getVulkanServer()->getMaxMeshCount();
+	if (meshCount > maxMeshCount) {
+		WARN_PRINTS("The renderer supports at most " + itos(maxMeshCount) + " meshes");
+		meshCount = maxMeshCount;
+	}
+
+	if (p_config.imageAllocations || p_config.formatReport || p_config.renderGraphReport) {
+		int result = 0;
+		if (p_config.imageAllocations) {
+			runImageAllocationBenchmark(p_config, vm->getVulkanServer());
+		} else if (p_config.formatReport) {
+			runFormatReport(vm);
+		} else {
+			result = runRenderGraphReport(vm->getVulkanServer());
+		}
+
+		vm->terminate();
+		delete vm;
+
+		windowServer->terminate_server();
+		delete windowServer;
+		return result;
+	}
+
+	// Scene
+	std::vector<Texture *> textures(p_config.textures);
+	for (size_t i = 0; i < textures.size(); ++i) {
+		if (p_config.textureCache) {
+			textures[i] = vm->getTextureCache().acquire(p_config.texturePath, p_config.mipmapMode);
+			CRASH_COND(!textures[i]);
+		} else if (p_config.textureUpdates) {
+			textures[i] = new Texture(vm);
+			CRASH_COND(!textures[i]->create(DYNAMIC_TEXTURE_SIZE, DYNAMIC_TEXTURE_SIZE, VK_FORMAT_R8G8B8A8_UNORM, nullptr, p_config.doubleBuffered));
+		} else {
+			textures[i] = new Texture(vm);
+			textures[i]->setStreamed(p_config.streamed);
+		}
+	}
+
+	if (!p_config.textureCache && !p_config.textureUpdates && textures.size()) {
+		// Decoded in parallel
+		const std::vector<std::string> paths(textures.size(), p_config.texturePath);
+		CRASH_COND(Texture::loadBatch(textures, paths, p_config.mipmapMode) != textures.size());
+	}
+
+	const float ballRadius = 10.f * std::cbrt(MAX(meshCount, 1) / 50.f) + 5.f;
+	// Without unique geometry all the meshes are instances of one cube
+	Geometry *cubeGeometry = nullptr;
+	if (!p_config.uniqueGeometry) {
+		cubeGeometry = new Geometry;
+		cubeMaker(cubeGeometry);
+		cubeGeometry->setResidency(p_config.geometryResidency);
+	}
+
+	std::vector<Mesh *> meshes(meshCount);
+	for (int i = 0; i < meshCount; ++i) {
+		meshes[i] = new Mesh;
+		if (p_config.uniqueGeometry) {
+			sphereMaker(meshes[i]->getGeometry(), p_config.sphereDetail + (i % 8), 0.1f);
+			meshes[i]->getGeometry()->setResidency(p_config.geometryResidency);
+		} else {
+			meshes[i]->setGeometry(cubeGeometry);
+		}
+		if (textures.size())
+			meshes[i]->setColorTexture(textures[i % textures.size()]);
+		meshes[i]->setTransform(glm::translate(glm::mat4(1.), glm::ballRand(ballRadius)));
+		vm->addMesh(meshes[i]);
+	}
+	if (cubeGeometry)
+		cubeGeometry->unreference();
+
+	const int dynamicCount = int(std::round(p_config.dynamicFraction * meshCount));
+
+	std::mt19937 random(1);
+	std::vector<uint32_t> rectData(DYNAMIC_RECT_SIZE * DYNAMIC_RECT_SIZE);
+
+	// When minified each mesh covers few pixels, so without the mip chain
+	// each fragment samples texels far apart
+	const float cameraDistance = ballRadius * (p_config.minified ? 16.f : 2.f);
+	vm->cameraSetNearFar(0.1, cameraDistance + ballRadius * 2.f);
+	vm->cameraSetTransform(glm::translate(glm::mat4(1.), glm::vec3(0., 0., cameraDistance)));
+
+	const char *mipmapNames[] = { "no", "gpu", "cpu" };
+	print_line("Benchmark: " + itos(meshCount) + " meshes (" + (p_config.uniqueGeometry ? "unique" : "shared") + " geometry), " +
+			   itos(textures.size()) + " textures (" + mipmapNames[p_config.mipmapMode] + " mipmaps" +
+			   (textures.size() ? ", " + itos(textures[0]->getMipLevels()) + " levels" : "") + "), " +
+			   itos(dynamicCount) + " dynamic, " + itos(p_config.frames) + " frames" +
+			   (p_config.minified ? ", minified" : "") + (p_config.threaded ? ", threaded" : ""));
+
+	std::vector<double> frameTimes;
+	frameTimes.reserve(p_config.frames);
+
+	const float deltaTime = 1.f / 60.f;
+	const int totalFrames = p_config.warmupFrames + p_config.frames;
+	for (int f = 0; f < totalFrames; ++f) {
+
+		if (f == p_config.warmupFrames) {
+			// Measure only the steady state
+			if (p_config.gpuProfiling)
+				vm->getVulkanServer()->setGpuProfiling(true, true);
+			Profiler::clear();
+			Profiler::set_enabled(true);
+		}
+
+		const uint64_t beginNs = Profiler::get_time_ns();
+
+		{
+			PROFILE_ZONE("tick");
+			for (int i = 0; i < dynamicCount; ++i) {
+				meshes[i]->setTransform(glm::rotate(meshes[i]->getTransform(), deltaTime * glm::radians(90.0f), glm::vec3(1.0f, .0f, .0f)));
+			}
+
+			for (int i = 0; i < p_config.textureUpdates && textures.size(); ++i) {
+				std::fill(rectData.begin(), rectData.end(), random() | 0xff000000);
+
+				Texture::Rect rect;
+				rect.x = random() % (DYNAMIC_TEXTURE_SIZE - DYNAMIC_RECT_SIZE + 1);
+				rect.y = random() % (DYNAMIC_TEXTURE_SIZE - DYNAMIC_RECT_SIZE + 1);
+				rect.width = DYNAMIC_RECT_SIZE;
+				rect.height = DYNAMIC_RECT_SIZE;
+				textures[random() % textures.size()]->update(rect, rectData.data());
+			}
+		}
+
+		vm->step();
+
+		if (f >= p_config.warmupFrames)
+			frameTimes.push_back(double(Profiler::get_time_ns() - beginNs) / 1e6);
+	}
+
+	// In threaded mode the render thread may still be drawing, the report
+	// reads its state
+	vm->sync();
+
+	Profiler::set_enabled(false);
+
+	// Report
+	std::vector<double> sorted(frameTimes);
+	std::sort(sorted.begin(), sorted.end());
+
+	double total = 0;
+	for (size_t i = 0; i < sorted.size(); ++i) {
+		total += sorted[i];
+	}
+
+	print_line("Frame time (ms):");
+	print_line("  mean " + rtos(total / sorted.size()));
+	print_line("  min  " + rtos(sorted.front()));
+	print_line("  p50  " + rtos(percentile(sorted, 50)));
+	print_line("  p95  " + rtos(percentile(sorted, 95)));
+	print_line("  p99  " + rtos(percentile(sorted, 99)));
+	print_line("  max  " + rtos(sorted.back()));
+
+	std::vector<Profiler::ZoneStats> zones;
+	Profiler::get_zone_stats(zones);
+	if (zones.size()) {
+		print_line("CPU zones (ms per frame / mean per call / max per call / calls):");
+		for (size_t i = 0; i < zones.size(); ++i) {
+			print_line("  " + std::string(zones[i].name) + ": " +
+					   rtos(zones[i].total_ms / frameTimes.size()) + " / " +
+					   rtos(zones[i].get_mean_ms()) + " / " +
+					   rtos(zones[i].max_ms) + " / " +
+					   itos(zones[i].count));
+		}
+	} else {
+		print_line("No CPU zones recorded, build with profiler=yes");
+	}
+
+	if (p_config.gpuProfiling && vm->getVulkanServer()->isGpuProfiling()) {
+		const GpuProfiler::FrameStats gpu = vm->getVulkanServer()->getGpuProfiler().getAverageStats();
+		print_line("GPU (ms):");
+		print_line("  render pass " + rtos(gpu.zoneMs[GpuProfiler::ZONE_RENDER_PASS]));
+		print_line("  draw        " + rtos(gpu.zoneMs[GpuProfiler::ZONE_DRAW]));
+		if (gpu.hasPipelineStatistics) {
+			print_line("  vertex invocations   " + itos(gpu.vertexShaderInvocations));
+			print_line("  fragment invocations " + itos(gpu.fragmentShaderInvocations));
+		}
+	}
+
+	vm->getVulkanServer()->printAttachmentMemoryReport();
+	vm->getVulkanServer()->getMemoryTracker().printReport();
+	vm->getVulkanServer()->printImagePoolReport();
+	vm->getVulkanServer()->getImageDecoder().printStats();
+	vm->getVulkanServer()->getTransferBatcher().printStats();
+	vm->getTextureCache().printStats();
+	vm->getVulkanServer()->getSamplerCache().printStats();
+	if (p_config.streamed)
+		vm->getVulkanServer()->getTextureStreamer().printStats();
+	if (vm->getVulkanServer()->isTextureTableEnabled()) {
+		vm->getVulkanServer()->getTextureTable().printStats();
+	} else {
+		vm->getVulkanServer()->getDescriptorAllocator().printStats();
+	}
+
+	if (!p_config.csvPath.empty()) {
+		std::ofstream file(p_config.csvPath.c_str());
+		if (file.is_open()) {
+			file << "frame,ms\n";
+			for (size_t i = 0; i < frameTimes.size(); ++i) {
+				file << i << "," << frameTimes[i] << "\n";
+			}
+		} else {
+			print_error("Can't write: " + p_config.csvPath);
+		}
+	}
+
+	if (!p_config.tracePath.empty())
+		Profiler::export_chrome_trace(p_config.tracePath);
+
+	// Cleanup
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		vm->removeMesh(meshes[i]);
+		delete meshes[i];
+	}
+
+	for (size_t i = 0; i < textures.size(); ++i) {
+		if (p_config.textureCache) {
+			vm->getTextureCache().release(textures[i]);
+		} else {
+			delete textures[i];
+		}
+	}
+
+	vm->terminate();
+	delete vm;
+
+	windowServer->terminate_server();
+	delete windowServer;
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+
+	ConsoleHandlers consoleHandlers;
+
+	int result = 1;
+	BenchmarkConfig config;
+	if (argc > 1 && strcmp(argv[1], "--help") == 0) {
+		printUsage();
+		result = 0;
+	} else if (parseArguments(argc, argv, config)) {
+		result = runBenchmark(config);
+	} else {
+		printUsage();
+	}
+
+	return result;
+}
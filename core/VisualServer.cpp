@@ -5,18 +5,27 @@
 #include "libs/vma/vk_mem_alloc.h"
 
 #include "core/error_macros.h"
+#include "core/ktx2.h"
 #include "core/mesh.h"
 #include "core/print_string.h"
+#include "core/profiler.h"
 #include "core/texture.h"
+#include "core/transcoder.h"
 #include "servers/window_server.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <fstream>
 
+#include "shaders/shader_shader_array_frag.gen.h"
+#include "shaders/shader_shader_bindless_frag.gen.h"
 #include "shaders/shader_shader_frag.gen.h"
 #include "shaders/shader_shader_vert.gen.h"
 
 // This cap is necessary because I've no memory management yet
-#define MAX_MESH_COUNT 50
+#define MAX_MESH_COUNT 1024
+#define IMAGE_SETS_PER_POOL 256
 
 // This rotate the camera view in order to make Coordinate system as:
 // Y+ Up
@@ -126,18 +135,22 @@ VulkanServer::VulkanServer(OldVisualServer *p_visualServer) :
 		device(VK_NULL_HANDLE),
 		graphicsQueue(VK_NULL_HANDLE),
 		presentationQueue(VK_NULL_HANDLE),
-		depthImage(VK_NULL_HANDLE),
-		depthImageMemory(VK_NULL_HANDLE),
-		depthImageView(VK_NULL_HANDLE),
 		swapchain(VK_NULL_HANDLE),
+		depthImageFormat(VK_FORMAT_UNDEFINED),
 		vertShaderModule(VK_NULL_HANDLE),
 		fragShaderModule(VK_NULL_HANDLE),
+		backbufferResource(RenderGraph::INVALID_ID),
+		depthResource(RenderGraph::INVALID_ID),
+		mainPass(RenderGraph::INVALID_ID),
 		renderPass(VK_NULL_HANDLE),
 		cameraDescriptorSetLayout(VK_NULL_HANDLE),
 		cameraDescriptorPool(VK_NULL_HANDLE),
 		meshesDescriptorSetLayout(VK_NULL_HANDLE),
 		meshesDescriptorPool(VK_NULL_HANDLE),
 		meshImagesDescriptorSetLayout(VK_NULL_HANDLE),
+		requestedTextureBinding(TEXTURE_BINDING_AUTO),
+		textureBinding(TEXTURE_BINDING_SETS),
+		textureTableCapacity(0),
 		pipelineLayout(VK_NULL_HANDLE),
 		graphicsPipeline(VK_NULL_HANDLE),
 		bufferMemoryDeviceAllocator(VK_NULL_HANDLE),
@@ -147,6 +160,17 @@ VulkanServer::VulkanServer(OldVisualServer *p_visualServer) :
 		graphicsCommandPool(VK_NULL_HANDLE),
 		imageAvailableSemaphore(VK_NULL_HANDLE),
 		copyFinishFence(VK_NULL_HANDLE),
+		presentMode(VK_PRESENT_MODE_FIFO_KHR),
+		inputSampler(nullptr),
+		inputSamplerUserData(nullptr),
+		pipelineStatisticsSupported(false),
+		submittedFrames(0),
+		swapchainOutOfDate(false),
+		imagePools(),
+		physicalDeviceProperties2Supported(false),
+		memoryBudgetSupported(false),
+		descriptorIndexingSupported(false),
+		descriptorUpdateAfterBindSupported(false),
 		reloadDrawCommandBuffer(true) {
 	deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 }
@@ -187,6 +211,8 @@ bool VulkanServer::create() {
 	if (!createLogicalDevice())
 		return false;
 
+	memoryTracker.create(instance, physicalDevice, memoryBudgetSupported);
+
 	lockupDeviceQueue();
 
 	if (!createCommandPool())
@@ -195,15 +221,25 @@ bool VulkanServer::create() {
 	if (!createDescriptorSetLayouts())
 		return false;
 
-	if (!createSwapchain())
-		return false;
-
+	// The allocators are used by the swapchain attachments
 	if (!createBufferMemoryDeviceAllocator())
 		return false;
 
 	if (!createBufferMemoryHostAllocator())
 		return false;
 
+	if (!transferBatcher.create(this))
+		return false;
+
+	threadPool.create();
+	samplerCache.create(device);
+
+	if (!createImagePools())
+		return false;
+
+	if (!createSwapchain())
+		return false;
+
 	if (!createUniformBuffers())
 		return false;
 
@@ -232,14 +268,32 @@ void VulkanServer::destroy() {
 	waitIdle();
 
 	removeAllMeshes();
+	{
+		std::lock_guard<std::mutex> lock(dynamicTexturesMutex);
+		for (size_t i = 0; i < dynamicTextures.size(); ++i) {
+			releaseFrameImages(dynamicTextures[i]->frameImages);
+		}
+		for (size_t i = 0; i < retiredFrameImages.size(); ++i) {
+			releaseFrameImages(retiredFrameImages[i]);
+		}
+		retiredFrameImages.clear();
+	}
+	destroyRetiredTextureImages(true);
+	transferBatcher.destroy();
+	threadPool.destroy();
+	samplerCache.destroy();
+	gpuProfiler.destroy();
 	destroySyncObjects();
 	destroyUniformPools();
 	destroyUniformBuffers();
+	destroySwapchain();
+	destroyImagePools();
 	destroyBufferMemoryHostAllocator();
 	destroyBufferMemoryDeviceAllocator();
-	destroySwapchain();
+	destroyOneTimeCommandPools();
 	destroyCommandPool();
 	destroyDescriptorSetLayouts();
+	memoryTracker.destroy();
 	destroyLogicalDevice();
 	destroyDebugCallback();
 	destroySurface();
@@ -249,13 +303,29 @@ void VulkanServer::destroy() {
 
 void VulkanServer::waitIdle() {
 	// assert that the device has finished all before cleanup
-	if (device != VK_NULL_HANDLE)
+	if (device != VK_NULL_HANDLE) {
+		std::lock_guard<std::mutex> lock(queueMutex);
 		vkDeviceWaitIdle(device);
+	}
 }
 
 #define LONGTIMEOUT_NANOSEC 3.6e+12 // 1 hour
 
+// When the acquire takes more than this the frame is skipped, so the caller
+// can process the window events instead of stalling
+#define ACQUIRE_TIMEOUT_NANOSEC 1e+8 // 100 ms
+
 void VulkanServer::draw() {
+	PROFILE_ZONE("VulkanServer::draw");
+
+	if (swapchainOutOfDate || swapchain == VK_NULL_HANDLE) {
+		recreateSwapchain();
+		if (swapchainOutOfDate || swapchain == VK_NULL_HANDLE)
+			return;
+	}
+
+	updateDynamicTextures();
+	updateTextureStreaming();
 
 	if (reloadDrawCommandBuffer) {
 		reloadDrawCommandBuffer = false;
@@ -264,22 +334,67 @@ void VulkanServer::draw() {
 
 	processCopy();
 
-	updateUniformBuffers();
+	float limiterSleepMs = 0;
+	if (PRESENT_POLICY_FIFO == latencyPolicy.presentPolicy) {
+		waitQueuedFrames(latencyPolicy.maxQueuedFrames);
+	} else {
+		std::chrono::steady_clock::time_point limiterBegin = std::chrono::steady_clock::now();
+		limitFrameRate();
+		limiterSleepMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - limiterBegin).count();
+	}
+
+	if (!latencyPolicy.justInTimeInput)
+		updateUniformBuffers();
 
 	// Acquire the next image
 	uint32_t imageIndex;
-	VkResult acquireRes = vkAcquireNextImageKHR(device, swapchain, LONGTIMEOUT_NANOSEC, imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
-	if (VK_ERROR_OUT_OF_DATE_KHR == acquireRes || VK_SUBOPTIMAL_KHR == acquireRes) {
+	VkResult acquireRes;
+	{
+		PROFILE_ZONE("VulkanServer::acquire");
+		acquireRes = vkAcquireNextImageKHR(device, swapchain, ACQUIRE_TIMEOUT_NANOSEC, imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+	}
+	if (VK_ERROR_OUT_OF_DATE_KHR == acquireRes) {
 		// Vulkan tell me that the surface is no more compatible, so is mandatory
 		// recreate the swap chain
 		recreateSwapchain();
 		return;
 	}
+	if (VK_TIMEOUT == acquireRes || VK_NOT_READY == acquireRes) {
+		std::lock_guard<std::mutex> lock(latencyStatsMutex);
+		++latencyStats.acquireTimeouts;
+		return;
+	}
+	// VK_SUBOPTIMAL_KHR is a success, the image is presented anyway and the
+	// swapchain is recreated after the present
+	ERR_FAIL_COND(VK_SUCCESS != acquireRes && VK_SUBOPTIMAL_KHR != acquireRes);
 
 	// This is used to be sure that the previous drawing has finished
 	vkWaitForFences(device, 1, &drawFinishFences[imageIndex], VK_TRUE, LONGTIMEOUT_NANOSEC);
 	vkResetFences(device, 1, &drawFinishFences[imageIndex]);
 
+	// The previous execution of this command buffer is finished, so its
+	// queries are available without wait
+	gpuProfiler.collect(imageIndex);
+
+	publishDynamicTextures(imageIndex);
+
+	// Recorded before a resize, with the framebuffers of the old swapchain
+	if (staleDrawCommandBuffers[imageIndex])
+		recordCommandBuffer(imageIndex);
+
+	for (auto it = queuedFrames.begin(); it != queuedFrames.end(); ++it) {
+		if (*it == imageIndex) {
+			queuedFrames.erase(it);
+			break;
+		}
+	}
+
+	if (latencyPolicy.justInTimeInput) {
+		if (inputSampler)
+			inputSampler(inputSamplerUserData);
+		updateUniformBuffers();
+	}
+
 	// Submit draw commands
 	VkSemaphore waitSemaphores[] = { imageAvailableSemaphore };
 	VkPipelineStageFlags waitStages[] = {
@@ -296,13 +411,6 @@ void VulkanServer::draw() {
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = &renderFinishedSemaphores[imageIndex];
 
-	ERR_FAIL_COND(
-			VK_SUCCESS != vkQueueSubmit(
-								  graphicsQueue,
-								  1,
-								  &submitInfo,
-								  drawFinishFences[imageIndex]));
-
 	// Present
 	VkPresentInfoKHR presInfo = {};
 	presInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -312,8 +420,44 @@ void VulkanServer::draw() {
 	presInfo.pSwapchains = &swapchain;
 	presInfo.pImageIndices = &imageIndex;
 
-	VkResult presentRes = vkQueuePresentKHR(presentationQueue, &presInfo);
-	if (VK_ERROR_OUT_OF_DATE_KHR == presentRes || VK_SUBOPTIMAL_KHR == presentRes) {
+	// The uploads enqueued until now are submitted before the frame that
+	// may use them
+	transferBatcher.flush();
+
+	VkResult presentRes;
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+
+		ERR_FAIL_COND(
+				VK_SUCCESS != vkQueueSubmit(
+									  graphicsQueue,
+									  1,
+									  &submitInfo,
+									  drawFinishFences[imageIndex]));
+
+		presentRes = vkQueuePresentKHR(presentationQueue, &presInfo);
+	}
+
+	gpuProfiler.markSubmitted(imageIndex, ++submittedFrames);
+
+	memoryTracker.updateBudget();
+
+	transferBatcher.collect();
+
+	// The released sets are reusable when all the swapchain images are cycled
+	if (submittedFrames > swapchainImages.size())
+		descriptorAllocator.collect(submittedFrames - swapchainImages.size());
+
+	if (retiredSwapchains.size())
+		destroyRetiredSwapchains(false);
+
+	if (retiredTextureImages.size())
+		destroyRetiredTextureImages(false);
+
+	queuedFrames.push_back(imageIndex);
+	sampleQueuedFrames(limiterSleepMs);
+
+	if (VK_ERROR_OUT_OF_DATE_KHR == presentRes || VK_SUBOPTIMAL_KHR == presentRes || VK_SUBOPTIMAL_KHR == acquireRes) {
 		// Vulkan tell me that the surface is no more compatible, so is mandatory
 		// recreate the swap chain
 		recreateSwapchain();
@@ -343,30 +487,96 @@ void VulkanServer::removeMesh(MeshHandle *p_meshHandle) {
 	// TODO Make the removal in a way that wait iddle is not required
 	waitIdle();
 
-	int item = -1;
-	for (int i = meshes.size() - 1; 0 <= i; --i) {
-		if (meshes[i] == p_meshHandle) {
-			item = i;
-			break;
+	if (!p_meshHandle)
+		return;
+
+	// The mesh may be still waiting its copy
+	std::vector<MeshHandle *> *lists[] = { &meshes, &meshesCopyInProgress, &meshesCopyPending };
+
+	bool found = false;
+	for (int l = 0; l < 3 && !found; ++l) {
+		std::vector<MeshHandle *> &list = *lists[l];
+		for (int i = list.size() - 1; 0 <= i; --i) {
+			if (list[i] == p_meshHandle) {
+				list[i] = list.back();
+				list.pop_back();
+				found = true;
+				break;
+			}
 		}
 	}
 
-	if (-1 == item)
+	if (!found)
 		return;
 
-	size_t s = meshes.size();
-	if (1 < s) {
-		meshes[item] = meshes[s - 1];
-		meshes.resize(s - 1);
-	} else {
-		meshes.clear();
-	}
-
 	p_meshHandle->mesh->meshHandle = nullptr;
 	delete p_meshHandle;
+
+	// The draw commands are still referring the removed mesh
+	reloadDrawCommandBuffer = true;
+}
+
+GeometryHandle *VulkanServer::acquireGeometry(Geometry *p_geometry) {
+
+	auto it = geometryHandles.find(p_geometry);
+	if (it != geometryHandles.end()) {
+		++it->second->meshCount;
+		return it->second;
+	}
+
+	// Released by a previous upload, the meshes are added by the render
+	// thread that owns the data of the geometries in the scene
+	if (Geometry::RESIDENCY_RELOAD == p_geometry->getResidency() && !p_geometry->hasData())
+		ERR_FAIL_COND_V(!p_geometry->reload(), nullptr);
+
+	GeometryHandle *handle = new GeometryHandle(p_geometry, this);
+	if (!handle->prepare()) {
+		delete handle;
+		return nullptr;
+	}
+
+	handle->meshCount = 1;
+	geometryHandles[p_geometry] = handle;
+	return handle;
+}
+
+void VulkanServer::releaseGeometry(GeometryHandle *p_handle) {
+	if (--p_handle->meshCount)
+		return;
+
+	geometryHandles.erase(p_handle->geometry);
+	delete p_handle;
+}
+
+void VulkanServer::setMeshTransform(Mesh *p_mesh, const glm::mat4 &p_transformation) {
+	if (!p_mesh->meshHandle)
+		return;
+
+	p_mesh->meshHandle->transformation = p_transformation;
+	p_mesh->meshHandle->hasTransformationChange = true;
+}
+
+void VulkanServer::setMeshColorTexture(Mesh *p_mesh, Texture *p_colorTexture) {
+	if (!p_mesh->meshHandle)
+		return;
+
+	p_mesh->meshHandle->colorTexture = p_colorTexture;
+	if (p_mesh->meshHandle->updateImages()) {
+		// The mesh binds another set
+		reloadDrawCommandBuffer = true;
+	}
+}
+
+void VulkanServer::setDefaultTexture(const Texture *p_texture) {
+	if (!isTextureTableEnabled())
+		return;
+
+	textureTable.setFillImage(p_texture->imageView, p_texture->imageSampler);
+	reloadDrawCommandBuffer = true;
 }
 
 void VulkanServer::processCopy() {
+	PROFILE_ZONE("VulkanServer::processCopy");
 	VkResult fenceStatus = vkGetFenceStatus(device, copyFinishFence);
 	if (fenceStatus != VK_SUCCESS) {
 		return; // Copy is in progress
@@ -375,9 +585,9 @@ void VulkanServer::processCopy() {
 	if (meshesCopyInProgress.size() > 0) {
 
 		// Copy process end
+		// The command buffer is implicitly reset when the next copy begin
 
-		// Clear command buffer
-		freeCommand(copyCommandBuffer);
+		gpuProfiler.collect(swapchainImages.size());
 
 		meshes.insert(meshes.end(), meshesCopyInProgress.begin(), meshesCopyInProgress.end());
 		meshesCopyInProgress.clear();
@@ -388,23 +598,58 @@ void VulkanServer::processCopy() {
 	// Check if there are meshes to copy in pending
 	if (meshesCopyPending.size() > 0) {
 
+		// The copies recorded before are completed, so the meshes of a
+		// geometry already uploaded are ready
+		std::vector<MeshHandle *> meshesToCopy;
+		for (size_t m = 0; m < meshesCopyPending.size(); ++m) {
+			if (meshesCopyPending[m]->geometry->uploaded) {
+				meshes.push_back(meshesCopyPending[m]);
+				reloadDrawCommandBuffer = true;
+			} else {
+				meshesToCopy.push_back(meshesCopyPending[m]);
+			}
+		}
+		meshesCopyPending.swap(meshesToCopy);
+
+		if (meshesCopyPending.empty())
+			return;
+
 		// Start new copy
 		beginOneTimeCommand(copyCommandBuffer);
 
+		const uint32_t copySlot = swapchainImages.size();
+		gpuProfiler.cmdResetSlot(copyCommandBuffer, copySlot);
+		gpuProfiler.cmdBeginZone(copyCommandBuffer, copySlot, GpuProfiler::ZONE_COPY);
+
 		for (int m = meshesCopyPending.size() - 1; 0 <= m; --m) {
-			vkCmdUpdateBuffer(copyCommandBuffer, meshesCopyPending[m]->vertexBuffer, 0, meshesCopyPending[m]->verticesSize, meshesCopyPending[m]->mesh->vertices.data());
-			vkCmdUpdateBuffer(copyCommandBuffer, meshesCopyPending[m]->indexBuffer, 0, meshesCopyPending[m]->indicesSize, meshesCopyPending[m]->mesh->triangles.data());
+			GeometryHandle *geometry = meshesCopyPending[m]->geometry;
+
+			// Shared with another mesh of this copy
+			if (geometry->uploaded)
+				continue;
+
+			vkCmdUpdateBuffer(copyCommandBuffer, geometry->vertexBuffer, 0, geometry->verticesSize, geometry->geometry->vertices.data());
+			vkCmdUpdateBuffer(copyCommandBuffer, geometry->indexBuffer, 0, geometry->indicesSize, geometry->geometry->triangles.data());
+
+			// vkCmdUpdateBuffer copies the data in the command buffer when
+			// recorded, so the host geometry is no longer needed
+			geometry->onUploaded();
 		}
 
+		gpuProfiler.cmdEndZone(copyCommandBuffer, copySlot, GpuProfiler::ZONE_COPY);
+
 		ERR_FAIL_COND(!endCommand(copyCommandBuffer));
 		ERR_FAIL_COND(!submitCommand(copyCommandBuffer, copyFinishFence));
 
+		gpuProfiler.markSubmitted(copySlot, submittedFrames);
+
 		meshesCopyInProgress.insert(meshesCopyInProgress.end(), meshesCopyPending.begin(), meshesCopyPending.end());
 		meshesCopyPending.clear();
 	}
 }
 
 void VulkanServer::updateUniformBuffers() {
+	PROFILE_ZONE("VulkanServer::updateUniformBuffers");
 
 	void *data;
 
@@ -438,7 +683,7 @@ void VulkanServer::updateUniformBuffers() {
 	for (int i = meshes.size() - 1; 0 <= i; --i) {
 		if (!meshes[i]->hasTransformationChange)
 			continue;
-		supportMeshUBO.model = meshes[i]->mesh->transformation;
+		supportMeshUBO.model = meshes[i]->transformation;
 		memcpy(data + meshes[i]->meshUniformBufferOffset * meshDynamicUniformBufferOffset, &supportMeshUBO, sizeof(MeshUniformBufferObject));
 		meshes[i]->hasTransformationChange = false;
 	}
@@ -448,15 +693,58 @@ void VulkanServer::updateUniformBuffers() {
 bool VulkanServer::createImageLoadBuffer(VkDeviceSize p_size, VkBuffer &r_buffer, VmaAllocation &r_allocation, VmaAllocator &r_allocator) {
 
 	r_allocator = bufferMemoryHostAllocator;
-	return createBuffer(bufferMemoryHostAllocator, p_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_SHARING_MODE_EXCLUSIVE, VMA_MEMORY_USAGE_CPU_TO_GPU, r_buffer, r_allocation);
+	return createBuffer(bufferMemoryHostAllocator, MemoryTracker::CATEGORY_STAGING, p_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_SHARING_MODE_EXCLUSIVE, VMA_MEMORY_USAGE_CPU_TO_GPU, r_buffer, r_allocation);
+}
+
+bool VulkanServer::createImageTexture(uint32_t p_width, uint32_t p_height, VkImage &r_image, VmaAllocation &r_allocation, uint32_t p_mipLevels, VkFormat p_format) {
+	// The mip levels are blitted from the previous level
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	if (p_mipLevels > 1)
+		usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+	return createImage(p_width, p_height, p_format, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryTracker::CATEGORY_TEXTURE, r_image, r_allocation, nullptr, p_mipLevels);
+}
+
+void VulkanServer::destroyImageTexture(VkImage &r_image, VmaAllocation &r_allocation) {
+	destroyImage(r_image, r_allocation);
+}
+
+bool VulkanServer::createImageViewTexture(VkImage p_image, VkImageView &r_imageView, uint32_t p_mipLevels, VkFormat p_format, VkComponentMapping p_swizzle) {
+	return createImageView(p_image, p_format, VK_IMAGE_ASPECT_COLOR_BIT, r_imageView, p_mipLevels, p_swizzle);
 }
 
-bool VulkanServer::createImageTexture(uint32_t p_width, uint32_t p_height, VkImage &r_image, VkDeviceMemory &r_memory) {
-	return createImage(p_width, p_height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, r_image, r_memory);
+bool VulkanServer::isSampledFormatSupported(VkFormat p_format) const {
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, p_format, &formatProperties);
+
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+										  VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+	return required == (formatProperties.optimalTilingFeatures & required);
+}
+
+bool VulkanServer::isLinearBlitSupported(VkFormat p_format) const {
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, p_format, &formatProperties);
+
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+										  VK_FORMAT_FEATURE_BLIT_DST_BIT |
+										  VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+	return required == (formatProperties.optimalTilingFeatures & required);
 }
 
-bool VulkanServer::createImageViewTexture(VkImage p_image, VkImageView &r_imageView) {
-	return createImageView(p_image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, r_imageView);
+VkFormat VulkanServer::chooseTranscodeFormat(bool p_alpha) {
+	std::vector<VkFormat> formats;
+	Transcoder::getTargetFormats(p_alpha, formats);
+
+	VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+	chooseBestSupportedFormat(
+			formats,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT,
+			&format);
+	return format;
 }
 
 bool VulkanServer::createInstance() {
@@ -495,6 +783,23 @@ bool VulkanServer::createInstance() {
 		return false;
 	}
 
+	// Optional, required to read the memory budget
+	physicalDeviceProperties2Supported = false;
+	{
+		uint32_t extensionCount = 0;
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> extensions(extensionCount);
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+
+		for (uint32_t i = 0; i < extensionCount; ++i) {
+			if (0 == strcmp(extensions[i].extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) {
+				requiredExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+				physicalDeviceProperties2Supported = true;
+				break;
+			}
+		}
+	}
+
 	createInfo.enabledLayerCount = static_cast<uint32_t>(layers.size());
 	createInfo.ppEnabledLayerNames = layers.data();
 	createInfo.enabledExtensionCount = static_cast<uint32_t>(requiredExtensions.size());
@@ -636,16 +941,96 @@ bool VulkanServer::createLogicalDevice() {
 		queueCreateInfoArray.push_back(presentationQueueCreateInfo);
 	}
 
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	pipelineStatisticsSupported = supportedFeatures.pipelineStatisticsQuery;
+
 	VkPhysicalDeviceFeatures physicalDeviceFeatures = {};
 	physicalDeviceFeatures.samplerAnisotropy = VK_TRUE;
+	// The cooked textures are BC compressed, the universal ones are
+	// transcoded to BC or ETC2
+	physicalDeviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+	physicalDeviceFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+	// Used only by the GPU profiler
+	physicalDeviceFeatures.pipelineStatisticsQuery = pipelineStatisticsSupported;
+
+	// The optional extensions are enabled only if supported
+	std::vector<const char *> enabledExtensions(deviceExtensions);
+
+	memoryBudgetSupported = false;
+	descriptorIndexingSupported = false;
+	descriptorUpdateAfterBindSupported = false;
+
+	// Only the features used by the texture table are enabled
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+	descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+	if (physicalDeviceProperties2Supported) {
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> extensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+
+		bool descriptorIndexingExtension = false;
+		bool maintenance3Extension = false;
+		for (uint32_t i = 0; i < extensionCount; ++i) {
+			if (0 == strcmp(extensions[i].extensionName, "VK_EXT_memory_budget")) {
+				enabledExtensions.push_back("VK_EXT_memory_budget");
+				memoryBudgetSupported = true;
+			} else if (0 == strcmp(extensions[i].extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)) {
+				descriptorIndexingExtension = true;
+			} else if (0 == strcmp(extensions[i].extensionName, VK_KHR_MAINTENANCE3_EXTENSION_NAME)) {
+				maintenance3Extension = true;
+			}
+		}
+
+		PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+				instance,
+				"vkGetPhysicalDeviceFeatures2KHR");
+
+		if (descriptorIndexingExtension && maintenance3Extension && getFeatures2) {
+			VkPhysicalDeviceDescriptorIndexingFeaturesEXT supportedIndexing = {};
+			supportedIndexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+			VkPhysicalDeviceFeatures2KHR features2 = {};
+			features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+			features2.pNext = &supportedIndexing;
+			getFeatures2(physicalDevice, &features2);
+
+			descriptorIndexingSupported = supportedIndexing.descriptorBindingPartiallyBound &&
+										  supportedIndexing.runtimeDescriptorArray;
+			descriptorUpdateAfterBindSupported = supportedIndexing.descriptorBindingSampledImageUpdateAfterBind &&
+												 supportedIndexing.descriptorBindingUpdateUnusedWhilePending;
+		}
+	}
+
+	selectTextureBinding(supportedFeatures);
+
+	if (isTextureTableEnabled()) {
+		// The draws index the table with a push constant
+		physicalDeviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+	}
+
+	if (TEXTURE_BINDING_BINDLESS == textureBinding) {
+		enabledExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+		enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+		descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+		if (descriptorUpdateAfterBindSupported) {
+			descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+			descriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		}
+	}
 
 	VkDeviceCreateInfo deviceCreateInfos = {};
 	deviceCreateInfos.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	if (TEXTURE_BINDING_BINDLESS == textureBinding)
+		deviceCreateInfos.pNext = &descriptorIndexingFeatures;
 	deviceCreateInfos.queueCreateInfoCount = queueCreateInfoArray.size();
 	deviceCreateInfos.pQueueCreateInfos = queueCreateInfoArray.data();
 	deviceCreateInfos.pEnabledFeatures = &physicalDeviceFeatures;
-	deviceCreateInfos.enabledExtensionCount = deviceExtensions.size();
-	deviceCreateInfos.ppEnabledExtensionNames = deviceExtensions.data();
+	deviceCreateInfos.enabledExtensionCount = enabledExtensions.size();
+	deviceCreateInfos.ppEnabledExtensionNames = enabledExtensions.data();
 
 	if (enableValidationLayer()) {
 		deviceCreateInfos.enabledLayerCount = layers.size();
@@ -665,6 +1050,47 @@ bool VulkanServer::createLogicalDevice() {
 	return true;
 }
 
+#define BINDLESS_TEXTURE_MAX_COUNT 16384
+#define ARRAY_TEXTURE_MAX_COUNT 256
+
+void VulkanServer::selectTextureBinding(const VkPhysicalDeviceFeatures &p_supportedFeatures) {
+
+	textureBinding = requestedTextureBinding;
+
+	if (TEXTURE_BINDING_SETS != textureBinding && !p_supportedFeatures.shaderSampledImageArrayDynamicIndexing) {
+		if (TEXTURE_BINDING_AUTO != textureBinding)
+			WARN_PRINTS("Texture arrays indexing not supported, fallback to the descriptor sets");
+		textureBinding = TEXTURE_BINDING_SETS;
+	}
+
+	if (TEXTURE_BINDING_AUTO == textureBinding) {
+		textureBinding = descriptorIndexingSupported ? TEXTURE_BINDING_BINDLESS : TEXTURE_BINDING_ARRAY;
+	} else if (TEXTURE_BINDING_BINDLESS == textureBinding && !descriptorIndexingSupported) {
+		WARN_PRINTS("VK_EXT_descriptor_indexing not supported, fallback to the texture array");
+		textureBinding = TEXTURE_BINDING_ARRAY;
+	}
+
+	if (!isTextureTableEnabled()) {
+		textureTableCapacity = 0;
+		print_verbose("Texture binding: descriptor sets");
+		return;
+	}
+
+	// The whole table is visible by the fragment shader
+	VkPhysicalDeviceProperties deviceProps;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProps);
+	const VkPhysicalDeviceLimits &limits = deviceProps.limits;
+
+	textureTableCapacity = TEXTURE_BINDING_BINDLESS == textureBinding ? BINDLESS_TEXTURE_MAX_COUNT : ARRAY_TEXTURE_MAX_COUNT;
+	textureTableCapacity = MIN(textureTableCapacity, limits.maxPerStageDescriptorSamplers);
+	textureTableCapacity = MIN(textureTableCapacity, limits.maxPerStageDescriptorSampledImages);
+	textureTableCapacity = MIN(textureTableCapacity, limits.maxDescriptorSetSamplers);
+	textureTableCapacity = MIN(textureTableCapacity, limits.maxDescriptorSetSampledImages);
+
+	print_verbose(std::string("Texture binding: ") + (TEXTURE_BINDING_BINDLESS == textureBinding ? "bindless" : "array") +
+				  " of " + itos(textureTableCapacity) + " textures");
+}
+
 void VulkanServer::destroyLogicalDevice() {
 	if (device == VK_NULL_HANDLE)
 		return;
@@ -791,18 +1217,31 @@ VkSurfaceFormatKHR VulkanServer::chooseSurfaceFormat(const std::vector<VkSurface
 
 VkPresentModeKHR VulkanServer::choosePresentMode(const std::vector<VkPresentModeKHR> &p_modes) {
 
-	// This is guaranteed to be supported, but doesn't works so good
-	VkPresentModeKHR bestMode = VK_PRESENT_MODE_FIFO_KHR;
+	// Ordered from the best to the worst
+	VkPresentModeKHR preferredModes[2];
+	switch (latencyPolicy.presentPolicy) {
+		case PRESENT_POLICY_FIFO:
+			// This is guaranteed to be supported
+			return VK_PRESENT_MODE_FIFO_KHR;
+		case PRESENT_POLICY_MAILBOX:
+			preferredModes[0] = VK_PRESENT_MODE_MAILBOX_KHR;
+			preferredModes[1] = VK_PRESENT_MODE_IMMEDIATE_KHR;
+			break;
+		case PRESENT_POLICY_IMMEDIATE:
+			preferredModes[0] = VK_PRESENT_MODE_IMMEDIATE_KHR;
+			preferredModes[1] = VK_PRESENT_MODE_MAILBOX_KHR;
+			break;
+	}
 
-	for (const auto &pm : p_modes) {
-		if (pm == VK_PRESENT_MODE_MAILBOX_KHR) {
-			return pm;
-		} else if (pm == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-			bestMode = pm;
+	for (int i = 0; i < 2; ++i) {
+		for (const auto &pm : p_modes) {
+			if (pm == preferredModes[i])
+				return pm;
 		}
 	}
 
-	return bestMode;
+	WARN_PRINTS("The preferred present modes are not supported, fallback to FIFO");
+	return VK_PRESENT_MODE_FIFO_KHR;
 }
 
 VkExtent2D VulkanServer::chooseExtent(const VkSurfaceCapabilitiesKHR &capabilities) {
@@ -838,9 +1277,6 @@ bool VulkanServer::createSwapchain() {
 	if (!createSwapchainImageViews())
 		return false;
 
-	if (!createDepthTestResources())
-		return false;
-
 	if (!createRenderPass())
 		return false;
 
@@ -858,12 +1294,11 @@ void VulkanServer::destroySwapchain() {
 	destroyFramebuffers();
 	destroyGraphicsPipelines();
 	destroyRenderPass();
-	destroyDepthTestResources();
 	destroySwapchainImageViews();
 	destroyRawSwapchain();
 }
 
-bool VulkanServer::createRawSwapchain() {
+bool VulkanServer::createRawSwapchain(VkSwapchainKHR p_oldSwapchain) {
 
 	SwapChainSupportDetails chainDetails = querySwapChainSupport(physicalDevice);
 
@@ -911,7 +1346,9 @@ bool VulkanServer::createRawSwapchain() {
 	chainCreate.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	chainCreate.presentMode = pMode;
 	chainCreate.clipped = VK_TRUE;
-	chainCreate.oldSwapchain = VK_NULL_HANDLE;
+	// Passing the old swapchain allows the driver to reuse its resources,
+	// and the images already queued are still presented
+	chainCreate.oldSwapchain = p_oldSwapchain;
 
 	VkResult res = vkCreateSwapchainKHR(
 			device,
@@ -923,12 +1360,19 @@ bool VulkanServer::createRawSwapchain() {
 
 	swapchainImageFormat = format.format;
 	swapchainExtent = extent2D;
+	presentMode = pMode;
+	{
+		std::lock_guard<std::mutex> lock(latencyStatsMutex);
+		latencyStats.presentMode = pMode;
+	}
 
 	print_verbose("Created swap chain");
 	return true;
 }
 
 void VulkanServer::destroyRawSwapchain() {
+	destroyRetiredSwapchains(true);
+
 	if (swapchain == VK_NULL_HANDLE)
 		return;
 	vkDestroySwapchainKHR(device, swapchain, nullptr);
@@ -936,205 +1380,463 @@ void VulkanServer::destroyRawSwapchain() {
 	print_verbose("swapchain destroyed");
 }
 
-void VulkanServer::lockupSwapchainImages() {
+void VulkanServer::destroyRetiredSwapchains(bool p_all) {
 
-	uint32_t imagesCount = 0;
-	vkGetSwapchainImagesKHR(device, swapchain, &imagesCount, nullptr);
+	for (int i = retiredSwapchains.size() - 1; 0 <= i; --i) {
+		// When all the swapchain images are cycled the presentation of the
+		// old images is surely finished
+		if (!p_all && submittedFrames < retiredSwapchains[i].frame + swapchainImages.size())
+			continue;
 
-	swapchainImages.resize(imagesCount);
+		RetiredSwapchain &retired = retiredSwapchains[i];
 
-	vkGetSwapchainImagesKHR(
-			device,
-			swapchain,
-			&imagesCount,
-			swapchainImages.data());
+		RenderGraph::destroyRealized(retired.realized);
 
-	print_verbose("Swapchain images lockup success");
+		for (size_t v = 0; v < retired.imageViews.size(); ++v) {
+			if (retired.imageViews[v] != VK_NULL_HANDLE)
+				destroyImageView(retired.imageViews[v]);
+		}
+
+		for (size_t j = 0; j < retired.renderFinishedSemaphores.size(); ++j) {
+			if (retired.renderFinishedSemaphores[j] != VK_NULL_HANDLE)
+				vkDestroySemaphore(device, retired.renderFinishedSemaphores[j], nullptr);
+		}
+
+		if (retired.swapchain != VK_NULL_HANDLE)
+			vkDestroySwapchainKHR(device, retired.swapchain, nullptr);
+		retiredSwapchains.erase(retiredSwapchains.begin() + i);
+		print_verbose("Retired swapchain destroyed");
+	}
 }
 
-bool VulkanServer::createSwapchainImageViews() {
+void VulkanServer::updateTextureStreaming() {
 
-	swapchainImageViews.resize(swapchainImages.size());
+	if (!textureStreamer.getStats().textures)
+		return;
 
-	bool error = false;
+	PROFILE_ZONE("VulkanServer::updateTextureStreaming");
 
-	for (int i = swapchainImageViews.size() - 1; i >= 0; --i) {
-		if (!createImageView(swapchainImages[i], swapchainImageFormat,
-					VK_IMAGE_ASPECT_COLOR_BIT, swapchainImageViews[i])) {
-			swapchainImageViews[i] = VK_NULL_HANDLE;
-			error = true;
+	{ // The other allocations of the device local heap are not evictable
+		const TextureStreamer::Stats stats = textureStreamer.getStats();
+		const std::vector<MemoryTracker::HeapBudget> &heaps = memoryTracker.getHeapBudgets();
+
+		uint64_t deviceBudget = 0;
+		for (size_t i = 0; i < heaps.size(); ++i) {
+			if (!heaps[i].deviceLocal)
+				continue;
+			const uint64_t available = heaps[i].budget > heaps[i].usage ? heaps[i].budget - heaps[i].usage : 0;
+			deviceBudget = MAX(deviceBudget, stats.residentBytes + available);
 		}
+
+		if (deviceBudget)
+			textureStreamer.setDeviceBudget(deviceBudget);
 	}
 
-	ERR_FAIL_COND_V(error, false);
+	// The texture is assumed to cover the mesh once, so the wanted level has
+	// as many texels as the pixels of the mesh diameter
+	const glm::vec3 cameraPosition(camera.transform[3]);
+	const float pixelsPerUnit = swapchainExtent.height / (2.f * std::tan(camera.FOV * 0.5f));
 
-	print_verbose("All image view created");
-	return true;
-}
+	std::vector<MeshHandle *> *lists[] = { &meshes, &meshesCopyInProgress, &meshesCopyPending };
+	for (int l = 0; l < 3; ++l) {
+		std::vector<MeshHandle *> &list = *lists[l];
+		for (size_t i = 0; i < list.size(); ++i) {
+			const Texture *texture = list[i]->colorTexture;
+			if (!texture || TextureStreamer::NOT_REQUESTED == texture->streamingId)
+				continue;
 
-void VulkanServer::destroySwapchainImageViews() {
-	for (int i = swapchainImages.size() - 1; i >= 0; --i) {
+			const glm::mat4 &t = list[i]->transformation;
+			const float scale = MAX(MAX(glm::length(glm::vec3(t[0])), glm::length(glm::vec3(t[1]))), glm::length(glm::vec3(t[2])));
+			const float radius = list[i]->geometry->boundingRadius * scale;
+			const float distance = glm::distance(glm::vec3(t[3]), cameraPosition);
 
-		if (swapchainImageViews[i] == VK_NULL_HANDLE)
-			continue;
+			// Inside the mesh the whole screen is covered
+			const float pixels = distance > radius ? 2.f * radius * pixelsPerUnit / distance : FLT_MAX;
 
-		destroyImageView(swapchainImageViews[i]);
+			textureStreamer.request(texture->streamingId, TextureStreamer::computeLevel(texture->width, texture->height, texture->mipLevels, pixels));
+		}
 	}
-	swapchainImageViews.clear();
-	print_verbose("Destroyed image views");
-}
-
-bool VulkanServer::createDepthTestResources() {
 
-	VkFormat depthFormat = findBestDepthFormat();
+	textureStreamer.update(streamingChanges);
+	if (streamingChanges.empty())
+		return;
 
-	bool s;
-	s = createImage(
-			swapchainExtent.width,
-			swapchainExtent.height,
-			depthFormat,
-			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			depthImage,
-			depthImageMemory);
+	for (size_t i = 0; i < streamingChanges.size(); ++i) {
+		Texture *texture = static_cast<Texture *>(streamingChanges[i].userData);
+		ERR_CONTINUE(!texture->_setResidentLevel(streamingChanges[i].residentLevel));
+	}
 
-	ERR_FAIL_COND_V(!s, false);
+	if (rebindTextureImages())
+		reloadDrawCommandBuffer = true;
+}
 
-	s = createImageView(
-			depthImage,
-			depthFormat,
-			VK_IMAGE_ASPECT_DEPTH_BIT,
-			depthImageView);
+void VulkanServer::registerDynamicTexture(Texture *p_texture) {
+	std::lock_guard<std::mutex> lock(dynamicTexturesMutex);
+	dynamicTextures.push_back(p_texture);
+}
 
-	ERR_FAIL_COND_V(!s, false);
+void VulkanServer::unregisterDynamicTexture(Texture *p_texture) {
+	std::lock_guard<std::mutex> lock(dynamicTexturesMutex);
 
-	s = transitionImageLayout(
-			depthImage,
-			depthFormat,
-			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	// Not registered when its creation failed
+	auto it = std::find(dynamicTextures.begin(), dynamicTextures.end(), p_texture);
+	if (it == dynamicTextures.end())
+		return;
 
-	ERR_FAIL_COND_V(!s, false);
+	dynamicTextures.erase(it);
 
-	print_verbose("Depth test resources created");
-	return true;
+	if (p_texture->frameImages.frameViews.size()) {
+		retiredFrameImages.push_back(p_texture->frameImages);
+		p_texture->frameImages = Texture::FrameImages();
+	}
 }
 
-void VulkanServer::destroyDepthTestResources() {
+void VulkanServer::updateDynamicTextures() {
+	std::lock_guard<std::mutex> lock(dynamicTexturesMutex);
 
-	destroyImageView(depthImageView);
-	destroyImage(depthImage, depthImageMemory);
-	print_verbose("Depth test resources destroyed");
-}
+	for (size_t i = 0; i < retiredFrameImages.size(); ++i) {
+		releaseFrameImages(retiredFrameImages[i]);
+	}
+	retiredFrameImages.clear();
 
-bool VulkanServer::createRenderPass() {
+	if (dynamicTextures.empty())
+		return;
 
-	VkAttachmentDescription attachments[2];
-
-	// Description of attachment
-	VkAttachmentDescription colorAttachmentDesc = {};
-	colorAttachmentDesc.format = swapchainImageFormat;
-	colorAttachmentDesc.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachmentDesc.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachmentDesc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colorAttachmentDesc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachmentDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachmentDesc.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachmentDesc.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-	attachments[0] = colorAttachmentDesc;
-
-	// Reference to attachment description
-	VkAttachmentReference colorAttachmentRef = {};
-	colorAttachmentRef.attachment = 0; // ID of description
-	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	// Depth attachment
-	VkAttachmentDescription depthAttachmentDesc = {};
-	depthAttachmentDesc.format = findBestDepthFormat();
-	depthAttachmentDesc.samples = VK_SAMPLE_COUNT_1_BIT;
-	depthAttachmentDesc.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachmentDesc.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachmentDesc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	depthAttachmentDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachmentDesc.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	depthAttachmentDesc.finalLayout =
-			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-	attachments[1] = depthAttachmentDesc;
-
-	// Depth attachment reference
-	VkAttachmentReference depthAttachmentRef = {};
-	depthAttachmentRef.attachment = 1;
-	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-	// The subpass describe how an attachment should be treated during execution
-	VkSubpassDescription subpassDesc = {};
-	subpassDesc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpassDesc.colorAttachmentCount = 1;
-	subpassDesc.pColorAttachments = &colorAttachmentRef;
-	subpassDesc.pDepthStencilAttachment = &depthAttachmentRef;
-
-	// The dependency is something that lead the subpass order, is like a
-	// "barrier"
-	VkSubpassDependency dependency = {};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-							   VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-	VkRenderPassCreateInfo renderPassCreateInfo = {};
-	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassCreateInfo.attachmentCount = 2;
-	renderPassCreateInfo.pAttachments = attachments;
-	renderPassCreateInfo.subpassCount = 1;
-	renderPassCreateInfo.pSubpasses = &subpassDesc;
-	renderPassCreateInfo.dependencyCount = 1;
-	renderPassCreateInfo.pDependencies = &dependency;
-
-	VkResult res = vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &renderPass);
-	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	PROFILE_ZONE("VulkanServer::updateDynamicTextures");
 
-	print_verbose("Render pass created");
-	return true;
-}
+	// The swap is published to each frame by publishDynamicTextures, the
+	// command buffers keep binding the images of their frame
+	for (size_t i = 0; i < dynamicTextures.size(); ++i) {
+		Texture *texture = dynamicTextures[i];
 
-void VulkanServer::destroyRenderPass() {
-	if (VK_NULL_HANDLE == device)
-		return;
-	vkDestroyRenderPass(device, renderPass, nullptr);
-	renderPass = VK_NULL_HANDLE;
+		// New, or the swapchain has another image count
+		if (texture->frameImages.frameViews.size() != drawCommandBuffers.size()) {
+			releaseFrameImages(texture->frameImages);
+			acquireFrameImages(texture);
+		}
+
+		texture->_swapBuffers();
+	}
 }
 
-bool VulkanServer::createDescriptorSetLayouts() {
+void VulkanServer::publishDynamicTextures(uint32_t p_frame) {
+	std::lock_guard<std::mutex> lock(dynamicTexturesMutex);
 
-	{
-		// Camera uniform buffer set layout
-		VkDescriptorSetLayoutBinding cameraDescriptorBinding = {};
-		cameraDescriptorBinding.binding = 0;
-		cameraDescriptorBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		// Since I can define an array of uniform with descriptorCount I can define
-		// the size of this array
-		cameraDescriptorBinding.descriptorCount = 1;
-		cameraDescriptorBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	bool record = false;
+	for (size_t i = 0; i < dynamicTextures.size(); ++i) {
+		const Texture *texture = dynamicTextures[i];
+		Texture::FrameImages &frameImages = dynamicTextures[i]->frameImages;
+		if (p_frame >= frameImages.frameViews.size() || frameImages.frameViews[p_frame] == texture->imageView)
+			continue;
 
-		VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
-		layoutCreateInfo.sType =
-				VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		layoutCreateInfo.bindingCount = 1;
-		layoutCreateInfo.pBindings = &cameraDescriptorBinding;
+		const int image = frameImages.views[0] == texture->imageView ? 0 : 1;
+
+		if (frameImages.ownSlots) {
+			// The slot is used only by this frame
+			textureTable.write(frameImages.frameTableIndices[p_frame], texture->imageView, frameImages.sampler);
+		} else if (isTextureTableEnabled()) {
+			frameImages.frameTableIndices[p_frame] = frameImages.tableIndices[image];
+			record = true;
+		} else {
+			frameImages.frameSets[p_frame] = frameImages.sets[image];
+			record = true;
+		}
 
-		VkResult res = vkCreateDescriptorSetLayout(
-				device,
-				&layoutCreateInfo,
-				nullptr,
-				&cameraDescriptorSetLayout);
-		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+		frameImages.frameViews[p_frame] = texture->imageView;
 	}
 
-	{
+	// The other frames are in flight, and their command buffers unchanged
+	if (record)
+		recordCommandBuffer(p_frame);
+}
+
+void VulkanServer::acquireFrameImages(Texture *p_texture) {
+	Texture::FrameImages &frameImages = p_texture->frameImages;
+	const size_t frameCount = drawCommandBuffers.size();
+
+	frameImages.views[0] = p_texture->imageView;
+	frameImages.views[1] = p_texture->backImageView;
+	frameImages.sampler = p_texture->imageSampler;
+	frameImages.frameViews.assign(frameCount, p_texture->imageView);
+
+	if (isTextureTableEnabled() && textureTable.isUpdateAfterBind()) {
+		frameImages.ownSlots = true;
+		frameImages.frameTableIndices.resize(frameCount);
+		for (size_t i = 0; i < frameCount; ++i) {
+			frameImages.frameTableIndices[i] = textureTable.acquireSlot(p_texture->imageView, frameImages.sampler);
+			if (TextureTable::INVALID_INDEX != frameImages.frameTableIndices[i])
+				continue;
+
+			// The table is full, the frames share the slots of the images
+			for (size_t j = 0; j < i; ++j) {
+				textureTable.releaseSlot(frameImages.frameTableIndices[j]);
+			}
+			frameImages.ownSlots = false;
+			break;
+		}
+	}
+
+	if (isTextureTableEnabled() && !frameImages.ownSlots) {
+		for (int i = 0; i < 2; ++i) {
+			frameImages.tableIndices[i] = textureTable.acquire(frameImages.views[i], frameImages.sampler);
+		}
+		if (TextureTable::INVALID_INDEX == frameImages.tableIndices[0] || TextureTable::INVALID_INDEX == frameImages.tableIndices[1])
+			WARN_PRINTS("The texture table is full, the meshes of the dynamic texture don't see its updates");
+		frameImages.frameTableIndices.assign(frameCount, frameImages.tableIndices[0]);
+	} else if (!isTextureTableEnabled()) {
+		for (int i = 0; i < 2; ++i) {
+			frameImages.sets[i] = descriptorAllocator.acquireImageSet(meshImagesDescriptorSetLayout, frameImages.views[i], frameImages.sampler);
+		}
+		frameImages.frameSets.assign(frameCount, frameImages.sets[0]);
+	}
+
+	// The new slots are written by the next recording, that binds them too
+	reloadDrawCommandBuffer = true;
+}
+
+void VulkanServer::releaseFrameImages(Texture::FrameImages &r_frameImages) {
+	if (r_frameImages.frameViews.empty())
+		return;
+
+	if (r_frameImages.ownSlots) {
+		for (size_t i = 0; i < r_frameImages.frameTableIndices.size(); ++i) {
+			textureTable.releaseSlot(r_frameImages.frameTableIndices[i]);
+		}
+	} else if (isTextureTableEnabled()) {
+		for (int i = 0; i < 2; ++i) {
+			if (TextureTable::INVALID_INDEX != r_frameImages.tableIndices[i])
+				textureTable.release(r_frameImages.views[i], r_frameImages.sampler);
+		}
+	} else {
+		for (int i = 0; i < 2; ++i) {
+			if (VK_NULL_HANDLE != r_frameImages.sets[i])
+				descriptorAllocator.releaseImageSet(meshImagesDescriptorSetLayout, r_frameImages.views[i], r_frameImages.sampler, submittedFrames);
+		}
+	}
+
+	r_frameImages = Texture::FrameImages();
+}
+
+bool VulkanServer::rebindTextureImages() {
+	bool rebound = false;
+
+	// updateImages does nothing when the view and the sampler are the same
+	std::vector<MeshHandle *> *lists[] = { &meshes, &meshesCopyInProgress, &meshesCopyPending };
+	for (int l = 0; l < 3; ++l) {
+		std::vector<MeshHandle *> &list = *lists[l];
+		for (size_t i = 0; i < list.size(); ++i) {
+			if (list[i]->colorTexture && list[i]->updateImages())
+				rebound = true;
+		}
+	}
+	return rebound;
+}
+
+void VulkanServer::retireTextureImage(VkImage p_image, VmaAllocation p_allocation, VkImageView p_imageView, uint64_t p_uploadBatch) {
+	RetiredTextureImage retired;
+	retired.image = p_image;
+	retired.allocation = p_allocation;
+	retired.imageView = p_imageView;
+	retired.uploadBatch = p_uploadBatch;
+	retired.frame = submittedFrames;
+	retiredTextureImages.push_back(retired);
+}
+
+void VulkanServer::destroyRetiredTextureImages(bool p_all) {
+
+	for (int i = retiredTextureImages.size() - 1; 0 <= i; --i) {
+		RetiredTextureImage &retired = retiredTextureImages[i];
+
+		// Like the swapchains, the frames that sample the image are completed
+		// when all the swapchain images are cycled
+		if (!p_all && submittedFrames < retired.frame + swapchainImages.size())
+			continue;
+
+		if (retired.uploadBatch)
+			transferBatcher.wait(retired.uploadBatch);
+
+		destroyImageView(retired.imageView);
+		destroyImage(retired.image, retired.allocation);
+		retiredTextureImages.erase(retiredTextureImages.begin() + i);
+	}
+}
+
+void VulkanServer::lockupSwapchainImages() {
+
+	uint32_t imagesCount = 0;
+	vkGetSwapchainImagesKHR(device, swapchain, &imagesCount, nullptr);
+
+	swapchainImages.resize(imagesCount);
+
+	vkGetSwapchainImagesKHR(
+			device,
+			swapchain,
+			&imagesCount,
+			swapchainImages.data());
+
+	print_verbose("Swapchain images lockup success");
+}
+
+bool VulkanServer::createSwapchainImageViews() {
+
+	swapchainImageViews.resize(swapchainImages.size());
+
+	bool error = false;
+
+	for (int i = swapchainImageViews.size() - 1; i >= 0; --i) {
+		if (!createImageView(swapchainImages[i], swapchainImageFormat,
+					VK_IMAGE_ASPECT_COLOR_BIT, swapchainImageViews[i])) {
+			swapchainImageViews[i] = VK_NULL_HANDLE;
+			error = true;
+		}
+	}
+
+	ERR_FAIL_COND_V(error, false);
+
+	print_verbose("All image view created");
+	return true;
+}
+
+void VulkanServer::destroySwapchainImageViews() {
+	for (int i = swapchainImageViews.size() - 1; i >= 0; --i) {
+
+		if (swapchainImageViews[i] == VK_NULL_HANDLE)
+			continue;
+
+		destroyImageView(swapchainImageViews[i]);
+	}
+	swapchainImageViews.clear();
+	print_verbose("Destroyed image views");
+}
+
+VulkanServer::AttachmentMemoryReport VulkanServer::getAttachmentMemoryReport() const {
+
+	AttachmentMemoryReport report;
+	report.extent = swapchainExtent;
+
+	// The swapchain images are allocated by the presentation engine, so the
+	// size is an estimation (all the supported formats are 32 bits)
+	AttachmentMemory color;
+	color.name = "color";
+	color.format = swapchainImageFormat;
+	color.count = swapchainImages.size();
+	color.lifetime = ATTACHMENT_LIFETIME_PRESENTATION;
+	color.bytes = VkDeviceSize(swapchainExtent.width) * swapchainExtent.height * 4 * color.count;
+	color.committedBytes = color.bytes;
+	report.attachments.push_back(color);
+
+	if (VK_NULL_HANDLE != renderGraph.getImage(depthResource)) {
+		AttachmentMemory depth;
+		depth.name = "depth";
+		depth.format = depthImageFormat;
+		depth.count = 1;
+		depth.lifetime = ATTACHMENT_LIFETIME_TRANSIENT;
+		depth.lazilyAllocated = renderGraph.isImageLazilyAllocated(depthResource);
+		depth.bytes = renderGraph.getImageSize(depthResource);
+		depth.committedBytes = depth.bytes;
+		if (depth.lazilyAllocated) {
+			// The lazily allocated depth has a dedicated memory
+			VmaAllocationInfo allocationInfo;
+			vmaGetAllocationInfo(bufferMemoryDeviceAllocator, renderGraph.getImageAllocation(depthResource), &allocationInfo);
+			vkGetDeviceMemoryCommitment(device, allocationInfo.deviceMemory, &depth.committedBytes);
+		}
+		report.attachments.push_back(depth);
+	}
+
+	for (size_t i = 0; i < report.attachments.size(); ++i) {
+		report.totalBytes += report.attachments[i].bytes;
+		report.committedBytes += report.attachments[i].committedBytes;
+	}
+
+	return report;
+}
+
+void VulkanServer::printAttachmentMemoryReport() const {
+
+	static const char *lifetimes[] = { "persistent", "transient", "presentation" };
+
+	const AttachmentMemoryReport report = getAttachmentMemoryReport();
+	print_line("Attachment memory, render target " + itos(report.extent.width) + "x" + itos(report.extent.height) + ":");
+	for (size_t i = 0; i < report.attachments.size(); ++i) {
+		const AttachmentMemory &a = report.attachments[i];
+		print_line(std::string("  ") + a.name + " x" + itos(a.count) + " (" + lifetimes[a.lifetime] + (a.lazilyAllocated ? ", lazily allocated" : "") + "): " +
+				   itos(a.bytes / 1024) + " KiB, committed " + itos(a.committedBytes / 1024) + " KiB");
+	}
+	print_line("  total " + itos(report.totalBytes / 1024) + " KiB, committed " + itos(report.committedBytes / 1024) + " KiB");
+
+	renderGraph.printReport();
+}
+
+bool VulkanServer::createRenderPass() {
+
+	depthImageFormat = findBestDepthFormat();
+
+	renderGraph.reset();
+
+	// The swapchain image is acquired with a semaphore waited at the color
+	// output stage, and is presented after the frame
+	backbufferResource = renderGraph.importImage(
+			"backbuffer",
+			swapchainImageFormat,
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	renderGraph.markOutput(backbufferResource);
+
+	// The depth is cleared at the begin of the pass and never stored, so the
+	// graph makes it a transient attachment
+	depthResource = renderGraph.createImage("depth", depthImageFormat);
+
+	mainPass = renderGraph.addPass("main", RenderGraph::PASS_RASTER, recordMainPass, this);
+
+	VkClearColorValue clearColor = { { 0., 0., 0., 1. } };
+	renderGraph.writeColor(mainPass, backbufferResource, VK_ATTACHMENT_LOAD_OP_CLEAR, clearColor);
+	// 1. Mean the furthest distance possible in the depth buffer that go
+	// from 0 to 1
+	renderGraph.writeDepth(mainPass, depthResource, VK_ATTACHMENT_LOAD_OP_CLEAR, 1.);
+
+	ERR_FAIL_COND_V(!renderGraph.compile(device), false);
+
+	renderPass = renderGraph.getRenderPass(mainPass);
+
+	print_verbose("Render pass created");
+	return true;
+}
+
+void VulkanServer::destroyRenderPass() {
+	if (VK_NULL_HANDLE == device)
+		return;
+	renderGraph.releaseCompiled();
+	renderPass = VK_NULL_HANDLE;
+}
+
+bool VulkanServer::createDescriptorSetLayouts() {
+
+	{
+		// Camera uniform buffer set layout
+		VkDescriptorSetLayoutBinding cameraDescriptorBinding = {};
+		cameraDescriptorBinding.binding = 0;
+		cameraDescriptorBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		// Since I can define an array of uniform with descriptorCount I can define
+		// the size of this array
+		cameraDescriptorBinding.descriptorCount = 1;
+		cameraDescriptorBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+		layoutCreateInfo.sType =
+				VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutCreateInfo.bindingCount = 1;
+		layoutCreateInfo.pBindings = &cameraDescriptorBinding;
+
+		VkResult res = vkCreateDescriptorSetLayout(
+				device,
+				&layoutCreateInfo,
+				nullptr,
+				&cameraDescriptorSetLayout);
+		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	}
+
+	{
 		// Mesh dynamic uniform buffer
 		VkDescriptorSetLayoutBinding meshesDescriptorBinding = {};
 		meshesDescriptorBinding.binding = 0;
@@ -1178,12 +1880,20 @@ bool VulkanServer::createDescriptorSetLayouts() {
 		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
 	}
 
+	if (isTextureTableEnabled()) {
+		const TextureTable::Mode mode = TEXTURE_BINDING_BINDLESS == textureBinding ? TextureTable::MODE_BINDLESS : TextureTable::MODE_ARRAY;
+		const bool updateAfterBind = TextureTable::MODE_BINDLESS == mode && descriptorUpdateAfterBindSupported;
+		ERR_FAIL_COND_V(!textureTable.create(device, mode, textureTableCapacity, updateAfterBind), false);
+	}
+
 	print_verbose("Uniform descriptors layouts created");
 	return true;
 }
 
 void VulkanServer::destroyDescriptorSetLayouts() {
 
+	textureTable.destroy();
+
 	if (VK_NULL_HANDLE != meshImagesDescriptorSetLayout) {
 		vkDestroyDescriptorSetLayout(
 				device,
@@ -1210,11 +1920,32 @@ void VulkanServer::destroyDescriptorSetLayouts() {
 bool VulkanServer::createGraphicsPipelines() {
 
 	vertShaderModule = createShaderModule(ShaderShaderVert::code_size, ShaderShaderVert::code);
-	fragShaderModule = createShaderModule(ShaderShaderFrag::code_size, ShaderShaderFrag::code);
+	switch (textureBinding) {
+		case TEXTURE_BINDING_BINDLESS:
+			fragShaderModule = createShaderModule(ShaderShaderBindlessFrag::code_size, ShaderShaderBindlessFrag::code);
+			break;
+		case TEXTURE_BINDING_ARRAY:
+			fragShaderModule = createShaderModule(ShaderShaderArrayFrag::code_size, ShaderShaderArrayFrag::code);
+			break;
+		default:
+			fragShaderModule = createShaderModule(ShaderShaderFrag::code_size, ShaderShaderFrag::code);
+	}
 
 	ERR_FAIL_COND_V(vertShaderModule == VK_NULL_HANDLE, false);
 	ERR_FAIL_COND_V(fragShaderModule == VK_NULL_HANDLE, false);
 
+	// The size of the texture array
+	VkSpecializationMapEntry textureCountEntry = {};
+	textureCountEntry.constantID = 0;
+	textureCountEntry.offset = 0;
+	textureCountEntry.size = sizeof(uint32_t);
+
+	VkSpecializationInfo textureCountSpecialization = {};
+	textureCountSpecialization.mapEntryCount = 1;
+	textureCountSpecialization.pMapEntries = &textureCountEntry;
+	textureCountSpecialization.dataSize = sizeof(uint32_t);
+	textureCountSpecialization.pData = &textureTableCapacity;
+
 	std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
 	{
 		VkPipelineShaderStageCreateInfo vertStageCreateInfo = {};
@@ -1231,6 +1962,8 @@ bool VulkanServer::createGraphicsPipelines() {
 		fragStageCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 		fragStageCreateInfo.module = fragShaderModule;
 		fragStageCreateInfo.pName = "main";
+		if (TEXTURE_BINDING_ARRAY == textureBinding)
+			fragStageCreateInfo.pSpecializationInfo = &textureCountSpecialization;
 		shaderStages.push_back(fragStageCreateInfo);
 	}
 
@@ -1266,25 +1999,23 @@ bool VulkanServer::createGraphicsPipelines() {
 	VkPipelineViewportStateCreateInfo viewportCreateInfo = {};
 	viewportCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 
-	VkViewport viewport = {};
-	viewport.x = .0;
-	viewport.y = .0;
-	viewport.width = (float)swapchainExtent.width;
-	viewport.height = (float)swapchainExtent.height;
-	viewport.minDepth = .0;
-	viewport.maxDepth = 1.;
-
+	// The viewport and the scissor (the part of screen that we want crop, it's
+	// not a transformation nor scaling) are dynamic states, so the pipeline
+	// doesn't depend on the swapchain size and is not recreated on resize
 	viewportCreateInfo.viewportCount = 1;
-	viewportCreateInfo.pViewports = &viewport;
+	viewportCreateInfo.pViewports = nullptr;
+	viewportCreateInfo.scissorCount = 1;
+	viewportCreateInfo.pScissors = nullptr;
 
-	// The scissor indicate the part of screen that we want crop, (it's not a
-	// transformation nor scaling)
-	VkRect2D scissor = {};
-	scissor.offset = { 0, 0 };
-	scissor.extent = swapchainExtent;
+	VkDynamicState dynamicStates[] = {
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR
+	};
 
-	viewportCreateInfo.scissorCount = 1;
-	viewportCreateInfo.pScissors = &scissor;
+	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {};
+	dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicStateCreateInfo.dynamicStateCount = 2;
+	dynamicStateCreateInfo.pDynamicStates = dynamicStates;
 
 	/// Active depth test
 	VkPipelineDepthStencilStateCreateInfo depthCreateInfo = {};
@@ -1346,12 +2077,23 @@ bool VulkanServer::createGraphicsPipelines() {
 	{
 		VkDescriptorSetLayout layouts[] = { cameraDescriptorSetLayout,
 			meshesDescriptorSetLayout,
-			meshImagesDescriptorSetLayout };
+			isTextureTableEnabled() ? textureTable.getLayout() : meshImagesDescriptorSetLayout };
 		VkPipelineLayoutCreateInfo layoutCreateInfo = {};
 		layoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 		layoutCreateInfo.setLayoutCount = 3;
 		layoutCreateInfo.pSetLayouts = layouts;
 
+		// The texture table index of the draw
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(uint32_t);
+
+		if (isTextureTableEnabled()) {
+			layoutCreateInfo.pushConstantRangeCount = 1;
+			layoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		}
+
 		ERR_FAIL_COND_V(
 				VK_SUCCESS != vkCreatePipelineLayout(
 									  device,
@@ -1370,6 +2112,7 @@ bool VulkanServer::createGraphicsPipelines() {
 	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
 	pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
 	pipelineCreateInfo.pViewportState = &viewportCreateInfo;
+	pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
 	pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
 	pipelineCreateInfo.pMultisampleState = &multisamplingCreateInfo;
 	pipelineCreateInfo.pColorBlendState = &colorBlendCreateInfo;
@@ -1448,49 +2191,25 @@ void VulkanServer::destroyShaderModule(VkShaderModule &shaderModule) {
 
 bool VulkanServer::createFramebuffers() {
 
-	swapchainFramebuffers.resize(swapchainImageViews.size());
+	renderGraph.setImportedImages(backbufferResource, swapchainImages, swapchainImageViews);
 
-	bool error = false;
-	VkImageView attachments[2];
-	for (int i = swapchainFramebuffers.size() - 1; 0 <= i; --i) {
-
-		// I'm using a single depthImageView since only one depth is drawen at a
-		// time due to semaphore set
-		attachments[0] = swapchainImageViews[i];
-		attachments[1] = depthImageView;
-
-		VkFramebufferCreateInfo bufferCreateInfo = {};
-		bufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		bufferCreateInfo.renderPass = renderPass;
-		bufferCreateInfo.attachmentCount = 2;
-		bufferCreateInfo.pAttachments = attachments;
-		bufferCreateInfo.width = swapchainExtent.width;
-		bufferCreateInfo.height = swapchainExtent.height;
-		bufferCreateInfo.layers = 1;
-
-		VkResult res = vkCreateFramebuffer(device, &bufferCreateInfo, nullptr,
-				&swapchainFramebuffers[i]);
-		if (res != VK_SUCCESS) {
-			swapchainFramebuffers[i] = VK_NULL_HANDLE;
-			error = true;
-		}
-	}
+	// On tiled GPU the depth, that lives only inside the render pass, is never
+	// committed when it uses lazily allocated memory
+	const bool s = renderGraph.realize(
+			bufferMemoryDeviceAllocator,
+			&memoryTracker,
+			swapchainExtent,
+			swapchainImages.size(),
+			hasMemoryProperty(VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT));
+
+	ERR_FAIL_COND_V(!s, false);
 
 	print_verbose("Framebuffers created");
 	return true;
 }
 
 void VulkanServer::destroyFramebuffers() {
-
-	for (int i = swapchainFramebuffers.size() - 1; 0 <= i; --i) {
-
-		if (swapchainFramebuffers[i] == VK_NULL_HANDLE)
-			continue;
-
-		vkDestroyFramebuffer(device, swapchainFramebuffers[i], nullptr);
-	}
-
-	swapchainFramebuffers.clear();
+	renderGraph.releaseRealized();
 }
 
 bool VulkanServer::createBufferMemoryDeviceAllocator() {
@@ -1533,6 +2252,121 @@ void VulkanServer::destroyBufferMemoryHostAllocator() {
 	bufferMemoryHostAllocator = VK_NULL_HANDLE;
 }
 
+// The images up to this size use the small texture pool
+#define SMALL_TEXTURE_MAX_SIZE (256 * 1024) // 256x256 RGBA
+#define SMALL_TEXTURE_BLOCK_SIZE (16 * 1024 * 1024)
+#define LARGE_TEXTURE_BLOCK_SIZE (128 * 1024 * 1024)
+#define RENDER_TARGET_BLOCK_SIZE (64 * 1024 * 1024)
+
+// The attachments from this size use a dedicated allocation, since the
+// driver can optimize them and they would waste the pool blocks
+#define DEDICATED_ATTACHMENT_MIN_SIZE (16 * 1024 * 1024)
+
+bool VulkanServer::createImagePools() {
+
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.extent = { 256, 256, 1 };
+	imageCreateInfo.mipLevels = 1;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VmaAllocationCreateInfo allocationCreateInfo = {};
+	allocationCreateInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+	for (int i = 0; i < IMAGE_POOL_MAX; ++i) {
+
+		VmaPoolCreateInfo poolCreateInfo = {};
+
+		// The pool memory type is found using a representative image
+		if (IMAGE_POOL_RENDER_TARGET == i) {
+			imageCreateInfo.format = findBestDepthFormat();
+			imageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+			poolCreateInfo.blockSize = RENDER_TARGET_BLOCK_SIZE;
+		} else {
+			imageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+			imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+			poolCreateInfo.blockSize = IMAGE_POOL_SMALL_TEXTURE == i ? SMALL_TEXTURE_BLOCK_SIZE : LARGE_TEXTURE_BLOCK_SIZE;
+		}
+
+		if (VK_SUCCESS != vmaFindMemoryTypeIndexForImageInfo(
+								  bufferMemoryDeviceAllocator,
+								  &imageCreateInfo,
+								  &allocationCreateInfo,
+								  &poolCreateInfo.memoryTypeIndex)) {
+
+			// Not fatal, the images of this pool use dedicated allocations
+			WARN_PRINTS("No memory type for the image pool " + itos(i));
+			imagePools[i] = VK_NULL_HANDLE;
+			continue;
+		}
+
+		ERR_FAIL_COND_V(
+				VK_SUCCESS != vmaCreatePool(
+									  bufferMemoryDeviceAllocator,
+									  &poolCreateInfo,
+									  &imagePools[i]),
+				false);
+	}
+
+	print_verbose("Image pools created");
+	return true;
+}
+
+void VulkanServer::destroyImagePools() {
+	for (int i = 0; i < IMAGE_POOL_MAX; ++i) {
+		if (VK_NULL_HANDLE == imagePools[i])
+			continue;
+		vmaDestroyPool(bufferMemoryDeviceAllocator, imagePools[i]);
+		imagePools[i] = VK_NULL_HANDLE;
+	}
+}
+
+VmaPool VulkanServer::chooseImagePool(MemoryTracker::Category p_category, VkDeviceSize p_size) const {
+
+	switch (p_category) {
+		case MemoryTracker::CATEGORY_TEXTURE:
+			if (p_size <= SMALL_TEXTURE_MAX_SIZE)
+				return imagePools[IMAGE_POOL_SMALL_TEXTURE];
+			if (p_size <= LARGE_TEXTURE_BLOCK_SIZE / 4)
+				return imagePools[IMAGE_POOL_LARGE_TEXTURE];
+			return VK_NULL_HANDLE;
+		case MemoryTracker::CATEGORY_ATTACHMENT:
+			if (p_size < DEDICATED_ATTACHMENT_MIN_SIZE)
+				return imagePools[IMAGE_POOL_RENDER_TARGET];
+			return VK_NULL_HANDLE;
+		default:
+			return VK_NULL_HANDLE;
+	}
+}
+
+void VulkanServer::printImagePoolReport() {
+
+	static const char *names[IMAGE_POOL_MAX] = { "small textures", "large textures", "render targets" };
+
+	print_line("Image pools (used / reserved KiB, allocations):");
+	for (int i = 0; i < IMAGE_POOL_MAX; ++i) {
+		if (VK_NULL_HANDLE == imagePools[i]) {
+			print_line(std::string("  ") + names[i] + ": not available");
+			continue;
+		}
+
+		VmaPoolStats stats;
+		vmaGetPoolStats(bufferMemoryDeviceAllocator, imagePools[i], &stats);
+		print_line(std::string("  ") + names[i] + ": " +
+				   itos((stats.size - stats.unusedSize) / 1024) + " / " + itos(stats.size / 1024) + ", " +
+				   itos(stats.allocationCount));
+	}
+
+	VmaStats stats;
+	vmaCalculateStats(bufferMemoryDeviceAllocator, &stats);
+	print_line("  device memory blocks " + itos(stats.total.blockCount) + ", sub allocations " + itos(stats.total.allocationCount));
+}
+
 int32_t VulkanServer::chooseMemoryType(uint32_t p_typeBits,
 		VkMemoryPropertyFlags p_propertyFlags) {
 
@@ -1552,11 +2386,24 @@ int32_t VulkanServer::chooseMemoryType(uint32_t p_typeBits,
 	return -1;
 }
 
+bool VulkanServer::hasMemoryProperty(VkMemoryPropertyFlags p_propertyFlags) {
+
+	VkPhysicalDeviceMemoryProperties memoryProps;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProps);
+
+	for (uint32_t i = 0; i < memoryProps.memoryTypeCount; ++i) {
+		if ((memoryProps.memoryTypes[i].propertyFlags & p_propertyFlags) == p_propertyFlags)
+			return true;
+	}
+	return false;
+}
+
 bool VulkanServer::createUniformBuffers() {
 
 	ERR_FAIL_COND_V(
 			!createBuffer(
 					bufferMemoryHostAllocator,
+					MemoryTracker::CATEGORY_UNIFORM,
 					sizeof(SceneUniformBufferObject),
 					VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 					VK_SHARING_MODE_EXCLUSIVE,
@@ -1582,6 +2429,7 @@ bool VulkanServer::createUniformBuffers() {
 	ERR_FAIL_COND_V(
 			!createBuffer(
 					bufferMemoryHostAllocator,
+					MemoryTracker::CATEGORY_UNIFORM,
 					meshDynamicUniformBufferOffset * MAX_MESH_COUNT,
 					VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 					VK_SHARING_MODE_EXCLUSIVE,
@@ -1653,26 +2501,16 @@ bool VulkanServer::createUniformPools() {
 		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
 	}
 
-	{ // Per image uniform buffer pool
+	{ // Mesh images, the pools are chained by the allocator on demand
 		VkDescriptorPoolSize poolSize = {};
 		// Image and sampler uniform
 		poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSize.descriptorCount = MAX_MESH_COUNT; // one texture for mesh
-
-		VkDescriptorPoolCreateInfo poolCreateInfo = {};
-		poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-		poolCreateInfo.poolSizeCount = 1;
-		poolCreateInfo.pPoolSizes = &poolSize;
-		poolCreateInfo.maxSets = MAX_MESH_COUNT;
+		poolSize.descriptorCount = 1; // one texture for set
 
-		VkResult res = vkCreateDescriptorPool(
-				device,
-				&poolCreateInfo,
-				nullptr,
-				&meshImagesDescriptorPool);
+		std::vector<VkDescriptorPoolSize> poolSizes;
+		poolSizes.push_back(poolSize);
 
-		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+		ERR_FAIL_COND_V(!descriptorAllocator.create(device, poolSizes, IMAGE_SETS_PER_POOL), false);
 	}
 
 	print_verbose("Uniform pools created");
@@ -1680,11 +2518,8 @@ bool VulkanServer::createUniformPools() {
 }
 
 void VulkanServer::destroyUniformPools() {
-	if (meshImagesDescriptorPool != VK_NULL_HANDLE) {
-		vkDestroyDescriptorPool(device, meshImagesDescriptorPool, nullptr);
-		meshImagesDescriptorPool = VK_NULL_HANDLE;
-		print_verbose("Mesh images uniform pool destroyed");
-	}
+	descriptorAllocator.destroy();
+	print_verbose("Mesh images uniform pools destroyed");
 	if (cameraDescriptorPool != VK_NULL_HANDLE) {
 		vkDestroyDescriptorPool(device, cameraDescriptorPool, nullptr);
 		cameraDescriptorPool = VK_NULL_HANDLE;
@@ -1806,38 +2641,97 @@ void VulkanServer::destroyCommandPool() {
 	copyCommandBuffer = VK_NULL_HANDLE;
 }
 
-bool VulkanServer::allocateCommandBuffers() {
-	// Doesn't require destructions (it's performed automatically during the
-	// destruction of command pool)
+VkCommandPool VulkanServer::getOneTimeCommandPool() {
 
-	drawCommandBuffers.resize(swapchainImages.size());
+	std::lock_guard<std::mutex> lock(oneTimeCommandPoolsMutex);
+
+	const std::thread::id threadId = std::this_thread::get_id();
+	std::map<std::thread::id, VkCommandPool>::iterator it = oneTimeCommandPools.find(threadId);
+	if (it != oneTimeCommandPools.end())
+		return it->second;
+
+	QueueFamilyIndices queueIndices = findQueueFamilies(physicalDevice);
+
+	VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+	commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolCreateInfo.queueFamilyIndex = queueIndices.graphicsFamilyIndex;
+	commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	VkCommandPool pool;
+	VkResult res = vkCreateCommandPool(
+			device,
+			&commandPoolCreateInfo,
+			nullptr,
+			&pool);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, VK_NULL_HANDLE);
+
+	oneTimeCommandPools[threadId] = pool;
+	print_verbose("One time command pool created");
+	return pool;
+}
+
+void VulkanServer::destroyOneTimeCommandPools() {
+
+	std::lock_guard<std::mutex> lock(oneTimeCommandPoolsMutex);
+
+	for (std::map<std::thread::id, VkCommandPool>::iterator it = oneTimeCommandPools.begin(); it != oneTimeCommandPools.end(); ++it) {
+		vkDestroyCommandPool(device, it->second, nullptr);
+	}
+	oneTimeCommandPools.clear();
+	print_verbose("One time command pools destroyed");
+}
+
+bool VulkanServer::allocateCommandBuffers() {
+	// Doesn't require destructions (it's performed automatically during the
+	// destruction of command pool)
+
+	ERR_FAIL_COND_V(!allocateDrawCommandBuffers(), false);
 
 	VkCommandBufferAllocateInfo allocateInfo = {};
 	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocateInfo.commandPool = graphicsCommandPool;
 	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocateInfo.commandBufferCount = (uint32_t)drawCommandBuffers.size();
-
+	allocateInfo.commandBufferCount = 1;
 	ERR_FAIL_COND_V(
 			VK_SUCCESS != vkAllocateCommandBuffers(
 								  device,
 								  &allocateInfo,
-								  drawCommandBuffers.data()),
+								  &copyCommandBuffer),
 			false);
 
-	allocateInfo.commandBufferCount = 1;
+	print_verbose("command buffers allocated");
+	return true;
+}
+
+bool VulkanServer::allocateDrawCommandBuffers() {
+
+	if (drawCommandBuffers.size()) {
+		vkFreeCommandBuffers(device, graphicsCommandPool, drawCommandBuffers.size(), drawCommandBuffers.data());
+		drawCommandBuffers.clear();
+	}
+
+	drawCommandBuffers.resize(swapchainImages.size());
+	staleDrawCommandBuffers.assign(drawCommandBuffers.size(), true);
+
+	VkCommandBufferAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocateInfo.commandPool = graphicsCommandPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandBufferCount = (uint32_t)drawCommandBuffers.size();
+
 	ERR_FAIL_COND_V(
 			VK_SUCCESS != vkAllocateCommandBuffers(
 								  device,
 								  &allocateInfo,
-								  &copyCommandBuffer),
+								  drawCommandBuffers.data()),
 			false);
 
-	print_verbose("command buffers allocated");
 	return true;
 }
 
 void VulkanServer::beginCommandBuffers() {
+	PROFILE_ZONE("VulkanServer::beginCommandBuffers");
 
 	vkWaitForFences(
 			device,
@@ -1846,57 +2740,111 @@ void VulkanServer::beginCommandBuffers() {
 			VK_TRUE,
 			LONGTIMEOUT_NANOSEC);
 
+	// The frames are completed, so the texture table can be written
+	textureTable.flushWrites();
+
 	for (int i = drawCommandBuffers.size() - 1; 0 <= i; --i) {
+		recordCommandBuffer(i);
+	}
+	print_verbose("Command buffers initializated");
+}
 
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-
-		// Begin command buffer
-		vkBeginCommandBuffer(drawCommandBuffers[i], &beginInfo);
-
-		VkRenderPassBeginInfo renderPassBeginInfo = {};
-		renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassBeginInfo.renderPass = renderPass;
-		renderPassBeginInfo.framebuffer = swapchainFramebuffers[i];
-		renderPassBeginInfo.renderArea.offset = { 0, 0 };
-		renderPassBeginInfo.renderArea.extent = swapchainExtent;
-		VkClearValue clearValues[2];
-		clearValues[0].color = { 0., 0., 0., 1. };
-		clearValues[1].depthStencil = { 1., 0 }; // 1. Mean the furthest distance
-				// possible in the depth buffer that
-				// go from 0 to 1
-		renderPassBeginInfo.clearValueCount = 2;
-		renderPassBeginInfo.pClearValues = clearValues;
-
-		// Begin render pass
-		vkCmdBeginRenderPass(drawCommandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-		// Bind graphics pipeline
-		vkCmdBindPipeline(drawCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-
-		if (meshes.size() > 0) {
-			// 0 camera, 1 mesh, 2 mesh images
-			VkDescriptorSet descriptorSets[] = { cameraDescriptorSet, VK_NULL_HANDLE, VK_NULL_HANDLE };
-			// Bind buffers
-			for (int m = 0, s = meshes.size(); m < s; ++m) {
-				MeshHandle *mh = meshes[m];
-				descriptorSets[1] = meshesDescriptorSet; // TODOD set here the right descriptor set
-				descriptorSets[2] = mh->imageDescriptorSet;
-				uint32_t dynamicOffset = mh->meshUniformBufferOffset * meshDynamicUniformBufferOffset;
-
-				vkCmdBindDescriptorSets(drawCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 3, descriptorSets, 1, &dynamicOffset);
-				vkCmdBindVertexBuffers(drawCommandBuffers[i], 0, 1, &mh->vertexBuffer, &mh->verticesBufferOffset);
-				vkCmdBindIndexBuffer(drawCommandBuffers[i], mh->indexBuffer, mh->indicesBufferOffset, VK_INDEX_TYPE_UINT32);
-				vkCmdDrawIndexed(drawCommandBuffers[i], mh->mesh->getCountIndices(), 1, 0, 0, 0);
-			}
-		}
+void VulkanServer::recordCommandBuffer(uint32_t p_index) {
+
+	staleDrawCommandBuffers[p_index] = false;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+	// Begin command buffer
+	vkBeginCommandBuffer(drawCommandBuffers[p_index], &beginInfo);
+
+	gpuProfiler.cmdResetSlot(drawCommandBuffers[p_index], p_index);
+	gpuProfiler.cmdBeginStatistics(drawCommandBuffers[p_index], p_index);
+	gpuProfiler.cmdBeginZone(drawCommandBuffers[p_index], p_index, GpuProfiler::ZONE_RENDER_PASS);
 
-		vkCmdEndRenderPass(drawCommandBuffers[i]);
+	// The barriers and the render pass are recorded by the render graph
+	renderGraph.record(drawCommandBuffers[p_index], p_index);
 
-		ERR_FAIL_COND(VK_SUCCESS != vkEndCommandBuffer(drawCommandBuffers[i]));
+	gpuProfiler.cmdEndZone(drawCommandBuffers[p_index], p_index, GpuProfiler::ZONE_RENDER_PASS);
+	gpuProfiler.cmdEndStatistics(drawCommandBuffers[p_index], p_index);
+
+	ERR_FAIL_COND(VK_SUCCESS != vkEndCommandBuffer(drawCommandBuffers[p_index]));
+}
+
+const Texture::FrameImages *VulkanServer::getFrameImages(const MeshHandle *p_meshHandle, uint32_t p_frame) {
+	const Texture *texture = p_meshHandle->colorTexture;
+	if (!texture || !texture->doubleBuffered || p_frame >= texture->frameImages.frameViews.size())
+		return nullptr;
+
+	const Texture::FrameImages &frameImages = texture->frameImages;
+	if (frameImages.frameTableIndices.size() && TextureTable::INVALID_INDEX == frameImages.frameTableIndices[p_frame])
+		return nullptr;
+	if (frameImages.frameSets.size() && VK_NULL_HANDLE == frameImages.frameSets[p_frame])
+		return nullptr;
+
+	return &frameImages;
+}
+
+void VulkanServer::recordMainPass(VkCommandBuffer p_command, uint32_t p_slot, void *p_userData) {
+	VulkanServer *vs = static_cast<VulkanServer *>(p_userData);
+
+	// Bind graphics pipeline
+	vkCmdBindPipeline(p_command, VK_PIPELINE_BIND_POINT_GRAPHICS, vs->graphicsPipeline);
+
+	VkViewport viewport = {};
+	viewport.x = .0;
+	viewport.y = .0;
+	viewport.width = (float)vs->swapchainExtent.width;
+	viewport.height = (float)vs->swapchainExtent.height;
+	viewport.minDepth = .0;
+	viewport.maxDepth = 1.;
+	vkCmdSetViewport(p_command, 0, 1, &viewport);
+
+	VkRect2D scissor = {};
+	scissor.offset = { 0, 0 };
+	scissor.extent = vs->swapchainExtent;
+	vkCmdSetScissor(p_command, 0, 1, &scissor);
+
+	vs->gpuProfiler.cmdBeginZone(p_command, p_slot, GpuProfiler::ZONE_DRAW);
+
+	if (vs->meshes.size() > 0 && vs->isTextureTableEnabled()) {
+		// The camera and the texture table are bound once
+		VkDescriptorSet tableSet = vs->textureTable.getSet();
+		vkCmdBindDescriptorSets(p_command, VK_PIPELINE_BIND_POINT_GRAPHICS, vs->pipelineLayout, 0, 1, &vs->cameraDescriptorSet, 0, nullptr);
+		vkCmdBindDescriptorSets(p_command, VK_PIPELINE_BIND_POINT_GRAPHICS, vs->pipelineLayout, 2, 1, &tableSet, 0, nullptr);
+
+		for (int m = 0, s = vs->meshes.size(); m < s; ++m) {
+			MeshHandle *mh = vs->meshes[m];
+			const Texture::FrameImages *frameImages = getFrameImages(mh, p_slot);
+			uint32_t dynamicOffset = mh->meshUniformBufferOffset * vs->meshDynamicUniformBufferOffset;
+
+			vkCmdBindDescriptorSets(p_command, VK_PIPELINE_BIND_POINT_GRAPHICS, vs->pipelineLayout, 1, 1, &vs->meshesDescriptorSet, 1, &dynamicOffset);
+			vkCmdPushConstants(p_command, vs->pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), frameImages ? &frameImages->frameTableIndices[p_slot] : &mh->textureIndex);
+			vkCmdBindVertexBuffers(p_command, 0, 1, &mh->geometry->vertexBuffer, &mh->geometry->verticesBufferOffset);
+			vkCmdBindIndexBuffer(p_command, mh->geometry->indexBuffer, mh->geometry->indicesBufferOffset, VK_INDEX_TYPE_UINT32);
+			vkCmdDrawIndexed(p_command, mh->geometry->indexCount, 1, 0, 0, 0);
+		}
+	} else if (vs->meshes.size() > 0) {
+		// 0 camera, 1 mesh, 2 mesh images
+		VkDescriptorSet descriptorSets[] = { vs->cameraDescriptorSet, VK_NULL_HANDLE, VK_NULL_HANDLE };
+		// Bind buffers
+		for (int m = 0, s = vs->meshes.size(); m < s; ++m) {
+			MeshHandle *mh = vs->meshes[m];
+			const Texture::FrameImages *frameImages = getFrameImages(mh, p_slot);
+			descriptorSets[1] = vs->meshesDescriptorSet; // TODOD set here the right descriptor set
+			descriptorSets[2] = frameImages ? frameImages->frameSets[p_slot] : mh->imageDescriptorSet;
+			uint32_t dynamicOffset = mh->meshUniformBufferOffset * vs->meshDynamicUniformBufferOffset;
+
+			vkCmdBindDescriptorSets(p_command, VK_PIPELINE_BIND_POINT_GRAPHICS, vs->pipelineLayout, 0, 3, descriptorSets, 1, &dynamicOffset);
+			vkCmdBindVertexBuffers(p_command, 0, 1, &mh->geometry->vertexBuffer, &mh->geometry->verticesBufferOffset);
+			vkCmdBindIndexBuffer(p_command, mh->geometry->indexBuffer, mh->geometry->indicesBufferOffset, VK_INDEX_TYPE_UINT32);
+			vkCmdDrawIndexed(p_command, mh->geometry->indexCount, 1, 0, 0, 0);
+		}
 	}
-	print_verbose("Command buffers initializated");
+
+	vs->gpuProfiler.cmdEndZone(p_command, p_slot, GpuProfiler::ZONE_DRAW);
 }
 
 bool VulkanServer::createSyncObjects() {
@@ -1911,39 +2859,7 @@ bool VulkanServer::createSyncObjects() {
 	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	renderFinishedSemaphores.resize(swapchainImages.size());
-	drawFinishFences.resize(swapchainImages.size());
-
-	bool success = true;
-	for (int i = swapchainImages.size() - 1; 0 <= i; --i) {
-		// Create semaphores
-
-		res = vkCreateSemaphore(
-				device,
-				&semaphoreCreateInfo,
-				nullptr,
-				&renderFinishedSemaphores[i]);
-
-		if (res != VK_SUCCESS) {
-			print_error("Semaphore creation failed");
-			success = false;
-			renderFinishedSemaphores[i] = VK_NULL_HANDLE;
-		}
-
-		res = vkCreateFence(
-				device,
-				&fenceCreateInfo,
-				nullptr,
-				&drawFinishFences[i]);
-
-		if (res != VK_SUCCESS) {
-			print_error("Draw fences creation failed");
-			success = false;
-			drawFinishFences[i] = VK_NULL_HANDLE;
-		}
-	}
-
-	if (!success) {
+	if (!createFrameSyncObjects()) {
 		return false;
 	}
 
@@ -1967,10 +2883,63 @@ bool VulkanServer::createSyncObjects() {
 	return true;
 }
 
-void VulkanServer::destroySyncObjects() {
+bool VulkanServer::createFrameSyncObjects() {
+
+	VkResult res;
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	VkFenceCreateInfo fenceCreateInfo = {};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
+	// The new entries are null, the existing are kept
+	renderFinishedSemaphores.resize(swapchainImages.size(), VK_NULL_HANDLE);
+	drawFinishFences.resize(swapchainImages.size(), VK_NULL_HANDLE);
+
+	bool success = true;
 	for (int i = swapchainImages.size() - 1; 0 <= i; --i) {
 
+		// Create semaphores
+
+		if (renderFinishedSemaphores[i] == VK_NULL_HANDLE) {
+			res = vkCreateSemaphore(
+					device,
+					&semaphoreCreateInfo,
+					nullptr,
+					&renderFinishedSemaphores[i]);
+
+			if (res != VK_SUCCESS) {
+				print_error("Semaphore creation failed");
+				success = false;
+				renderFinishedSemaphores[i] = VK_NULL_HANDLE;
+			}
+		}
+
+		if (drawFinishFences[i] != VK_NULL_HANDLE)
+			continue;
+
+		res = vkCreateFence(
+				device,
+				&fenceCreateInfo,
+				nullptr,
+				&drawFinishFences[i]);
+
+		if (res != VK_SUCCESS) {
+			print_error("Draw fences creation failed");
+			success = false;
+			drawFinishFences[i] = VK_NULL_HANDLE;
+		}
+	}
+
+	return success;
+}
+
+void VulkanServer::destroyFrameSyncObjects(size_t p_from) {
+
+	for (int i = drawFinishFences.size() - 1; (int)p_from <= i; --i) {
+
 		if (renderFinishedSemaphores[i] != VK_NULL_HANDLE)
 			vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
 
@@ -1978,8 +2947,13 @@ void VulkanServer::destroySyncObjects() {
 			vkDestroyFence(device, drawFinishFences[i], nullptr);
 	}
 
-	renderFinishedSemaphores.clear();
-	drawFinishFences.clear();
+	renderFinishedSemaphores.resize(MIN(p_from, renderFinishedSemaphores.size()));
+	drawFinishFences.resize(MIN(p_from, drawFinishFences.size()));
+}
+
+void VulkanServer::destroySyncObjects() {
+
+	destroyFrameSyncObjects(0);
 
 	if (imageAvailableSemaphore != VK_NULL_HANDLE) {
 		vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
@@ -1999,12 +2973,18 @@ void VulkanServer::reloadCamera() {
 }
 
 void VulkanServer::removeAllMeshes() {
-	meshesCopyPending.clear();
 
-	for (int m = meshes.size() - 1; 0 <= m; --m) {
-		removeMesh(meshes[m]);
+	// The pending meshes own their geometry buffers too
+	std::vector<MeshHandle *> *lists[] = { &meshes, &meshesCopyInProgress, &meshesCopyPending };
+	for (int l = 0; l < 3; ++l) {
+		std::vector<MeshHandle *> &list = *lists[l];
+		while (list.size()) {
+			removeMesh(list.back());
+		}
 	}
-	meshes.clear();
+
+	if (geometryHandles.size())
+		WARN_PRINTS(itos(geometryHandles.size()) + " geometries still in use");
 	print_verbose("All meshes removed from scene");
 }
 
@@ -2144,16 +3124,189 @@ int VulkanServer::autoSelectPhysicalDevice(
 }
 
 void VulkanServer::recreateSwapchain() {
-	waitIdle();
+	PROFILE_ZONE("VulkanServer::recreateSwapchain");
+
+	// Cleared only when all is rebuilt, so a failure is retried by the next
+	// draw
+	swapchainOutOfDate = true;
+
+	SwapChainSupportDetails chainDetails = querySwapChainSupport(physicalDevice);
+	VkExtent2D extent = chooseExtent(chainDetails.capabilities);
+	if (0 == extent.width || 0 == extent.height) {
+		// The window is minimized, retry when it has a size
+		return;
+	}
+
+	// The old swapchain is retired with the objects used by the frames in
+	// flight, they are destroyed when these frames and the presentation of
+	// the old images are finished, so there is no wait
+	RetiredSwapchain retired;
+	retired.swapchain = swapchain;
+	retired.frame = submittedFrames;
+	renderGraph.takeRealized(retired.realized);
+	retired.imageViews.swap(swapchainImageViews);
+	retired.renderFinishedSemaphores = renderFinishedSemaphores;
+	std::fill(renderFinishedSemaphores.begin(), renderFinishedSemaphores.end(), (VkSemaphore)VK_NULL_HANDLE);
+	retiredSwapchains.push_back(retired);
+	swapchain = VK_NULL_HANDLE;
+
+	const VkFormat oldFormat = swapchainImageFormat;
+	const size_t oldImageCount = swapchainImages.size();
+
+	ERR_FAIL_COND(!createRawSwapchain(retired.swapchain));
+
+	lockupSwapchainImages();
+
+	if (oldImageCount != swapchainImages.size() || oldFormat != swapchainImageFormat) {
+		// The command buffers, or the render pass they use, are replaced so
+		// this is the only case that waits the frames in flight
+		vkWaitForFences(device, drawFinishFences.size(), drawFinishFences.data(), VK_TRUE, LONGTIMEOUT_NANOSEC);
+		queuedFrames.clear();
+	}
+
+	if (oldImageCount != swapchainImages.size()) {
+		// The draw command buffers and the sync objects are per image
+		destroyFrameSyncObjects(swapchainImages.size());
+		ERR_FAIL_COND(!allocateDrawCommandBuffers());
+	}
+
+	// The retired semaphores are replaced
+	ERR_FAIL_COND(!createFrameSyncObjects());
+
+	if (oldFormat != swapchainImageFormat) {
+		// The render pass, and so the pipeline, depends on the format
+		destroyGraphicsPipelines();
+		destroyRenderPass();
+		ERR_FAIL_COND(!createRenderPass());
+		ERR_FAIL_COND(!createGraphicsPipelines());
+	}
+
+	ERR_FAIL_COND(!createSwapchainImageViews());
+	ERR_FAIL_COND(!createFramebuffers());
 
-	// Recreate swapchain
-	destroySwapchain();
-	createSwapchain();
 	reloadCamera();
+
+	// Each command buffer is recorded when its frame is finished
+	staleDrawCommandBuffers.assign(drawCommandBuffers.size(), true);
+
+	// The profiler has a slot for each swapchain image
+	if (gpuProfiler.isEnabled() && gpuProfiler.getSlotCount() != swapchainImages.size() + 1)
+		setGpuProfiling(true, gpuProfiler.hasPipelineStatistics());
+
+	swapchainOutOfDate = false;
+}
+
+void VulkanServer::setLatencyPolicy(const LatencyPolicy &p_policy) {
+	ERR_FAIL_COND(p_policy.maxQueuedFrames < 1);
+	ERR_FAIL_COND(p_policy.frameLimit < 0);
+
+	const bool recreate = latencyPolicy.presentPolicy != p_policy.presentPolicy;
+	latencyPolicy = p_policy;
+
+	if (recreate && swapchain != VK_NULL_HANDLE)
+		recreateSwapchain();
+}
+
+void VulkanServer::setInputSampler(InputSampler p_sampler, void *p_userData) {
+	inputSampler = p_sampler;
+	inputSamplerUserData = p_userData;
+}
+
+void VulkanServer::setGpuProfiling(bool p_enabled, bool p_pipelineStatistics) {
+
+	// The queries are recorded inside the draw command buffers
+	waitIdle();
+	gpuProfiler.destroy();
+
+	if (p_enabled) {
+		if (p_pipelineStatistics && !pipelineStatisticsSupported) {
+			WARN_PRINTS("Pipeline statistics queries not supported by this device");
+			p_pipelineStatistics = false;
+		}
+
+		QueueFamilyIndices queueIndices = findQueueFamilies(physicalDevice);
+		if (!gpuProfiler.create(physicalDevice, device, queueIndices.graphicsFamilyIndex, swapchainImages.size() + 1, p_pipelineStatistics)) {
+			gpuProfiler.destroy();
+			print_error("GPU profiler creation failed");
+		}
+	}
+
 	reloadDrawCommandBuffer = true;
 }
 
-bool VulkanServer::createBuffer(VmaAllocator p_allocator, VkDeviceSize p_size,
+VulkanServer::LatencyStats VulkanServer::getLatencyStats() {
+	std::lock_guard<std::mutex> lock(latencyStatsMutex);
+	return latencyStats;
+}
+
+void VulkanServer::limitFrameRate() {
+
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	if (latencyPolicy.frameLimit <= 0) {
+		lastFrameTime = now;
+		return;
+	}
+
+	const std::chrono::steady_clock::duration frameDuration =
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::duration<double>(1.0 / latencyPolicy.frameLimit));
+
+	std::chrono::steady_clock::time_point target = lastFrameTime + frameDuration;
+	if (target <= now) {
+		// Late, don't try to recover the lost time
+		lastFrameTime = now;
+		return;
+	}
+
+	// The OS sleep is not precise, so sleep until 1ms before the target and
+	// spin the remaining time
+	const std::chrono::steady_clock::time_point sleepTarget = target - std::chrono::milliseconds(1);
+	if (sleepTarget > now)
+		std::this_thread::sleep_until(sleepTarget);
+
+	while (std::chrono::steady_clock::now() < target) {
+		std::this_thread::yield();
+	}
+
+	lastFrameTime = target;
+}
+
+void VulkanServer::retireFinishedFrames() {
+	while (!queuedFrames.empty()) {
+		if (VK_SUCCESS != vkGetFenceStatus(device, drawFinishFences[queuedFrames.front()]))
+			break;
+		queuedFrames.pop_front();
+	}
+}
+
+void VulkanServer::waitQueuedFrames(uint32_t p_maxQueuedFrames) {
+	retireFinishedFrames();
+
+	// Wait the oldest frames until there is room for another one
+	while (queuedFrames.size() >= p_maxQueuedFrames) {
+		vkWaitForFences(device, 1, &drawFinishFences[queuedFrames.front()], VK_TRUE, LONGTIMEOUT_NANOSEC);
+		queuedFrames.pop_front();
+	}
+}
+
+void VulkanServer::sampleQueuedFrames(float p_limiterSleepMs) {
+	retireFinishedFrames();
+
+	std::lock_guard<std::mutex> lock(latencyStatsMutex);
+
+	const uint32_t depth = queuedFrames.size();
+	++latencyStats.frames;
+	latencyStats.queuedFrames = depth;
+	latencyStats.peakQueuedFrames = MAX(latencyStats.peakQueuedFrames, depth);
+	// Incremental mean
+	latencyStats.averageQueuedFrames += (depth - latencyStats.averageQueuedFrames) / latencyStats.frames;
+	latencyStats.limiterSleepMs = p_limiterSleepMs;
+}
+
+bool VulkanServer::createBuffer(VmaAllocator p_allocator,
+		MemoryTracker::Category p_category,
+		VkDeviceSize p_size,
 		VkBufferUsageFlags p_usage,
 		VkSharingMode p_sharingMode,
 		VmaMemoryUsage p_memoryUsage,
@@ -2181,11 +3334,14 @@ bool VulkanServer::createBuffer(VmaAllocator p_allocator, VkDeviceSize p_size,
 								  &allocationInfo),
 			false);
 
+	memoryTracker.trackAllocation((uint64_t)r_allocation, p_category, allocationInfo.size, allocationInfo.memoryType);
+
 	return allocationInfo.size >= p_size;
 }
 
 void VulkanServer::destroyBuffer(VmaAllocator p_allocator, VkBuffer &r_buffer,
 		VmaAllocation &r_allocation) {
+	memoryTracker.untrackAllocation((uint64_t)r_allocation);
 	vmaDestroyBuffer(p_allocator, r_buffer, r_allocation);
 	r_buffer = VK_NULL_HANDLE;
 	r_allocation = VK_NULL_HANDLE;
@@ -2243,7 +3399,10 @@ bool VulkanServer::createImage(
 		VkFormat p_format, VkImageTiling p_tiling,
 		VkImageUsageFlags p_usage,
 		VkMemoryPropertyFlags p_memoryFlags,
-		VkImage &r_image, VkDeviceMemory &r_memory) {
+		MemoryTracker::Category p_category,
+		VkImage &r_image, VmaAllocation &r_allocation,
+		VkDeviceSize *r_size,
+		uint32_t p_mipLevels) {
 
 	VkImageCreateInfo imageCreateInfo = {};
 	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -2252,7 +3411,7 @@ bool VulkanServer::createImage(
 	imageCreateInfo.extent.width = p_width;
 	imageCreateInfo.extent.height = p_height;
 	imageCreateInfo.extent.depth = 1;
-	imageCreateInfo.mipLevels = 1;
+	imageCreateInfo.mipLevels = p_mipLevels;
 	imageCreateInfo.arrayLayers = 1;
 	imageCreateInfo.tiling = p_tiling;
 	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -2260,58 +3419,91 @@ bool VulkanServer::createImage(
 	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	ERR_FAIL_COND_V(
-			VK_SUCCESS != vkCreateImage(device, &imageCreateInfo, nullptr, &r_image),
-			false);
+	VmaAllocationCreateInfo allocationCreateInfo = {};
+	allocationCreateInfo.requiredFlags = p_memoryFlags;
 
-	VkMemoryRequirements memoryRequirements;
-	vkGetImageMemoryRequirements(device, r_image, &memoryRequirements);
+	// The lazily allocated memory is never sub allocated, otherwise the pool
+	// is chosen using an estimated size: the formats not known by KTX2 are
+	// 32 bits, and the mip chain adds one third
+	if (p_memoryFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) {
+		allocationCreateInfo.pool = VK_NULL_HANDLE;
+	} else {
+		VkDeviceSize estimatedSize = KTX2::getBlockSize(p_format) ? KTX2::getLevelSize(p_format, p_width, p_height, 0) : VkDeviceSize(p_width) * p_height * 4;
+		if (p_mipLevels > 1)
+			estimatedSize += estimatedSize / 3;
+		allocationCreateInfo.pool = chooseImagePool(p_category, estimatedSize);
+	}
 
-	VkMemoryAllocateInfo memoryAllocInfo = {};
-	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryAllocInfo.allocationSize = memoryRequirements.size;
-	memoryAllocInfo.memoryTypeIndex =
-			chooseMemoryType(memoryRequirements.memoryTypeBits, p_memoryFlags);
+	if (VK_NULL_HANDLE == allocationCreateInfo.pool)
+		allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
 
-	ERR_FAIL_COND_V(
-			VK_SUCCESS != vkAllocateMemory(
-								  device,
-								  &memoryAllocInfo,
-								  nullptr,
-								  &r_memory),
-			false);
+	VmaAllocationInfo allocationInfo = {};
+	VkResult res = vmaCreateImage(
+			bufferMemoryDeviceAllocator,
+			&imageCreateInfo,
+			&allocationCreateInfo,
+			&r_image,
+			&r_allocation,
+			&allocationInfo);
+
+	if (VK_SUCCESS != res && VK_NULL_HANDLE != allocationCreateInfo.pool) {
+		// The pool memory type is not compatible with this image
+		allocationCreateInfo.pool = VK_NULL_HANDLE;
+		allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+		res = vmaCreateImage(
+				bufferMemoryDeviceAllocator,
+				&imageCreateInfo,
+				&allocationCreateInfo,
+				&r_image,
+				&r_allocation,
+				&allocationInfo);
+	}
+
+	if (VK_SUCCESS != res) {
+		r_image = VK_NULL_HANDLE;
+		r_allocation = VK_NULL_HANDLE;
+		if (p_memoryFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) {
+			// Not fatal, the caller fallback to device local memory
+			print_verbose("Lazily allocated image creation failed");
+		} else {
+			print_error("Image creation failed, error: " + itos(res));
+		}
+		return false;
+	}
+
+	memoryTracker.trackAllocation((uint64_t)r_allocation, p_category, allocationInfo.size, allocationInfo.memoryType);
 
-	vkBindImageMemory(device, r_image, r_memory, /*Offset*/ 0);
+	if (r_size)
+		*r_size = allocationInfo.size;
 	return true;
 }
 
-void VulkanServer::destroyImage(VkImage &p_image, VkDeviceMemory &p_memory) {
+void VulkanServer::destroyImage(VkImage &r_image, VmaAllocation &r_allocation) {
 	if (VK_NULL_HANDLE == device)
 		return;
-	vkDestroyImage(device, p_image, nullptr);
-	vkFreeMemory(device, p_memory, nullptr);
-	p_image = VK_NULL_HANDLE;
-	p_memory = VK_NULL_HANDLE;
+	memoryTracker.untrackAllocation((uint64_t)r_allocation);
+	vmaDestroyImage(bufferMemoryDeviceAllocator, r_image, r_allocation);
+	r_image = VK_NULL_HANDLE;
+	r_allocation = VK_NULL_HANDLE;
 }
 
 bool VulkanServer::createImageView(
 		VkImage p_image,
 		VkFormat p_format,
 		VkImageAspectFlags p_aspectFlags,
-		VkImageView &r_imageView) {
+		VkImageView &r_imageView,
+		uint32_t p_mipLevels,
+		VkComponentMapping p_swizzle) {
 
 	VkImageViewCreateInfo viewCreateInfo = {};
 	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 	viewCreateInfo.image = p_image;
 	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 	viewCreateInfo.format = p_format;
-	viewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-	viewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-	viewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-	viewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components = p_swizzle;
 	viewCreateInfo.subresourceRange.aspectMask = p_aspectFlags;
 	viewCreateInfo.subresourceRange.baseMipLevel = 0;
-	viewCreateInfo.subresourceRange.levelCount = 1;
+	viewCreateInfo.subresourceRange.levelCount = p_mipLevels;
 	viewCreateInfo.subresourceRange.baseArrayLayer = 0;
 	viewCreateInfo.subresourceRange.layerCount = 1;
 
@@ -2334,9 +3526,13 @@ void VulkanServer::destroyImageView(VkImageView &r_imageView) {
 }
 
 bool VulkanServer::allocateCommand(VkCommandBuffer &r_command) {
+	VkCommandPool pool = getOneTimeCommandPool();
+	if (VK_NULL_HANDLE == pool)
+		return false;
+
 	VkCommandBufferAllocateInfo allocateInfo = {};
 	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocateInfo.commandPool = graphicsCommandPool;
+	allocateInfo.commandPool = pool;
 	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 	allocateInfo.commandBufferCount = 1;
 
@@ -2375,6 +3571,7 @@ bool VulkanServer::submitCommand(VkCommandBuffer p_command, VkFence p_fence) {
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &p_command;
 
+	std::lock_guard<std::mutex> lock(queueMutex);
 	if (VK_SUCCESS != vkQueueSubmit(graphicsQueue, 1, &submitInfo, p_fence)) {
 		return false;
 	}
@@ -2419,133 +3616,283 @@ bool VulkanServer::submitWaitCommand(VkCommandBuffer p_command) {
 void VulkanServer::freeCommand(VkCommandBuffer &r_command) {
 	if (VK_NULL_HANDLE == device)
 		return;
-	vkFreeCommandBuffers(device, graphicsCommandPool, 1, &r_command);
+	// Must be called by the same thread that allocated the command
+	vkFreeCommandBuffers(device, getOneTimeCommandPool(), 1, &r_command);
 	r_command = VK_NULL_HANDLE;
 }
 
-bool VulkanServer::transitionImageLayout(VkImage p_image, VkFormat p_format,
-		VkImageLayout p_oldLayout,
-		VkImageLayout p_newLayout) {
+OldVisualServer::OldVisualServer() :
+		defaultTexture(nullptr),
+		vulkanServer(this),
+		threaded(false),
+		commandQueue(nullptr),
+		renderThreadWaiting(false),
+		framesPushed(0),
+		framesDrawn(0),
+		syncsPushed(0),
+		syncsProcessed(0) {}
 
-	VkImageMemoryBarrier barrier = {};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = p_oldLayout;
-	barrier.newLayout = p_newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = p_image;
+OldVisualServer::~OldVisualServer() {}
 
-	if (p_newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-		barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_DEPTH_BIT;
+bool OldVisualServer::init(bool p_threaded) {
 
-		if (hasStencilComponent(p_format)) {
-			barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
-		}
-	} else {
-		barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_COLOR_BIT;
-	}
+	ERR_FAIL_COND_V(!vulkanServer.create(), false);
 
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
+	textureCache.create(&vulkanServer);
 
-	VkPipelineStageFlags srcStage;
-	VkPipelineStageFlags dstStage;
+	defaultTexture = textureCache.acquire("/home/andrea/Workspace/git/HelloVulkan/assets/default.png");
+	ERR_FAIL_COND_V(!defaultTexture, false);
+	vulkanServer.setDefaultTexture(defaultTexture);
 
-	if (p_oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-			p_newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+	threaded = p_threaded;
+	if (threaded) {
+		commandQueue = new CommandQueue<RenderCommand, RENDER_COMMAND_QUEUE_SIZE>;
+		renderThread = std::thread(&OldVisualServer::renderThreadLoop, this);
+		print_verbose("Render thread started");
+	}
 
-		barrier.srcAccessMask = 0; // Because from undefined
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	return true;
+}
 
-		srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+void OldVisualServer::terminate() {
 
-	} else if (p_oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-			   p_newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+	if (threaded) {
+		RenderCommand command;
+		command.type = RenderCommand::TYPE_EXIT;
+		pushCommand(command);
 
-		barrier.srcAccessMask = 0; // Because from undefined
-		barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
-								VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		renderThread.join();
+		delete commandQueue;
+		commandQueue = nullptr;
+		threaded = false;
+		print_verbose("Render thread terminated");
+	}
 
-		srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		dstStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	textureCache.release(defaultTexture);
+	defaultTexture = nullptr;
+	textureCache.destroy();
+	vulkanServer.destroy();
+}
 
-	} else if (p_oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-			   p_newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+bool OldVisualServer::can_step() {
+	//return WindowServer::get_singleton()->is_drawable(window);
+	return true;
+}
 
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+void OldVisualServer::step() {
+	PROFILE_ZONE("OldVisualServer::step");
 
-		srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	WindowServer::get_singleton()->fetch_events();
 
-	} else {
-		ERR_EXPLAIN("[ERROR] layout transfer not supported ");
-		ERR_FAIL_V(false);
+	if (!threaded) {
+		vulkanServer.draw();
+		return;
 	}
 
-	VkCommandBuffer command;
-	ERR_FAIL_COND_V(!allocateCommand(command), false);
+	RenderCommand command;
+	command.type = RenderCommand::TYPE_DRAW;
+	pushCommand(command);
+	++framesPushed;
 
-	beginOneTimeCommand(command);
+	// The game thread can't be more than one frame ahead
+	std::unique_lock<std::mutex> lock(gameThreadMutex);
+	gameThreadCondition.wait(lock, [this] {
+		return framesDrawn.load() + 1 >= framesPushed;
+	});
+}
 
-	vkCmdPipelineBarrier(command, srcStage, dstStage, 0, 0, nullptr, 0, nullptr,
-			1, &barrier);
+void OldVisualServer::addMesh(Mesh *p_mesh) {
+	ERR_FAIL_COND(p_mesh->visualServer);
 
-	bool success = true;
-	if (endCommand(command)) {
-		if (!submitWaitCommand(command)) {
-			print_error("command submit failed, Image transition layout failed");
-			success = false;
-		}
-	} else {
-		print_error("command ending failed, Image transition layout failed");
-		success = false;
-	}
-	freeCommand(command);
-	return success;
+	p_mesh->visualServer = this;
+	++p_mesh->geometry->sceneMeshCount;
+
+	RenderCommand command;
+	command.type = RenderCommand::TYPE_ADD_MESH;
+	command.mesh = p_mesh;
+	command.texture = p_mesh->colorTexture;
+	command.transform = p_mesh->transformation;
+	pushCommand(command);
 }
 
-OldVisualServer::OldVisualServer() :
-		defaultTexture(nullptr),
-		vulkanServer(this) {}
+void OldVisualServer::removeMesh(Mesh *p_mesh) {
+	if (p_mesh->visualServer != this)
+		return;
 
-OldVisualServer::~OldVisualServer() {}
+	p_mesh->visualServer = nullptr;
+	--p_mesh->geometry->sceneMeshCount;
 
-bool OldVisualServer::init() {
+	RenderCommand command;
+	command.type = RenderCommand::TYPE_REMOVE_MESH;
+	command.mesh = p_mesh;
+	pushCommand(command);
 
-	ERR_FAIL_COND_V(!vulkanServer.create(), false);
+	// The caller is free to delete the mesh once this function returns
+	sync();
+}
 
-	defaultTexture = new Texture(&vulkanServer);
-	ERR_FAIL_COND_V(
-			!defaultTexture->load(
-					"/home/andrea/Workspace/git/HelloVulkan/assets/default.png"),
-			false);
+void OldVisualServer::meshSetTransform(Mesh *p_mesh, const glm::mat4 &p_transformation) {
+	RenderCommand command;
+	command.type = RenderCommand::TYPE_MESH_SET_TRANSFORM;
+	command.mesh = p_mesh;
+	command.transform = p_transformation;
+	pushCommand(command);
+}
 
-	return true;
+void OldVisualServer::meshSetColorTexture(Mesh *p_mesh, Texture *p_colorTexture) {
+	RenderCommand command;
+	command.type = RenderCommand::TYPE_MESH_SET_COLOR_TEXTURE;
+	command.mesh = p_mesh;
+	command.texture = p_colorTexture;
+	pushCommand(command);
 }
 
-void OldVisualServer::terminate() {
-	delete defaultTexture;
-	vulkanServer.destroy();
+void OldVisualServer::cameraSetTransform(const glm::mat4 &p_transform) {
+	RenderCommand command;
+	command.type = RenderCommand::TYPE_CAMERA_SET_TRANSFORM;
+	command.transform = p_transform;
+	pushCommand(command);
 }
 
-bool OldVisualServer::can_step() {
-	//return WindowServer::get_singleton()->is_drawable(window);
-	return true;
+void OldVisualServer::cameraSetNearFar(float p_near, float p_far) {
+	RenderCommand command;
+	command.type = RenderCommand::TYPE_CAMERA_SET_NEAR_FAR;
+	command.params[0] = p_near;
+	command.params[1] = p_far;
+	pushCommand(command);
 }
 
-void OldVisualServer::step() {
-	WindowServer::get_singleton()->fetch_events();
-	vulkanServer.draw();
+void OldVisualServer::cameraSetFOV_deg(float p_FOV_deg) {
+	RenderCommand command;
+	command.type = RenderCommand::TYPE_CAMERA_SET_FOV;
+	command.params[0] = p_FOV_deg;
+	pushCommand(command);
 }
 
-void OldVisualServer::addMesh(Mesh *p_mesh) {
-	vulkanServer.addMesh(p_mesh);
+void OldVisualServer::setLatencyPolicy(const VulkanServer::LatencyPolicy &p_policy) {
+	RenderCommand command;
+	command.type = RenderCommand::TYPE_SET_LATENCY_POLICY;
+	command.latencyPolicy = p_policy;
+	pushCommand(command);
 }
 
-void OldVisualServer::removeMesh(Mesh *p_mesh) {
-	vulkanServer.removeMesh(p_mesh);
+void OldVisualServer::setInputSampler(VulkanServer::InputSampler p_sampler, void *p_userData) {
+	// The render thread reads the sampler during the draw
+	sync();
+	vulkanServer.setInputSampler(p_sampler, p_userData);
+}
+
+void OldVisualServer::pushCommand(const RenderCommand &p_command) {
+
+	if (!threaded) {
+		executeCommand(p_command);
+		return;
+	}
+
+	commandQueue->push(p_command);
+
+	// The queue store and this load are sequentially consistent, so if the
+	// render thread is not seen as waiting it will see the new command
+	if (renderThreadWaiting.load()) {
+		std::lock_guard<std::mutex> lock(renderThreadMutex);
+		renderThreadCondition.notify_one();
+	}
+}
+
+void OldVisualServer::executeCommand(const RenderCommand &p_command) {
+
+	switch (p_command.type) {
+		case RenderCommand::TYPE_ADD_MESH:
+			vulkanServer.addMesh(p_command.mesh);
+			vulkanServer.setMeshTransform(p_command.mesh, p_command.transform);
+			if (p_command.texture)
+				vulkanServer.setMeshColorTexture(p_command.mesh, p_command.texture);
+			break;
+		case RenderCommand::TYPE_REMOVE_MESH:
+			vulkanServer.removeMesh(p_command.mesh);
+			break;
+		case RenderCommand::TYPE_MESH_SET_TRANSFORM:
+			vulkanServer.setMeshTransform(p_command.mesh, p_command.transform);
+			break;
+		case RenderCommand::TYPE_MESH_SET_COLOR_TEXTURE:
+			vulkanServer.setMeshColorTexture(p_command.mesh, p_command.texture);
+			break;
+		case RenderCommand::TYPE_CAMERA_SET_TRANSFORM:
+			vulkanServer.getCamera().setTransform(p_command.transform);
+			break;
+		case RenderCommand::TYPE_CAMERA_SET_NEAR_FAR:
+			vulkanServer.getCamera().setNearFar(p_command.params[0], p_command.params[1]);
+			break;
+		case RenderCommand::TYPE_CAMERA_SET_FOV:
+			vulkanServer.getCamera().setFOV_deg(p_command.params[0]);
+			break;
+		case RenderCommand::TYPE_SET_LATENCY_POLICY:
+			vulkanServer.setLatencyPolicy(p_command.latencyPolicy);
+			break;
+		case RenderCommand::TYPE_SYNC:
+		case RenderCommand::TYPE_DRAW:
+		case RenderCommand::TYPE_EXIT:
+			// Handled by the render thread loop
+			break;
+	}
+}
+
+void OldVisualServer::sync() {
+	if (!threaded)
+		return;
+
+	RenderCommand command;
+	command.type = RenderCommand::TYPE_SYNC;
+	pushCommand(command);
+	++syncsPushed;
+
+	std::unique_lock<std::mutex> lock(gameThreadMutex);
+	gameThreadCondition.wait(lock, [this] {
+		return syncsProcessed.load() >= syncsPushed;
+	});
+}
+
+void OldVisualServer::renderThreadLoop() {
+
+	Profiler::set_thread_name("Render thread");
+
+	RenderCommand command;
+	while (true) {
+
+		if (!commandQueue->try_pop(command)) {
+			// Sleep until the game thread push something
+			std::unique_lock<std::mutex> lock(renderThreadMutex);
+			renderThreadWaiting.store(true);
+			renderThreadCondition.wait(lock, [this] {
+				return !commandQueue->is_empty();
+			});
+			renderThreadWaiting.store(false);
+			continue;
+		}
+
+		switch (command.type) {
+			case RenderCommand::TYPE_DRAW:
+				vulkanServer.draw();
+				{
+					std::lock_guard<std::mutex> lock(gameThreadMutex);
+					++framesDrawn;
+				}
+				gameThreadCondition.notify_one();
+				break;
+			case RenderCommand::TYPE_SYNC:
+				{
+					std::lock_guard<std::mutex> lock(gameThreadMutex);
+					++syncsProcessed;
+				}
+				gameThreadCondition.notify_one();
+				break;
+			case RenderCommand::TYPE_EXIT:
+				// Make sure that the GPU has finished before give back the
+				// ownership of the VulkanServer to the main thread
+				vulkanServer.waitIdle();
+				return;
+			default:
+				executeCommand(command);
+		}
+	}
 }
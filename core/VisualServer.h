@@ -1,11 +1,30 @@
 #pragma once
 
+#include "core/command_queue.h"
+#include "core/descriptor_allocator.h"
+#include "core/gpu_profiler.h"
+#include "core/image_decoder.h"
+#include "core/memory_tracker.h"
+#include "core/render_graph.h"
+#include "core/sampler_cache.h"
+#include "core/texture_cache.h"
+#include "core/texture_streamer.h"
+#include "core/texture_table.h"
+#include "core/thread_pool.h"
+#include "core/transfer_batcher.h"
 #include "core/rid.h"
 #include "hellovulkan.h"
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
 
 class OldVisualServer;
 class Mesh;
+class Geometry;
+class GeometryHandle;
 struct MeshHandle;
 class Texture;
 
@@ -129,6 +148,8 @@ class VulkanServer {
 public:
 	friend class Texture;
 	friend class MeshHandle;
+	friend class GeometryHandle;
+	friend class TransferBatcher;
 
 	static const glm::mat4 COORDSYSTEMROTATOR;
 
@@ -154,6 +175,112 @@ public:
 		std::vector<VkPresentModeKHR> presentModes;
 	};
 
+	// LATENCY POLICY
+	//		The time between the input sampling and the image presentation
+	// depends on how many frames are queued in front of the presentation
+	// engine.
+	//		FIFO is the vsync mode guaranteed by the driver, the acquire call
+	// blocks only when all the swapchain images are queued, so it's possible to
+	// have N frames of latency. For this reason the number of queued frames is
+	// capped by waiting the oldest in flight frame before acquire.
+	//		MAILBOX and IMMEDIATE never block, so the CPU frame limiter is used to
+	// don't render frames that will be never presented.
+	//		When justInTimeInput is enabled, the input sampler is called after
+	// the acquire (that is the point where the CPU may wait) right before the
+	// upload of the uniforms, so the drawn frame use the freshest input.
+	enum PresentPolicy {
+		PRESENT_POLICY_FIFO,
+		PRESENT_POLICY_MAILBOX,
+		PRESENT_POLICY_IMMEDIATE
+	};
+
+	struct LatencyPolicy {
+		PresentPolicy presentPolicy;
+		uint32_t maxQueuedFrames; // Used by FIFO, must be at least 1
+		float frameLimit; // Frames per second, 0 means unlimited. Not used by FIFO
+		bool justInTimeInput;
+
+		LatencyPolicy() :
+				presentPolicy(PRESENT_POLICY_MAILBOX),
+				maxQueuedFrames(2),
+				frameLimit(0),
+				justInTimeInput(false) {}
+	};
+
+	struct LatencyStats {
+		uint64_t frames;
+		uint32_t queuedFrames; // Frames submitted and not yet finished by the GPU
+		uint32_t peakQueuedFrames;
+		float averageQueuedFrames;
+		float limiterSleepMs; // Time spent in the frame limiter last frame
+		uint64_t acquireTimeouts;
+		VkPresentModeKHR presentMode;
+
+		LatencyStats() :
+				frames(0),
+				queuedFrames(0),
+				peakQueuedFrames(0),
+				averageQueuedFrames(0),
+				limiterSleepMs(0),
+				acquireTimeouts(0),
+				presentMode(VK_PRESENT_MODE_FIFO_KHR) {}
+	};
+
+	enum AttachmentLifetime {
+		ATTACHMENT_LIFETIME_PERSISTENT, // The content is kept between passes
+		ATTACHMENT_LIFETIME_TRANSIENT, // The content lives only inside the render pass
+		ATTACHMENT_LIFETIME_PRESENTATION // Owned by the swapchain
+	};
+
+	struct AttachmentMemory {
+		const char *name;
+		VkFormat format;
+		uint32_t count;
+		AttachmentLifetime lifetime;
+		bool lazilyAllocated;
+		VkDeviceSize bytes;
+		VkDeviceSize committedBytes; // Less than bytes when lazily allocated
+
+		AttachmentMemory() :
+				name(""),
+				format(VK_FORMAT_UNDEFINED),
+				count(0),
+				lifetime(ATTACHMENT_LIFETIME_PERSISTENT),
+				lazilyAllocated(false),
+				bytes(0),
+				committedBytes(0) {}
+	};
+
+	// The attachment memory of the render target (the window)
+	struct AttachmentMemoryReport {
+		VkExtent2D extent;
+		std::vector<AttachmentMemory> attachments;
+		VkDeviceSize totalBytes;
+		VkDeviceSize committedBytes;
+
+		AttachmentMemoryReport() :
+				extent({ 0, 0 }),
+				totalBytes(0),
+				committedBytes(0) {}
+	};
+
+	// TEXTURE BINDING
+	//		How the draws select their texture:
+	//		BINDLESS and ARRAY bind the texture table once per frame, and each
+	// draw push its slot index; BINDLESS requires VK_EXT_descriptor_indexing.
+	//		SETS binds a descriptor set per draw, shared by the meshes with the
+	// same texture.
+	//		AUTO selects BINDLESS when supported, otherwise ARRAY.
+	enum TextureBinding {
+		TEXTURE_BINDING_AUTO,
+		TEXTURE_BINDING_BINDLESS,
+		TEXTURE_BINDING_ARRAY,
+		TEXTURE_BINDING_SETS
+	};
+
+	// Called by the thread that draws, right before the uniform upload
+	typedef void (*InputSampler)(void *p_userData);
+
 	VulkanServer(OldVisualServer *p_visualServer);
 
 	bool enableValidationLayer();
@@ -169,15 +296,96 @@ public:
 	void removeMesh(Mesh *p_mesh);
 	void removeMesh(MeshHandle *p_meshHandle);
 
+	// The first acquire of a geometry creates its buffers, the last release
+	// destroys them (the GPU must not use them anymore)
+	GeometryHandle *acquireGeometry(Geometry *p_geometry);
+	void releaseGeometry(GeometryHandle *p_handle);
+
+	// The mesh state is copied inside its MeshHandle, so these functions
+	// must be used to update the rendered mesh
+	void setMeshTransform(Mesh *p_mesh, const glm::mat4 &p_transformation);
+	void setMeshColorTexture(Mesh *p_mesh, Texture *p_colorTexture);
+
 	Camera &getCamera() { return camera; }
 
+	uint32_t getMaxMeshCount() const { return meshUniformBufferData.size; }
+
+	// Can be changed at runtime, the swapchain is recreated only when the
+	// present mode changes
+	void setLatencyPolicy(const LatencyPolicy &p_policy);
+	const LatencyPolicy &getLatencyPolicy() const { return latencyPolicy; }
+
+	void setInputSampler(InputSampler p_sampler, void *p_userData);
+
+	// Thread safe
+	LatencyStats getLatencyStats();
+
+	// When enabled the GPU time of the passes is measured, the pipeline
+	// statistics are collected only if supported by the device
+	void setGpuProfiling(bool p_enabled, bool p_pipelineStatistics = false);
+	bool isGpuProfiling() const { return gpuProfiler.isEnabled(); }
+	GpuProfiler &getGpuProfiler() { return gpuProfiler; }
+
+	// For the objects created outside the renderer, e.g. by the benchmark
+	VkDevice getDevice() const { return device; }
+	VmaAllocator getDeviceAllocator() const { return bufferMemoryDeviceAllocator; }
+
+	// Every allocation is tracked by category, the budget callbacks are
+	// called by the thread that draws
+	MemoryTracker &getMemoryTracker() { return memoryTracker; }
+
+	// The image uploads and layout transitions are batched, and flushed by
+	// the draw before its submission
+	TransferBatcher &getTransferBatcher() { return transferBatcher; }
+	// Used by the loaders for the CPU work, e.g. the texture transcoding
+	ThreadPool &getThreadPool() { return threadPool; }
+	// Decodes the images of Texture::loadBatch on the thread pool
+	ImageDecoder &getImageDecoder() { return imageDecoder; }
+	SamplerCache &getSamplerCache() { return samplerCache; }
+
+	// Fed by the draw with the levels wanted by the meshes on the screen, its
+	// budget is clamped to the free part of the device local heap
+	TextureStreamer &getTextureStreamer() { return textureStreamer; }
+
+	// The mesh image sets are cached by texture and shared between meshes
+	DescriptorAllocator &getDescriptorAllocator() { return descriptorAllocator; }
+
+	// Must be called before create, after it returns the selected binding
+	void setTextureBinding(TextureBinding p_binding) { requestedTextureBinding = p_binding; }
+	TextureBinding getTextureBinding() const { return textureBinding; }
+	bool isTextureTableEnabled() const { return TEXTURE_BINDING_BINDLESS == textureBinding || TEXTURE_BINDING_ARRAY == textureBinding; }
+	TextureTable &getTextureTable() { return textureTable; }
+
+	// The unused slots of the texture table point to this texture
+	void setDefaultTexture(const Texture *p_texture);
+
+	AttachmentMemoryReport getAttachmentMemoryReport() const;
+	void printAttachmentMemoryReport() const;
+
+	// Usage of the image pools and count of device memory allocations
+	void printImagePoolReport();
+
 public:
 	void processCopy();
 	void updateUniformBuffers();
 
 	bool createImageLoadBuffer(VkDeviceSize p_size, VkBuffer &r_buffer, VmaAllocation &r_allocation, VmaAllocator &r_allocator);
-	bool createImageTexture(uint32_t p_width, uint32_t p_height, VkImage &r_image, VkDeviceMemory &r_memory);
-	bool createImageViewTexture(VkImage p_image, VkImageView &r_imageView);
+	bool createImageTexture(uint32_t p_width, uint32_t p_height, VkImage &r_image, VmaAllocation &r_allocation, uint32_t p_mipLevels = 1, VkFormat p_format = VK_FORMAT_R8G8B8A8_UNORM);
+	void destroyImageTexture(VkImage &r_image, VmaAllocation &r_allocation);
+	// The swizzle maps the channels of the format to the RGBA read by the
+	// shaders, the default {} is the identity
+	bool createImageViewTexture(VkImage p_image, VkImageView &r_imageView, uint32_t p_mipLevels = 1, VkFormat p_format = VK_FORMAT_R8G8B8A8_UNORM, VkComponentMapping p_swizzle = {});
+
+	// True when the format can be sampled with the linear filter, the block
+	// compressed formats depend on the device
+	bool isSampledFormatSupported(VkFormat p_format) const;
+
+	// The best format supported by the device to transcode the universal
+	// textures, RGBA8 when no block format is supported
+	VkFormat chooseTranscodeFormat(bool p_alpha);
+
+	// True when the mip chain of the format can be generated by vkCmdBlitImage
+	bool isLinearBlitSupported(VkFormat p_format) const;
 
 private:
 	RID window;
@@ -203,13 +411,17 @@ private:
 
 	std::vector<VkImageView> swapchainImageViews;
 
-	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
-	VkImageView depthImageView;
+	VkFormat depthImageFormat;
 
 	VkShaderModule vertShaderModule;
 	VkShaderModule fragShaderModule;
 
+	RenderGraph renderGraph;
+	RenderGraph::ResourceId backbufferResource;
+	RenderGraph::ResourceId depthResource;
+	RenderGraph::PassId mainPass;
+
+	// Owned by the render graph
 	VkRenderPass renderPass;
 
 	// Used to store camera informations
@@ -224,13 +436,17 @@ private:
 
 	// Used to store mesh textures
 	VkDescriptorSetLayout meshImagesDescriptorSetLayout;
-	VkDescriptorPool meshImagesDescriptorPool;
+	DescriptorAllocator descriptorAllocator;
+
+	// Used to store all the textures, when enabled
+	TextureBinding requestedTextureBinding;
+	TextureBinding textureBinding;
+	uint32_t textureTableCapacity;
+	TextureTable textureTable;
 
 	VkPipelineLayout pipelineLayout;
 	VkPipeline graphicsPipeline;
 
-	std::vector<VkFramebuffer> swapchainFramebuffers;
-
 	VmaAllocator bufferMemoryDeviceAllocator;
 
 	VmaAllocator bufferMemoryHostAllocator;
@@ -259,6 +475,9 @@ private:
 
 	std::vector<VkCommandBuffer> drawCommandBuffers; // Used to draw things
 	std::vector<VkFence> drawFinishFences;
+	// Recorded with objects that no longer exist, recorded again when the
+	// frame is acquired
+	std::vector<bool> staleDrawCommandBuffers;
 	VkCommandBuffer copyCommandBuffer; // Used to copy data to GPU
 
 	VkSemaphore imageAvailableSemaphore;
@@ -266,6 +485,93 @@ private:
 
 	VkFence copyFinishFence;
 
+	// The queues are shared between the render thread and the threads that
+	// load resources, so each access to them must be guarded
+	std::mutex queueMutex;
+
+	// The one time commands are allocated from a pool owned by the calling
+	// thread, in this way the loading threads doesn't need to synchronize the
+	// command pool with the render thread
+	std::mutex oneTimeCommandPoolsMutex;
+	std::map<std::thread::id, VkCommandPool> oneTimeCommandPools;
+
+	TransferBatcher transferBatcher;
+	ThreadPool threadPool;
+	ImageDecoder imageDecoder;
+	SamplerCache samplerCache;
+	TextureStreamer textureStreamer;
+	std::vector<TextureStreamer::Change> streamingChanges;
+
+	std::mutex dynamicTexturesMutex;
+	std::vector<Texture *> dynamicTextures;
+	// Of the unregistered textures, released by the render thread
+	std::vector<Texture::FrameImages> retiredFrameImages;
+
+	LatencyPolicy latencyPolicy;
+	VkPresentModeKHR presentMode;
+	InputSampler inputSampler;
+	void *inputSamplerUserData;
+
+	// Swapchain image indices submitted and not yet observed as finished,
+	// from the oldest to the newest
+	std::deque<uint32_t> queuedFrames;
+	std::chrono::steady_clock::time_point lastFrameTime;
+
+	std::mutex latencyStatsMutex;
+	LatencyStats latencyStats;
+
+	// A slot for each draw command buffer, plus one for the copy command
+	GpuProfiler gpuProfiler;
+	bool pipelineStatisticsSupported;
+	uint64_t submittedFrames;
+
+	struct RetiredSwapchain {
+		VkSwapchainKHR swapchain;
+		uint64_t frame; // Submitted frames when retired
+		// Used by the frames in flight
+		RenderGraph::Realized realized;
+		std::vector<VkImageView> imageViews;
+		// Waited by the queued presents, that the fences don't cover
+		std::vector<VkSemaphore> renderFinishedSemaphores;
+	};
+
+	// Swapchains replaced by a resize, with the objects that depend on them,
+	// waiting the end of the frames in flight and of the presentation
+	std::vector<RetiredSwapchain> retiredSwapchains;
+
+	struct RetiredTextureImage {
+		VkImage image;
+		VmaAllocation allocation;
+		VkImageView imageView;
+		uint64_t uploadBatch;
+		uint64_t frame; // Submitted frames when retired
+	};
+
+	// Images of the streamed textures replaced by another residency,
+	// waiting the end of the frames that sample them
+	std::vector<RetiredTextureImage> retiredTextureImages;
+
+	// Set when the swapchain can't be recreated (minimized window, or a
+	// failure), until a recreation succeeds
+	bool swapchainOutOfDate;
+
+	enum ImagePool {
+		IMAGE_POOL_SMALL_TEXTURE,
+		IMAGE_POOL_LARGE_TEXTURE,
+		IMAGE_POOL_RENDER_TARGET,
+		IMAGE_POOL_MAX
+	};
+
+	// Sub allocate the images, instead of a vkAllocateMemory per image
+	VmaPool imagePools[IMAGE_POOL_MAX];
+
+	bool physicalDeviceProperties2Supported;
+	bool memoryBudgetSupported;
+	bool descriptorIndexingSupported;
+	// The bindless table is written in place by the dynamic textures
+	bool descriptorUpdateAfterBindSupported;
+	MemoryTracker memoryTracker;
+
 private:
 	bool reloadDrawCommandBuffer;
 
@@ -275,6 +581,9 @@ private:
 	std::vector<MeshHandle *> meshesCopyInProgress;
 	std::vector<MeshHandle *> meshesCopyPending;
 
+	// Shared by the meshes with the same geometry
+	std::map<Geometry *, GeometryHandle *> geometryHandles;
+
 private:
 	bool createInstance();
 	void destroyInstance();
@@ -288,6 +597,8 @@ private:
 	bool pickPhysicalDevice();
 
 	bool createLogicalDevice();
+	// Resolve the requested texture binding with the device support
+	void selectTextureBinding(const VkPhysicalDeviceFeatures &p_supportedFeatures);
 	void destroyLogicalDevice();
 
 	void lockupDeviceQueue();
@@ -308,19 +619,44 @@ private:
 	// This method is used to create the simple swap chain object
 	// The swapchain is the array that is used to hold all information about the
 	// image to show.
-	bool createRawSwapchain();
+	bool createRawSwapchain(VkSwapchainKHR p_oldSwapchain = VK_NULL_HANDLE);
 	void destroyRawSwapchain();
 
+	// When p_all is false, only the swapchains that finished to present
+	// are destroyed
+	void destroyRetiredSwapchains(bool p_all);
+
+	// Requests the levels of the streamed textures from the screen size of
+	// the meshes, and recreates the images of the changed textures
+	void updateTextureStreaming();
+	void retireTextureImage(VkImage p_image, VmaAllocation p_allocation, VkImageView p_imageView, uint64_t p_uploadBatch);
+	void destroyRetiredTextureImages(bool p_all);
+
+	// Thread safe, the double buffered textures swap their images in the draw
+	void registerDynamicTexture(Texture *p_texture);
+	void unregisterDynamicTexture(Texture *p_texture);
+	void updateDynamicTextures();
+	// Called once the fence of the frame is signaled, the frame samples the
+	// front images from now on. Without the update after bind the command
+	// buffer of the frame is recorded again
+	void publishDynamicTextures(uint32_t p_frame);
+	// A binding per swapchain image, to the front image
+	void acquireFrameImages(Texture *p_texture);
+	void releaseFrameImages(Texture::FrameImages &r_frameImages);
+
+	// After the textures changed their image views, returns true when a mesh
+	// binds another set (or slot)
+	bool rebindTextureImages();
+
 	void lockupSwapchainImages();
 
 	bool createSwapchainImageViews();
 	void destroySwapchainImageViews();
 
-	bool createDepthTestResources();
-	void destroyDepthTestResources();
-
 	// The render pass is an object that is used to organize the rendering process
-	// It doesn't have any rendering command nor resources informations
+	// It doesn't have any rendering command nor resources informations.
+	// The frame is described by the render graph, that derives the render
+	// pass, its transitions and its dependencies
 	bool createRenderPass();
 	void destroyRenderPass();
 
@@ -340,7 +676,9 @@ private:
 	void destroyShaderModule(VkShaderModule &shaderModule);
 
 	// The framebuffer object represent the memory that will be used by renderpass
-	// The framebuffer is created using renderpass informations
+	// The framebuffer is created using renderpass informations.
+	// The render graph allocates the transient attachments (the depth) and a
+	// framebuffer for each swapchain image
 	bool createFramebuffers();
 	void destroyFramebuffers();
 
@@ -352,9 +690,16 @@ private:
 	bool createBufferMemoryHostAllocator();
 	void destroyBufferMemoryHostAllocator();
 
+	// Allocated from the device allocator
+	bool createImagePools();
+	void destroyImagePools();
+
 	// typeBits indicate the suitable types of memory for the buffer
 	int32_t chooseMemoryType(uint32_t p_typeBits, VkMemoryPropertyFlags p_propertyFlags);
 
+	// True if at least one memory type has all the flags
+	bool hasMemoryProperty(VkMemoryPropertyFlags p_propertyFlags);
+
 	bool createUniformBuffers();
 	void destroyUniformBuffers();
 
@@ -369,6 +714,11 @@ private:
 	bool createCommandPool();
 	void destroyCommandPool();
 
+	// Returns the command pool of the calling thread, used to allocate one
+	// time commands
+	VkCommandPool getOneTimeCommandPool();
+	void destroyOneTimeCommandPools();
+
 	// Command buffer is an object where are stored all commands, here are stored
 	// all informations about renderpass, attachments, etc.. It's possible to have
 	// two kind of command buffers primary and seconday The secondary can be
@@ -376,16 +726,38 @@ private:
 	// This function only allocate a command buffer and doesn't initialize it
 	bool allocateCommandBuffers();
 
+	// (Re)allocate a draw command buffer for each swapchain image
+	bool allocateDrawCommandBuffers();
+
 	// This function take all commandBuffers and set it in executable state with
 	// all commands to execute This store the renderpass, so it should be
 	// submitted each time the swapchain is recreated
 	void beginCommandBuffers();
+	// The frame must be completed
+	void recordCommandBuffer(uint32_t p_index);
+
+	// Records the draw commands of the main pass, inside its render pass
+	static void recordMainPass(VkCommandBuffer p_command, uint32_t p_slot, void *p_userData);
+	// The images published to the frame by the double buffered texture of
+	// the mesh, nullptr when the mesh binds its own set (or slot)
+	static const Texture::FrameImages *getFrameImages(const MeshHandle *p_meshHandle, uint32_t p_frame);
 
 	bool createSyncObjects();
 	void destroySyncObjects();
 
+	// The sync objects used by each swapchain image, the create adds the
+	// missing ones and the destroy removes the ones from the index p_from
+	bool createFrameSyncObjects();
+	void destroyFrameSyncObjects(size_t p_from);
+
 	void reloadCamera();
 
+	// Latency policy helpers
+	void limitFrameRate();
+	void retireFinishedFrames();
+	void waitQueuedFrames(uint32_t p_maxQueuedFrames);
+	void sampleQueuedFrames(float p_limiterSleepMs);
+
 	void removeAllMeshes();
 
 	bool checkInstanceExtensionsSupport(const std::vector<const char *> &p_required_extensions);
@@ -399,7 +771,7 @@ private:
 	void recreateSwapchain();
 
 	// return the size of allocated memory, or 0 if error.
-	bool createBuffer(VmaAllocator p_allocator, VkDeviceSize p_size, VkBufferUsageFlags p_usage, VkSharingMode p_sharingMode, VmaMemoryUsage p_memoryUsage, VkBuffer &r_buffer, VmaAllocation &r_allocation);
+	bool createBuffer(VmaAllocator p_allocator, MemoryTracker::Category p_category, VkDeviceSize p_size, VkBufferUsageFlags p_usage, VkSharingMode p_sharingMode, VmaMemoryUsage p_memoryUsage, VkBuffer &r_buffer, VmaAllocation &r_allocation);
 	void destroyBuffer(VmaAllocator p_allocator, VkBuffer &r_buffer, VmaAllocation &r_allocation);
 
 	bool hasStencilComponent(VkFormat p_format);
@@ -409,10 +781,15 @@ private:
 	// and return one of it if it's supported by the Hardware
 	bool chooseBestSupportedFormat(const std::vector<VkFormat> &p_formats, VkImageTiling p_tiling, VkFormatFeatureFlags p_features, VkFormat *r_format);
 
-	bool createImage(uint32_t p_width, uint32_t p_height, VkFormat p_format, VkImageTiling p_tiling, VkImageUsageFlags p_usage, VkMemoryPropertyFlags p_memoryFlags, VkImage &r_image, VkDeviceMemory &r_memory);
-	void destroyImage(VkImage &p_image, VkDeviceMemory &p_memory);
+	// The memory is sub allocated from the image pool of the category,
+	// r_size, when not null, receives the allocated memory size
+	bool createImage(uint32_t p_width, uint32_t p_height, VkFormat p_format, VkImageTiling p_tiling, VkImageUsageFlags p_usage, VkMemoryPropertyFlags p_memoryFlags, MemoryTracker::Category p_category, VkImage &r_image, VmaAllocation &r_allocation, VkDeviceSize *r_size = nullptr, uint32_t p_mipLevels = 1);
+	void destroyImage(VkImage &r_image, VmaAllocation &r_allocation);
 
-	bool createImageView(VkImage p_image, VkFormat p_format, VkImageAspectFlags p_aspectFlags, VkImageView &r_imageView);
+	// Returns VK_NULL_HANDLE when the image must use a dedicated allocation
+	VmaPool chooseImagePool(MemoryTracker::Category p_category, VkDeviceSize p_size) const;
+
+	bool createImageView(VkImage p_image, VkFormat p_format, VkImageAspectFlags p_aspectFlags, VkImageView &r_imageView, uint32_t p_mipLevels = 1, VkComponentMapping p_swizzle = {});
 	void destroyImageView(VkImageView &r_imageView);
 
 	// Command Buffers helpers
@@ -422,29 +799,124 @@ private:
 	bool submitCommand(VkCommandBuffer p_command, VkFence p_fence);
 	bool submitWaitCommand(VkCommandBuffer p_command);
 	void freeCommand(VkCommandBuffer &r_command);
+};
 
-	bool transitionImageLayout(VkImage p_image, VkFormat p_format, VkImageLayout p_oldLayout, VkImageLayout p_newLayout);
+// THREADED RENDERING
+//		When the OldVisualServer is initialized in threaded mode the
+// VulkanServer is owned by a dedicated render thread.
+//		All the calls that change the scene (add / remove mesh, set mesh
+// transform, camera updates) are encoded in a RenderCommand and pushed inside a
+// lock free queue, the render thread consume these commands and draw.
+//		The scene state is double buffered: the game thread write the state
+// inside Mesh (and the values passed to the camera functions), the render
+// thread own a copy of it inside MeshHandle and Camera.
+//		The game thread can stay at most one frame ahead of the render thread,
+// so the frame time is max(simulation, render) instead of simulation + render
+//
+// 		game thread:   | tick N | tick N+1 | tick N+2 |
+// 		render thread:          | draw N   | draw N+1 | draw N+2 |
+//
+//		The Geometry of a Mesh is read by the render thread, so it's not
+// allowed to change it once the mesh is added to the scene. When the
+// geometry isn't kept the render thread releases it after the upload, and
+// reloads it when a mesh brings it back in the scene.
+
+struct RenderCommand {
+	enum Type {
+		TYPE_ADD_MESH,
+		TYPE_REMOVE_MESH,
+		TYPE_MESH_SET_TRANSFORM,
+		TYPE_MESH_SET_COLOR_TEXTURE,
+		TYPE_CAMERA_SET_TRANSFORM,
+		TYPE_CAMERA_SET_NEAR_FAR,
+		TYPE_CAMERA_SET_FOV,
+		TYPE_SET_LATENCY_POLICY,
+		TYPE_SYNC, // Notify the game thread when processed
+		TYPE_DRAW,
+		TYPE_EXIT
+	};
+
+	Type type;
+	Mesh *mesh;
+	Texture *texture;
+	glm::mat4 transform;
+	float params[2];
+	VulkanServer::LatencyPolicy latencyPolicy;
 };
 
+// Power of two
+#define RENDER_COMMAND_QUEUE_SIZE 4096
+
 class OldVisualServer {
 	friend class VulkanServer;
 
 	Texture *defaultTexture;
 	VulkanServer vulkanServer;
+	TextureCache textureCache;
+
+	bool threaded;
+	std::thread renderThread;
+	CommandQueue<RenderCommand, RENDER_COMMAND_QUEUE_SIZE> *commandQueue;
+
+	// Used to put the render thread in sleep when there are no commands
+	std::mutex renderThreadMutex;
+	std::condition_variable renderThreadCondition;
+	std::atomic<bool> renderThreadWaiting;
+
+	// Used to put the game thread in sleep when it's too much ahead
+	std::mutex gameThreadMutex;
+	std::condition_variable gameThreadCondition;
+
+	uint64_t framesPushed;
+	std::atomic<uint64_t> framesDrawn;
+	uint64_t syncsPushed;
+	std::atomic<uint64_t> syncsProcessed;
 
 public:
 	OldVisualServer();
 	~OldVisualServer();
 
-	bool init();
+	bool init(bool p_threaded = false);
 	void terminate();
 
 	bool can_step();
 	void step();
 
+	// Wait until the render thread has processed all pushed commands, then
+	// it's idle and the VulkanServer can be read until the next command
+	void sync();
+
+	bool isThreaded() const { return threaded; }
+
 	void addMesh(Mesh *p_mesh);
 	void removeMesh(Mesh *p_mesh);
 
+	void meshSetTransform(Mesh *p_mesh, const glm::mat4 &p_transformation);
+	void meshSetColorTexture(Mesh *p_mesh, Texture *p_colorTexture);
+
+	// Use these functions instead to access directly to the camera,
+	// because in threaded mode the camera is owned by the render thread
+	void cameraSetTransform(const glm::mat4 &p_transform);
+	void cameraSetNearFar(float p_near, float p_far);
+	void cameraSetFOV_deg(float p_FOV_deg);
+
+	void setLatencyPolicy(const VulkanServer::LatencyPolicy &p_policy);
+
+	// In threaded mode the sampler is called by the render thread
+	void setInputSampler(VulkanServer::InputSampler p_sampler, void *p_userData);
+	VulkanServer::LatencyStats getLatencyStats() { return vulkanServer.getLatencyStats(); }
+
+	// In threaded mode the VulkanServer is owned by the render thread
 	VulkanServer *getVulkanServer() { return &vulkanServer; }
 	const Texture *getDefaultTeture() const { return defaultTexture; }
+
+	// The textures loaded by path should be acquired from the cache, so the
+	// same file is never loaded twice
+	TextureCache &getTextureCache() { return textureCache; }
+
+private:
+	void pushCommand(const RenderCommand &p_command);
+	void executeCommand(const RenderCommand &p_command);
+
+	void renderThreadLoop();
 };
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "core/typedefs.h"
+#include <atomic>
+#include <thread>
+
+/// Lock free ring buffer that can be used to transfer commands from one
+/// thread to another.
+///
+/// It's a single producer single consumer queue:
+///  - Only one thread is allowed to `push`
+///  - Only one (other) thread is allowed to `pop`
+///
+/// The SIZE must be a power of two, so the index wrapping is just a mask.
+template <class T, uint32_t SIZE>
+class CommandQueue {
+
+	static_assert((SIZE & (SIZE - 1)) == 0, "CommandQueue SIZE must be a power of two");
+
+	T buffer[SIZE];
+
+	// Index of the next command to read, written only by the consumer
+	std::atomic<uint32_t> head;
+
+	// Index of the next free slot, written only by the producer
+	std::atomic<uint32_t> tail;
+
+public:
+	CommandQueue() :
+			head(0),
+			tail(0) {}
+
+	/// Returns false when the queue is full
+	bool try_push(const T &p_command) {
+		const uint32_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) >= SIZE)
+			return false;
+
+		buffer[t & (SIZE - 1)] = p_command;
+		tail.store(t + 1, std::memory_order_seq_cst);
+		return true;
+	}
+
+	/// Blocks the producer until there is a free slot
+	void push(const T &p_command) {
+		while (!try_push(p_command)) {
+			std::this_thread::yield();
+		}
+	}
+
+	/// Returns false when the queue is empty
+	bool try_pop(T &r_command) {
+		const uint32_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_seq_cst))
+			return false;
+
+		r_command = buffer[h & (SIZE - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool is_empty() const {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_seq_cst);
+	}
+};
@@ -0,0 +1,38 @@
+#include "console_handlers.h"
+
+#include <iostream>
+
+static void printLineCallback(void *, const std::string &p_line, bool p_error) {
+	if (p_error) {
+		std::cerr << "[ERROR] " << p_line << std::endl;
+	} else {
+		std::cout << p_line << std::endl;
+	}
+}
+
+static void printErrorCallback(
+		void *,
+		const char *p_function,
+		const char *p_file,
+		int p_line,
+		const char *p_error,
+		const char *p_explain,
+		ErrorHandlerType p_type) {
+
+	std::cerr << (p_type == ERR_HANDLER_ERROR ? "[ERROR] " : "[WARN] ")
+			  << p_file << " Function: " << p_function << ", line: " << p_line
+			  << "\n\t" << p_error << " " << p_explain << std::endl;
+}
+
+ConsoleHandlers::ConsoleHandlers() {
+	printHandler.printfunc = printLineCallback;
+	add_print_handler(&printHandler);
+
+	errorHandler.errfunc = printErrorCallback;
+	add_error_handler(&errorHandler);
+}
+
+ConsoleHandlers::~ConsoleHandlers() {
+	remove_error_handler(&errorHandler);
+	remove_print_handler(&printHandler);
+}
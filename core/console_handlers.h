@@ -0,0 +1,17 @@
+#pragma once
+
+#include "core/error_macros.h"
+#include "core/print_string.h"
+
+// CONSOLE HANDLERS
+//		Write the printed lines and the errors on the standard output and
+// error, for the command line tools. Added by the constructor and removed
+// by the destructor, so an instance in main covers the whole run.
+class ConsoleHandlers {
+	PrintHandlerList printHandler;
+	ErrorHandlerList errorHandler;
+
+public:
+	ConsoleHandlers();
+	~ConsoleHandlers();
+};
@@ -0,0 +1,193 @@
+#include "descriptor_allocator.h"
+
+#include "core/error_macros.h"
+#include "core/print_string.h"
+#include "core/string.h"
+
+DescriptorAllocator::DescriptorAllocator() :
+		device(VK_NULL_HANDLE),
+		setsPerPool(0) {}
+
+bool DescriptorAllocator::create(VkDevice p_device, const std::vector<VkDescriptorPoolSize> &p_poolSizes, uint32_t p_setsPerPool) {
+	ERR_FAIL_COND_V(p_poolSizes.empty(), false);
+	ERR_FAIL_COND_V(!p_setsPerPool, false);
+
+	device = p_device;
+	setsPerPool = p_setsPerPool;
+
+	poolSizes = p_poolSizes;
+	for (size_t i = 0; i < poolSizes.size(); ++i) {
+		poolSizes[i].descriptorCount *= setsPerPool;
+	}
+
+	return createPool();
+}
+
+void DescriptorAllocator::destroy() {
+
+	if (imageSets.size())
+		WARN_PRINTS("Descriptor allocator destroyed with " + itos(imageSets.size()) + " image sets in use");
+
+	// The sets are freed with their pools
+	for (size_t i = 0; i < pools.size(); ++i) {
+		vkDestroyDescriptorPool(device, pools[i], nullptr);
+	}
+
+	pools.clear();
+	freeSets.clear();
+	retiredSets.clear();
+	imageSets.clear();
+	stats = Stats();
+}
+
+bool DescriptorAllocator::createPool() {
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.poolSizeCount = poolSizes.size();
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+	poolCreateInfo.maxSets = setsPerPool;
+
+	VkDescriptorPool pool;
+	VkResult res = vkCreateDescriptorPool(
+			device,
+			&poolCreateInfo,
+			nullptr,
+			&pool);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	pools.push_back(pool);
+	++stats.poolCount;
+
+	print_verbose("Descriptor pool " + itos(pools.size()) + " created");
+	return true;
+}
+
+bool DescriptorAllocator::allocate(VkDescriptorSetLayout p_layout, VkDescriptorSet &r_set) {
+
+	std::vector<VkDescriptorSet> &layoutFreeSets = freeSets[p_layout];
+	if (layoutFreeSets.size()) {
+		r_set = layoutFreeSets.back();
+		layoutFreeSets.pop_back();
+		--stats.freeSets;
+		return true;
+	}
+
+	ERR_FAIL_COND_V(pools.empty(), false);
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = pools.back();
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &p_layout;
+
+	VkResult res = vkAllocateDescriptorSets(device, &allocInfo, &r_set);
+
+	if (VK_ERROR_OUT_OF_POOL_MEMORY_KHR == res || VK_ERROR_FRAGMENTED_POOL == res) {
+		// The last pool is exhausted, chain a new one
+		ERR_FAIL_COND_V(!createPool(), false);
+
+		allocInfo.descriptorPool = pools.back();
+		res = vkAllocateDescriptorSets(device, &allocInfo, &r_set);
+	}
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	++stats.allocatedSets;
+	return true;
+}
+
+void DescriptorAllocator::release(VkDescriptorSetLayout p_layout, VkDescriptorSet p_set, uint64_t p_frame) {
+	if (VK_NULL_HANDLE == p_set)
+		return;
+
+	RetiredSet retired;
+	retired.layout = p_layout;
+	retired.set = p_set;
+	retired.frame = p_frame;
+	retiredSets.push_back(retired);
+	++stats.retiredSets;
+}
+
+void DescriptorAllocator::collect(uint64_t p_completedFrame) {
+
+	for (int i = retiredSets.size() - 1; 0 <= i; --i) {
+		if (retiredSets[i].frame > p_completedFrame)
+			continue;
+
+		freeSets[retiredSets[i].layout].push_back(retiredSets[i].set);
+		retiredSets[i] = retiredSets.back();
+		retiredSets.pop_back();
+		--stats.retiredSets;
+		++stats.freeSets;
+	}
+}
+
+VkDescriptorSet DescriptorAllocator::acquireImageSet(VkDescriptorSetLayout p_layout, VkImageView p_imageView, VkSampler p_sampler) {
+
+	ImageSetKey key;
+	key.layout = p_layout;
+	key.imageView = p_imageView;
+	key.sampler = p_sampler;
+
+	auto it = imageSets.find(key);
+	if (it != imageSets.end()) {
+		++it->second.refCount;
+		++stats.cacheHits;
+		return it->second.set;
+	}
+
+	++stats.cacheMisses;
+
+	ImageSet imageSet;
+	imageSet.refCount = 1;
+	ERR_FAIL_COND_V(!allocate(p_layout, imageSet.set), VK_NULL_HANDLE);
+
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfo.imageView = p_imageView;
+	imageInfo.sampler = p_sampler;
+
+	VkWriteDescriptorSet writeDesc = {};
+	writeDesc.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writeDesc.dstSet = imageSet.set;
+	writeDesc.dstBinding = 0;
+	writeDesc.descriptorCount = 1;
+	writeDesc.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writeDesc.pImageInfo = &imageInfo;
+
+	vkUpdateDescriptorSets(device, 1, &writeDesc, 0, nullptr);
+
+	imageSets[key] = imageSet;
+	++stats.cachedSets;
+	return imageSet.set;
+}
+
+void DescriptorAllocator::releaseImageSet(VkDescriptorSetLayout p_layout, VkImageView p_imageView, VkSampler p_sampler, uint64_t p_frame) {
+
+	ImageSetKey key;
+	key.layout = p_layout;
+	key.imageView = p_imageView;
+	key.sampler = p_sampler;
+
+	auto it = imageSets.find(key);
+	ERR_FAIL_COND(it == imageSets.end());
+
+	if (--it->second.refCount)
+		return;
+
+	release(p_layout, it->second.set, p_frame);
+	imageSets.erase(it);
+	--stats.cachedSets;
+}
+
+DescriptorAllocator::Stats DescriptorAllocator::getStats() const {
+	return stats;
+}
+
+void DescriptorAllocator::printStats() const {
+	print_line("Descriptor sets: " + itos(stats.poolCount) + " pools, " + itos(stats.allocatedSets) + " allocated, " +
+			   itos(stats.cachedSets) + " cached images, " + itos(stats.freeSets) + " free, " + itos(stats.retiredSets) + " retired, cache " +
+			   itos(stats.cacheHits) + " hits / " + itos(stats.cacheMisses) + " misses");
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "hellovulkan.h"
+#include <map>
+
+// DESCRIPTOR ALLOCATOR
+//		Allocates the descriptor sets from a chain of pools: when a pool is
+// exhausted a new one is created, so there is no fixed cap on the sets.
+//		The pools are never freed set by set, the released sets go in a free
+// list of their layout and are reused by the next allocations. A released
+// set may be still used by the frames in flight, so it's retired with the
+// frame of the release and becomes reusable only once that frame is
+// completed (see collect).
+//		The image sets (one combined image sampler) are cached by
+// (layout, image view, sampler) and ref counted, so all the meshes that use
+// the same texture share one set. A cached set is written once and never
+// updated, so it can be shared by the recorded command buffers.
+class DescriptorAllocator {
+public:
+	struct Stats {
+		uint32_t poolCount;
+		uint32_t allocatedSets; // From the pools
+		uint32_t freeSets;
+		uint32_t retiredSets;
+		uint32_t cachedSets;
+		uint64_t cacheHits;
+		uint64_t cacheMisses;
+
+		Stats() :
+				poolCount(0),
+				allocatedSets(0),
+				freeSets(0),
+				retiredSets(0),
+				cachedSets(0),
+				cacheHits(0),
+				cacheMisses(0) {}
+	};
+
+private:
+	struct ImageSetKey {
+		VkDescriptorSetLayout layout;
+		VkImageView imageView;
+		VkSampler sampler;
+
+		bool operator<(const ImageSetKey &p_other) const {
+			if (layout != p_other.layout)
+				return layout < p_other.layout;
+			if (imageView != p_other.imageView)
+				return imageView < p_other.imageView;
+			return sampler < p_other.sampler;
+		}
+	};
+
+	struct ImageSet {
+		VkDescriptorSet set;
+		uint32_t refCount;
+	};
+
+	struct RetiredSet {
+		VkDescriptorSetLayout layout;
+		VkDescriptorSet set;
+		uint64_t frame;
+	};
+
+	VkDevice device;
+
+	// The descriptors of each pool are these sizes multiplied by the sets
+	std::vector<VkDescriptorPoolSize> poolSizes;
+	uint32_t setsPerPool;
+
+	std::vector<VkDescriptorPool> pools;
+	std::map<VkDescriptorSetLayout, std::vector<VkDescriptorSet> > freeSets;
+	std::vector<RetiredSet> retiredSets;
+	std::map<ImageSetKey, ImageSet> imageSets;
+
+	Stats stats;
+
+public:
+	DescriptorAllocator();
+
+	// p_poolSizes are the descriptors per set
+	bool create(VkDevice p_device, const std::vector<VkDescriptorPoolSize> &p_poolSizes, uint32_t p_setsPerPool);
+	void destroy();
+
+	bool allocate(VkDescriptorSetLayout p_layout, VkDescriptorSet &r_set);
+
+	// The set is reusable once p_frame is completed
+	void release(VkDescriptorSetLayout p_layout, VkDescriptorSet p_set, uint64_t p_frame);
+
+	// Makes reusable the sets released up to p_completedFrame included
+	void collect(uint64_t p_completedFrame);
+
+	// Returns the cached set of the image, binding 0 must be a combined image
+	// sampler. Each acquire must be paired with a release
+	VkDescriptorSet acquireImageSet(VkDescriptorSetLayout p_layout, VkImageView p_imageView, VkSampler p_sampler);
+	void releaseImageSet(VkDescriptorSetLayout p_layout, VkImageView p_imageView, VkSampler p_sampler, uint64_t p_frame);
+
+	Stats getStats() const;
+	void printStats() const;
+
+private:
+	bool createPool();
+};
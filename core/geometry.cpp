@@ -0,0 +1,134 @@
+#include "geometry.h"
+
+#include "core/error_macros.h"
+#include "core/profiler.h"
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "libs/tiny_obj_loader/tiny_obj_loader.h"
+
+Geometry::Geometry() :
+		refCount(1),
+		sceneMeshCount(0),
+		residency(RESIDENCY_KEEP) {}
+
+Geometry::~Geometry() {}
+
+void Geometry::reference() {
+	++refCount;
+}
+
+void Geometry::unreference() {
+	ERR_FAIL_COND(!refCount.load());
+	if (1 == refCount--)
+		delete this;
+}
+
+int Geometry::addUniqueTriangle(int p_lastIndex, const Vertex p_vertices[3]) {
+	vertices.push_back(p_vertices[0]);
+	vertices.push_back(p_vertices[1]);
+	vertices.push_back(p_vertices[2]);
+
+	triangles.push_back(
+			Triangle({ (uint32_t)++p_lastIndex, (uint32_t)++p_lastIndex,
+					(uint32_t)++p_lastIndex }));
+	return p_lastIndex;
+}
+
+void Geometry::setResidency(Residency p_residency) {
+	// Shared, or held by the GeometryHandle of the renderer
+	ERR_FAIL_COND(getRefCount() > 1);
+	ERR_FAIL_COND(sceneMeshCount.load());
+	residency = p_residency;
+}
+
+uint64_t Geometry::getHostBytes() const {
+	return sizeof(Vertex) * vertices.capacity() + sizeof(Triangle) * triangles.capacity();
+}
+
+bool Geometry::reload() {
+	ERR_FAIL_COND_V(RESIDENCY_RELOAD != residency, false);
+	ERR_FAIL_COND_V(sourcePath.empty(), false);
+
+	if (hasData())
+		return true;
+
+	return loadObj(sourcePath);
+}
+
+void Geometry::onUploaded() {
+	if (RESIDENCY_KEEP == residency)
+		return;
+
+	// The swap frees the memory, clear would keep the capacity
+	std::vector<Vertex>().swap(vertices);
+	std::vector<Triangle>().swap(triangles);
+}
+
+// Utility loadObj
+void set_vertex_position(Vertex &r_vertex, tinyobj::index_t &p_index,
+		tinyobj::attrib_t p_attributes) {
+	r_vertex.pos = { p_attributes.vertices[(p_index.vertex_index * 3) + 0],
+		p_attributes.vertices[(p_index.vertex_index * 3) + 1],
+		p_attributes.vertices[(p_index.vertex_index * 3) + 2] };
+}
+
+// Utility loadObj
+void set_vertex_uv(Vertex &r_vertex, tinyobj::index_t &p_index,
+		tinyobj::attrib_t p_attributes) {
+	if (-1 < p_index.texcoord_index) {
+		// Since vulkan texture coords start from  top left corner and obj format
+		// start from bottom left I need invert it using "1. -
+		// p_attributes.texcoords[(p_index.texcoord_index*2)+1]" to make it correct
+		r_vertex.textCoord = {
+			p_attributes.texcoords[(p_index.texcoord_index * 2) + 0],
+			1. - p_attributes.texcoords[(p_index.texcoord_index * 2) + 1]
+		};
+	} else {
+		r_vertex.textCoord = { 0, 0 };
+	}
+}
+
+bool Geometry::loadObj(const std::string &p_path) {
+	PROFILE_ZONE("Geometry::loadObj");
+
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string err;
+
+	ERR_FAIL_COND_V(
+			!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, p_path.c_str()),
+			false);
+
+	sourcePath = p_path;
+	vertices.clear();
+	triangles.clear();
+
+	int lastIndex = -1;
+	for (int i = shapes.size() - 1; 0 <= i; --i) { // Each shape
+
+		std::vector<tinyobj::index_t> &lIndices = shapes[i].mesh.indices; // Contains index of UV, vertex position, normal
+		const size_t indexCount(lIndices.size());
+
+		for (size_t j = 0; j < indexCount; j += 3) { // Each triangle of shape
+
+			size_t vertexId = j + 0;
+			Vertex vert[3];
+
+			set_vertex_position(vert[0], lIndices[vertexId], attrib);
+			set_vertex_uv(vert[0], lIndices[vertexId], attrib);
+
+			++vertexId;
+			set_vertex_position(vert[1], lIndices[vertexId], attrib);
+			set_vertex_uv(vert[1], lIndices[vertexId], attrib);
+
+			++vertexId;
+			set_vertex_position(vert[2], lIndices[vertexId], attrib);
+			set_vertex_uv(vert[2], lIndices[vertexId], attrib);
+
+			lastIndex = addUniqueTriangle(lastIndex, vert);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "hellovulkan.h"
+#include <atomic>
+
+struct Vertex {
+	glm::vec3 pos;
+	glm::vec2 textCoord; // UV
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription desc = {};
+		desc.binding = 0;
+		desc.stride = sizeof(Vertex);
+		desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return desc;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 2> getAttributesDescription() {
+		std::array<VkVertexInputAttributeDescription, 2> attr;
+		attr[0].binding = 0;
+		attr[0].location = 0;
+		attr[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attr[0].offset = offsetof(Vertex, pos);
+
+		attr[1].binding = 0;
+		attr[1].location = 2;
+		attr[1].format = VK_FORMAT_R32G32_SFLOAT;
+		attr[1].offset = offsetof(Vertex, textCoord);
+
+		return attr;
+	}
+};
+
+struct Triangle {
+	uint32_t indices[3];
+};
+
+// GEOMETRY
+//		The vertices and the triangles of an asset, shared by all the meshes
+// that draw it: each mesh is an instance with its own transform and
+// texture. The renderer creates the device buffers once per geometry, and
+// uploads them once, so N instances cost one geometry and N transforms.
+//		Ref counted, the creator holds the first reference and each mesh
+// that uses the geometry holds one; the last unreference deletes it.
+//		While a mesh that uses the geometry is in the scene, the vertices and
+// the triangles belong to the renderer and must not be changed (nor read
+// when they are not kept).
+class Geometry {
+	friend class OldVisualServer;
+
+public:
+	// What happens to the vertices and the triangles once uploaded
+	enum Residency {
+		// Kept in host memory
+		RESIDENCY_KEEP,
+		// Released, the geometry can't be uploaded again once all its meshes
+		// leave the scene
+		RESIDENCY_DISCARD,
+		// Released, and loaded again by the renderer from the file of loadObj
+		// when a mesh brings the geometry back in the scene
+		RESIDENCY_RELOAD
+	};
+
+private:
+	std::atomic<uint32_t> refCount;
+	// Meshes of the geometry in the scene, counted by the game thread
+	std::atomic<uint32_t> sceneMeshCount;
+
+	Residency residency;
+	std::string sourcePath;
+
+public:
+	std::vector<Vertex> vertices;
+	std::vector<Triangle> triangles;
+
+public:
+	Geometry();
+
+	void reference();
+	void unreference();
+	uint32_t getRefCount() const { return refCount.load(); }
+
+	// Return the size in bytes of vertices
+	VkDeviceSize verticesSizeInBytes() const {
+		return sizeof(Vertex) * vertices.size();
+	}
+
+	// return the size in bytes of triangles indices
+	VkDeviceSize indicesSizeInBytes() const {
+		return sizeof(Triangle) * triangles.size();
+	}
+
+	uint32_t getCountIndices() const {
+		return triangles.size() * 3;
+	}
+
+	int addUniqueTriangle(int p_lastIndex, const Vertex p_vertices[3]);
+
+	// Load new vertices from OBJ file
+	bool loadObj(const std::string &p_path);
+
+	// Must be set before sharing the geometry and adding its meshes to the
+	// scene, RESIDENCY_RELOAD requires a geometry loaded by loadObj
+	void setResidency(Residency p_residency);
+	Residency getResidency() const { return residency; }
+
+	bool hasData() const { return vertices.size() && triangles.size(); }
+	// Of the vectors, with their unused capacity
+	uint64_t getHostBytes() const;
+
+	// Loads again the data released by RESIDENCY_RELOAD
+	bool reload();
+
+	// Called by the renderer once the data is uploaded
+	void onUploaded();
+
+private:
+	// Deleted by the last unreference
+	~Geometry();
+};
@@ -0,0 +1,376 @@
+#include "gpu_profiler.h"
+
+#include "core/error_macros.h"
+#include "core/print_string.h"
+#include "core/string.h"
+#include <fstream>
+
+#define STATISTICS_COUNT 4
+
+GpuProfiler::FrameStats::FrameStats() :
+		frame(0),
+		hasPipelineStatistics(false),
+		inputAssemblyVertices(0),
+		vertexShaderInvocations(0),
+		clippingPrimitives(0),
+		fragmentShaderInvocations(0) {
+
+	for (int z = 0; z < ZONE_MAX; ++z) {
+		zoneMs[z] = 0;
+		zoneValid[z] = false;
+	}
+}
+
+GpuProfiler::GpuProfiler() :
+		device(VK_NULL_HANDLE),
+		timestampPool(VK_NULL_HANDLE),
+		statisticsPool(VK_NULL_HANDLE),
+		timestampPeriodNs(1),
+		timestampMask(~uint64_t(0)),
+		pendingCopyMs(0),
+		hasPendingCopy(false),
+		historyHead(0),
+		collectedFrames(0) {}
+
+bool GpuProfiler::create(VkPhysicalDevice p_physicalDevice, VkDevice p_device, uint32_t p_queueFamilyIndex, uint32_t p_slotCount, bool p_pipelineStatistics) {
+
+	device = p_device;
+
+	VkPhysicalDeviceProperties deviceProps;
+	vkGetPhysicalDeviceProperties(p_physicalDevice, &deviceProps);
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(p_physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> familyProps(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(p_physicalDevice, &familyCount, familyProps.data());
+
+	ERR_FAIL_COND_V(p_queueFamilyIndex >= familyCount, false);
+
+	const uint32_t validBits = familyProps[p_queueFamilyIndex].timestampValidBits;
+	if (0 == validBits) {
+		WARN_PRINTS("The graphics queue doesn't support timestamps, GPU profiler disabled");
+		return true;
+	}
+
+	timestampPeriodNs = deviceProps.limits.timestampPeriod;
+	timestampMask = validBits >= 64 ? ~uint64_t(0) : ((uint64_t(1) << validBits) - 1);
+
+	slots.resize(p_slotCount);
+
+	VkQueryPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	poolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	poolCreateInfo.queryCount = p_slotCount * ZONE_MAX * 2;
+
+	ERR_FAIL_COND_V(VK_SUCCESS != vkCreateQueryPool(device, &poolCreateInfo, nullptr, &timestampPool), false);
+
+	if (p_pipelineStatistics) {
+		poolCreateInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		poolCreateInfo.queryCount = p_slotCount;
+		poolCreateInfo.pipelineStatistics =
+				VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+		ERR_FAIL_COND_V(VK_SUCCESS != vkCreateQueryPool(device, &poolCreateInfo, nullptr, &statisticsPool), false);
+	}
+
+	history.resize(HISTORY_SIZE);
+	historyHead = 0;
+	collectedFrames = 0;
+
+	print_verbose("GPU profiler created");
+	return true;
+}
+
+void GpuProfiler::destroy() {
+	if (statisticsPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device, statisticsPool, nullptr);
+		statisticsPool = VK_NULL_HANDLE;
+	}
+
+	if (timestampPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device, timestampPool, nullptr);
+		timestampPool = VK_NULL_HANDLE;
+	}
+
+	slots.clear();
+	history.clear();
+	hasPendingCopy = false;
+}
+
+void GpuProfiler::cmdResetSlot(VkCommandBuffer p_command, uint32_t p_slot) {
+	if (!isEnabled())
+		return;
+
+	vkCmdResetQueryPool(p_command, timestampPool, getTimestampQuery(p_slot, Zone(0), false), ZONE_MAX * 2);
+
+	if (hasPipelineStatistics())
+		vkCmdResetQueryPool(p_command, statisticsPool, p_slot, 1);
+
+	slots[p_slot].pipelineStatistics = false;
+}
+
+void GpuProfiler::cmdBeginZone(VkCommandBuffer p_command, uint32_t p_slot, Zone p_zone) {
+	if (!isEnabled())
+		return;
+
+	vkCmdWriteTimestamp(p_command, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, getTimestampQuery(p_slot, p_zone, false));
+}
+
+void GpuProfiler::cmdEndZone(VkCommandBuffer p_command, uint32_t p_slot, Zone p_zone) {
+	if (!isEnabled())
+		return;
+
+	vkCmdWriteTimestamp(p_command, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, getTimestampQuery(p_slot, p_zone, true));
+}
+
+void GpuProfiler::cmdBeginStatistics(VkCommandBuffer p_command, uint32_t p_slot) {
+	if (!hasPipelineStatistics())
+		return;
+
+	vkCmdBeginQuery(p_command, statisticsPool, p_slot, 0);
+	slots[p_slot].pipelineStatistics = true;
+}
+
+void GpuProfiler::cmdEndStatistics(VkCommandBuffer p_command, uint32_t p_slot) {
+	if (!hasPipelineStatistics())
+		return;
+
+	vkCmdEndQuery(p_command, statisticsPool, p_slot);
+}
+
+void GpuProfiler::markSubmitted(uint32_t p_slot, uint64_t p_frame) {
+	if (!isEnabled())
+		return;
+
+	slots[p_slot].frame = p_frame;
+}
+
+bool GpuProfiler::collect(uint32_t p_slot) {
+	if (!isEnabled())
+		return false;
+
+	Slot &slot = slots[p_slot];
+	if (0 == slot.frame)
+		return false;
+
+	// Value and availability for each query, the not written zones are
+	// simply not available
+	uint64_t timestamps[ZONE_MAX * 2][2];
+	VkResult res = vkGetQueryPoolResults(
+			device,
+			timestampPool,
+			getTimestampQuery(p_slot, Zone(0), false),
+			ZONE_MAX * 2,
+			sizeof(timestamps),
+			timestamps,
+			sizeof(timestamps[0]),
+			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res && VK_NOT_READY != res, false);
+
+	FrameStats stats;
+	stats.frame = slot.frame;
+
+	bool hasDrawZones = false;
+	for (int z = 0; z < ZONE_MAX; ++z) {
+		const uint64_t *begin = timestamps[z * 2];
+		const uint64_t *end = timestamps[z * 2 + 1];
+		if (!begin[1] || !end[1])
+			continue;
+
+		const uint64_t ticks = (end[0] - begin[0]) & timestampMask;
+		stats.zoneMs[z] = double(ticks) * timestampPeriodNs / 1e6;
+		stats.zoneValid[z] = true;
+
+		if (ZONE_COPY != z)
+			hasDrawZones = true;
+	}
+
+	if (slot.pipelineStatistics) {
+		uint64_t statistics[STATISTICS_COUNT + 1];
+		res = vkGetQueryPoolResults(
+				device,
+				statisticsPool,
+				p_slot,
+				1,
+				sizeof(statistics),
+				statistics,
+				sizeof(statistics),
+				VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+		// The order is the order of the bits
+		if (VK_SUCCESS == res && statistics[STATISTICS_COUNT]) {
+			stats.hasPipelineStatistics = true;
+			stats.inputAssemblyVertices = statistics[0];
+			stats.vertexShaderInvocations = statistics[1];
+			stats.clippingPrimitives = statistics[2];
+			stats.fragmentShaderInvocations = statistics[3];
+		}
+	}
+
+	slot.frame = 0;
+
+	if (!hasDrawZones) {
+		// Copy slot, the time is assigned to the next collected frame
+		if (stats.zoneValid[ZONE_COPY]) {
+			pendingCopyMs += stats.zoneMs[ZONE_COPY];
+			hasPendingCopy = true;
+		}
+		return true;
+	}
+
+	if (hasPendingCopy) {
+		stats.zoneMs[ZONE_COPY] += pendingCopyMs;
+		stats.zoneValid[ZONE_COPY] = true;
+		pendingCopyMs = 0;
+		hasPendingCopy = false;
+	}
+
+	pushHistory(stats);
+	return true;
+}
+
+bool GpuProfiler::getLastFrameStats(FrameStats &r_stats) const {
+	if (0 == collectedFrames)
+		return false;
+
+	r_stats = history[(historyHead + HISTORY_SIZE - 1) % HISTORY_SIZE];
+	return true;
+}
+
+GpuProfiler::FrameStats GpuProfiler::getAverageStats() const {
+
+	FrameStats average;
+	uint32_t zoneCount[ZONE_MAX] = {};
+	uint32_t statisticsCount = 0;
+
+	forEachHistory([&](const FrameStats &p_stats) {
+		average.frame = p_stats.frame;
+
+		for (int z = 0; z < ZONE_MAX; ++z) {
+			if (!p_stats.zoneValid[z])
+				continue;
+			average.zoneMs[z] += p_stats.zoneMs[z];
+			++zoneCount[z];
+		}
+
+		if (p_stats.hasPipelineStatistics) {
+			average.inputAssemblyVertices += p_stats.inputAssemblyVertices;
+			average.vertexShaderInvocations += p_stats.vertexShaderInvocations;
+			average.clippingPrimitives += p_stats.clippingPrimitives;
+			average.fragmentShaderInvocations += p_stats.fragmentShaderInvocations;
+			++statisticsCount;
+		}
+	});
+
+	for (int z = 0; z < ZONE_MAX; ++z) {
+		if (!zoneCount[z])
+			continue;
+		average.zoneMs[z] /= zoneCount[z];
+		average.zoneValid[z] = true;
+	}
+
+	if (statisticsCount) {
+		average.hasPipelineStatistics = true;
+		average.inputAssemblyVertices /= statisticsCount;
+		average.vertexShaderInvocations /= statisticsCount;
+		average.clippingPrimitives /= statisticsCount;
+		average.fragmentShaderInvocations /= statisticsCount;
+	}
+
+	return average;
+}
+
+static const char *zoneNames[] = {
+	"render_pass",
+	"draw",
+	"copy"
+};
+
+bool GpuProfiler::dumpCSV(const std::string &p_path) const {
+
+	std::ofstream file(p_path.c_str());
+	ERR_FAIL_COND_V(!file.is_open(), false);
+
+	file << "frame";
+	for (int z = 0; z < ZONE_MAX; ++z) {
+		file << "," << zoneNames[z] << "_ms";
+	}
+	file << ",input_assembly_vertices,vertex_shader_invocations,clipping_primitives,fragment_shader_invocations\n";
+
+	forEachHistory([&](const FrameStats &p_stats) {
+		file << p_stats.frame;
+		for (int z = 0; z < ZONE_MAX; ++z) {
+			file << ",";
+			if (p_stats.zoneValid[z])
+				file << p_stats.zoneMs[z];
+		}
+
+		if (p_stats.hasPipelineStatistics) {
+			file << "," << p_stats.inputAssemblyVertices
+				 << "," << p_stats.vertexShaderInvocations
+				 << "," << p_stats.clippingPrimitives
+				 << "," << p_stats.fragmentShaderInvocations;
+		} else {
+			file << ",,,,";
+		}
+		file << "\n";
+	});
+
+	return true;
+}
+
+bool GpuProfiler::dumpJSON(const std::string &p_path) const {
+
+	std::ofstream file(p_path.c_str());
+	ERR_FAIL_COND_V(!file.is_open(), false);
+
+	file << "{\"frames\":[";
+
+	bool first = true;
+	forEachHistory([&](const FrameStats &p_stats) {
+		if (!first)
+			file << ",";
+		first = false;
+
+		file << "\n{\"frame\":" << p_stats.frame;
+		for (int z = 0; z < ZONE_MAX; ++z) {
+			if (p_stats.zoneValid[z])
+				file << ",\"" << zoneNames[z] << "_ms\":" << p_stats.zoneMs[z];
+		}
+
+		if (p_stats.hasPipelineStatistics) {
+			file << ",\"input_assembly_vertices\":" << p_stats.inputAssemblyVertices
+				 << ",\"vertex_shader_invocations\":" << p_stats.vertexShaderInvocations
+				 << ",\"clipping_primitives\":" << p_stats.clippingPrimitives
+				 << ",\"fragment_shader_invocations\":" << p_stats.fragmentShaderInvocations;
+		}
+		file << "}";
+	});
+
+	file << "\n]}\n";
+	return true;
+}
+
+uint32_t GpuProfiler::getTimestampQuery(uint32_t p_slot, Zone p_zone, bool p_end) const {
+	return (p_slot * ZONE_MAX + p_zone) * 2 + (p_end ? 1 : 0);
+}
+
+void GpuProfiler::pushHistory(const FrameStats &p_stats) {
+	history[historyHead] = p_stats;
+	historyHead = (historyHead + 1) % HISTORY_SIZE;
+	++collectedFrames;
+}
+
+template <class F>
+void GpuProfiler::forEachHistory(F p_func) const {
+	const uint32_t count = MIN(collectedFrames, uint64_t(HISTORY_SIZE));
+	const uint32_t first = (historyHead + HISTORY_SIZE - count) % HISTORY_SIZE;
+
+	for (uint32_t i = 0; i < count; ++i) {
+		p_func(history[(first + i) % HISTORY_SIZE]);
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "hellovulkan.h"
+
+// GPU PROFILER
+//		Measure the GPU time of the passes using timestamp queries, and
+// optionally the pipeline statistics (vertices, vertex and fragment shader
+// invocations).
+//		The queries are organized in slots, each slot is used by one command
+// buffer: one slot per swapchain image (the draw command buffers) plus one
+// for the copy command buffer.
+//		The draw command buffers are recorded once and submitted many times, so
+// the reset of the slot queries is recorded inside the command buffer itself.
+//		The results are never waited: they are read when the fence that
+// protect the command buffer is already signaled, so the data of a frame is
+// available when its swapchain image is acquired again (N frames later).
+class GpuProfiler {
+public:
+	enum Zone {
+		ZONE_RENDER_PASS, // From render pass begin to render pass end
+		ZONE_DRAW, // The mesh draw calls, inside the render pass
+		ZONE_COPY, // Mesh upload
+		ZONE_MAX
+	};
+
+	struct FrameStats {
+		uint64_t frame;
+		double zoneMs[ZONE_MAX];
+		bool zoneValid[ZONE_MAX];
+
+		bool hasPipelineStatistics;
+		uint64_t inputAssemblyVertices;
+		uint64_t vertexShaderInvocations;
+		uint64_t clippingPrimitives;
+		uint64_t fragmentShaderInvocations;
+
+		FrameStats();
+	};
+
+	// Number of frames kept in the history, used by the dump
+	static const uint32_t HISTORY_SIZE = 256;
+
+private:
+	struct Slot {
+		uint64_t frame; // 0 when there is nothing to collect
+		bool pipelineStatistics;
+
+		Slot() :
+				frame(0),
+				pipelineStatistics(false) {}
+	};
+
+	VkDevice device;
+	VkQueryPool timestampPool;
+	VkQueryPool statisticsPool;
+	double timestampPeriodNs;
+	uint64_t timestampMask;
+
+	std::vector<Slot> slots;
+
+	// Copy time collected but not yet assigned to a frame
+	double pendingCopyMs;
+	bool hasPendingCopy;
+
+	std::vector<FrameStats> history;
+	uint32_t historyHead;
+	uint64_t collectedFrames;
+
+public:
+	GpuProfiler();
+
+	bool create(VkPhysicalDevice p_physicalDevice, VkDevice p_device, uint32_t p_queueFamilyIndex, uint32_t p_slotCount, bool p_pipelineStatistics);
+	void destroy();
+
+	bool isEnabled() const { return timestampPool != VK_NULL_HANDLE; }
+	bool hasPipelineStatistics() const { return statisticsPool != VK_NULL_HANDLE; }
+	uint32_t getSlotCount() const { return slots.size(); }
+
+	// Must be recorded outside the render pass before any other query of
+	// the slot
+	void cmdResetSlot(VkCommandBuffer p_command, uint32_t p_slot);
+
+	void cmdBeginZone(VkCommandBuffer p_command, uint32_t p_slot, Zone p_zone);
+	void cmdEndZone(VkCommandBuffer p_command, uint32_t p_slot, Zone p_zone);
+
+	void cmdBeginStatistics(VkCommandBuffer p_command, uint32_t p_slot);
+	void cmdEndStatistics(VkCommandBuffer p_command, uint32_t p_slot);
+
+	// Tells that the command buffer of the slot is submitted
+	void markSubmitted(uint32_t p_slot, uint64_t p_frame);
+
+	// Reads the results of the slot without wait, it must be called only when
+	// the fence of its command buffer is signaled.
+	// Returns false when nothing is collected
+	bool collect(uint32_t p_slot);
+
+	bool getLastFrameStats(FrameStats &r_stats) const;
+
+	// Average of the frames in history
+	FrameStats getAverageStats() const;
+
+	// One row / object per frame in history, from the oldest
+	bool dumpCSV(const std::string &p_path) const;
+	bool dumpJSON(const std::string &p_path) const;
+
+private:
+	uint32_t getTimestampQuery(uint32_t p_slot, Zone p_zone, bool p_end) const;
+	void pushHistory(const FrameStats &p_stats);
+
+	// Call the function for each frame in history from the oldest
+	template <class F>
+	void forEachHistory(F p_func) const;
+};
@@ -0,0 +1,243 @@
+#include "image_decoder.h"
+
+#include "core/error_macros.h"
+#include "core/mapped_file.h"
+#include "core/print_string.h"
+#include "core/profiler.h"
+#include "core/string.h"
+#include "core/thread_pool.h"
+#include "core/typedefs.h"
+#include "libs/stb/stb_image.h"
+#include <climits>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define IMAGE_DECODER_X86
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(IMAGE_DECODER_X86) && (defined(__GNUC__) || defined(__clang__))
+// Compiled for SSSE3 without raising the target of the whole build, it's
+// called only when the CPU supports it
+#define SSSE3_FUNCTION __attribute__((target("ssse3")))
+#else
+#define SSSE3_FUNCTION
+#endif
+
+static void expandRGBToRGBAScalar(const uint8_t *p_src, uint8_t *r_dst, size_t p_pixels) {
+	for (size_t i = 0; i < p_pixels; ++i) {
+		r_dst[0] = p_src[0];
+		r_dst[1] = p_src[1];
+		r_dst[2] = p_src[2];
+		r_dst[3] = 255;
+		p_src += 3;
+		r_dst += 4;
+	}
+}
+
+#ifdef IMAGE_DECODER_X86
+SSSE3_FUNCTION static void expandRGBToRGBASSSE3(const uint8_t *p_src, uint8_t *r_dst, size_t p_pixels) {
+	// Each load takes 4 pixels and 4 bytes of the next ones
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+
+	// The last load of 16 pixels reads 4 bytes past them, so 2 pixels
+	// must follow
+	size_t i = 0;
+	for (; i + 18 <= p_pixels; i += 16) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p_src));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p_src + 12));
+		const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p_src + 24));
+		const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p_src + 36));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(r_dst), _mm_or_si128(_mm_shuffle_epi8(a, shuffle), alpha));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(r_dst + 16), _mm_or_si128(_mm_shuffle_epi8(b, shuffle), alpha));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(r_dst + 32), _mm_or_si128(_mm_shuffle_epi8(c, shuffle), alpha));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(r_dst + 48), _mm_or_si128(_mm_shuffle_epi8(d, shuffle), alpha));
+
+		p_src += 48;
+		r_dst += 64;
+	}
+
+	expandRGBToRGBAScalar(p_src, r_dst, p_pixels - i);
+}
+#endif
+
+bool ImageDecoder::isSSSE3Supported() {
+#if defined(IMAGE_DECODER_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return info[2] & (1 << 9);
+#elif defined(IMAGE_DECODER_X86)
+	return __builtin_cpu_supports("ssse3");
+#else
+	return false;
+#endif
+}
+
+void ImageDecoder::expandRGBToRGBA(const uint8_t *p_src, uint8_t *r_dst, size_t p_pixels) {
+#ifdef IMAGE_DECODER_X86
+	static const bool ssse3 = isSSSE3Supported();
+	if (ssse3) {
+		expandRGBToRGBASSSE3(p_src, r_dst, p_pixels);
+		return;
+	}
+#endif
+	expandRGBToRGBAScalar(p_src, r_dst, p_pixels);
+}
+
+bool ImageDecoder::decodeFile(const std::string &p_path, const HeaderFunction &p_header, Image &r_image) {
+	PROFILE_ZONE("ImageDecoder::decodeFile");
+
+	r_image = Image();
+
+	MappedFile file;
+	if (!file.open(p_path)) {
+		ERR_EXPLAIN("Can't open the image: " + p_path);
+		ERR_FAIL_V(false);
+	}
+
+	return decodeMemory(file.getData(), file.getSize(), p_path, p_header, r_image);
+}
+
+bool ImageDecoder::decodeMemory(const uint8_t *p_data, size_t p_size, const std::string &p_name, const HeaderFunction &p_header, Image &r_image) {
+	PROFILE_ZONE("ImageDecoder::decodeMemory");
+
+	r_image = Image();
+
+	ERR_FAIL_COND_V(p_size > size_t(INT_MAX), false);
+	const int fileSize = int(p_size);
+	r_image.fileBytes = p_size;
+
+	if (!stbi_info_from_memory(p_data, fileSize, &r_image.width, &r_image.height, &r_image.sourceChannels)) {
+		ERR_EXPLAIN("Can't read the image: " + p_name);
+		ERR_FAIL_V(false);
+	}
+
+	size_t reserve = 0;
+	const int channels = p_header(r_image, reserve);
+	if (!channels)
+		return false;
+
+	ERR_FAIL_COND_V(channels < 1 || channels > 4, false);
+
+	// The RGB sources are expanded by expandRGBToRGBA, stb would convert
+	// them in a second buffer
+	const bool expand = 3 == r_image.sourceChannels && 4 == channels;
+
+	int width;
+	int height;
+	int sourceChannels;
+	stbi_uc *pixels = stbi_load_from_memory(
+			p_data,
+			fileSize,
+			&width,
+			&height,
+			&sourceChannels,
+			expand ? 0 : channels);
+
+	if (!pixels) {
+		ERR_EXPLAIN("Can't decode the image: " + p_name);
+		ERR_FAIL_V(false);
+	}
+
+	const size_t pixelCount = size_t(width) * height;
+	r_image.width = width;
+	r_image.height = height;
+	r_image.channels = channels;
+	r_image.data.reserve(MAX(reserve, pixelCount * channels));
+	r_image.data.resize(pixelCount * channels);
+
+	if (expand) {
+		expandRGBToRGBA(pixels, r_image.data.data(), pixelCount);
+	} else {
+		memcpy(r_image.data.data(), pixels, pixelCount * channels);
+	}
+
+	stbi_image_free(pixels);
+	return true;
+}
+
+void ImageDecoder::decodeAll(ThreadPool *p_threadPool, uint32_t p_count, const DecodeFunction &p_function, std::vector<Image> &r_images) {
+	PROFILE_ZONE("ImageDecoder::decodeAll");
+
+	r_images.clear();
+	r_images.resize(p_count);
+
+	const uint64_t begin = Profiler::get_time_ns();
+
+	// A file per chunk, their decode time is too different to split them
+	// evenly in advance
+	const ThreadPool::RangeFunction decodeRange = [this, &p_function, &r_images](uint32_t p_begin, uint32_t p_end) {
+		for (uint32_t i = p_begin; i < p_end; ++i) {
+			const uint64_t fileBegin = Profiler::get_time_ns();
+			const bool success = p_function(i, r_images[i]);
+			if (!success)
+				r_images[i] = Image();
+
+			_addFile(Profiler::get_time_ns() - fileBegin, success, r_images[i]);
+		}
+	};
+
+	if (p_threadPool) {
+		p_threadPool->parallelFor(p_count, 1, decodeRange);
+	} else {
+		decodeRange(0, p_count);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.wallNs += Profiler::get_time_ns() - begin;
+}
+
+void ImageDecoder::_addFile(uint64_t p_busyNs, bool p_success, const Image &p_image) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto it = threadIndices.find(std::this_thread::get_id());
+	if (it == threadIndices.end()) {
+		it = threadIndices.insert(std::make_pair(std::this_thread::get_id(), stats.threads.size())).first;
+		stats.threads.push_back(ThreadStats());
+	}
+
+	ThreadStats &thread = stats.threads[it->second];
+	++thread.files;
+	thread.busyNs += p_busyNs;
+
+	if (!p_success) {
+		++stats.failures;
+		return;
+	}
+
+	++stats.files;
+	stats.fileBytes += p_image.fileBytes;
+	stats.decodedBytes += uint64_t(p_image.width) * p_image.height * p_image.channels;
+}
+
+ImageDecoder::Stats ImageDecoder::getStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void ImageDecoder::clearStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	stats = Stats();
+	threadIndices.clear();
+}
+
+void ImageDecoder::printStats() {
+	const Stats s = getStats();
+
+	print_line("Image decoding: " + itos(s.files) + " files (" + itos(s.failures) + " failed), " +
+			   itos(s.fileBytes / 1024) + " KiB read, " + itos(s.decodedBytes / 1024) + " KiB decoded in " +
+			   rtos(double(s.wallNs) / 1e6) + " ms, " + rtos(s.getThroughput()) + " MB/s decoded" +
+			   (isSSSE3Supported() ? ", SSSE3" : ""));
+
+	std::string utilization;
+	for (size_t i = 0; i < s.threads.size(); ++i) {
+		utilization += " " + itos(i) + ":" + rtos(s.getUtilization(i) * 100.f) + "% (" + itos(s.threads[i].files) + " files)";
+	}
+	if (s.threads.size())
+		print_line("  thread utilization" + utilization);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ThreadPool;
+
+// IMAGE DECODER
+//		Decodes the JPG and PNG files of the textures. A level loads hundreds
+// of them, so decodeAll spreads the files across the workers of the thread
+// pool, one file per chunk.
+//		The file is mapped and decoded with its own channels, so stb doesn't
+// convert it in a second buffer. stb decodes in its own buffer, that is
+// copied in the data of the image (reserved for the mip chain too), and the
+// upload copies the data again in the staging buffer. The RGB sources are
+// expanded to RGBA with SSSE3, when the CPU supports it, by the first copy;
+// the other channel conversions are left to stb.
+//		The decoder accumulates the throughput of the decodes, and the time
+// each thread spent decoding, over all the calls of decodeAll.
+class ImageDecoder {
+public:
+	struct Image {
+		int width;
+		int height;
+		int sourceChannels;
+		int channels; // Of the data
+		uint64_t fileBytes;
+		// The level 0, tightly packed
+		std::vector<uint8_t> data;
+
+		Image() :
+				width(0),
+				height(0),
+				sourceChannels(0),
+				channels(0),
+				fileBytes(0) {}
+	};
+
+	struct ThreadStats {
+		uint32_t files;
+		uint64_t busyNs;
+
+		ThreadStats() :
+				files(0),
+				busyNs(0) {}
+	};
+
+	struct Stats {
+		uint32_t files;
+		uint32_t failures;
+		uint64_t fileBytes;
+		uint64_t decodedBytes;
+		uint64_t wallNs; // Of the decodeAll calls
+		// Ordered by the first decode of each thread
+		std::vector<ThreadStats> threads;
+
+		Stats() :
+				files(0),
+				failures(0),
+				fileBytes(0),
+				decodedBytes(0),
+				wallNs(0) {}
+
+		float getThroughput() const { return wallNs ? float(double(decodedBytes) / (1024. * 1024.) / (double(wallNs) / 1e9)) : 0; }
+		float getUtilization(size_t p_thread) const { return wallNs ? float(double(threads[p_thread].busyNs) / wallNs) : 0; }
+	};
+
+	// Called once the header is read, p_image has the size and the source
+	// channels. Returns the channels to decode (1 to 4), 0 cancels the decode.
+	// r_reserve is the capacity of the data, e.g. for the mip chain
+	typedef std::function<int(const Image &p_image, size_t &r_reserve)> HeaderFunction;
+
+	// Decodes the file p_index in r_image, called by the workers
+	typedef std::function<bool(uint32_t p_index, Image &r_image)> DecodeFunction;
+
+private:
+	std::mutex mutex;
+	Stats stats;
+	std::map<std::thread::id, size_t> threadIndices;
+
+public:
+	// Decodes on the calling thread
+	static bool decodeFile(const std::string &p_path, const HeaderFunction &p_header, Image &r_image);
+	// Decodes the bytes of a file already in memory, p_name is for the errors
+	static bool decodeMemory(const uint8_t *p_data, size_t p_size, const std::string &p_name, const HeaderFunction &p_header, Image &r_image);
+
+	// Adds the opaque alpha, p_src has 3 bytes per pixel and r_dst 4
+	static void expandRGBToRGBA(const uint8_t *p_src, uint8_t *r_dst, size_t p_pixels);
+	static bool isSSSE3Supported();
+
+	// Without the pool the files are decoded by the calling thread.
+	// r_images receives an image per file, the failed ones are empty
+	void decodeAll(ThreadPool *p_threadPool, uint32_t p_count, const DecodeFunction &p_function, std::vector<Image> &r_images);
+
+	Stats getStats();
+	void clearStats();
+	void printStats();
+
+private:
+	void _addFile(uint64_t p_busyNs, bool p_success, const Image &p_image);
+};
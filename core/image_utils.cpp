@@ -0,0 +1,110 @@
+#include "image_utils.h"
+
+#include "core/profiler.h"
+#include "core/typedefs.h"
+#include <cmath>
+
+static const int LINEAR_STEPS = 4096;
+
+namespace {
+
+struct SRGBTables {
+	// The linear value of each sRGB value, in steps of toSRGB
+	uint16_t toLinear[256];
+	uint8_t toSRGB[LINEAR_STEPS];
+
+	SRGBTables() {
+		for (int i = 0; i < 256; ++i) {
+			const float c = i / 255.f;
+			const float l = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			toLinear[i] = uint16_t(l * (LINEAR_STEPS - 1) + 0.5f);
+		}
+
+		for (int i = 0; i < LINEAR_STEPS; ++i) {
+			const float l = float(i) / (LINEAR_STEPS - 1);
+			const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.f / 2.4f) - 0.055f;
+			toSRGB[i] = uint8_t(CLAMP(c * 255.f + 0.5f, 0.f, 255.f));
+		}
+	}
+};
+
+// Built by the first use, from any loading thread
+const SRGBTables &getSRGBTables() {
+	static const SRGBTables tables;
+	return tables;
+}
+
+} // namespace
+
+uint32_t computeMipLevels(uint32_t p_width, uint32_t p_height) {
+	uint32_t levels = 1;
+	for (uint32_t size = MAX(p_width, p_height); size > 1; size >>= 1) {
+		++levels;
+	}
+	return levels;
+}
+
+static _FORCE_INLINE_ void filterSRGBPixel(const SRGBTables &p_tables, const uint8_t *p00, const uint8_t *p01, const uint8_t *p10, const uint8_t *p11, uint32_t p_channels, uint8_t *r_dst) {
+	// Averaged in integer steps, the sum of the four samples fits 16 bits
+	// The last channel of the gray+alpha and RGBA images is the linear alpha
+	const uint32_t colorChannels = 4 == p_channels || 2 == p_channels ? p_channels - 1 : p_channels;
+	for (uint32_t c = 0; c < colorChannels; ++c) {
+		const uint32_t sum = p_tables.toLinear[p00[c]] + p_tables.toLinear[p01[c]] + p_tables.toLinear[p10[c]] + p_tables.toLinear[p11[c]];
+		r_dst[c] = p_tables.toSRGB[(sum + 2) >> 2];
+	}
+	// The alpha is linear
+	for (uint32_t c = colorChannels; c < p_channels; ++c) {
+		r_dst[c] = uint8_t((p00[c] + p01[c] + p10[c] + p11[c] + 2) / 4);
+	}
+}
+
+void buildMipChain(uint32_t p_width, uint32_t p_height, uint32_t p_channels, uint32_t p_levels, std::vector<uint8_t> &r_data, bool p_srgb) {
+	PROFILE_ZONE("buildMipChain");
+
+	const SRGBTables *tables = p_srgb ? &getSRGBTables() : nullptr;
+
+	size_t srcOffset = 0;
+	uint32_t srcWidth = p_width;
+	uint32_t srcHeight = p_height;
+
+	for (uint32_t level = 1; level < p_levels; ++level) {
+		const uint32_t dstWidth = MAX(srcWidth >> 1, 1u);
+		const uint32_t dstHeight = MAX(srcHeight >> 1, 1u);
+
+		const size_t dstOffset = r_data.size();
+		r_data.resize(dstOffset + size_t(dstWidth) * dstHeight * p_channels);
+
+		const uint8_t *src = r_data.data() + srcOffset;
+		uint8_t *dst = r_data.data() + dstOffset;
+
+		for (uint32_t y = 0; y < dstHeight; ++y) {
+			// The odd sizes clamp the last row and column
+			const uint32_t y0 = MIN(y * 2, srcHeight - 1);
+			const uint32_t y1 = MIN(y * 2 + 1, srcHeight - 1);
+
+			for (uint32_t x = 0; x < dstWidth; ++x) {
+				const uint32_t x0 = MIN(x * 2, srcWidth - 1);
+				const uint32_t x1 = MIN(x * 2 + 1, srcWidth - 1);
+
+				const uint8_t *p00 = src + (size_t(y0) * srcWidth + x0) * p_channels;
+				const uint8_t *p01 = src + (size_t(y0) * srcWidth + x1) * p_channels;
+				const uint8_t *p10 = src + (size_t(y1) * srcWidth + x0) * p_channels;
+				const uint8_t *p11 = src + (size_t(y1) * srcWidth + x1) * p_channels;
+
+				uint8_t *d = dst + (size_t(y) * dstWidth + x) * p_channels;
+				if (tables) {
+					filterSRGBPixel(*tables, p00, p01, p10, p11, p_channels, d);
+					continue;
+				}
+
+				for (uint32_t c = 0; c < p_channels; ++c) {
+					d[c] = uint8_t((p00[c] + p01[c] + p10[c] + p11[c] + 2) / 4);
+				}
+			}
+		}
+
+		srcOffset = dstOffset;
+		srcWidth = dstWidth;
+		srcHeight = dstHeight;
+	}
+}
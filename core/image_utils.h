@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Returns the levels of the full chain down to 1x1
+uint32_t computeMipLevels(uint32_t p_width, uint32_t p_height);
+
+// Appends to the level 0 (8 bits per channel) the other levels, each one is
+// the 2x2 box filter of the previous. The sRGB channels (all but the alpha
+// of 2 and 4 channels) are averaged in linear space, or the levels darken
+void buildMipChain(uint32_t p_width, uint32_t p_height, uint32_t p_channels, uint32_t p_levels, std::vector<uint8_t> &r_data, bool p_srgb = false);
@@ -0,0 +1,311 @@
+#include "ktx2.h"
+
+#include "core/error_macros.h"
+#include "core/typedefs.h"
+#include <cstring>
+
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// Header (identifier excluded) and index, up to the level index
+#define KTX2_HEADER_SIZE 68
+#define KTX2_LEVEL_INDEX_ENTRY_SIZE 24
+
+// Khronos data format, basic descriptor block
+#define KHR_DF_MODEL_RGBSDA 1
+#define KHR_DF_MODEL_BC1A 128
+#define KHR_DF_MODEL_BC3 130
+#define KHR_DF_MODEL_ETC1S 163
+#define KHR_DF_PRIMARIES_BT709 1
+#define KHR_DF_TRANSFER_LINEAR 1
+#define KHR_DF_TRANSFER_SRGB 2
+#define KHR_DF_CHANNEL_BC1A_COLOR 0
+#define KHR_DF_CHANNEL_BC3_COLOR 0
+#define KHR_DF_CHANNEL_BC3_ALPHA 15
+#define KHR_DF_CHANNEL_ETC1S_RGB 0
+#define KHR_DF_CHANNEL_ETC1S_AAA 15
+#define KHR_DF_CHANNEL_RGBSDA_RED 0
+#define KHR_DF_CHANNEL_RGBSDA_GREEN 1
+#define KHR_DF_CHANNEL_RGBSDA_BLUE 2
+#define KHR_DF_CHANNEL_RGBSDA_ALPHA 15
+
+static uint32_t readU32(const uint8_t *p_data) {
+	uint32_t value;
+	memcpy(&value, p_data, sizeof(value));
+	return value;
+}
+
+static uint64_t readU64(const uint8_t *p_data) {
+	uint64_t value;
+	memcpy(&value, p_data, sizeof(value));
+	return value;
+}
+
+static void appendU8(std::vector<uint8_t> &r_file, uint8_t p_value) {
+	r_file.push_back(p_value);
+}
+
+static void appendU16(std::vector<uint8_t> &r_file, uint16_t p_value) {
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&p_value);
+	r_file.insert(r_file.end(), bytes, bytes + sizeof(p_value));
+}
+
+static void appendU32(std::vector<uint8_t> &r_file, uint32_t p_value) {
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&p_value);
+	r_file.insert(r_file.end(), bytes, bytes + sizeof(p_value));
+}
+
+static void appendU64(std::vector<uint8_t> &r_file, uint64_t p_value) {
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&p_value);
+	r_file.insert(r_file.end(), bytes, bytes + sizeof(p_value));
+}
+
+static void writeU64(std::vector<uint8_t> &r_file, size_t p_offset, uint64_t p_value) {
+	memcpy(r_file.data() + p_offset, &p_value, sizeof(p_value));
+}
+
+static void appendSample(std::vector<uint8_t> &r_file, uint16_t p_bitOffset, uint8_t p_bitLength, uint8_t p_channel) {
+	appendU16(r_file, p_bitOffset);
+	appendU8(r_file, p_bitLength - 1);
+	appendU8(r_file, p_channel);
+	appendU32(r_file, 0); // Sample position
+	appendU32(r_file, 0); // Lower
+	appendU32(r_file, p_bitLength >= 32 ? UINT32_MAX : (1u << p_bitLength) - 1); // Upper
+}
+
+uint32_t KTX2::getBlockSize(VkFormat p_format) {
+	switch (p_format) {
+		case VK_FORMAT_R8_UNORM:
+		case VK_FORMAT_R8_SRGB:
+			return 1;
+		case VK_FORMAT_R8G8_UNORM:
+		case VK_FORMAT_R8G8_SRGB:
+			return 2;
+		case VK_FORMAT_R8G8B8A8_UNORM:
+		case VK_FORMAT_R8G8B8A8_SRGB:
+			return 4;
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+		case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+			return 8;
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+		case VK_FORMAT_BC3_SRGB_BLOCK:
+			return 16;
+		default:
+			return 0;
+	}
+}
+
+bool KTX2::isBlockCompressed(VkFormat p_format) {
+	// The uncompressed formats have at most 4 bytes per texel
+	return getBlockSize(p_format) >= 8;
+}
+
+uint64_t KTX2::getUniversalLevelSize(uint32_t p_width, uint32_t p_height, uint32_t p_level, bool p_alpha) {
+	const uint64_t blocksX = (MAX(p_width >> p_level, 1u) + 3) / 4;
+	const uint64_t blocksY = (MAX(p_height >> p_level, 1u) + 3) / 4;
+	return blocksX * blocksY * UNIVERSAL_BLOCK_SIZE * (p_alpha ? 2 : 1);
+}
+
+uint64_t KTX2::getLevelSize(VkFormat p_format, uint32_t p_width, uint32_t p_height, uint32_t p_level) {
+	uint64_t width = MAX(p_width >> p_level, 1u);
+	uint64_t height = MAX(p_height >> p_level, 1u);
+
+	if (isBlockCompressed(p_format)) {
+		// 4x4 blocks
+		width = (width + 3) / 4;
+		height = (height + 3) / 4;
+	}
+
+	return width * height * getBlockSize(p_format);
+}
+
+bool KTX2::parse(const uint8_t *p_data, size_t p_size, Header &r_header) {
+
+	ERR_FAIL_COND_V(p_size < sizeof(KTX2_IDENTIFIER) + KTX2_HEADER_SIZE, false);
+
+	if (0 != memcmp(p_data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER))) {
+		ERR_EXPLAIN("Not a KTX2 file");
+		ERR_FAIL_V(false);
+	}
+
+	const uint8_t *header = p_data + sizeof(KTX2_IDENTIFIER);
+	const VkFormat format = VkFormat(readU32(header + 0));
+	const uint32_t width = readU32(header + 8);
+	const uint32_t height = readU32(header + 12);
+	const uint32_t depth = readU32(header + 16);
+	const uint32_t layerCount = readU32(header + 20);
+	const uint32_t faceCount = readU32(header + 24);
+	const uint32_t levelCount = MAX(readU32(header + 28), 1u);
+	const uint32_t supercompression = readU32(header + 32);
+
+	if (!width || !height || depth > 1 || layerCount > 1 || faceCount != 1 || supercompression) {
+		ERR_EXPLAIN("Only 2D KTX2 files without supercompression are supported");
+		ERR_FAIL_V(false);
+	}
+
+	bool universal = false;
+	bool alpha = false;
+
+	if (VK_FORMAT_UNDEFINED == format) {
+		// The universal blocks are identified by the data format descriptor
+		const uint32_t dfdOffset = readU32(header + 36);
+		const uint32_t dfdSize = readU32(header + 40);
+		ERR_FAIL_COND_V(dfdSize < 4 + 24 || size_t(dfdOffset) + dfdSize > p_size, false);
+
+		const uint8_t *dfd = p_data + dfdOffset;
+		const uint16_t blockSize = uint16_t(dfd[10] | (dfd[11] << 8));
+		if (KHR_DF_MODEL_ETC1S != dfd[12] || blockSize < 24 || size_t(4) + blockSize > dfdSize) {
+			ERR_EXPLAIN("KTX2 format not supported: only the universal blocks have an undefined format");
+			ERR_FAIL_V(false);
+		}
+
+		universal = true;
+		alpha = (blockSize - 24) / 16 > 1;
+	} else if (0 == getBlockSize(format)) {
+		ERR_EXPLAIN("KTX2 format not supported: " + std::to_string(format));
+		ERR_FAIL_V(false);
+	}
+
+	// Down to 1x1 of the largest size, the sizes of the levels shift by it
+	ERR_FAIL_COND_V(levelCount > 32, false);
+
+	const size_t levelIndexOffset = sizeof(KTX2_IDENTIFIER) + KTX2_HEADER_SIZE;
+	ERR_FAIL_COND_V(p_size < levelIndexOffset + size_t(levelCount) * KTX2_LEVEL_INDEX_ENTRY_SIZE, false);
+
+	r_header.format = format;
+	r_header.universal = universal;
+	r_header.alpha = alpha;
+	r_header.width = width;
+	r_header.height = height;
+	r_header.levels.resize(levelCount);
+
+	for (uint32_t i = 0; i < levelCount; ++i) {
+		const uint8_t *entry = p_data + levelIndexOffset + i * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+		Level &level = r_header.levels[i];
+		level.offset = readU64(entry + 0);
+		level.size = readU64(entry + 8);
+
+		const uint64_t expectedSize = universal ? getUniversalLevelSize(width, height, i, alpha) : getLevelSize(format, width, height, i);
+		// The sum could overflow with a crafted offset
+		if (level.offset > p_size || level.size > p_size - level.offset || level.size != expectedSize) {
+			ERR_EXPLAIN("Corrupted KTX2 level " + std::to_string(i));
+			ERR_FAIL_V(false);
+		}
+	}
+
+	return true;
+}
+
+static void appendDFDHeader(std::vector<uint8_t> &r_dfd, uint8_t p_model, bool p_srgb, uint8_t p_blockDimension, uint8_t p_bytesPlane0, int p_samples) {
+	const uint16_t blockSize = 24 + 16 * p_samples;
+	appendU32(r_dfd, 4 + blockSize); // Total size
+	appendU32(r_dfd, 0); // Khronos vendor, basic descriptor type
+	appendU16(r_dfd, 2); // Version
+	appendU16(r_dfd, blockSize);
+	appendU8(r_dfd, p_model);
+	appendU8(r_dfd, KHR_DF_PRIMARIES_BT709);
+	appendU8(r_dfd, p_srgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR);
+	appendU8(r_dfd, 0); // Straight alpha
+	appendU8(r_dfd, p_blockDimension);
+	appendU8(r_dfd, p_blockDimension);
+	appendU8(r_dfd, 0);
+	appendU8(r_dfd, 0);
+	appendU8(r_dfd, p_bytesPlane0);
+	for (int i = 1; i < 8; ++i) {
+		appendU8(r_dfd, 0);
+	}
+}
+
+// The levels are stored from the smallest, each aligned to p_alignment
+static void writeContainer(VkFormat p_format, uint32_t p_width, uint32_t p_height, const std::vector<uint8_t> &p_dfd, const std::vector<std::vector<uint8_t> > &p_levels, size_t p_alignment, std::vector<uint8_t> &r_file) {
+
+	const uint32_t levelCount = p_levels.size();
+	const size_t levelIndexOffset = sizeof(KTX2_IDENTIFIER) + KTX2_HEADER_SIZE;
+	const size_t dfdOffset = levelIndexOffset + levelCount * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+
+	r_file.clear();
+	r_file.insert(r_file.end(), KTX2_IDENTIFIER, KTX2_IDENTIFIER + sizeof(KTX2_IDENTIFIER));
+
+	appendU32(r_file, p_format);
+	appendU32(r_file, 1); // Type size, 1 for the blocks and the bytes
+	appendU32(r_file, p_width);
+	appendU32(r_file, p_height);
+	appendU32(r_file, 0); // Depth
+	appendU32(r_file, 0); // Layers
+	appendU32(r_file, 1); // Faces
+	appendU32(r_file, levelCount);
+	appendU32(r_file, 0); // Supercompression
+
+	appendU32(r_file, dfdOffset);
+	appendU32(r_file, p_dfd.size());
+	appendU32(r_file, 0); // Key values
+	appendU32(r_file, 0);
+	appendU64(r_file, 0); // Supercompression global data
+	appendU64(r_file, 0);
+
+	// The level index is filled once the data is placed
+	r_file.resize(dfdOffset, 0);
+	r_file.insert(r_file.end(), p_dfd.begin(), p_dfd.end());
+
+	for (int i = levelCount - 1; 0 <= i; --i) {
+		r_file.resize((r_file.size() + p_alignment - 1) / p_alignment * p_alignment, 0);
+
+		const size_t entry = levelIndexOffset + i * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+		writeU64(r_file, entry + 0, r_file.size());
+		writeU64(r_file, entry + 8, p_levels[i].size());
+		writeU64(r_file, entry + 16, p_levels[i].size());
+
+		r_file.insert(r_file.end(), p_levels[i].begin(), p_levels[i].end());
+	}
+}
+
+void KTX2::write(VkFormat p_format, uint32_t p_width, uint32_t p_height, const std::vector<std::vector<uint8_t> > &p_levels, std::vector<uint8_t> &r_file) {
+	ERR_FAIL_COND(!getBlockSize(p_format));
+	ERR_FAIL_COND(p_levels.empty());
+
+	for (size_t i = 0; i < p_levels.size(); ++i) {
+		ERR_FAIL_COND(p_levels[i].size() != getLevelSize(p_format, p_width, p_height, i));
+	}
+
+	const bool srgb = VK_FORMAT_R8G8B8A8_SRGB == p_format || VK_FORMAT_BC1_RGB_SRGB_BLOCK == p_format ||
+					  VK_FORMAT_BC1_RGBA_SRGB_BLOCK == p_format || VK_FORMAT_BC3_SRGB_BLOCK == p_format;
+
+	// Data format descriptor
+	std::vector<uint8_t> dfd;
+	if (VK_FORMAT_R8G8B8A8_UNORM == p_format || VK_FORMAT_R8G8B8A8_SRGB == p_format) {
+		appendDFDHeader(dfd, KHR_DF_MODEL_RGBSDA, srgb, 0, 4, 4);
+		appendSample(dfd, 0, 8, KHR_DF_CHANNEL_RGBSDA_RED);
+		appendSample(dfd, 8, 8, KHR_DF_CHANNEL_RGBSDA_GREEN);
+		appendSample(dfd, 16, 8, KHR_DF_CHANNEL_RGBSDA_BLUE);
+		appendSample(dfd, 24, 8, KHR_DF_CHANNEL_RGBSDA_ALPHA);
+	} else if (VK_FORMAT_BC3_UNORM_BLOCK == p_format || VK_FORMAT_BC3_SRGB_BLOCK == p_format) {
+		appendDFDHeader(dfd, KHR_DF_MODEL_BC3, srgb, 3, 16, 2);
+		appendSample(dfd, 0, 64, KHR_DF_CHANNEL_BC3_ALPHA);
+		appendSample(dfd, 64, 64, KHR_DF_CHANNEL_BC3_COLOR);
+	} else {
+		appendDFDHeader(dfd, KHR_DF_MODEL_BC1A, srgb, 3, 8, 1);
+		appendSample(dfd, 0, 64, KHR_DF_CHANNEL_BC1A_COLOR);
+	}
+
+	writeContainer(p_format, p_width, p_height, dfd, p_levels, MAX(getBlockSize(p_format), 4u), r_file);
+}
+
+void KTX2::writeUniversal(uint32_t p_width, uint32_t p_height, bool p_alpha, const std::vector<std::vector<uint8_t> > &p_levels, std::vector<uint8_t> &r_file) {
+	ERR_FAIL_COND(p_levels.empty());
+
+	for (size_t i = 0; i < p_levels.size(); ++i) {
+		ERR_FAIL_COND(p_levels[i].size() != getUniversalLevelSize(p_width, p_height, i, p_alpha));
+	}
+
+	// The alpha slice is a sample of its own, as in the basis files
+	std::vector<uint8_t> dfd;
+	appendDFDHeader(dfd, KHR_DF_MODEL_ETC1S, false, 3, p_alpha ? 16 : 8, p_alpha ? 2 : 1);
+	appendSample(dfd, 0, 64, KHR_DF_CHANNEL_ETC1S_RGB);
+	if (p_alpha)
+		appendSample(dfd, 64, 64, KHR_DF_CHANNEL_ETC1S_AAA);
+
+	writeContainer(VK_FORMAT_UNDEFINED, p_width, p_height, dfd, p_levels, UNIVERSAL_BLOCK_SIZE, r_file);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "libs/vulkan/vulkan_core.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// KTX2
+//		Reader and writer of the KTX2 container, limited to what the texture
+// cooker produces: 2D images, one layer, one face, no supercompression.
+//		The level data is stored as is, so a block compressed level can be
+// copied directly in the staging buffer.
+//		The universal files (see Transcoder) have an undefined format and the
+// ETC1S color model, each level has the color blocks followed by the alpha
+// blocks when the image has alpha.
+//		The file stores the levels from the smallest, the level index is used
+// to find them; the levels here are always ordered from the level 0.
+class KTX2 {
+public:
+	struct Level {
+		uint64_t offset; // From the file begin
+		uint64_t size;
+	};
+
+	struct Header {
+		VkFormat format; // Undefined for the universal blocks
+		bool universal;
+		bool alpha; // Only for the universal blocks
+		uint32_t width;
+		uint32_t height;
+		std::vector<Level> levels;
+
+		Header() :
+				format(VK_FORMAT_UNDEFINED),
+				universal(false),
+				alpha(false),
+				width(0),
+				height(0) {}
+	};
+
+	// Bytes of a universal block, of each slice
+	static const uint32_t UNIVERSAL_BLOCK_SIZE = 8;
+
+	// Validate the file and read the level index, the data is not copied
+	static bool parse(const uint8_t *p_data, size_t p_size, Header &r_header);
+
+	// p_levels are ordered from the level 0
+	static void write(VkFormat p_format, uint32_t p_width, uint32_t p_height, const std::vector<std::vector<uint8_t> > &p_levels, std::vector<uint8_t> &r_file);
+	static void writeUniversal(uint32_t p_width, uint32_t p_height, bool p_alpha, const std::vector<std::vector<uint8_t> > &p_levels, std::vector<uint8_t> &r_file);
+
+	// The bytes of a block (or of a texel for the uncompressed formats),
+	// 0 when the format is not supported
+	static uint32_t getBlockSize(VkFormat p_format);
+	static bool isBlockCompressed(VkFormat p_format);
+
+	// Size of a level, rounded up to whole blocks
+	static uint64_t getLevelSize(VkFormat p_format, uint32_t p_width, uint32_t p_height, uint32_t p_level);
+	static uint64_t getUniversalLevelSize(uint32_t p_width, uint32_t p_height, uint32_t p_level, bool p_alpha);
+};
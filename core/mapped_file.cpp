@@ -0,0 +1,112 @@
+#include "mapped_file.h"
+
+#include "core/error_macros.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() :
+		data(nullptr),
+		size(0),
+#ifdef _WIN32
+		fileHandle(INVALID_HANDLE_VALUE),
+		mappingHandle(nullptr)
+#else
+		fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &p_path) {
+	close();
+
+	fileHandle = CreateFileA(p_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	ERR_FAIL_COND_V(INVALID_HANDLE_VALUE == fileHandle, false);
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || 0 == fileSize.QuadPart) {
+		close();
+		ERR_EXPLAIN("Can't map the empty file: " + p_path);
+		ERR_FAIL_V(false);
+	}
+
+	mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mappingHandle) {
+		close();
+		ERR_FAIL_V(false);
+	}
+
+	data = static_cast<const uint8_t *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	if (!data) {
+		close();
+		ERR_FAIL_V(false);
+	}
+
+	size = size_t(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::close() {
+	if (data)
+		UnmapViewOfFile(data);
+	if (mappingHandle)
+		CloseHandle(mappingHandle);
+	if (INVALID_HANDLE_VALUE != fileHandle)
+		CloseHandle(fileHandle);
+
+	data = nullptr;
+	size = 0;
+	mappingHandle = nullptr;
+	fileHandle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool MappedFile::open(const std::string &p_path) {
+	close();
+
+	fd = ::open(p_path.c_str(), O_RDONLY);
+	ERR_FAIL_COND_V(0 > fd, false);
+
+	struct stat fileStat;
+	if (0 != fstat(fd, &fileStat) || 0 == fileStat.st_size) {
+		close();
+		ERR_EXPLAIN("Can't map the empty file: " + p_path);
+		ERR_FAIL_V(false);
+	}
+
+	void *mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == mapping) {
+		close();
+		ERR_FAIL_V(false);
+	}
+
+	data = static_cast<const uint8_t *>(mapping);
+	size = fileStat.st_size;
+	return true;
+}
+
+void MappedFile::close() {
+	if (data)
+		munmap(const_cast<uint8_t *>(data), size);
+	if (0 <= fd)
+		::close(fd);
+
+	data = nullptr;
+	size = 0;
+	fd = -1;
+}
+
+#endif
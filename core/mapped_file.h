@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read only memory mapping of a whole file, the pages are loaded by the OS
+// on access so the data can be copied without reading it in a buffer first
+class MappedFile {
+	const uint8_t *data;
+	size_t size;
+
+#ifdef _WIN32
+	void *fileHandle;
+	void *mappingHandle;
+#else
+	int fd;
+#endif
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool open(const std::string &p_path);
+	void close();
+
+	bool isOpen() const { return data != nullptr; }
+	const uint8_t *getData() const { return data; }
+	size_t getSize() const { return size; }
+};
@@ -0,0 +1,275 @@
+#include "memory_tracker.h"
+
+#include "core/error_macros.h"
+#include "core/print_string.h"
+#include "core/string.h"
+
+// The Vulkan headers in use are older than VK_EXT_memory_budget
+#ifndef VK_EXT_memory_budget
+#define VK_EXT_memory_budget 1
+#define VK_EXT_MEMORY_BUDGET_EXTENSION_NAME "VK_EXT_memory_budget"
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT ((VkStructureType)1000237000)
+
+typedef struct VkPhysicalDeviceMemoryBudgetPropertiesEXT {
+	VkStructureType sType;
+	void *pNext;
+	VkDeviceSize heapBudget[VK_MAX_MEMORY_HEAPS];
+	VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS];
+} VkPhysicalDeviceMemoryBudgetPropertiesEXT;
+#endif
+
+const float MemoryTracker::ESTIMATED_BUDGET_RATIO = 0.8;
+
+const char *MemoryTracker::getCategoryName(Category p_category) {
+	static const char *names[CATEGORY_MAX] = {
+		"mesh",
+		"texture",
+		"uniform",
+		"staging",
+		"attachment"
+	};
+	ERR_FAIL_INDEX_V(p_category, CATEGORY_MAX, "");
+	return names[p_category];
+}
+
+MemoryTracker::MemoryTracker() :
+		physicalDevice(VK_NULL_HANDLE),
+		memoryProperties({}),
+		getMemoryProperties2(nullptr) {}
+
+void MemoryTracker::create(VkInstance p_instance, VkPhysicalDevice p_physicalDevice, bool p_budgetExtension) {
+
+	physicalDevice = p_physicalDevice;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	getMemoryProperties2 = nullptr;
+	if (p_budgetExtension) {
+		getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(
+				p_instance,
+				"vkGetPhysicalDeviceMemoryProperties2KHR");
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		heapTrackedBytes.assign(memoryProperties.memoryHeapCount, 0);
+		heaps.resize(memoryProperties.memoryHeapCount);
+		for (size_t i = 0; i < callbacks.size(); ++i) {
+			callbacks[i].exceeded.assign(heaps.size(), false);
+		}
+	}
+
+	updateBudget();
+
+	print_verbose(std::string("Memory tracker created, budget ") + (getMemoryProperties2 ? "from VK_EXT_memory_budget" : "estimated"));
+}
+
+void MemoryTracker::destroy() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (allocations.size())
+		WARN_PRINTS("Memory tracker destroyed with " + itos(allocations.size()) + " live allocations");
+
+	allocations.clear();
+	heapTrackedBytes.clear();
+	heaps.clear();
+	for (int c = 0; c < CATEGORY_MAX; ++c) {
+		categories[c] = CategoryStats();
+		hostCategories[c] = CategoryStats();
+	}
+	getMemoryProperties2 = nullptr;
+	physicalDevice = VK_NULL_HANDLE;
+}
+
+void MemoryTracker::trackAllocation(uint64_t p_handle, Category p_category, VkDeviceSize p_size, uint32_t p_memoryType) {
+	ERR_FAIL_COND(!p_handle);
+	ERR_FAIL_INDEX(p_category, CATEGORY_MAX);
+	ERR_FAIL_COND(p_memoryType >= memoryProperties.memoryTypeCount);
+
+	Allocation allocation;
+	allocation.category = p_category;
+	allocation.size = p_size;
+	allocation.heapIndex = memoryProperties.memoryTypes[p_memoryType].heapIndex;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	allocations[p_handle] = allocation;
+
+	CategoryStats &stats = categories[p_category];
+	stats.liveBytes += p_size;
+	stats.peakBytes = MAX(stats.peakBytes, stats.liveBytes);
+	++stats.liveCount;
+	stats.peakCount = MAX(stats.peakCount, stats.liveCount);
+	++stats.totalCount;
+
+	heapTrackedBytes[allocation.heapIndex] += p_size;
+}
+
+void MemoryTracker::untrackAllocation(uint64_t p_handle) {
+	if (!p_handle)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto it = allocations.find(p_handle);
+	if (it == allocations.end())
+		return;
+
+	CategoryStats &stats = categories[it->second.category];
+	stats.liveBytes -= it->second.size;
+	--stats.liveCount;
+
+	heapTrackedBytes[it->second.heapIndex] -= it->second.size;
+
+	allocations.erase(it);
+}
+
+MemoryTracker::CategoryStats MemoryTracker::getCategoryStats(Category p_category) {
+	ERR_FAIL_INDEX_V(p_category, CATEGORY_MAX, CategoryStats());
+	std::lock_guard<std::mutex> lock(mutex);
+	return categories[p_category];
+}
+
+void MemoryTracker::trackHostMemory(Category p_category, uint64_t p_size) {
+	ERR_FAIL_INDEX(p_category, CATEGORY_MAX);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	CategoryStats &stats = hostCategories[p_category];
+	stats.liveBytes += p_size;
+	stats.peakBytes = MAX(stats.peakBytes, stats.liveBytes);
+	++stats.liveCount;
+	stats.peakCount = MAX(stats.peakCount, stats.liveCount);
+	++stats.totalCount;
+}
+
+void MemoryTracker::untrackHostMemory(Category p_category, uint64_t p_size) {
+	ERR_FAIL_INDEX(p_category, CATEGORY_MAX);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	CategoryStats &stats = hostCategories[p_category];
+	ERR_FAIL_COND(stats.liveBytes < p_size || !stats.liveCount);
+	stats.liveBytes -= p_size;
+	--stats.liveCount;
+}
+
+MemoryTracker::CategoryStats MemoryTracker::getHostCategoryStats(Category p_category) {
+	ERR_FAIL_INDEX_V(p_category, CATEGORY_MAX, CategoryStats());
+	std::lock_guard<std::mutex> lock(mutex);
+	return hostCategories[p_category];
+}
+
+void MemoryTracker::addBudgetCallback(float p_threshold, BudgetCallback p_callback, void *p_userData) {
+	ERR_FAIL_COND(!p_callback);
+	ERR_FAIL_COND(p_threshold <= 0 || p_threshold > 1);
+
+	Callback callback;
+	callback.threshold = p_threshold;
+	callback.function = p_callback;
+	callback.userData = p_userData;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	callback.exceeded.assign(heaps.size(), false);
+	callbacks.push_back(callback);
+}
+
+void MemoryTracker::removeBudgetCallback(BudgetCallback p_callback, void *p_userData) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int i = callbacks.size() - 1; 0 <= i; --i) {
+		if (callbacks[i].function == p_callback && callbacks[i].userData == p_userData)
+			callbacks.erase(callbacks.begin() + i);
+	}
+}
+
+void MemoryTracker::updateBudget() {
+	if (VK_NULL_HANDLE == physicalDevice)
+		return;
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps = {};
+	if (getMemoryProperties2) {
+		budgetProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+		VkPhysicalDeviceMemoryProperties2KHR props2 = {};
+		props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+		props2.pNext = &budgetProps;
+		getMemoryProperties2(physicalDevice, &props2);
+	}
+
+	std::vector<BudgetCall> calls;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (uint32_t i = 0; i < heaps.size(); ++i) {
+			HeapBudget &heap = heaps[i];
+			heap.size = memoryProperties.memoryHeaps[i].size;
+			heap.deviceLocal = memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+			heap.trackedBytes = heapTrackedBytes[i];
+
+			if (getMemoryProperties2) {
+				heap.budget = budgetProps.heapBudget[i];
+				heap.usage = budgetProps.heapUsage[i];
+			} else {
+				heap.budget = VkDeviceSize(heap.size * ESTIMATED_BUDGET_RATIO);
+				heap.usage = heap.trackedBytes;
+			}
+		}
+
+		for (size_t c = 0; c < callbacks.size(); ++c) {
+			Callback &callback = callbacks[c];
+			for (uint32_t i = 0; i < heaps.size(); ++i) {
+				const bool exceeded = heaps[i].getUsageRatio() >= callback.threshold;
+				if (exceeded == callback.exceeded[i])
+					continue;
+
+				callback.exceeded[i] = exceeded;
+
+				BudgetCall call;
+				call.function = callback.function;
+				call.userData = callback.userData;
+				call.heapIndex = i;
+				call.heap = heaps[i];
+				call.exceeded = exceeded;
+				calls.push_back(call);
+			}
+		}
+	}
+
+	for (size_t c = 0; c < calls.size(); ++c) {
+		calls[c].function(calls[c].heapIndex, calls[c].heap, calls[c].exceeded, calls[c].userData);
+	}
+}
+
+std::vector<MemoryTracker::HeapBudget> MemoryTracker::getHeapBudgets() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return heaps;
+}
+
+void MemoryTracker::printReport() {
+
+	updateBudget();
+
+	print_line("GPU memory by category (live / peak KiB, live / peak allocations):");
+	for (int c = 0; c < CATEGORY_MAX; ++c) {
+		const CategoryStats stats = getCategoryStats((Category)c);
+		print_line(std::string("  ") + getCategoryName((Category)c) + ": " +
+				   itos(stats.liveBytes / 1024) + " / " + itos(stats.peakBytes / 1024) + ", " +
+				   itos(stats.liveCount) + " / " + itos(stats.peakCount));
+	}
+
+	print_line("Host memory by category (live / peak KiB, live / peak blocks):");
+	for (int c = 0; c < CATEGORY_MAX; ++c) {
+		const CategoryStats stats = getHostCategoryStats((Category)c);
+		if (!stats.totalCount)
+			continue;
+		print_line(std::string("  ") + getCategoryName((Category)c) + ": " +
+				   itos(stats.liveBytes / 1024) + " / " + itos(stats.peakBytes / 1024) + ", " +
+				   itos(stats.liveCount) + " / " + itos(stats.peakCount));
+	}
+
+	const std::vector<HeapBudget> budgets = getHeapBudgets();
+	print_line(std::string("Heaps (usage / budget MiB, ") + (getMemoryProperties2 ? "VK_EXT_memory_budget" : "estimated") + "):");
+	for (uint32_t i = 0; i < budgets.size(); ++i) {
+		print_line("  " + itos(i) + (budgets[i].deviceLocal ? " device local: " : " host: ") +
+				   itos(budgets[i].usage / (1024 * 1024)) + " / " + itos(budgets[i].budget / (1024 * 1024)) +
+				   ", tracked " + itos(budgets[i].trackedBytes / (1024 * 1024)));
+	}
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "hellovulkan.h"
+#include <mutex>
+#include <unordered_map>
+
+// MEMORY TRACKER
+//		Each GPU allocation is tagged with a category, so the live and peak
+// bytes are known per category and per memory heap.
+//		The heap budget is read from VK_EXT_memory_budget when the device
+// supports it, otherwise the budget is estimated as a fraction of the heap
+// size and the usage is the tracked bytes.
+//		The budget callbacks are called by updateBudget (once per frame, from
+// the thread that draws) when the usage of a heap crosses their threshold,
+// so the streaming can release memory before the allocations fail.
+//		The host memory kept by the renderer for its resources (e.g. the
+// geometry of the meshes in the scene) is tracked by category too, by size
+// only.
+class MemoryTracker {
+public:
+	enum Category {
+		CATEGORY_MESH,
+		CATEGORY_TEXTURE,
+		CATEGORY_UNIFORM,
+		CATEGORY_STAGING,
+		CATEGORY_ATTACHMENT,
+		CATEGORY_MAX
+	};
+
+	struct CategoryStats {
+		uint64_t liveBytes;
+		uint64_t peakBytes;
+		uint32_t liveCount;
+		uint32_t peakCount;
+		uint64_t totalCount; // Allocations since the creation
+
+		CategoryStats() :
+				liveBytes(0),
+				peakBytes(0),
+				liveCount(0),
+				peakCount(0),
+				totalCount(0) {}
+	};
+
+	struct HeapBudget {
+		VkDeviceSize size;
+		VkDeviceSize budget;
+		VkDeviceSize usage; // Of all the processes when the extension is used
+		VkDeviceSize trackedBytes; // Allocated by this process
+		bool deviceLocal;
+
+		float getUsageRatio() const { return budget ? float(double(usage) / budget) : 0; }
+	};
+
+	// p_exceeded is true when the usage goes above the threshold and false
+	// when it comes back under
+	typedef void (*BudgetCallback)(uint32_t p_heapIndex, const HeapBudget &p_heap, bool p_exceeded, void *p_userData);
+
+	// Used when the device doesn't report the budget
+	static const float ESTIMATED_BUDGET_RATIO;
+
+	static const char *getCategoryName(Category p_category);
+
+private:
+	struct Allocation {
+		Category category;
+		VkDeviceSize size;
+		uint32_t heapIndex;
+	};
+
+	struct Callback {
+		float threshold;
+		BudgetCallback function;
+		void *userData;
+
+		// One per heap
+		std::vector<bool> exceeded;
+	};
+
+	// A crossing found under the lock, the callback is called after
+	struct BudgetCall {
+		BudgetCallback function;
+		void *userData;
+		uint32_t heapIndex;
+		HeapBudget heap;
+		bool exceeded;
+	};
+
+	VkPhysicalDevice physicalDevice;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+
+	// Null when VK_EXT_memory_budget is not used
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2;
+
+	std::mutex mutex;
+
+	// Keyed by the VmaAllocation or the VkDeviceMemory
+	std::unordered_map<uint64_t, Allocation> allocations;
+	CategoryStats categories[CATEGORY_MAX];
+	CategoryStats hostCategories[CATEGORY_MAX];
+	std::vector<VkDeviceSize> heapTrackedBytes;
+
+	std::vector<HeapBudget> heaps;
+	std::vector<Callback> callbacks;
+
+public:
+	MemoryTracker();
+
+	// p_budgetExtension must be true only when both VK_EXT_memory_budget and
+	// VK_KHR_get_physical_device_properties2 are enabled
+	void create(VkInstance p_instance, VkPhysicalDevice p_physicalDevice, bool p_budgetExtension);
+	void destroy();
+
+	bool hasBudgetExtension() const { return getMemoryProperties2 != nullptr; }
+
+	// Thread safe
+	void trackAllocation(uint64_t p_handle, Category p_category, VkDeviceSize p_size, uint32_t p_memoryType);
+	void untrackAllocation(uint64_t p_handle);
+
+	// Thread safe
+	CategoryStats getCategoryStats(Category p_category);
+
+	// Thread safe, each track must be paired with an untrack of the same size
+	void trackHostMemory(Category p_category, uint64_t p_size);
+	void untrackHostMemory(Category p_category, uint64_t p_size);
+	CategoryStats getHostCategoryStats(Category p_category);
+
+	// Calls the callback when a heap crosses the threshold, that is the
+	// usage / budget ratio in the range (0, 1]. Thread safe
+	void addBudgetCallback(float p_threshold, BudgetCallback p_callback, void *p_userData);
+	void removeBudgetCallback(BudgetCallback p_callback, void *p_userData);
+
+	// Reads the budget and calls the callbacks, outside the lock so they can
+	// add or remove callbacks. Thread safe
+	void updateBudget();
+	std::vector<HeapBudget> getHeapBudgets();
+
+	void printReport();
+};
@@ -3,43 +3,57 @@
 #include "VisualServer.h"
 #include "core/error_macros.h"
 #include "core/print_string.h"
+#include "core/profiler.h"
 #include "core/texture.h"
 #include "hellovulkan.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "libs/tiny_obj_loader/tiny_obj_loader.h"
-
-MeshHandle::MeshHandle(Mesh *p_mesh, VulkanServer *p_vulkanServer) :
-		mesh(p_mesh),
+GeometryHandle::GeometryHandle(Geometry *p_geometry, VulkanServer *p_vulkanServer) :
 		vulkanServer(p_vulkanServer),
+		geometry(p_geometry),
+		meshCount(0),
+		verticesSize(0),
+		verticesBufferOffset(0),
 		vertexBuffer(VK_NULL_HANDLE),
 		vertexAllocation(VK_NULL_HANDLE),
+		indicesSize(0),
+		indicesBufferOffset(0),
 		indexBuffer(VK_NULL_HANDLE),
 		indexAllocation(VK_NULL_HANDLE),
-		imageDescriptorSet(VK_NULL_HANDLE) {}
+		indexCount(0),
+		boundingRadius(0.f),
+		uploaded(false),
+		hostBytes(0) {
+	geometry->reference();
+}
 
-MeshHandle::~MeshHandle() {
+GeometryHandle::~GeometryHandle() {
 	clear();
+	geometry->unreference();
 }
 
-void MeshHandle::clear() {
+void GeometryHandle::clear() {
 	vulkanServer->destroyBuffer(vulkanServer->bufferMemoryDeviceAllocator,
 			indexBuffer, indexAllocation);
 	vulkanServer->destroyBuffer(vulkanServer->bufferMemoryDeviceAllocator,
 			vertexBuffer, vertexAllocation);
-	if (VK_NULL_HANDLE != imageDescriptorSet) {
-		vkFreeDescriptorSets(vulkanServer->device,
-				vulkanServer->meshImagesDescriptorPool, 1,
-				&imageDescriptorSet);
-		imageDescriptorSet = VK_NULL_HANDLE;
+
+	if (hostBytes) {
+		vulkanServer->memoryTracker.untrackHostMemory(MemoryTracker::CATEGORY_MESH, hostBytes);
+		hostBytes = 0;
 	}
 }
 
-bool MeshHandle::prepare() {
+bool GeometryHandle::prepare() {
+
+	if (!geometry->hasData()) {
+		print_error("[ERROR] The geometry has no data (released by its residency?), mesh not added");
+		return false;
+	}
 
 	if (!vulkanServer->createBuffer(
 				vulkanServer->bufferMemoryDeviceAllocator,
-				mesh->verticesSizeInBytes(),
+				MemoryTracker::CATEGORY_MESH,
+				geometry->verticesSizeInBytes(),
 				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 				VK_SHARING_MODE_EXCLUSIVE,
 				VMA_MEMORY_USAGE_GPU_ONLY,
@@ -52,7 +66,7 @@ bool MeshHandle::prepare() {
 	}
 
 	if (!vulkanServer->createBuffer(
-				vulkanServer->bufferMemoryDeviceAllocator, mesh->indicesSizeInBytes(),
+				vulkanServer->bufferMemoryDeviceAllocator, MemoryTracker::CATEGORY_MESH, geometry->indicesSizeInBytes(),
 				VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 				VK_SHARING_MODE_EXCLUSIVE, VMA_MEMORY_USAGE_GPU_ONLY, indexBuffer,
 				indexAllocation)) {
@@ -62,157 +76,196 @@ bool MeshHandle::prepare() {
 		return false;
 	}
 
-	verticesSize = mesh->verticesSizeInBytes();
+	verticesSize = geometry->verticesSizeInBytes();
 	verticesBufferOffset = 0;
-	indicesSize = mesh->indicesSizeInBytes();
+	indicesSize = geometry->indicesSizeInBytes();
 	indicesBufferOffset = 0;
-	meshUniformBufferOffset = vulkanServer->meshUniformBufferData.count++;
-	hasTransformationChange = true;
+	indexCount = geometry->getCountIndices();
 
-	if (!allocateImagesDescriptorSet()) {
+	boundingRadius = 0.f;
+	for (size_t i = 0; i < geometry->vertices.size(); ++i) {
+		boundingRadius = MAX(boundingRadius, glm::length(geometry->vertices[i].pos));
+	}
 
-		print_error("[ERROR] Mesh images allocation failed");
+	hostBytes = geometry->getHostBytes();
+	vulkanServer->memoryTracker.trackHostMemory(MemoryTracker::CATEGORY_MESH, hostBytes);
+
+	return true;
+}
+
+void GeometryHandle::onUploaded() {
+	uploaded = true;
+
+	if (Geometry::RESIDENCY_KEEP == geometry->getResidency())
+		return;
+
+	geometry->onUploaded();
+
+	vulkanServer->memoryTracker.untrackHostMemory(MemoryTracker::CATEGORY_MESH, hostBytes);
+	hostBytes = 0;
+}
+
+MeshHandle::MeshHandle(Mesh *p_mesh, VulkanServer *p_vulkanServer) :
+		mesh(p_mesh),
+		vulkanServer(p_vulkanServer),
+		geometry(nullptr),
+		transformation(1.f),
+		colorTexture(nullptr),
+		imageDescriptorSet(VK_NULL_HANDLE),
+		textureIndex(0),
+		imageDescriptorView(VK_NULL_HANDLE),
+		imageDescriptorSampler(VK_NULL_HANDLE) {}
+
+MeshHandle::~MeshHandle() {
+	clear();
+}
+
+void MeshHandle::clear() {
+	if (geometry) {
+		vulkanServer->releaseGeometry(geometry);
+		geometry = nullptr;
+	}
+	releaseImages();
+}
+
+bool MeshHandle::prepare() {
+
+	// The buffers are created by the first mesh of the geometry
+	geometry = vulkanServer->acquireGeometry(mesh->geometry);
+	if (!geometry) {
 		clear();
 		return false;
 	}
 
+	meshUniformBufferOffset = vulkanServer->meshUniformBufferData.count++;
+	hasTransformationChange = true;
+
 	updateImages();
 
-	return true;
-}
+	if (VK_NULL_HANDLE == imageDescriptorView) {
 
-bool MeshHandle::allocateImagesDescriptorSet() {
-	// Allocate dynamic buffer of meshes
-	VkDescriptorSetAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = vulkanServer->meshImagesDescriptorPool;
-	allocInfo.descriptorSetCount = 1;
-	allocInfo.pSetLayouts = &vulkanServer->meshImagesDescriptorSetLayout;
-
-	VkResult res = vkAllocateDescriptorSets(vulkanServer->device, &allocInfo,
-			&imageDescriptorSet);
-	if (res != VK_SUCCESS) {
+		print_error("[ERROR] Mesh images allocation failed");
+		clear();
 		return false;
 	}
 
 	return true;
 }
 
-void MeshHandle::updateImages() {
+bool MeshHandle::updateImages() {
 
-	VkDescriptorImageInfo imageInfo = {};
-	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	const Texture *defaultTexture = vulkanServer->visualServer->getDefaultTeture();
+	const Texture *texture = colorTexture ? colorTexture : defaultTexture;
 
-	VkWriteDescriptorSet writeDesc = {};
-	writeDesc.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	writeDesc.dstSet = imageDescriptorSet;
-	writeDesc.dstBinding = 0;
-	writeDesc.descriptorCount = 1;
-	writeDesc.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	writeDesc.pImageInfo = &imageInfo;
+	if (imageDescriptorView == texture->imageView &&
+			imageDescriptorSampler == texture->imageSampler) {
+		return false;
+	}
 
-	if (mesh->colorTexture) {
-		imageInfo.sampler = mesh->colorTexture->imageSampler;
-		imageInfo.imageView = mesh->colorTexture->imageView;
-	} else {
-		imageInfo.sampler =
-				vulkanServer->visualServer->getDefaultTeture()->imageSampler;
-		imageInfo.imageView =
-				vulkanServer->visualServer->getDefaultTeture()->imageView;
+	// The frames bind the images published by a double buffered texture, so
+	// the set of the mesh is kept when they swap
+	if (texture->doubleBuffered && imageDescriptorView == texture->backImageView &&
+			imageDescriptorSampler == texture->imageSampler) {
+		return false;
 	}
 
-	vkUpdateDescriptorSets(vulkanServer->device, 1, &writeDesc, 0, nullptr);
-}
+	// The new image is acquired before releasing the current one, so when
+	// the texture doesn't change the cached set (or slot) is not recycled
+	if (vulkanServer->isTextureTableEnabled()) {
+
+		TextureTable &table = vulkanServer->textureTable;
+		uint32_t index = table.acquire(texture->imageView, texture->imageSampler);
+
+		if (TextureTable::INVALID_INDEX == index && texture != defaultTexture) {
+			WARN_PRINTS("The texture table is full, the mesh uses the default texture");
+			texture = defaultTexture;
+			if (imageDescriptorView == texture->imageView &&
+					imageDescriptorSampler == texture->imageSampler) {
+				return false;
+			}
+			index = table.acquire(texture->imageView, texture->imageSampler);
+		}
 
-Mesh::Mesh() :
-		colorTexture(nullptr),
-		meshHandle(nullptr),
-		transformation(1.f) {}
+		// On failure the mesh keeps the current slot
+		ERR_FAIL_COND_V(TextureTable::INVALID_INDEX == index, false);
 
-Mesh::~Mesh() {}
+		releaseImages();
+		textureIndex = index;
 
-void Mesh::setColorTexture(Texture *p_colorTexture) {
-	colorTexture = p_colorTexture;
-	if (meshHandle)
-		meshHandle->updateImages();
-}
+	} else {
 
-void Mesh::setTransform(const glm::mat4 &p_transformation) {
-	transformation = p_transformation;
-	if (meshHandle)
-		meshHandle->hasTransformationChange = true;
-}
+		VkDescriptorSet set = vulkanServer->descriptorAllocator.acquireImageSet(
+				vulkanServer->meshImagesDescriptorSetLayout,
+				texture->imageView,
+				texture->imageSampler);
 
-int Mesh::addUniqueTriangle(int p_lastIndex, const Vertex p_vertices[3]) {
-	vertices.push_back(p_vertices[0]);
-	vertices.push_back(p_vertices[1]);
-	vertices.push_back(p_vertices[2]);
+		// On failure the mesh keeps the current set
+		ERR_FAIL_COND_V(VK_NULL_HANDLE == set, false);
 
-	triangles.push_back(
-			Triangle({ (uint32_t)++p_lastIndex, (uint32_t)++p_lastIndex,
-					(uint32_t)++p_lastIndex }));
-	return p_lastIndex;
-}
+		releaseImages();
+		imageDescriptorSet = set;
+	}
 
-// Utility loadObj
-void set_vertex_position(Vertex &r_vertex, tinyobj::index_t &p_index,
-		tinyobj::attrib_t p_attributes) {
-	r_vertex.pos = { p_attributes.vertices[(p_index.vertex_index * 3) + 0],
-		p_attributes.vertices[(p_index.vertex_index * 3) + 1],
-		p_attributes.vertices[(p_index.vertex_index * 3) + 2] };
+	imageDescriptorView = texture->imageView;
+	imageDescriptorSampler = texture->imageSampler;
+	return true;
 }
 
-// Utility loadObj
-void set_vertex_uv(Vertex &r_vertex, tinyobj::index_t &p_index,
-		tinyobj::attrib_t p_attributes) {
-	if (-1 < p_index.texcoord_index) {
-		// Since vulkan texture coords start from  top left corner and obj format
-		// start from bottom left I need invert it using "1. -
-		// p_attributes.texcoords[(p_index.texcoord_index*2)+1]" to make it correct
-		r_vertex.textCoord = {
-			p_attributes.texcoords[(p_index.texcoord_index * 2) + 0],
-			1. - p_attributes.texcoords[(p_index.texcoord_index * 2) + 1]
-		};
+void MeshHandle::releaseImages() {
+	if (VK_NULL_HANDLE == imageDescriptorView)
+		return;
+
+	if (vulkanServer->isTextureTableEnabled()) {
+		vulkanServer->textureTable.release(
+				imageDescriptorView,
+				imageDescriptorSampler);
 	} else {
-		r_vertex.textCoord = { 0, 0 };
+		vulkanServer->descriptorAllocator.releaseImageSet(
+				vulkanServer->meshImagesDescriptorSetLayout,
+				imageDescriptorView,
+				imageDescriptorSampler,
+				vulkanServer->submittedFrames);
 	}
-}
-
-bool Mesh::loadObj(const std::string &p_path) {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string err;
 
-	ERR_FAIL_COND_V(
-			!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, p_path.c_str()),
-			false);
-
-	int lastIndex = -1;
-	for (int i = shapes.size() - 1; 0 <= i; --i) { // Each shape
-
-		std::vector<tinyobj::index_t> &lIndices = shapes[i].mesh.indices; // Contains index of UV, vertex position, normal
-		const size_t indexCount(lIndices.size());
+	imageDescriptorSet = VK_NULL_HANDLE;
+	textureIndex = 0;
+	imageDescriptorView = VK_NULL_HANDLE;
+	imageDescriptorSampler = VK_NULL_HANDLE;
+}
 
-		for (int j = 0; j < indexCount; j += 3) { // Each triangle of shape
+Mesh::Mesh() :
+		visualServer(nullptr),
+		meshHandle(nullptr),
+		geometry(new Geometry),
+		colorTexture(nullptr),
+		transformation(1.f) {}
 
-			int vertexId = j + 0;
-			Vertex vert[3];
+Mesh::~Mesh() {
+	geometry->unreference();
+}
 
-			set_vertex_position(vert[0], lIndices[vertexId], attrib);
-			set_vertex_uv(vert[0], lIndices[vertexId], attrib);
+void Mesh::setGeometry(Geometry *p_geometry) {
+	ERR_FAIL_COND(!p_geometry);
+	ERR_FAIL_COND(visualServer);
 
-			++vertexId;
-			set_vertex_position(vert[1], lIndices[vertexId], attrib);
-			set_vertex_uv(vert[1], lIndices[vertexId], attrib);
+	// The same geometry may be set again
+	p_geometry->reference();
+	geometry->unreference();
+	geometry = p_geometry;
+}
 
-			++vertexId;
-			set_vertex_position(vert[2], lIndices[vertexId], attrib);
-			set_vertex_uv(vert[2], lIndices[vertexId], attrib);
+void Mesh::setColorTexture(Texture *p_colorTexture) {
+	colorTexture = p_colorTexture;
+	if (visualServer)
+		visualServer->meshSetColorTexture(this, p_colorTexture);
+}
 
-			lastIndex = addUniqueTriangle(lastIndex, vert);
-		}
-	}
+void Mesh::setTransform(const glm::mat4 &p_transformation) {
+	transformation = p_transformation;
+	if (visualServer)
+		visualServer->meshSetTransform(this, p_transformation);
+}
 
-	return true;
+bool Mesh::loadObj(const std::string &p_path) {
+	return geometry->loadObj(p_path);
 }
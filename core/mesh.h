@@ -1,19 +1,22 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include "core/geometry.h"
 #include "hellovulkan.h"
-#include "libs/tiny_obj_loader/tiny_obj_loader.h"
 
 class OldVisualServer;
 class VulkanServer;
 class Mesh;
 class Texture;
 
-// This struct is used to know handle the memory of mesh
-class MeshHandle {
+// The device buffers of a Geometry, shared by the handles of all the meshes
+// that use it. Created by the first mesh and destroyed with the last one
+class GeometryHandle {
 public:
 	VulkanServer *vulkanServer;
-	Mesh *mesh;
+	// Referenced until the handle is destroyed
+	Geometry *geometry;
+	uint32_t meshCount;
 
 	size_t verticesSize;
 	VkDeviceSize verticesBufferOffset;
@@ -24,83 +27,87 @@ public:
 	VkDeviceSize indicesBufferOffset;
 	VkBuffer indexBuffer;
 	VmaAllocation indexAllocation;
+	// The draw doesn't read the triangles, they may be released
+	uint32_t indexCount;
 
-	uint32_t meshUniformBufferOffset;
-	bool hasTransformationChange;
+	// Of the vertices, from the origin of the geometry
+	float boundingRadius;
 
-	VkDescriptorSet imageDescriptorSet;
+	// The copy is recorded, the next meshes don't wait a copy
+	bool uploaded;
 
-	MeshHandle(Mesh *p_mesh, VulkanServer *p_vulkanServer);
-	~MeshHandle();
+	// Tracked in the host memory of the mesh category, until the geometry
+	// data is released
+	uint64_t hostBytes;
+
+	GeometryHandle(Geometry *p_geometry, VulkanServer *p_vulkanServer);
+	~GeometryHandle();
 
 	void clear();
 	bool prepare();
-	bool allocateImagesDescriptorSet();
-	void updateImages();
+	// Called once the data is recorded in the copy command buffer, releases
+	// it according to the residency of the geometry
+	void onUploaded();
 };
 
-struct Vertex {
-	glm::vec3 pos;
-	glm::vec2 textCoord; // UV
+// This struct is used to know handle the memory of mesh
+class MeshHandle {
+public:
+	Mesh *mesh;
+	VulkanServer *vulkanServer;
 
-	static VkVertexInputBindingDescription getBindingDescription() {
-		VkVertexInputBindingDescription desc = {};
-		desc.binding = 0;
-		desc.stride = sizeof(Vertex);
-		desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-		return desc;
-	}
+	GeometryHandle *geometry;
+
+	uint32_t meshUniformBufferOffset;
+	bool hasTransformationChange;
 
-	static std::array<VkVertexInputAttributeDescription, 2> getAttributesDescription() {
-		std::array<VkVertexInputAttributeDescription, 2> attr;
-		attr[0].binding = 0;
-		attr[0].location = 0;
-		attr[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attr[0].offset = offsetof(Vertex, pos);
+	// Copy of the Mesh state owned by the renderer
+	glm::mat4 transformation;
+	Texture *colorTexture;
 
-		attr[1].binding = 0;
-		attr[1].location = 2;
-		attr[1].format = VK_FORMAT_R32G32_SFLOAT;
-		attr[1].offset = offsetof(Vertex, textCoord);
+	// Shared with the meshes that use the same texture, the view and the
+	// sampler are the key of the set in the descriptor allocator, or of the
+	// slot in the texture table when it's enabled
+	VkDescriptorSet imageDescriptorSet;
+	uint32_t textureIndex;
+	VkImageView imageDescriptorView;
+	VkSampler imageDescriptorSampler;
 
-		return attr;
-	}
-};
+	MeshHandle(Mesh *p_mesh, VulkanServer *p_vulkanServer);
+	~MeshHandle();
 
-struct Triangle {
-	uint32_t indices[3];
+	void clear();
+	bool prepare();
+	// Returns true when the image descriptor set (or slot) is changed
+	bool updateImages();
+	void releaseImages();
 };
 
+// An instance of a geometry, with its transform and texture
 class Mesh {
+	friend class OldVisualServer;
 	friend class VulkanServer;
 	friend class MeshHandle;
 
+	// Set by the visual server when the mesh is added to the scene
+	OldVisualServer *visualServer;
+
+	// Owned by the renderer
 	MeshHandle *meshHandle;
 
+	Geometry *geometry;
 	Texture *colorTexture;
 	glm::mat4 transformation;
 
 public:
-	std::vector<Vertex> vertices;
-	std::vector<Triangle> triangles;
-
-public:
+	// With its own empty geometry
 	Mesh();
 	~Mesh();
 
-	// Return the size in bytes of vertices
-	const VkDeviceSize verticesSizeInBytes() const {
-		return sizeof(Vertex) * vertices.size();
-	}
-
-	// return the size in bytes of triangles indices
-	const VkDeviceSize indicesSizeInBytes() const {
-		return sizeof(Triangle) * triangles.size();
-	}
-
-	const uint32_t getCountIndices() const {
-		return triangles.size() * 3;
-	}
+	// The mesh references the geometry, and releases the previous one. Can't
+	// be changed while the mesh is in the scene
+	void setGeometry(Geometry *p_geometry);
+	Geometry *getGeometry() const { return geometry; }
 
 	void setColorTexture(Texture *p_colorTexture);
 	const Texture *getColorTexture() const { return colorTexture; }
@@ -110,9 +117,7 @@ public:
 		return transformation;
 	}
 
-	int addUniqueTriangle(int p_lastIndex, const Vertex p_vertices[3]);
-
-	// Load new vertices from OBJ file
+	// Load new vertices from OBJ file, in the geometry of the mesh
 	bool loadObj(const std::string &p_path);
 };
 
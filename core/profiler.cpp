@@ -0,0 +1,203 @@
+#include "profiler.h"
+
+#include "core/error_macros.h"
+#include "core/print_string.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+namespace {
+
+struct ThreadBuffer {
+	uint32_t thread_id;
+	std::string name;
+	std::vector<Profiler::Event> events;
+
+	// Written only by the owner thread
+	std::atomic<uint64_t> write_index;
+	uint32_t depth;
+
+	// The events before this index are discarded
+	std::atomic<uint64_t> clear_index;
+
+	ThreadBuffer(uint32_t p_thread_id) :
+			thread_id(p_thread_id),
+			events(Profiler::THREAD_BUFFER_SIZE),
+			write_index(0),
+			depth(0),
+			clear_index(0) {}
+};
+
+std::mutex buffers_mutex;
+
+// The buffers are never freed, so the events of the terminated threads
+// can still be exported
+std::vector<ThreadBuffer *> buffers;
+
+thread_local ThreadBuffer *thread_buffer = nullptr;
+
+ThreadBuffer *get_thread_buffer() {
+	if (!thread_buffer) {
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		thread_buffer = new ThreadBuffer(buffers.size() + 1);
+		thread_buffer->name = "Thread " + itos(thread_buffer->thread_id);
+		buffers.push_back(thread_buffer);
+	}
+	return thread_buffer;
+}
+
+// Calls the function for each not discarded event of the buffer
+template <class F>
+void for_each_event(const ThreadBuffer *p_buffer, F p_func) {
+	const uint64_t end = p_buffer->write_index.load(std::memory_order_acquire);
+	uint64_t begin = p_buffer->clear_index.load(std::memory_order_relaxed);
+	if (end - begin > Profiler::THREAD_BUFFER_SIZE)
+		begin = end - Profiler::THREAD_BUFFER_SIZE;
+
+	for (uint64_t i = begin; i < end; ++i) {
+		p_func(p_buffer->events[i & (Profiler::THREAD_BUFFER_SIZE - 1)]);
+	}
+}
+
+void write_json_string(std::ofstream &p_file, const char *p_string) {
+	p_file << '"';
+	for (const char *c = p_string; *c; ++c) {
+		if ('"' == *c || '\\' == *c)
+			p_file << '\\';
+		p_file << *c;
+	}
+	p_file << '"';
+}
+
+} // namespace
+
+std::atomic<bool> Profiler::enabled(false);
+
+void Profiler::set_enabled(bool p_enabled) {
+	enabled.store(p_enabled);
+	print_verbose(std::string("CPU profiler ") + (p_enabled ? "enabled" : "disabled"));
+}
+
+void Profiler::set_thread_name(const std::string &p_name) {
+	ThreadBuffer *buffer = get_thread_buffer();
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+	buffer->name = p_name;
+}
+
+uint32_t Profiler::begin_zone() {
+	return get_thread_buffer()->depth++;
+}
+
+void Profiler::end_zone(const char *p_name, uint64_t p_begin_ns, uint32_t p_depth) {
+	const uint64_t end_ns = get_time_ns();
+
+	ThreadBuffer *buffer = get_thread_buffer();
+	buffer->depth = p_depth;
+
+	const uint64_t index = buffer->write_index.load(std::memory_order_relaxed);
+	Event &event = buffer->events[index & (THREAD_BUFFER_SIZE - 1)];
+	event.name = p_name;
+	event.begin_ns = p_begin_ns;
+	event.end_ns = end_ns;
+	event.depth = p_depth;
+
+	buffer->write_index.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::clear() {
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+	for (size_t i = 0; i < buffers.size(); ++i) {
+		buffers[i]->clear_index.store(buffers[i]->write_index.load(std::memory_order_acquire));
+	}
+}
+
+bool Profiler::export_chrome_trace(const std::string &p_path) {
+
+	std::ofstream file(p_path.c_str());
+	ERR_FAIL_COND_V(!file.is_open(), false);
+
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+
+	// The timestamps are relative to the first event
+	uint64_t origin_ns = ~uint64_t(0);
+	for (size_t i = 0; i < buffers.size(); ++i) {
+		for_each_event(buffers[i], [&](const Event &p_event) {
+			origin_ns = MIN(origin_ns, p_event.begin_ns);
+		});
+	}
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	bool first = true;
+	uint64_t count = 0;
+	for (size_t i = 0; i < buffers.size(); ++i) {
+		const ThreadBuffer *buffer = buffers[i];
+
+		// Thread name metadata
+		if (!first)
+			file << ",";
+		first = false;
+		file << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_id << ",\"args\":{\"name\":";
+		write_json_string(file, buffer->name.c_str());
+		file << "}}";
+
+		for_each_event(buffer, [&](const Event &p_event) {
+			// Complete event, the time is in microseconds
+			file << ",\n{\"name\":";
+			write_json_string(file, p_event.name);
+			file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+				 << ",\"ts\":" << double(p_event.begin_ns - origin_ns) / 1000.0
+				 << ",\"dur\":" << double(p_event.end_ns - p_event.begin_ns) / 1000.0
+				 << "}";
+			++count;
+		});
+	}
+
+	file << "\n]}\n";
+
+	print_verbose("CPU profiler, exported " + itos(count) + " events in: " + p_path);
+	return true;
+}
+
+void Profiler::get_zone_stats(std::vector<ZoneStats> &r_stats) {
+
+	// The same literal may have different addresses in different units,
+	// so the zones are grouped by the string
+	std::map<std::string, ZoneStats> zones;
+
+	{
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		for (size_t i = 0; i < buffers.size(); ++i) {
+			for_each_event(buffers[i], [&](const Event &p_event) {
+				const double ms = double(p_event.end_ns - p_event.begin_ns) / 1e6;
+
+				auto it = zones.find(p_event.name);
+				if (it == zones.end()) {
+					ZoneStats stats;
+					stats.name = p_event.name;
+					stats.count = 1;
+					stats.total_ms = ms;
+					stats.min_ms = ms;
+					stats.max_ms = ms;
+					zones[p_event.name] = stats;
+				} else {
+					ZoneStats &stats = it->second;
+					++stats.count;
+					stats.total_ms += ms;
+					stats.min_ms = MIN(stats.min_ms, ms);
+					stats.max_ms = MAX(stats.max_ms, ms);
+				}
+			});
+		}
+	}
+
+	r_stats.clear();
+	for (auto it = zones.begin(); it != zones.end(); ++it) {
+		r_stats.push_back(it->second);
+	}
+
+	std::sort(r_stats.begin(), r_stats.end(), [](const ZoneStats &p_a, const ZoneStats &p_b) {
+		return p_a.total_ms > p_b.total_ms;
+	});
+}
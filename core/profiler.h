@@ -0,0 +1,115 @@
+#pragma once
+
+#include "core/typedefs.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// CPU PROFILER
+//		Scoped zones recorded in a ring buffer owned by the calling thread, so
+// recording a zone never takes a lock.
+//		The zones are compiled only when PROFILER_ENABLED is defined (scons
+// argument profiler=yes), in this case when the profiler is disabled at
+// runtime a zone costs an atomic relaxed load.
+//
+//		void VulkanServer::draw() {
+//			PROFILE_FUNCTION();
+//			...
+//			{
+//				PROFILE_ZONE("Acquire");
+//				...
+//			}
+//		}
+//
+//		The zone name must be a string literal (or any string that lives
+// until the profiler is cleared), only the pointer is stored.
+//		The recorded zones can be exported as Chrome trace event JSON, that
+// can be opened with chrome://tracing or https://ui.perfetto.dev
+
+class Profiler {
+public:
+	struct Event {
+		const char *name;
+		uint64_t begin_ns;
+		uint64_t end_ns;
+		uint32_t depth;
+	};
+
+	struct ZoneStats {
+		const char *name;
+		uint64_t count;
+		double total_ms;
+		double min_ms;
+		double max_ms;
+
+		double get_mean_ms() const { return count ? total_ms / count : 0; }
+	};
+
+	// Power of two, events per thread
+	static const uint32_t THREAD_BUFFER_SIZE = 1 << 16;
+
+private:
+	static std::atomic<bool> enabled;
+
+public:
+	static _FORCE_INLINE_ bool is_enabled() {
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	static void set_enabled(bool p_enabled);
+
+	static void set_thread_name(const std::string &p_name);
+
+	static _FORCE_INLINE_ uint64_t get_time_ns() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch())
+				.count();
+	}
+
+	static uint32_t begin_zone();
+	static void end_zone(const char *p_name, uint64_t p_begin_ns, uint32_t p_depth);
+
+	/// Discard all the recorded events
+	static void clear();
+
+	/// The events recorded while exporting may be partially written, so
+	/// disable the profiler before export if exact data is required
+	static bool export_chrome_trace(const std::string &p_path);
+
+	/// Aggregate the recorded events by zone name, sorted by total time
+	static void get_zone_stats(std::vector<ZoneStats> &r_stats);
+};
+
+class ProfilerZone {
+	const char *name;
+	uint64_t begin_ns;
+	uint32_t depth;
+
+public:
+	_FORCE_INLINE_ ProfilerZone(const char *p_name) :
+			name(nullptr) {
+		if (!Profiler::is_enabled())
+			return;
+
+		name = p_name;
+		depth = Profiler::begin_zone();
+		begin_ns = Profiler::get_time_ns();
+	}
+
+	_FORCE_INLINE_ ~ProfilerZone() {
+		if (name)
+			Profiler::end_zone(name, begin_ns, depth);
+	}
+};
+
+#define __PROFILE_JOIN_IMPL(m_a, m_b) m_a##m_b
+#define __PROFILE_JOIN(m_a, m_b) __PROFILE_JOIN_IMPL(m_a, m_b)
+
+#ifdef PROFILER_ENABLED
+#define PROFILE_ZONE(m_name) ProfilerZone __PROFILE_JOIN(__profiler_zone_, __LINE__)(m_name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__FUNCTION__)
+#else
+#define PROFILE_ZONE(m_name)
+#define PROFILE_FUNCTION()
+#endif
@@ -0,0 +1,1036 @@
+#include "render_graph.h"
+
+#include "core/error_macros.h"
+#include "core/memory_tracker.h"
+#include "core/print_string.h"
+#include "core/string.h"
+#include <algorithm>
+
+struct AccessInfo {
+	VkImageLayout layout;
+	VkPipelineStageFlags stages;
+	VkAccessFlags access;
+	VkImageUsageFlags usage;
+	bool write;
+	bool attachment;
+};
+
+static const AccessInfo accessInfos[RenderGraph::ACCESS_MAX] = {
+	// ACCESS_COLOR_ATTACHMENT_WRITE
+	{ VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+			true,
+			true },
+	// ACCESS_DEPTH_ATTACHMENT_WRITE
+	{ VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+			true,
+			true },
+	// ACCESS_DEPTH_ATTACHMENT_READ
+	{ VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+			false,
+			true },
+	// ACCESS_SAMPLED_READ
+	{ VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_USAGE_SAMPLED_BIT,
+			false,
+			false },
+	// ACCESS_TRANSFER_READ
+	{ VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT,
+			VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			false,
+			false },
+	// ACCESS_TRANSFER_WRITE
+	{ VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+			true,
+			false }
+};
+
+// The content before the access is not needed
+static bool isFullOverwrite(const AccessInfo &p_info, VkAttachmentLoadOp p_loadOp) {
+	if (!p_info.write)
+		return false;
+	return !p_info.attachment || VK_ATTACHMENT_LOAD_OP_LOAD != p_loadOp;
+}
+
+static VkAccessFlags getWriteAccess(VkAccessFlags p_access) {
+	return p_access & (VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+							  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+							  VK_ACCESS_TRANSFER_WRITE_BIT |
+							  VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+bool RenderGraph::getLayoutAccess(VkImageLayout p_layout, VkPipelineStageFlags &r_stages, VkAccessFlags &r_access) {
+
+	switch (p_layout) {
+		case VK_IMAGE_LAYOUT_UNDEFINED:
+			r_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			r_access = 0;
+			return true;
+		case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+			r_stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+			r_access = 0;
+			return true;
+		default:
+			break;
+	}
+
+	for (int i = 0; i < ACCESS_MAX; ++i) {
+		if (accessInfos[i].layout == p_layout) {
+			r_stages = accessInfos[i].stages;
+			r_access = accessInfos[i].access;
+			return true;
+		}
+	}
+	return false;
+}
+
+VkImageAspectFlags RenderGraph::getFormatAspect(VkFormat p_format) {
+	switch (p_format) {
+		case VK_FORMAT_D16_UNORM:
+		case VK_FORMAT_X8_D24_UNORM_PACK32:
+		case VK_FORMAT_D32_SFLOAT:
+			return VK_IMAGE_ASPECT_DEPTH_BIT;
+		case VK_FORMAT_D16_UNORM_S8_UINT:
+		case VK_FORMAT_D24_UNORM_S8_UINT:
+		case VK_FORMAT_D32_SFLOAT_S8_UINT:
+			return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+		case VK_FORMAT_S8_UINT:
+			return VK_IMAGE_ASPECT_STENCIL_BIT;
+		default:
+			return VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+}
+
+RenderGraph::RenderGraph() :
+		compiled(false),
+		finalSrcStages(0),
+		finalDstStages(0),
+		device(VK_NULL_HANDLE),
+		allocator(VK_NULL_HANDLE),
+		memoryTracker(nullptr),
+		extent({ 0, 0 }),
+		slotCount(0) {}
+
+RenderGraph::~RenderGraph() {
+	if (compiled)
+		WARN_PRINTS("Render graph destroyed without releasing it");
+}
+
+void RenderGraph::reset() {
+	ERR_FAIL_COND(compiled);
+	resources.clear();
+	passes.clear();
+}
+
+RenderGraph::ResourceId RenderGraph::createImage(const std::string &p_name, VkFormat p_format, uint32_t p_width, uint32_t p_height) {
+	ERR_FAIL_COND_V(compiled, INVALID_ID);
+
+	Resource resource = {};
+	resource.name = p_name;
+	resource.format = p_format;
+	resource.imported = false;
+	resource.width = p_width;
+	resource.height = p_height;
+	resource.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	resource.finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	resource.aliasGroup = INVALID_ID;
+	resources.push_back(resource);
+	return resources.size() - 1;
+}
+
+RenderGraph::ResourceId RenderGraph::importImage(const std::string &p_name, VkFormat p_format, VkImageLayout p_initialLayout, VkImageLayout p_finalLayout, VkPipelineStageFlags p_initialStages) {
+	ERR_FAIL_COND_V(compiled, INVALID_ID);
+
+	Resource resource = {};
+	resource.name = p_name;
+	resource.format = p_format;
+	resource.imported = true;
+	resource.initialLayout = p_initialLayout;
+	resource.finalLayout = p_finalLayout;
+	resource.initialStages = p_initialStages;
+	resource.aliasGroup = INVALID_ID;
+	resources.push_back(resource);
+	return resources.size() - 1;
+}
+
+void RenderGraph::markOutput(ResourceId p_resource) {
+	ERR_FAIL_INDEX(p_resource, (int)resources.size());
+	resources[p_resource].output = true;
+}
+
+RenderGraph::PassId RenderGraph::addPass(const std::string &p_name, PassType p_type, RecordCallback p_callback, void *p_userData) {
+	ERR_FAIL_COND_V(compiled, INVALID_ID);
+
+	Pass pass;
+	pass.name = p_name;
+	pass.type = p_type;
+	pass.callback = p_callback;
+	pass.userData = p_userData;
+	pass.sideEffect = false;
+	pass.culled = false;
+	pass.barrierSrcStages = 0;
+	pass.barrierDstStages = 0;
+	pass.renderPass = VK_NULL_HANDLE;
+	passes.push_back(pass);
+	return passes.size() - 1;
+}
+
+void RenderGraph::setPassSideEffect(PassId p_pass, bool p_sideEffect) {
+	ERR_FAIL_INDEX(p_pass, (int)passes.size());
+	passes[p_pass].sideEffect = p_sideEffect;
+}
+
+RenderGraph::PassAccess &RenderGraph::addAccess(PassId p_pass, ResourceId p_resource, Access p_access) {
+	PassAccess access = {};
+	access.resource = p_resource;
+	access.access = p_access;
+	access.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	passes[p_pass].accesses.push_back(access);
+	return passes[p_pass].accesses.back();
+}
+
+void RenderGraph::writeColor(PassId p_pass, ResourceId p_resource, VkAttachmentLoadOp p_loadOp, const VkClearColorValue &p_clear) {
+	ERR_FAIL_INDEX(p_pass, (int)passes.size());
+	ERR_FAIL_INDEX(p_resource, (int)resources.size());
+	ERR_FAIL_COND(PASS_RASTER != passes[p_pass].type);
+
+	PassAccess &access = addAccess(p_pass, p_resource, ACCESS_COLOR_ATTACHMENT_WRITE);
+	access.loadOp = p_loadOp;
+	access.clearValue.color = p_clear;
+}
+
+void RenderGraph::writeDepth(PassId p_pass, ResourceId p_resource, VkAttachmentLoadOp p_loadOp, float p_clearDepth) {
+	ERR_FAIL_INDEX(p_pass, (int)passes.size());
+	ERR_FAIL_INDEX(p_resource, (int)resources.size());
+	ERR_FAIL_COND(PASS_RASTER != passes[p_pass].type);
+
+	PassAccess &access = addAccess(p_pass, p_resource, ACCESS_DEPTH_ATTACHMENT_WRITE);
+	access.loadOp = p_loadOp;
+	access.clearValue.depthStencil = { p_clearDepth, 0 };
+}
+
+void RenderGraph::readDepth(PassId p_pass, ResourceId p_resource) {
+	ERR_FAIL_INDEX(p_pass, (int)passes.size());
+	ERR_FAIL_INDEX(p_resource, (int)resources.size());
+	ERR_FAIL_COND(PASS_RASTER != passes[p_pass].type);
+
+	PassAccess &access = addAccess(p_pass, p_resource, ACCESS_DEPTH_ATTACHMENT_READ);
+	access.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+}
+
+void RenderGraph::readSampled(PassId p_pass, ResourceId p_resource) {
+	ERR_FAIL_INDEX(p_pass, (int)passes.size());
+	ERR_FAIL_INDEX(p_resource, (int)resources.size());
+	addAccess(p_pass, p_resource, ACCESS_SAMPLED_READ);
+}
+
+void RenderGraph::readTransfer(PassId p_pass, ResourceId p_resource) {
+	ERR_FAIL_INDEX(p_pass, (int)passes.size());
+	ERR_FAIL_INDEX(p_resource, (int)resources.size());
+	addAccess(p_pass, p_resource, ACCESS_TRANSFER_READ);
+}
+
+void RenderGraph::writeTransfer(PassId p_pass, ResourceId p_resource) {
+	ERR_FAIL_INDEX(p_pass, (int)passes.size());
+	ERR_FAIL_INDEX(p_resource, (int)resources.size());
+	addAccess(p_pass, p_resource, ACCESS_TRANSFER_WRITE);
+}
+
+bool RenderGraph::compile(VkDevice p_device) {
+	ERR_FAIL_COND_V(compiled, false);
+
+	device = p_device;
+
+	cullPasses();
+	computeLifetimes();
+	assignAliasGroups();
+
+	compiled = true;
+	if (!derivePassSynchronization()) {
+		releaseCompiled();
+		ERR_FAIL_V(false);
+	}
+
+	print_verbose("Render graph compiled, " + itos(executionOrder.size()) + " passes, " + itos(passes.size() - executionOrder.size()) + " culled");
+	return true;
+}
+
+void RenderGraph::releaseCompiled() {
+	releaseRealized();
+
+	for (size_t p = 0; p < passes.size(); ++p) {
+		Pass &pass = passes[p];
+		if (VK_NULL_HANDLE != pass.renderPass)
+			vkDestroyRenderPass(device, pass.renderPass, nullptr);
+		pass.renderPass = VK_NULL_HANDLE;
+		pass.barriers.clear();
+		pass.barrierSrcStages = 0;
+		pass.barrierDstStages = 0;
+		pass.attachments.clear();
+		pass.clearValues.clear();
+		pass.culled = false;
+	}
+
+	for (size_t r = 0; r < resources.size(); ++r) {
+		resources[r].usage = 0;
+		resources[r].aliasGroup = INVALID_ID;
+	}
+
+	executionOrder.clear();
+	aliasGroups.clear();
+	finalBarriers.clear();
+	finalSrcStages = 0;
+	finalDstStages = 0;
+	compiled = false;
+}
+
+bool RenderGraph::isPassCulled(PassId p_pass) const {
+	ERR_FAIL_INDEX_V(p_pass, (int)passes.size(), true);
+	return passes[p_pass].culled;
+}
+
+VkRenderPass RenderGraph::getRenderPass(PassId p_pass) const {
+	ERR_FAIL_INDEX_V(p_pass, (int)passes.size(), VK_NULL_HANDLE);
+	return passes[p_pass].renderPass;
+}
+
+void RenderGraph::cullPasses() {
+
+	// Backward liveness: a resource is needed when a following pass reads
+	// its content, or when it's an output
+	std::vector<bool> needed(resources.size());
+	for (size_t r = 0; r < resources.size(); ++r) {
+		needed[r] = resources[r].output;
+	}
+
+	for (int p = passes.size() - 1; 0 <= p; --p) {
+		Pass &pass = passes[p];
+
+		pass.culled = !pass.sideEffect;
+		for (size_t a = 0; a < pass.accesses.size(); ++a) {
+			if (accessInfos[pass.accesses[a].access].write && needed[pass.accesses[a].resource])
+				pass.culled = false;
+		}
+
+		if (pass.culled)
+			continue;
+
+		for (size_t a = 0; a < pass.accesses.size(); ++a) {
+			const PassAccess &access = pass.accesses[a];
+			if (isFullOverwrite(accessInfos[access.access], access.loadOp))
+				needed[access.resource] = false;
+		}
+
+		for (size_t a = 0; a < pass.accesses.size(); ++a) {
+			const PassAccess &access = pass.accesses[a];
+			if (!isFullOverwrite(accessInfos[access.access], access.loadOp))
+				needed[access.resource] = true;
+		}
+	}
+
+	executionOrder.clear();
+	for (size_t p = 0; p < passes.size(); ++p) {
+		if (!passes[p].culled)
+			executionOrder.push_back(p);
+		else
+			print_verbose("Render graph pass culled: " + passes[p].name);
+	}
+}
+
+void RenderGraph::computeLifetimes() {
+
+	for (size_t r = 0; r < resources.size(); ++r) {
+		resources[r].usage = 0;
+		resources[r].firstPass = INVALID_ID;
+		resources[r].lastPass = INVALID_ID;
+	}
+
+	for (size_t i = 0; i < executionOrder.size(); ++i) {
+		const Pass &pass = passes[executionOrder[i]];
+		for (size_t a = 0; a < pass.accesses.size(); ++a) {
+			Resource &resource = resources[pass.accesses[a].resource];
+			resource.usage |= accessInfos[pass.accesses[a].access].usage;
+			if (INVALID_ID == resource.firstPass)
+				resource.firstPass = i;
+			resource.lastPass = i;
+		}
+	}
+}
+
+void RenderGraph::assignAliasGroups() {
+
+	std::vector<ResourceId> transients;
+	for (size_t r = 0; r < resources.size(); ++r) {
+		if (!resources[r].imported && INVALID_ID != resources[r].firstPass)
+			transients.push_back(r);
+	}
+
+	std::sort(transients.begin(), transients.end(), [this](ResourceId a, ResourceId b) {
+		return resources[a].firstPass < resources[b].firstPass;
+	});
+
+	// Greedy interval assignment: a resource joins the first group that is
+	// no more used when its lifetime begins
+	std::vector<int> groupLastPass;
+	aliasGroups.clear();
+	for (size_t t = 0; t < transients.size(); ++t) {
+		Resource &resource = resources[transients[t]];
+
+		int group = INVALID_ID;
+		for (size_t g = 0; g < aliasGroups.size(); ++g) {
+			if (groupLastPass[g] < resource.firstPass) {
+				group = g;
+				break;
+			}
+		}
+
+		if (INVALID_ID == group) {
+			AliasGroup aliasGroup = {};
+			aliasGroups.push_back(aliasGroup);
+			groupLastPass.push_back(INVALID_ID);
+			group = aliasGroups.size() - 1;
+		}
+
+		resource.aliasGroup = group;
+		aliasGroups[group].resources.push_back(transients[t]);
+		groupLastPass[group] = resource.lastPass;
+	}
+
+	// The stages of all the accesses to the group memory, waited by the first
+	// access of each resource of the group
+	for (size_t i = 0; i < executionOrder.size(); ++i) {
+		const Pass &pass = passes[executionOrder[i]];
+		for (size_t a = 0; a < pass.accesses.size(); ++a) {
+			const Resource &resource = resources[pass.accesses[a].resource];
+			if (INVALID_ID == resource.aliasGroup)
+				continue;
+			const AccessInfo &info = accessInfos[pass.accesses[a].access];
+			aliasGroups[resource.aliasGroup].stages |= info.stages;
+			aliasGroups[resource.aliasGroup].writeAccess |= getWriteAccess(info.access);
+		}
+	}
+}
+
+bool RenderGraph::derivePassSynchronization() {
+
+	struct State {
+		VkImageLayout layout;
+		VkPipelineStageFlags stages;
+		VkAccessFlags writeAccess;
+	};
+
+	std::vector<State> states(resources.size());
+	for (size_t r = 0; r < resources.size(); ++r) {
+		const Resource &resource = resources[r];
+		if (resource.imported) {
+			states[r].layout = resource.initialLayout;
+			states[r].stages = resource.initialStages;
+			states[r].writeAccess = 0;
+		} else if (INVALID_ID != resource.aliasGroup) {
+			states[r].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			states[r].stages = aliasGroups[resource.aliasGroup].stages;
+			states[r].writeAccess = aliasGroups[resource.aliasGroup].writeAccess;
+		} else {
+			states[r] = State();
+		}
+	}
+
+	for (size_t i = 0; i < executionOrder.size(); ++i) {
+		Pass &pass = passes[executionOrder[i]];
+
+		std::vector<VkAttachmentDescription> descriptions;
+
+		VkSubpassDependency dependency = {};
+		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependency.dstSubpass = 0;
+
+		for (size_t a = 0; a < pass.accesses.size(); ++a) {
+			const PassAccess &access = pass.accesses[a];
+			const AccessInfo &info = accessInfos[access.access];
+			const Resource &resource = resources[access.resource];
+			State &state = states[access.resource];
+
+			const bool overwrite = isFullOverwrite(info, access.loadOp);
+
+			if (PASS_RASTER == pass.type && info.attachment) {
+
+				// The transition is done by the render pass
+				VkAttachmentDescription description = {};
+				description.format = resource.format;
+				description.samples = VK_SAMPLE_COUNT_1_BIT;
+				description.loadOp = access.loadOp;
+				description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				description.initialLayout = overwrite ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+
+				if (!overwrite && VK_IMAGE_LAYOUT_UNDEFINED == state.layout)
+					WARN_PRINTS("The pass " + pass.name + " loads the undefined content of " + resource.name);
+
+				// Stored only when the content is used after this pass
+				const bool stored = info.write && (resource.output || (int)i < resource.lastPass);
+				description.storeOp = stored ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+				if (resource.imported && (int)i == resource.lastPass && VK_IMAGE_LAYOUT_UNDEFINED != resource.finalLayout)
+					description.finalLayout = resource.finalLayout;
+				else
+					description.finalLayout = info.layout;
+
+				dependency.srcStageMask |= state.stages;
+				dependency.srcAccessMask |= state.writeAccess;
+				dependency.dstStageMask |= info.stages;
+				dependency.dstAccessMask |= info.access;
+
+				pass.attachments.push_back(access.resource);
+				pass.clearValues.push_back(access.clearValue);
+				descriptions.push_back(description);
+
+				state.layout = description.finalLayout;
+
+			} else {
+
+				// Read after read in the same layout doesn't need a barrier
+				if (state.layout != info.layout || state.writeAccess || info.write) {
+
+					Barrier barrier = {};
+					barrier.resource = access.resource;
+					barrier.barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+					barrier.barrier.oldLayout = overwrite ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+					barrier.barrier.newLayout = info.layout;
+					barrier.barrier.srcAccessMask = state.writeAccess;
+					barrier.barrier.dstAccessMask = info.access;
+					barrier.barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					barrier.barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					barrier.barrier.subresourceRange.aspectMask = getFormatAspect(resource.format);
+					barrier.barrier.subresourceRange.levelCount = 1;
+					barrier.barrier.subresourceRange.layerCount = 1;
+					pass.barriers.push_back(barrier);
+
+					pass.barrierSrcStages |= state.stages;
+					pass.barrierDstStages |= info.stages;
+				}
+
+				state.layout = info.layout;
+			}
+
+			if (info.write) {
+				state.stages = info.stages;
+				state.writeAccess = getWriteAccess(info.access);
+			} else {
+				state.stages |= info.stages;
+			}
+		}
+
+		if (PASS_RASTER == pass.type) {
+			ERR_EXPLAIN("The raster pass " + pass.name + " has no attachments");
+			ERR_FAIL_COND_V(descriptions.empty(), false);
+
+			if (!dependency.srcStageMask)
+				dependency.srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+			if (!createRenderPass(pass, descriptions, dependency))
+				return false;
+		}
+	}
+
+	// The outputs not yet in their final layout
+	for (size_t r = 0; r < resources.size(); ++r) {
+		const Resource &resource = resources[r];
+		if (!resource.imported || VK_IMAGE_LAYOUT_UNDEFINED == resource.finalLayout)
+			continue;
+		if (INVALID_ID == resource.firstPass || states[r].layout == resource.finalLayout)
+			continue;
+
+		VkPipelineStageFlags dstStages;
+		VkAccessFlags dstAccess;
+		ERR_FAIL_COND_V(!getLayoutAccess(resource.finalLayout, dstStages, dstAccess), false);
+
+		Barrier barrier = {};
+		barrier.resource = r;
+		barrier.barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.barrier.oldLayout = states[r].layout;
+		barrier.barrier.newLayout = resource.finalLayout;
+		barrier.barrier.srcAccessMask = states[r].writeAccess;
+		barrier.barrier.dstAccessMask = dstAccess;
+		barrier.barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.barrier.subresourceRange.aspectMask = getFormatAspect(resource.format);
+		barrier.barrier.subresourceRange.levelCount = 1;
+		barrier.barrier.subresourceRange.layerCount = 1;
+		finalBarriers.push_back(barrier);
+
+		finalSrcStages |= states[r].stages;
+		finalDstStages |= dstStages;
+	}
+
+	return true;
+}
+
+bool RenderGraph::createRenderPass(Pass &r_pass, const std::vector<VkAttachmentDescription> &p_descriptions, const VkSubpassDependency &p_dependency) {
+
+	std::vector<VkAttachmentReference> colorReferences;
+	VkAttachmentReference depthReference = {};
+	bool hasDepth = false;
+
+	for (size_t a = 0; a < r_pass.attachments.size(); ++a) {
+		const Resource &resource = resources[r_pass.attachments[a]];
+
+		VkAttachmentReference reference = {};
+		reference.attachment = a;
+
+		if (getFormatAspect(resource.format) & VK_IMAGE_ASPECT_COLOR_BIT) {
+			reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+			colorReferences.push_back(reference);
+		} else {
+			ERR_EXPLAIN("The pass " + r_pass.name + " has more depth attachments");
+			ERR_FAIL_COND_V(hasDepth, false);
+
+			// The layout used inside the pass
+			bool readOnly = true;
+			for (size_t i = 0; i < r_pass.accesses.size(); ++i) {
+				if (r_pass.accesses[i].resource == r_pass.attachments[a] && accessInfos[r_pass.accesses[i].access].write)
+					readOnly = false;
+			}
+
+			reference.layout = readOnly ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+			depthReference = reference;
+			hasDepth = true;
+		}
+	}
+
+	VkSubpassDescription subpassDesc = {};
+	subpassDesc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpassDesc.colorAttachmentCount = colorReferences.size();
+	subpassDesc.pColorAttachments = colorReferences.data();
+	subpassDesc.pDepthStencilAttachment = hasDepth ? &depthReference : nullptr;
+
+	VkRenderPassCreateInfo renderPassCreateInfo = {};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = p_descriptions.size();
+	renderPassCreateInfo.pAttachments = p_descriptions.data();
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &subpassDesc;
+	renderPassCreateInfo.dependencyCount = 1;
+	renderPassCreateInfo.pDependencies = &p_dependency;
+
+	VkResult res = vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &r_pass.renderPass);
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	return true;
+}
+
+void RenderGraph::setImportedImages(ResourceId p_resource, const std::vector<VkImage> &p_images, const std::vector<VkImageView> &p_views) {
+	ERR_FAIL_INDEX(p_resource, (int)resources.size());
+	ERR_FAIL_COND(!resources[p_resource].imported);
+	ERR_FAIL_COND(p_images.size() != p_views.size());
+
+	resources[p_resource].importedImages = p_images;
+	resources[p_resource].importedViews = p_views;
+}
+
+bool RenderGraph::realize(VmaAllocator p_allocator, MemoryTracker *p_memoryTracker, VkExtent2D p_extent, uint32_t p_slotCount, bool p_lazyMemory) {
+	ERR_FAIL_COND_V(!compiled, false);
+	ERR_FAIL_COND_V(VK_NULL_HANDLE != allocator, false);
+
+	allocator = p_allocator;
+	memoryTracker = p_memoryTracker;
+	extent = p_extent;
+	slotCount = p_slotCount;
+
+	for (size_t r = 0; r < resources.size(); ++r) {
+		const Resource &resource = resources[r];
+		if (!resource.imported || INVALID_ID == resource.firstPass)
+			continue;
+
+		ERR_EXPLAIN("The imported image " + resource.name + " has not an image for each slot");
+		ERR_FAIL_COND_V(resource.importedImages.size() < slotCount, false);
+	}
+
+	if (!allocateTransients(p_lazyMemory) || !createFramebuffers()) {
+		releaseRealized();
+		ERR_FAIL_V(false);
+	}
+
+	print_verbose("Render graph realized, transients " + itos(transientStats.requiredBytes / 1024) + " KiB, allocated " + itos(transientStats.allocatedBytes / 1024) + " KiB");
+	return true;
+}
+
+bool RenderGraph::allocateTransients(bool p_lazyMemory) {
+
+	transientStats = TransientStats();
+
+	const VkImageUsageFlags attachmentUsage =
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+
+	for (size_t g = 0; g < aliasGroups.size(); ++g) {
+		AliasGroup &group = aliasGroups[g];
+
+		// Requirements of the images that share the group memory
+		VkMemoryRequirements groupRequirements = {};
+		groupRequirements.memoryTypeBits = ~0u;
+		std::vector<ResourceId> shared;
+
+		for (size_t i = 0; i < group.resources.size(); ++i) {
+			Resource &resource = resources[group.resources[i]];
+
+			// Used only inside one render pass, so the content is never
+			// stored: the attachment can live only in the tile memory
+			const bool transient = !(resource.usage & ~attachmentUsage) && resource.firstPass == resource.lastPass;
+
+			VkImageCreateInfo imageCreateInfo = {};
+			imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageCreateInfo.extent.width = resource.width ? resource.width : extent.width;
+			imageCreateInfo.extent.height = resource.height ? resource.height : extent.height;
+			imageCreateInfo.extent.depth = 1;
+			imageCreateInfo.mipLevels = 1;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.format = resource.format;
+			imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageCreateInfo.usage = resource.usage | (transient ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0);
+			imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+			VkResult res = vkCreateImage(device, &imageCreateInfo, nullptr, &resource.image);
+			ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+			VkMemoryRequirements requirements;
+			vkGetImageMemoryRequirements(device, resource.image, &requirements);
+			resource.size = requirements.size;
+			++transientStats.imageCount;
+			transientStats.requiredBytes += requirements.size;
+
+			if (transient && p_lazyMemory) {
+				// The lazily allocated memory is never committed on tiled GPU,
+				// so there is nothing to alias
+				VmaAllocationCreateInfo allocationCreateInfo = {};
+				allocationCreateInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+				DedicatedAllocation dedicated;
+				dedicated.resource = group.resources[i];
+				dedicated.size = requirements.size;
+				res = vmaAllocateMemory(allocator, &requirements, &allocationCreateInfo, &dedicated.allocation, nullptr);
+				if (VK_SUCCESS == res) {
+					resource.allocation = dedicated.allocation;
+					resource.lazilyAllocated = true;
+					dedicatedAllocations.push_back(dedicated);
+					transientStats.lazilyAllocatedBytes += requirements.size;
+					continue;
+				}
+			}
+
+			if (!(groupRequirements.memoryTypeBits & requirements.memoryTypeBits)) {
+				// Not compatible with the group memory
+				VmaAllocationCreateInfo allocationCreateInfo = {};
+				allocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+				DedicatedAllocation dedicated;
+				dedicated.resource = group.resources[i];
+				dedicated.size = requirements.size;
+				res = vmaAllocateMemory(allocator, &requirements, &allocationCreateInfo, &dedicated.allocation, nullptr);
+				ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+				resource.allocation = dedicated.allocation;
+				dedicatedAllocations.push_back(dedicated);
+				continue;
+			}
+
+			groupRequirements.size = MAX(groupRequirements.size, requirements.size);
+			groupRequirements.alignment = MAX(groupRequirements.alignment, requirements.alignment);
+			groupRequirements.memoryTypeBits &= requirements.memoryTypeBits;
+			shared.push_back(group.resources[i]);
+		}
+
+		if (shared.empty())
+			continue;
+
+		VmaAllocationCreateInfo allocationCreateInfo = {};
+		allocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+		VkResult res = vmaAllocateMemory(allocator, &groupRequirements, &allocationCreateInfo, &group.allocation, nullptr);
+		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+		group.size = groupRequirements.size;
+
+		for (size_t i = 0; i < shared.size(); ++i) {
+			resources[shared[i]].allocation = group.allocation;
+		}
+	}
+
+	// Bind and track
+	for (size_t r = 0; r < resources.size(); ++r) {
+		Resource &resource = resources[r];
+		if (VK_NULL_HANDLE == resource.image)
+			continue;
+
+		ERR_FAIL_COND_V(VK_SUCCESS != vmaBindImageMemory(allocator, resource.allocation, resource.image), false);
+
+		VkImageViewCreateInfo viewCreateInfo = {};
+		viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewCreateInfo.image = resource.image;
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCreateInfo.format = resource.format;
+		viewCreateInfo.subresourceRange.aspectMask = getFormatAspect(resource.format);
+		viewCreateInfo.subresourceRange.levelCount = 1;
+		viewCreateInfo.subresourceRange.layerCount = 1;
+
+		VkResult res = vkCreateImageView(device, &viewCreateInfo, nullptr, &resource.view);
+		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	}
+
+	std::vector<VmaAllocation> allocations;
+	for (size_t g = 0; g < aliasGroups.size(); ++g) {
+		if (VK_NULL_HANDLE != aliasGroups[g].allocation)
+			allocations.push_back(aliasGroups[g].allocation);
+	}
+	for (size_t d = 0; d < dedicatedAllocations.size(); ++d) {
+		allocations.push_back(dedicatedAllocations[d].allocation);
+	}
+
+	for (size_t i = 0; i < allocations.size(); ++i) {
+		VmaAllocationInfo allocationInfo;
+		vmaGetAllocationInfo(allocator, allocations[i], &allocationInfo);
+		transientStats.allocatedBytes += allocationInfo.size;
+		++transientStats.allocationCount;
+
+		if (memoryTracker)
+			memoryTracker->trackAllocation((uint64_t)allocations[i], MemoryTracker::CATEGORY_ATTACHMENT, allocationInfo.size, allocationInfo.memoryType);
+	}
+
+	return true;
+}
+
+bool RenderGraph::createFramebuffers() {
+
+	for (size_t i = 0; i < executionOrder.size(); ++i) {
+		Pass &pass = passes[executionOrder[i]];
+		if (PASS_RASTER != pass.type)
+			continue;
+
+		pass.framebuffers.resize(slotCount, VK_NULL_HANDLE);
+
+		std::vector<VkImageView> views(pass.attachments.size());
+		for (uint32_t s = 0; s < slotCount; ++s) {
+
+			for (size_t a = 0; a < pass.attachments.size(); ++a) {
+				views[a] = getImageView(pass.attachments[a], s);
+			}
+
+			VkFramebufferCreateInfo framebufferCreateInfo = {};
+			framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferCreateInfo.renderPass = pass.renderPass;
+			framebufferCreateInfo.attachmentCount = views.size();
+			framebufferCreateInfo.pAttachments = views.data();
+			framebufferCreateInfo.width = extent.width;
+			framebufferCreateInfo.height = extent.height;
+			framebufferCreateInfo.layers = 1;
+
+			VkResult res = vkCreateFramebuffer(device, &framebufferCreateInfo, nullptr, &pass.framebuffers[s]);
+			ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+		}
+	}
+
+	return true;
+}
+
+void RenderGraph::releaseRealized() {
+	Realized realized;
+	takeRealized(realized);
+	destroyRealized(realized);
+}
+
+void RenderGraph::takeRealized(Realized &r_realized) {
+	r_realized = Realized();
+	if (VK_NULL_HANDLE == allocator)
+		return;
+
+	r_realized.device = device;
+	r_realized.allocator = allocator;
+	r_realized.memoryTracker = memoryTracker;
+
+	for (size_t p = 0; p < passes.size(); ++p) {
+		for (size_t s = 0; s < passes[p].framebuffers.size(); ++s) {
+			if (VK_NULL_HANDLE != passes[p].framebuffers[s])
+				r_realized.framebuffers.push_back(passes[p].framebuffers[s]);
+		}
+		passes[p].framebuffers.clear();
+	}
+
+	for (size_t r = 0; r < resources.size(); ++r) {
+		Resource &resource = resources[r];
+		if (VK_NULL_HANDLE != resource.view)
+			r_realized.views.push_back(resource.view);
+		if (VK_NULL_HANDLE != resource.image)
+			r_realized.images.push_back(resource.image);
+		resource.view = VK_NULL_HANDLE;
+		resource.image = VK_NULL_HANDLE;
+		resource.allocation = VK_NULL_HANDLE;
+		resource.size = 0;
+		resource.lazilyAllocated = false;
+	}
+
+	for (size_t g = 0; g < aliasGroups.size(); ++g) {
+		if (VK_NULL_HANDLE == aliasGroups[g].allocation)
+			continue;
+		r_realized.allocations.push_back(aliasGroups[g].allocation);
+		aliasGroups[g].allocation = VK_NULL_HANDLE;
+		aliasGroups[g].size = 0;
+	}
+
+	for (size_t d = 0; d < dedicatedAllocations.size(); ++d) {
+		r_realized.allocations.push_back(dedicatedAllocations[d].allocation);
+	}
+	dedicatedAllocations.clear();
+
+	transientStats = TransientStats();
+	allocator = VK_NULL_HANDLE;
+	memoryTracker = nullptr;
+	slotCount = 0;
+}
+
+void RenderGraph::destroyRealized(Realized &r_realized) {
+	if (VK_NULL_HANDLE == r_realized.allocator)
+		return;
+
+	for (size_t i = 0; i < r_realized.framebuffers.size(); ++i) {
+		vkDestroyFramebuffer(r_realized.device, r_realized.framebuffers[i], nullptr);
+	}
+
+	for (size_t i = 0; i < r_realized.views.size(); ++i) {
+		vkDestroyImageView(r_realized.device, r_realized.views[i], nullptr);
+	}
+
+	for (size_t i = 0; i < r_realized.images.size(); ++i) {
+		vkDestroyImage(r_realized.device, r_realized.images[i], nullptr);
+	}
+
+	for (size_t i = 0; i < r_realized.allocations.size(); ++i) {
+		if (r_realized.memoryTracker)
+			r_realized.memoryTracker->untrackAllocation((uint64_t)r_realized.allocations[i]);
+		vmaFreeMemory(r_realized.allocator, r_realized.allocations[i]);
+	}
+
+	r_realized = Realized();
+}
+
+VkImage RenderGraph::getImage(ResourceId p_resource, uint32_t p_slot) const {
+	ERR_FAIL_INDEX_V(p_resource, (int)resources.size(), VK_NULL_HANDLE);
+	const Resource &resource = resources[p_resource];
+	if (resource.imported) {
+		ERR_FAIL_INDEX_V(p_slot, resource.importedImages.size(), VK_NULL_HANDLE);
+		return resource.importedImages[p_slot];
+	}
+	return resource.image;
+}
+
+VkImageView RenderGraph::getImageView(ResourceId p_resource, uint32_t p_slot) const {
+	ERR_FAIL_INDEX_V(p_resource, (int)resources.size(), VK_NULL_HANDLE);
+	const Resource &resource = resources[p_resource];
+	if (resource.imported) {
+		ERR_FAIL_INDEX_V(p_slot, resource.importedViews.size(), VK_NULL_HANDLE);
+		return resource.importedViews[p_slot];
+	}
+	return resource.view;
+}
+
+VkDeviceSize RenderGraph::getImageSize(ResourceId p_resource) const {
+	ERR_FAIL_INDEX_V(p_resource, (int)resources.size(), 0);
+	return resources[p_resource].size;
+}
+
+bool RenderGraph::isImageLazilyAllocated(ResourceId p_resource) const {
+	ERR_FAIL_INDEX_V(p_resource, (int)resources.size(), false);
+	return resources[p_resource].lazilyAllocated;
+}
+
+VmaAllocation RenderGraph::getImageAllocation(ResourceId p_resource) const {
+	ERR_FAIL_INDEX_V(p_resource, (int)resources.size(), VK_NULL_HANDLE);
+	return resources[p_resource].allocation;
+}
+
+void RenderGraph::cmdBarriers(VkCommandBuffer p_command, uint32_t p_slot, const std::vector<Barrier> &p_barriers, VkPipelineStageFlags p_srcStages, VkPipelineStageFlags p_dstStages) const {
+
+	if (p_barriers.empty())
+		return;
+
+	std::vector<VkImageMemoryBarrier> barriers(p_barriers.size());
+	for (size_t b = 0; b < p_barriers.size(); ++b) {
+		barriers[b] = p_barriers[b].barrier;
+		barriers[b].image = getImage(p_barriers[b].resource, p_slot);
+	}
+
+	// All the barriers of the pass in one call
+	vkCmdPipelineBarrier(
+			p_command,
+			p_srcStages ? p_srcStages : VkPipelineStageFlags(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT),
+			p_dstStages,
+			0,
+			0,
+			nullptr,
+			0,
+			nullptr,
+			barriers.size(),
+			barriers.data());
+}
+
+void RenderGraph::record(VkCommandBuffer p_command, uint32_t p_slot) {
+	ERR_FAIL_COND(VK_NULL_HANDLE == allocator);
+	ERR_FAIL_INDEX(p_slot, slotCount);
+
+	for (size_t i = 0; i < executionOrder.size(); ++i) {
+		const Pass &pass = passes[executionOrder[i]];
+
+		cmdBarriers(p_command, p_slot, pass.barriers, pass.barrierSrcStages, pass.barrierDstStages);
+
+		if (PASS_RASTER == pass.type) {
+
+			VkRenderPassBeginInfo renderPassBeginInfo = {};
+			renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			renderPassBeginInfo.renderPass = pass.renderPass;
+			renderPassBeginInfo.framebuffer = pass.framebuffers[p_slot];
+			renderPassBeginInfo.renderArea.offset = { 0, 0 };
+			renderPassBeginInfo.renderArea.extent = extent;
+			renderPassBeginInfo.clearValueCount = pass.clearValues.size();
+			renderPassBeginInfo.pClearValues = pass.clearValues.data();
+
+			vkCmdBeginRenderPass(p_command, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+			if (pass.callback)
+				pass.callback(p_command, p_slot, pass.userData);
+
+			vkCmdEndRenderPass(p_command);
+
+		} else if (pass.callback) {
+			pass.callback(p_command, p_slot, pass.userData);
+		}
+	}
+
+	cmdBarriers(p_command, p_slot, finalBarriers, finalSrcStages, finalDstStages);
+}
+
+void RenderGraph::printReport() const {
+
+	print_line("Render graph, " + itos(executionOrder.size()) + " passes (" + itos(passes.size() - executionOrder.size()) + " culled):");
+	for (size_t i = 0; i < executionOrder.size(); ++i) {
+		const Pass &pass = passes[executionOrder[i]];
+		print_line("  " + pass.name + ": " + itos(pass.attachments.size()) + " attachments, " + itos(pass.barriers.size()) + " barriers");
+	}
+
+	print_line("  transient images " + itos(transientStats.imageCount) + " in " + itos(aliasGroups.size()) + " alias groups, " +
+			   itos(transientStats.requiredBytes / 1024) + " KiB required, " + itos(transientStats.allocatedBytes / 1024) + " KiB allocated (" +
+			   itos(transientStats.lazilyAllocatedBytes / 1024) + " KiB lazily)");
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include "hellovulkan.h"
+
+class MemoryTracker;
+
+// RENDER GRAPH
+//		The frame is described as a list of passes that declare the accesses
+// (read / write) to virtual image resources, the graph compiler derives
+// everything that before was written by hand:
+//
+//	- The passes that don't contribute to an output are culled.
+//	- The layout transitions and the barriers between the passes; the ones of
+//	  the attachments are folded inside the render pass (initial / final
+//	  layout and external subpass dependency), the others are recorded as
+//	  image memory barriers right before the pass.
+//	- The load and store operations: an attachment not read after the pass is
+//	  not stored.
+//	- The memory of the transient images whose lifetimes don't overlap is
+//	  aliased: they are placed in the same alias group and share one allocation.
+//
+//		The resources are transient (created and owned by the graph, their
+// content lives only inside the frame) or imported (created outside, as the
+// swapchain images, with one image per slot).
+//		The command buffers are recorded once per slot (swapchain image) and
+// submitted many times, so the transient images are shared by all the frames
+// in flight: the first access of a transient waits all the accesses of its
+// alias group, that covers the previous frame too.
+//
+//		Usage:
+//		build (createImage / importImage, addPass, pass accesses, markOutput),
+//		compile (needs the device, creates the render passes),
+//		realize (allocates the transients and the framebuffers, depends on the
+//		extent), record (once per command buffer).
+class RenderGraph {
+public:
+	typedef int ResourceId;
+	typedef int PassId;
+
+	static const int INVALID_ID = -1;
+
+	enum Access {
+		ACCESS_COLOR_ATTACHMENT_WRITE,
+		ACCESS_DEPTH_ATTACHMENT_WRITE,
+		ACCESS_DEPTH_ATTACHMENT_READ,
+		ACCESS_SAMPLED_READ,
+		ACCESS_TRANSFER_READ,
+		ACCESS_TRANSFER_WRITE,
+		ACCESS_MAX
+	};
+
+	enum PassType {
+		PASS_RASTER, // Has a render pass, its attachments are the written images
+		PASS_TRANSFER
+	};
+
+	// Called during the record, inside the render pass for raster passes
+	typedef void (*RecordCallback)(VkCommandBuffer p_command, uint32_t p_slot, void *p_userData);
+
+	struct TransientStats {
+		uint32_t imageCount;
+		uint32_t allocationCount;
+		VkDeviceSize requiredBytes; // Without aliasing
+		VkDeviceSize allocatedBytes;
+		VkDeviceSize lazilyAllocatedBytes;
+
+		TransientStats() :
+				imageCount(0),
+				allocationCount(0),
+				requiredBytes(0),
+				allocatedBytes(0),
+				lazilyAllocatedBytes(0) {}
+	};
+
+	// Stage and access of a layout, used to derive the barriers
+	static bool getLayoutAccess(VkImageLayout p_layout, VkPipelineStageFlags &r_stages, VkAccessFlags &r_access);
+	static VkImageAspectFlags getFormatAspect(VkFormat p_format);
+
+private:
+	struct Resource {
+		std::string name;
+		VkFormat format;
+		bool imported;
+
+		// Transient, 0 means the realize extent
+		uint32_t width;
+		uint32_t height;
+
+		// Imported
+		VkImageLayout initialLayout;
+		VkImageLayout finalLayout;
+		VkPipelineStageFlags initialStages; // Waited before the first access
+		std::vector<VkImage> importedImages;
+		std::vector<VkImageView> importedViews;
+
+		bool output;
+
+		// Compiled
+		VkImageUsageFlags usage;
+		int firstPass; // Index in the execution order
+		int lastPass;
+		int aliasGroup;
+
+		// Realized
+		VkImage image;
+		VkImageView view;
+		VmaAllocation allocation; // Shared by the alias group
+		VkDeviceSize size;
+		bool lazilyAllocated;
+	};
+
+	struct PassAccess {
+		ResourceId resource;
+		Access access;
+		VkAttachmentLoadOp loadOp;
+		VkClearValue clearValue;
+	};
+
+	// The image is set at record time, the imported ones change per slot
+	struct Barrier {
+		ResourceId resource;
+		VkImageMemoryBarrier barrier;
+	};
+
+	struct Pass {
+		std::string name;
+		PassType type;
+		RecordCallback callback;
+		void *userData;
+		bool sideEffect;
+		std::vector<PassAccess> accesses;
+
+		// Compiled
+		bool culled;
+		std::vector<Barrier> barriers;
+		VkPipelineStageFlags barrierSrcStages;
+		VkPipelineStageFlags barrierDstStages;
+		VkRenderPass renderPass;
+		std::vector<ResourceId> attachments; // Of the framebuffer, in order
+		std::vector<VkClearValue> clearValues;
+
+		// Realized, one per slot
+		std::vector<VkFramebuffer> framebuffers;
+	};
+
+	struct AliasGroup {
+		std::vector<ResourceId> resources;
+		VkPipelineStageFlags stages; // Of all the accesses of the resources
+		VkAccessFlags writeAccess;
+		VmaAllocation allocation;
+		VkDeviceSize size;
+	};
+
+	// Images that can't share the group allocation
+	struct DedicatedAllocation {
+		ResourceId resource;
+		VmaAllocation allocation;
+		VkDeviceSize size;
+	};
+
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+
+	// Compiled
+	bool compiled;
+	std::vector<PassId> executionOrder; // Not culled passes
+	std::vector<AliasGroup> aliasGroups;
+
+	// Transitions of the outputs to their final layout, recorded at the end
+	std::vector<Barrier> finalBarriers;
+	VkPipelineStageFlags finalSrcStages;
+	VkPipelineStageFlags finalDstStages;
+
+	// Realized
+	VkDevice device;
+	VmaAllocator allocator;
+	MemoryTracker *memoryTracker;
+	VkExtent2D extent;
+	uint32_t slotCount;
+	std::vector<DedicatedAllocation> dedicatedAllocations;
+	TransientStats transientStats;
+
+public:
+	RenderGraph();
+	~RenderGraph();
+
+	/** BUILD */
+
+	// Clear the declarations, the compiled and realized objects must be
+	// already released
+	void reset();
+
+	ResourceId createImage(const std::string &p_name, VkFormat p_format, uint32_t p_width = 0, uint32_t p_height = 0);
+
+	// p_initialStages are the stages that must complete before the first
+	// access, e.g. the stage waited on the acquire semaphore
+	ResourceId importImage(const std::string &p_name, VkFormat p_format, VkImageLayout p_initialLayout, VkImageLayout p_finalLayout, VkPipelineStageFlags p_initialStages);
+
+	// The outputs, and the passes that write them, are never culled
+	void markOutput(ResourceId p_resource);
+
+	PassId addPass(const std::string &p_name, PassType p_type, RecordCallback p_callback, void *p_userData);
+	void setPassSideEffect(PassId p_pass, bool p_sideEffect);
+
+	void writeColor(PassId p_pass, ResourceId p_resource, VkAttachmentLoadOp p_loadOp, const VkClearColorValue &p_clear = VkClearColorValue());
+	void writeDepth(PassId p_pass, ResourceId p_resource, VkAttachmentLoadOp p_loadOp, float p_clearDepth = 1.);
+	void readDepth(PassId p_pass, ResourceId p_resource);
+	void readSampled(PassId p_pass, ResourceId p_resource);
+	void readTransfer(PassId p_pass, ResourceId p_resource);
+	void writeTransfer(PassId p_pass, ResourceId p_resource);
+
+	/** COMPILE */
+
+	bool compile(VkDevice p_device);
+	void releaseCompiled();
+	bool isCompiled() const { return compiled; }
+
+	bool isPassCulled(PassId p_pass) const;
+	VkRenderPass getRenderPass(PassId p_pass) const;
+
+	/** REALIZE */
+
+	// The imported images must be set, with one image per slot, before the
+	// realize
+	void setImportedImages(ResourceId p_resource, const std::vector<VkImage> &p_images, const std::vector<VkImageView> &p_views);
+
+	// p_lazyMemory allows the attachments that are never stored to use lazily
+	// allocated memory
+	bool realize(VmaAllocator p_allocator, MemoryTracker *p_memoryTracker, VkExtent2D p_extent, uint32_t p_slotCount, bool p_lazyMemory);
+	void releaseRealized();
+
+	// The objects of a realize, taken from the graph so they are destroyed
+	// when the frames that use them are finished
+	struct Realized {
+		VkDevice device;
+		VmaAllocator allocator;
+		MemoryTracker *memoryTracker;
+		std::vector<VkFramebuffer> framebuffers;
+		std::vector<VkImageView> views;
+		std::vector<VkImage> images;
+		std::vector<VmaAllocation> allocations;
+
+		Realized() :
+				device(VK_NULL_HANDLE),
+				allocator(VK_NULL_HANDLE),
+				memoryTracker(nullptr) {}
+	};
+
+	// Leaves the graph unrealized, as releaseRealized, without destroying
+	void takeRealized(Realized &r_realized);
+	static void destroyRealized(Realized &r_realized);
+
+	VkImage getImage(ResourceId p_resource, uint32_t p_slot = 0) const;
+	VkImageView getImageView(ResourceId p_resource, uint32_t p_slot = 0) const;
+	VkDeviceSize getImageSize(ResourceId p_resource) const;
+	bool isImageLazilyAllocated(ResourceId p_resource) const;
+	VmaAllocation getImageAllocation(ResourceId p_resource) const;
+
+	const TransientStats &getTransientStats() const { return transientStats; }
+
+	/** RECORD */
+
+	void record(VkCommandBuffer p_command, uint32_t p_slot);
+
+	void printReport() const;
+
+private:
+	PassAccess &addAccess(PassId p_pass, ResourceId p_resource, Access p_access);
+
+	void cullPasses();
+	void computeLifetimes();
+	void assignAliasGroups();
+	bool derivePassSynchronization();
+	bool createRenderPass(Pass &r_pass, const std::vector<VkAttachmentDescription> &p_descriptions, const VkSubpassDependency &p_dependency);
+	void cmdBarriers(VkCommandBuffer p_command, uint32_t p_slot, const std::vector<Barrier> &p_barriers, VkPipelineStageFlags p_srcStages, VkPipelineStageFlags p_dstStages) const;
+
+	bool allocateTransients(bool p_lazyMemory);
+	bool createFramebuffers();
+};
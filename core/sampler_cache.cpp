@@ -0,0 +1,104 @@
+#include "sampler_cache.h"
+
+#include "core/error_macros.h"
+#include "core/print_string.h"
+#include "core/string.h"
+
+SamplerCache::SamplerCache() :
+		device(VK_NULL_HANDLE) {}
+
+void SamplerCache::create(VkDevice p_device) {
+	device = p_device;
+}
+
+void SamplerCache::destroy() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (samplers.size())
+		WARN_PRINTS("Sampler cache destroyed with " + itos(samplers.size()) + " samplers in use");
+
+	for (auto it = samplers.begin(); it != samplers.end(); ++it) {
+		vkDestroySampler(device, it->second.sampler, nullptr);
+	}
+
+	samplers.clear();
+	samplerKeys.clear();
+	stats = Stats();
+}
+
+SamplerCache::Key SamplerCache::makeKey(const VkSamplerCreateInfo &p_createInfo) {
+	Key key;
+	memset(&key, 0, sizeof(key));
+
+	uint32_t *field = key.fields;
+	*field++ = p_createInfo.flags;
+	*field++ = p_createInfo.magFilter;
+	*field++ = p_createInfo.minFilter;
+	*field++ = p_createInfo.mipmapMode;
+	*field++ = p_createInfo.addressModeU;
+	*field++ = p_createInfo.addressModeV;
+	*field++ = p_createInfo.addressModeW;
+	memcpy(field++, &p_createInfo.mipLodBias, sizeof(float));
+	*field++ = p_createInfo.anisotropyEnable;
+	memcpy(field++, &p_createInfo.maxAnisotropy, sizeof(float));
+	*field++ = p_createInfo.compareEnable;
+	*field++ = p_createInfo.compareOp;
+	memcpy(field++, &p_createInfo.minLod, sizeof(float));
+	memcpy(field++, &p_createInfo.maxLod, sizeof(float));
+	*field++ = p_createInfo.borderColor;
+	*field++ = p_createInfo.unnormalizedCoordinates;
+	return key;
+}
+
+VkSampler SamplerCache::acquire(const VkSamplerCreateInfo &p_createInfo) {
+	ERR_FAIL_COND_V(p_createInfo.pNext, VK_NULL_HANDLE);
+
+	const Key key = makeKey(p_createInfo);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto it = samplers.find(key);
+	if (it != samplers.end()) {
+		++it->second.refCount;
+		++stats.hits;
+		return it->second.sampler;
+	}
+
+	Entry entry;
+	entry.refCount = 1;
+	VkResult res = vkCreateSampler(device, &p_createInfo, nullptr, &entry.sampler);
+	ERR_FAIL_COND_V(VK_SUCCESS != res, VK_NULL_HANDLE);
+
+	samplers[key] = entry;
+	samplerKeys[entry.sampler] = key;
+
+	++stats.misses;
+	++stats.liveSamplers;
+	return entry.sampler;
+}
+
+void SamplerCache::release(VkSampler p_sampler) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto keyIt = samplerKeys.find(p_sampler);
+	ERR_FAIL_COND(keyIt == samplerKeys.end());
+
+	auto it = samplers.find(keyIt->second);
+	if (--it->second.refCount)
+		return;
+
+	vkDestroySampler(device, p_sampler, nullptr);
+	samplers.erase(it);
+	samplerKeys.erase(keyIt);
+	--stats.liveSamplers;
+}
+
+SamplerCache::Stats SamplerCache::getStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void SamplerCache::printStats() {
+	const Stats s = getStats();
+	print_line("Samplers: " + itos(s.liveSamplers) + " live, " + itos(s.hits) + " hits / " + itos(s.misses) + " misses");
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "hellovulkan.h"
+#include <cstring>
+#include <map>
+#include <mutex>
+
+// SAMPLER CACHE
+//		The samplers are deduplicated by their create info: all the textures
+// with the same filtering share one VkSampler, ref counted.
+//		The create info must not have a pNext chain.
+//		Thread safe, the textures are created by the loading threads.
+class SamplerCache {
+public:
+	struct Stats {
+		uint32_t liveSamplers;
+		uint64_t hits;
+		uint64_t misses;
+
+		Stats() :
+				liveSamplers(0),
+				hits(0),
+				misses(0) {}
+	};
+
+private:
+	// All the fields are 32 bits, so there is no padding to compare
+	struct Key {
+		uint32_t fields[16];
+
+		bool operator<(const Key &p_other) const {
+			return memcmp(fields, p_other.fields, sizeof(fields)) < 0;
+		}
+	};
+
+	struct Entry {
+		VkSampler sampler;
+		uint32_t refCount;
+	};
+
+	VkDevice device;
+
+	std::mutex mutex;
+	std::map<Key, Entry> samplers;
+	std::map<VkSampler, Key> samplerKeys;
+
+	Stats stats;
+
+public:
+	SamplerCache();
+
+	void create(VkDevice p_device);
+	void destroy();
+
+	// Returns VK_NULL_HANDLE on failure.
+	// Each acquire must be paired with a release
+	VkSampler acquire(const VkSamplerCreateInfo &p_createInfo);
+	void release(VkSampler p_sampler);
+
+	Stats getStats();
+	void printStats();
+
+private:
+	static Key makeKey(const VkSamplerCreateInfo &p_createInfo);
+};
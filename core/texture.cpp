@@ -1,11 +1,24 @@
 ﻿#include "texture.h"
 
 #define STB_IMAGE_IMPLEMENTATION
+// The images are decoded by the workers of the thread pool, stb writes the
+// failure reason (and the GIF header reset) to a global that is not thread
+// local. The decoder reports its own errors
+#define STBI_NO_FAILURE_STRINGS
+#define STBI_NO_GIF
 #include "libs/stb/stb_image.h"
 
 #include "VisualServer.h"
 #include "core/error_macros.h"
 #include "core/print_string.h"
+#include "core/image_utils.h"
+#include "core/ktx2.h"
+#include "core/mapped_file.h"
+#include "core/profiler.h"
+#include "core/texture_streamer.h"
+#include "core/transcoder.h"
+
+const size_t Texture::MAX_STALE_RECTS = 16;
 
 Texture::Texture(OldVisualServer *p_visualServer) :
 		Texture(p_visualServer->getVulkanServer()) {}
@@ -13,97 +26,232 @@ Texture::Texture(OldVisualServer *p_visualServer) :
 Texture::Texture(VulkanServer *p_vulkanServer) :
 		vulkanServer(p_vulkanServer),
 		image(VK_NULL_HANDLE),
-		imageMemory(VK_NULL_HANDLE),
+		imageAllocation(VK_NULL_HANDLE),
 		imageView(VK_NULL_HANDLE),
 		imageSampler(VK_NULL_HANDLE),
-		channels_of_image(4) // RGB Alpha
-{}
+		uploadBatch(0),
+		channels_of_image(4), // RGB Alpha
+		mipLevels(1),
+		format(VK_FORMAT_R8G8B8A8_UNORM),
+		swizzle(),
+		dataSize(0),
+		streamed(false),
+		streamingId(TextureStreamer::NOT_REQUESTED),
+		residentLevel(0),
+		dynamic(false),
+		doubleBuffered(false),
+		swapPending(false),
+		backImage(VK_NULL_HANDLE),
+		backImageAllocation(VK_NULL_HANDLE),
+		backImageView(VK_NULL_HANDLE) {}
 
 Texture::~Texture() {
 	clear();
 }
 
-bool Texture::load(const std::string &p_path) {
+bool Texture::load(const std::string &p_path, MipmapMode p_mipmapMode, Usage p_usage) {
+	PROFILE_ZONE("Texture::load");
+
+	if (isKTX2Path(p_path))
+		return loadKTX2(p_path);
 
 	clear();
 
-	VkBuffer imageBuffer;
-	VmaAllocation allocation;
-	VmaAllocator allocator;
+	MappedFile file;
+	if (!file.open(p_path)) {
+		ERR_EXPLAIN("Can't open the texture: " + p_path);
+		ERR_FAIL_V(false);
+	}
 
-	// Load image inside buffer
-	{
-		int real_channels_of_image;
-		unsigned char *imageData = stbi_load(p_path.c_str(), &width, &height, &real_channels_of_image, channels_of_image);
+	return loadMemory(file.getData(), file.getSize(), p_path, p_mipmapMode, p_usage);
+}
 
-		ERR_FAIL_COND_V(!imageData, false);
+bool Texture::loadMemory(const uint8_t *p_data, size_t p_size, const std::string &p_path, MipmapMode p_mipmapMode, Usage p_usage) {
+	PROFILE_ZONE("Texture::loadMemory");
 
-		VkDeviceSize size = width * height * channels_of_image;
+	if (isKTX2Path(p_path))
+		return _loadKTX2(p_data, p_size, p_path);
 
-		// Load inside buffer
-		if (!vulkanServer->createImageLoadBuffer(size, imageBuffer, allocation, allocator)) {
-			print_error("Failed to create load buffer during image loading");
-			stbi_image_free(imageData);
-			return false;
+	clear();
+
+	// Counted in the decoder stats like the batches
+	std::vector<ImageDecoder::Image> images;
+	vulkanServer->getImageDecoder().decodeAll(
+			nullptr,
+			1,
+			[this, p_data, p_size, &p_path, p_mipmapMode, p_usage](uint32_t, ImageDecoder::Image &r_image) {
+				return _decode(p_data, p_size, p_path, p_mipmapMode, p_usage, r_image);
+			},
+			images);
+
+	if (images[0].data.empty()) {
+		clear();
+		return false;
+	}
+
+	return _upload(images[0]);
+}
+
+uint32_t Texture::loadBatch(const std::vector<Texture *> &p_textures, const std::vector<std::string> &p_paths, MipmapMode p_mipmapMode, Usage p_usage) {
+	PROFILE_ZONE("Texture::loadBatch");
+
+	ERR_FAIL_COND_V(p_textures.size() != p_paths.size(), 0);
+	if (p_textures.empty())
+		return 0;
+
+	VulkanServer *vulkanServer = p_textures[0]->vulkanServer;
+
+	// The KTX2 files have nothing to decode
+	uint32_t loaded = 0;
+	std::vector<uint32_t> decoded;
+	for (uint32_t i = 0; i < p_textures.size(); ++i) {
+		if (isKTX2Path(p_paths[i])) {
+			if (p_textures[i]->loadKTX2(p_paths[i]))
+				++loaded;
+		} else {
+			p_textures[i]->clear();
+			decoded.push_back(i);
+		}
+	}
+
+	std::vector<ImageDecoder::Image> images;
+	vulkanServer->getImageDecoder().decodeAll(
+			&vulkanServer->getThreadPool(),
+			decoded.size(),
+			[&p_textures, &p_paths, &decoded, p_mipmapMode, p_usage](uint32_t p_index, ImageDecoder::Image &r_image) {
+				const uint32_t i = decoded[p_index];
+				MappedFile file;
+				if (!file.open(p_paths[i])) {
+					ERR_EXPLAIN("Can't open the texture: " + p_paths[i]);
+					ERR_FAIL_V(false);
+				}
+				return p_textures[i]->_decode(file.getData(), file.getSize(), p_paths[i], p_mipmapMode, p_usage, r_image);
+			},
+			images);
+
+	for (size_t i = 0; i < decoded.size(); ++i) {
+		Texture *texture = p_textures[decoded[i]];
+		if (images[i].data.empty()) {
+			texture->clear();
+			continue;
+		}
+
+		if (texture->_upload(images[i]))
+			++loaded;
+
+		// Releases the memory of the decoded image early
+		images[i] = ImageDecoder::Image();
+	}
+
+	return loaded;
+}
+
+bool Texture::isKTX2Path(const std::string &p_path) {
+	const std::string ktx2Extension(".ktx2");
+	return p_path.size() > ktx2Extension.size() &&
+		   0 == p_path.compare(p_path.size() - ktx2Extension.size(), ktx2Extension.size(), ktx2Extension);
+}
+
+bool Texture::_decode(const uint8_t *p_data, size_t p_size, const std::string &p_path, MipmapMode p_mipmapMode, Usage p_usage, ImageDecoder::Image &r_image) {
+	PROFILE_ZONE("Texture::_decode");
+
+	bool blitMips = false;
+
+	// Once the header is read the format is known, so the data is decoded
+	// with its channels and reserved for the mip chain
+	const bool success = ImageDecoder::decodeMemory(p_data, p_size, p_path, [&](const ImageDecoder::Image &p_image, size_t &r_reserve) {
+		width = p_image.width;
+		height = p_image.height;
+		format = _chooseFormat(p_image.sourceChannels, p_usage, channels_of_image, swizzle);
+
+		mipLevels = MIPMAP_NONE == p_mipmapMode ? 1 : computeMipLevels(width, height);
+
+		// Without the linear blit the chain is filtered by the CPU, the
+		// streamed levels are kept in host memory
+		blitMips = mipLevels > 1 &&
+				   MIPMAP_GENERATE == p_mipmapMode &&
+				   !(streamed && mipLevels > 1) &&
+				   vulkanServer->isLinearBlitSupported(format);
+
+		dataSize = 0;
+		for (uint32_t level = 0; level < mipLevels; ++level) {
+			dataSize += KTX2::getLevelSize(format, width, height, level);
 		}
 
-		void *data;
-		vmaMapMemory(allocator, allocation, &data);
-		memcpy(data, imageData, size);
-		vmaUnmapMemory(allocator, allocation);
+		r_reserve = blitMips ? 0 : dataSize;
+		return channels_of_image;
+	},
+			r_image);
+
+	if (!success)
+		return false;
+
+	if (mipLevels > 1 && !blitMips)
+		buildMipChain(width, height, channels_of_image, mipLevels, r_image.data, USAGE_COLOR_SRGB == p_usage);
+
+	return true;
+}
 
-		stbi_image_free(imageData);
+bool Texture::_upload(const ImageDecoder::Image &p_image) {
+	PROFILE_ZONE("Texture::_upload");
+
+	const VkDeviceSize size = VkDeviceSize(width) * height * channels_of_image;
+	const bool hasChain = p_image.data.size() > size;
+
+	// The streamed textures always have the chain built by the CPU
+	if (streamed && hasChain) {
+		std::vector<TransferBatcher::ImageLevel> levels(mipLevels);
+		VkDeviceSize offset = 0;
+		for (uint32_t level = 0; level < mipLevels; ++level) {
+			levels[level].data = p_image.data.data() + offset;
+			levels[level].size = KTX2::getLevelSize(format, width, height, level);
+			offset += levels[level].size;
+		}
+
+		if (!_initStreaming(levels)) {
+			clear();
+			return false;
+		}
+		return true;
 	}
 
 	bool success = false;
 	// Create image
-	if (vulkanServer->createImageTexture(width, height, image, imageMemory)) {
+	if (vulkanServer->createImageTexture(width, height, image, imageAllocation, mipLevels, format)) {
 
 		// Create image view
-		if (vulkanServer->createImageViewTexture(image, imageView)) {
-
-			if (vulkanServer->transitionImageLayout(image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)) {
-
-				// fill image
-				VkCommandBuffer commandBuffer;
-				if (vulkanServer->allocateCommand(commandBuffer)) {
-					vulkanServer->beginOneTimeCommand(commandBuffer);
-
-					VkBufferImageCopy region = {};
-					region.bufferOffset = 0;
-					region.bufferRowLength = 0;
-					region.bufferImageHeight = 0;
-					region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-					region.imageSubresource.mipLevel = 0;
-					region.imageSubresource.baseArrayLayer = 0;
-					region.imageSubresource.layerCount = 1;
-					region.imageOffset = { 0, 0, 0 };
-					region.imageExtent = { (uint32_t)width, (uint32_t)height, 1 };
-
-					vkCmdCopyBufferToImage(commandBuffer,
-							imageBuffer,
-							image,
-							VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-							1,
-							&region);
-
-					if (vulkanServer->endCommand(commandBuffer)) {
-						if (vulkanServer->submitWaitCommand(commandBuffer)) {
-							if (vulkanServer->transitionImageLayout(image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)) {
-								if (_createSampler()) {
-									success = true;
-								}
-							}
-						}
-					}
-					vulkanServer->freeCommand(commandBuffer);
+		if (vulkanServer->createImageViewTexture(image, imageView, mipLevels, format, swizzle)) {
+
+			// The transitions and the copy are batched with the other uploads,
+			// and executed before the next frame
+			if (mipLevels > 1 && !hasChain) {
+				uploadBatch = vulkanServer->getTransferBatcher().uploadImageGenerateMips(
+						image,
+						format,
+						width,
+						height,
+						p_image.data.data(),
+						size,
+						mipLevels);
+			} else {
+				uploadBatch = vulkanServer->getTransferBatcher().uploadImage(
+						image,
+						format,
+						width,
+						height,
+						p_image.data.data(),
+						p_image.data.size(),
+						mipLevels);
+			}
+
+			if (uploadBatch) {
+				if (_createSampler()) {
+					success = true;
 				}
 			}
 		}
 	}
 
-	// Destroy support buffer
-	vulkanServer->destroyBuffer(allocator, imageBuffer, allocation);
 	if (!success) {
 		// cleanup in case of errors
 		clear();
@@ -111,6 +259,393 @@ bool Texture::load(const std::string &p_path) {
 	return success;
 }
 
+bool Texture::loadKTX2(const std::string &p_path) {
+	PROFILE_ZONE("Texture::loadKTX2");
+
+	clear();
+
+	MappedFile file;
+	if (!file.open(p_path)) {
+		ERR_EXPLAIN("Can't open the texture: " + p_path);
+		ERR_FAIL_V(false);
+	}
+
+	return _loadKTX2(file.getData(), file.getSize(), p_path);
+}
+
+bool Texture::_loadKTX2(const uint8_t *p_data, size_t p_size, const std::string &p_path) {
+	clear();
+
+	KTX2::Header header;
+	if (!KTX2::parse(p_data, p_size, header)) {
+		ERR_EXPLAIN("Can't parse the texture: " + p_path);
+		ERR_FAIL_V(false);
+	}
+
+	width = header.width;
+	height = header.height;
+	mipLevels = header.levels.size();
+	swizzle = VkComponentMapping();
+
+	std::vector<TransferBatcher::ImageLevel> levels(mipLevels);
+	std::vector<std::vector<uint8_t> > transcodedLevels;
+
+	if (header.universal) {
+		format = vulkanServer->chooseTranscodeFormat(header.alpha);
+
+		// Each level is split between the workers
+		transcodedLevels.resize(mipLevels);
+		for (uint32_t i = 0; i < mipLevels; ++i) {
+			if (!Transcoder::transcodeLevel(
+						&vulkanServer->getThreadPool(),
+						p_data + header.levels[i].offset,
+						MAX(uint32_t(width) >> i, 1u),
+						MAX(uint32_t(height) >> i, 1u),
+						header.alpha,
+						format,
+						transcodedLevels[i])) {
+				return false;
+			}
+
+			levels[i].data = transcodedLevels[i].data();
+			levels[i].size = transcodedLevels[i].size();
+		}
+	} else {
+		if (!vulkanServer->isSampledFormatSupported(header.format)) {
+			ERR_EXPLAIN("The device doesn't support the format of the texture: " + p_path);
+			ERR_FAIL_V(false);
+		}
+
+		format = header.format;
+
+		// The levels point in the file data, they are copied by the upload
+		for (uint32_t i = 0; i < mipLevels; ++i) {
+			levels[i].data = p_data + header.levels[i].offset;
+			levels[i].size = header.levels[i].size;
+		}
+	}
+
+	dataSize = 0;
+	for (uint32_t i = 0; i < mipLevels; ++i) {
+		dataSize += levels[i].size;
+	}
+
+	if (streamed && mipLevels > 1) {
+		if (!_initStreaming(levels)) {
+			clear();
+			return false;
+		}
+		return true;
+	}
+
+	bool success = false;
+	if (vulkanServer->createImageTexture(width, height, image, imageAllocation, mipLevels, format)) {
+		if (vulkanServer->createImageViewTexture(image, imageView, mipLevels, format)) {
+
+			// The data can be released once the levels are in the staging buffer
+			uploadBatch = vulkanServer->getTransferBatcher().uploadImageLevels(
+					image,
+					format,
+					width,
+					height,
+					levels);
+
+			if (uploadBatch) {
+				if (_createSampler()) {
+					success = true;
+				}
+			}
+		}
+	}
+
+	if (!success) {
+		clear();
+	}
+	return success;
+}
+
+VkFormat Texture::_chooseFormat(int p_sourceChannels, Usage p_usage, int &r_channels, VkComponentMapping &r_swizzle) const {
+	const bool srgb = USAGE_COLOR_SRGB == p_usage;
+
+	// Identity
+	r_swizzle = VkComponentMapping();
+
+	VkFormat format;
+	switch (p_sourceChannels) {
+		case 1:
+			r_channels = 1;
+			format = srgb ? VK_FORMAT_R8_SRGB : VK_FORMAT_R8_UNORM;
+			if (USAGE_DATA != p_usage) {
+				// Gray, opaque
+				r_swizzle.r = VK_COMPONENT_SWIZZLE_R;
+				r_swizzle.g = VK_COMPONENT_SWIZZLE_R;
+				r_swizzle.b = VK_COMPONENT_SWIZZLE_R;
+				r_swizzle.a = VK_COMPONENT_SWIZZLE_ONE;
+			}
+			break;
+		case 2:
+			if (srgb) {
+				// R8G8_SRGB decodes the alpha in G as a color, stb expands the
+				// gray in RGB and the alpha stays linear
+				r_channels = 4;
+				return VK_FORMAT_R8G8B8A8_SRGB;
+			}
+			r_channels = 2;
+			format = VK_FORMAT_R8G8_UNORM;
+			if (USAGE_DATA != p_usage) {
+				// Gray in R, alpha in G
+				r_swizzle.r = VK_COMPONENT_SWIZZLE_R;
+				r_swizzle.g = VK_COMPONENT_SWIZZLE_R;
+				r_swizzle.b = VK_COMPONENT_SWIZZLE_R;
+				r_swizzle.a = VK_COMPONENT_SWIZZLE_G;
+			}
+			break;
+		default:
+			r_channels = 4;
+			return srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+	}
+
+	if (vulkanServer->isSampledFormatSupported(format))
+		return format;
+
+	// The R8 sRGB format is optional, stb expands the gray in RGB
+	r_channels = 4;
+	r_swizzle = VkComponentMapping();
+	return srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+}
+
+bool Texture::_initStreaming(const std::vector<TransferBatcher::ImageLevel> &p_levels) {
+
+	std::vector<uint64_t> levelSizes(p_levels.size());
+	streamLevels.resize(p_levels.size());
+	for (size_t i = 0; i < p_levels.size(); ++i) {
+		const uint8_t *data = static_cast<const uint8_t *>(p_levels[i].data);
+		streamLevels[i].assign(data, data + p_levels[i].size);
+		levelSizes[i] = p_levels[i].size;
+	}
+
+	TextureStreamer &streamer = vulkanServer->getTextureStreamer();
+	streamingId = streamer.addTexture(width, height, levelSizes, this);
+	ERR_FAIL_COND_V(TextureStreamer::NOT_REQUESTED == streamingId, false);
+
+	if (!_setResidentLevel(streamer.getTailLevel(streamingId)))
+		return false;
+
+	return _createSampler();
+}
+
+bool Texture::_setResidentLevel(uint32_t p_level) {
+	PROFILE_ZONE("Texture::_setResidentLevel");
+
+	ERR_FAIL_COND_V(p_level >= streamLevels.size(), false);
+
+	const uint32_t levelCount = mipLevels - p_level;
+	const uint32_t levelWidth = MAX(uint32_t(width) >> p_level, 1u);
+	const uint32_t levelHeight = MAX(uint32_t(height) >> p_level, 1u);
+
+	VkImage newImage = VK_NULL_HANDLE;
+	VmaAllocation newAllocation = VK_NULL_HANDLE;
+	VkImageView newImageView = VK_NULL_HANDLE;
+
+	if (!vulkanServer->createImageTexture(levelWidth, levelHeight, newImage, newAllocation, levelCount, format))
+		return false;
+
+	if (!vulkanServer->createImageViewTexture(newImage, newImageView, levelCount, format, swizzle)) {
+		vulkanServer->destroyImage(newImage, newAllocation);
+		return false;
+	}
+
+	std::vector<TransferBatcher::ImageLevel> levels(levelCount);
+	for (uint32_t i = 0; i < levelCount; ++i) {
+		levels[i].data = streamLevels[p_level + i].data();
+		levels[i].size = streamLevels[p_level + i].size();
+	}
+
+	const uint64_t batch = vulkanServer->getTransferBatcher().uploadImageLevels(
+			newImage,
+			format,
+			levelWidth,
+			levelHeight,
+			levels);
+
+	if (!batch) {
+		vulkanServer->destroyImageView(newImageView);
+		vulkanServer->destroyImage(newImage, newAllocation);
+		return false;
+	}
+
+	// The frames in flight may still sample the current image
+	if (VK_NULL_HANDLE != image)
+		vulkanServer->retireTextureImage(image, imageAllocation, imageView, uploadBatch);
+
+	image = newImage;
+	imageAllocation = newAllocation;
+	imageView = newImageView;
+	uploadBatch = batch;
+	residentLevel = p_level;
+	return true;
+}
+
+bool Texture::create(uint32_t p_width, uint32_t p_height, VkFormat p_format, const void *p_data, bool p_doubleBuffered) {
+	PROFILE_ZONE("Texture::create");
+
+	clear();
+
+	const uint32_t texelSize = KTX2::getBlockSize(p_format);
+	ERR_FAIL_COND_V(!texelSize || KTX2::isBlockCompressed(p_format), false);
+	ERR_FAIL_COND_V(!p_width || !p_height, false);
+
+	width = p_width;
+	height = p_height;
+	format = p_format;
+	swizzle = VkComponentMapping();
+	mipLevels = 1;
+	dataSize = uint64_t(p_width) * p_height * texelSize;
+	dynamic = true;
+	doubleBuffered = p_doubleBuffered;
+
+	std::vector<uint8_t> zero;
+	const uint8_t *data = static_cast<const uint8_t *>(p_data);
+	if (!data) {
+		zero.resize(dataSize, 0);
+		data = zero.data();
+	}
+
+	if (doubleBuffered)
+		hostCopy.assign(data, data + dataSize);
+
+	if (!_createDynamicImage(data, image, imageAllocation, imageView) ||
+			(doubleBuffered && !_createDynamicImage(data, backImage, backImageAllocation, backImageView)) ||
+			!_createSampler()) {
+		clear();
+		return false;
+	}
+
+	// Only the double buffered textures swap their image
+	if (doubleBuffered)
+		vulkanServer->registerDynamicTexture(this);
+
+	return true;
+}
+
+bool Texture::_createDynamicImage(const void *p_data, VkImage &r_image, VmaAllocation &r_allocation, VkImageView &r_imageView) {
+
+	if (!vulkanServer->createImageTexture(width, height, r_image, r_allocation, 1, format))
+		return false;
+
+	if (!vulkanServer->createImageViewTexture(r_image, r_imageView, 1, format, swizzle))
+		return false;
+
+	uploadBatch = vulkanServer->getTransferBatcher().uploadImage(
+			r_image,
+			format,
+			width,
+			height,
+			p_data,
+			dataSize);
+
+	return uploadBatch;
+}
+
+bool Texture::update(const Rect &p_rect, const void *p_data, uint32_t p_rowPitch) {
+	PROFILE_ZONE("Texture::update");
+
+	ERR_FAIL_COND_V(!dynamic, false);
+	ERR_FAIL_COND_V(!p_rect.width || !p_rect.height, false);
+	ERR_FAIL_COND_V(p_rect.x + p_rect.width > uint32_t(width) || p_rect.y + p_rect.height > uint32_t(height), false);
+
+	const uint32_t texelSize = KTX2::getBlockSize(format);
+	const uint32_t rowPitch = p_rowPitch ? p_rowPitch : p_rect.width * texelSize;
+
+	std::lock_guard<std::mutex> lock(updateMutex);
+
+	std::vector<TransferBatcher::ImageRegion> regions;
+
+	if (!doubleBuffered) {
+		// The copy waits the frames in flight that sample the image
+		TransferBatcher::ImageRegion region;
+		region.offset = { int32_t(p_rect.x), int32_t(p_rect.y) };
+		region.extent = { p_rect.width, p_rect.height };
+		region.data = p_data;
+		region.rowPitch = rowPitch;
+		regions.push_back(region);
+
+		const uint64_t batch = vulkanServer->getTransferBatcher().updateImage(image, format, regions);
+		ERR_FAIL_COND_V(!batch, false);
+		uploadBatch = batch;
+		return true;
+	}
+
+	const uint32_t hostPitch = width * texelSize;
+	const uint8_t *src = static_cast<const uint8_t *>(p_data);
+	uint8_t *dst = hostCopy.data() + p_rect.y * hostPitch + p_rect.x * texelSize;
+	for (uint32_t row = 0; row < p_rect.height; ++row) {
+		memcpy(dst, src, p_rect.width * texelSize);
+		dst += hostPitch;
+		src += rowPitch;
+	}
+
+	// The back receives the rectangle and what it missed of the front
+	backStaleRects.push_back(p_rect);
+	for (size_t i = 0; i < backStaleRects.size(); ++i) {
+		const Rect &rect = backStaleRects[i];
+
+		TransferBatcher::ImageRegion region;
+		region.offset = { int32_t(rect.x), int32_t(rect.y) };
+		region.extent = { rect.width, rect.height };
+		region.data = hostCopy.data() + rect.y * hostPitch + rect.x * texelSize;
+		region.rowPitch = hostPitch;
+		regions.push_back(region);
+	}
+
+	const uint64_t batch = vulkanServer->getTransferBatcher().updateImage(backImage, format, regions);
+	ERR_FAIL_COND_V(!batch, false);
+	uploadBatch = batch;
+
+	backStaleRects.clear();
+	frontStaleRects.push_back(p_rect);
+
+	if (frontStaleRects.size() > MAX_STALE_RECTS) {
+		Rect bounds = frontStaleRects[0];
+		for (size_t i = 1; i < frontStaleRects.size(); ++i) {
+			const Rect &rect = frontStaleRects[i];
+			const uint32_t right = MAX(bounds.x + bounds.width, rect.x + rect.width);
+			const uint32_t bottom = MAX(bounds.y + bounds.height, rect.y + rect.height);
+			bounds.x = MIN(bounds.x, rect.x);
+			bounds.y = MIN(bounds.y, rect.y);
+			bounds.width = right - bounds.x;
+			bounds.height = bottom - bounds.y;
+		}
+		frontStaleRects.assign(1, bounds);
+	}
+
+	swapPending = true;
+	return true;
+}
+
+bool Texture::_swapBuffers() {
+	std::lock_guard<std::mutex> lock(updateMutex);
+
+	if (!swapPending)
+		return false;
+
+	// The copies of the back are flushed by the draw before its submission
+	std::swap(image, backImage);
+	std::swap(imageAllocation, backImageAllocation);
+	std::swap(imageView, backImageView);
+	std::swap(frontStaleRects, backStaleRects);
+	swapPending = false;
+	return true;
+}
+
+uint64_t Texture::getRGBA8DataSize() const {
+	uint64_t size = 0;
+	for (uint32_t level = 0; level < mipLevels; ++level) {
+		size += KTX2::getLevelSize(VK_FORMAT_R8G8B8A8_UNORM, width, height, level);
+	}
+	return size;
+}
+
 bool Texture::_createSampler() {
 
 	VkSamplerCreateInfo samplerCreateInfo = {};
@@ -126,19 +661,52 @@ bool Texture::_createSampler() {
 	samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
 	samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
 	samplerCreateInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	// Trilinear over the whole chain, the view limits the levels so the
+	// textures with different chains share the sampler
+	samplerCreateInfo.minLod = 0;
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+	samplerCreateInfo.mipLodBias = 0;
 
-	return VK_SUCCESS == vkCreateSampler(vulkanServer->device, &samplerCreateInfo, nullptr, &imageSampler);
+	imageSampler = vulkanServer->getSamplerCache().acquire(samplerCreateInfo);
+	return VK_NULL_HANDLE != imageSampler;
 }
 
 void Texture::clear() {
+	if (TextureStreamer::NOT_REQUESTED != streamingId) {
+		vulkanServer->getTextureStreamer().removeTexture(streamingId);
+		streamingId = TextureStreamer::NOT_REQUESTED;
+	}
+	streamLevels.clear();
+	residentLevel = 0;
+
+	if (dynamic && doubleBuffered)
+		vulkanServer->unregisterDynamicTexture(this);
+
 	if (VK_NULL_HANDLE != imageSampler) {
-		vkDestroySampler(vulkanServer->device, imageSampler, nullptr);
+		vulkanServer->getSamplerCache().release(imageSampler);
 		imageSampler = VK_NULL_HANDLE;
 	}
+	if (uploadBatch) {
+		// The image can't be destroyed while the upload is executed
+		vulkanServer->getTransferBatcher().wait(uploadBatch);
+		uploadBatch = 0;
+	}
 	if (VK_NULL_HANDLE != imageView) {
 		vulkanServer->destroyImageView(imageView);
 	}
 	if (VK_NULL_HANDLE != image) {
-		vulkanServer->destroyImage(image, imageMemory);
+		vulkanServer->destroyImage(image, imageAllocation);
+	}
+	if (VK_NULL_HANDLE != backImageView) {
+		vulkanServer->destroyImageView(backImageView);
+	}
+	if (VK_NULL_HANDLE != backImage) {
+		vulkanServer->destroyImage(backImage, backImageAllocation);
 	}
+	hostCopy.clear();
+	frontStaleRects.clear();
+	backStaleRects.clear();
+	dynamic = false;
+	doubleBuffered = false;
+	swapPending = false;
 }
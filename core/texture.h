@@ -1,7 +1,10 @@
 ﻿#ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include "core/image_decoder.h"
+#include "core/transfer_batcher.h"
 #include "hellovulkan.h"
+#include <mutex>
 
 class OldVisualServer;
 class VulkanServer;
@@ -10,24 +13,182 @@ class Mesh;
 class Texture {
 	friend class Mesh;
 	friend class MeshHandle;
+	friend class VulkanServer;
 
 	VulkanServer *vulkanServer;
 	VkImage image;
-	VkDeviceMemory imageMemory;
+	VmaAllocation imageAllocation;
 	VkImageView imageView;
 	VkSampler imageSampler;
 
+	// Batch of the upload, 0 when there is no upload
+	uint64_t uploadBatch;
+
 	int width;
 	int height;
 	int channels_of_image;
+	uint32_t mipLevels;
+	VkFormat format;
+	VkComponentMapping swizzle;
+	uint64_t dataSize;
+
+	// The streamed textures keep all the levels in host memory, and only
+	// the levels from residentLevel are in the image
+	bool streamed;
+	uint32_t streamingId;
+	uint32_t residentLevel;
+	std::vector<std::vector<uint8_t> > streamLevels;
+
+public:
+	struct Rect {
+		uint32_t x;
+		uint32_t y;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	// Above this the stale rectangles are merged in their bounds
+	static const size_t MAX_STALE_RECTS;
+
+private:
+	// The dynamic textures are created by create and changed by update.
+	// When double buffered the updates write the back image, that becomes
+	// the front at the next draw, so the frames in flight keep sampling the
+	// front without waiting the copy. An image misses the rectangles written
+	// in the other since its last update (the stale rectangles), they are
+	// copied again from the host copy of the texture
+	bool dynamic;
+	bool doubleBuffered;
+	bool swapPending;
+	VkImage backImage;
+	VmaAllocation backImageAllocation;
+	VkImageView backImageView;
+	std::vector<uint8_t> hostCopy;
+	std::vector<Rect> frontStaleRects;
+	std::vector<Rect> backStaleRects;
+	// The updates come from the game thread, the swap from the draw
+	std::mutex updateMutex;
+
+	// The bindings of the double buffered images, owned by the render
+	// thread. Each frame samples the image published to it once its fence is
+	// signaled, so the swap doesn't touch the frames in flight: with the
+	// update after bind the frame has its own slot of the texture table,
+	// written in place, otherwise it binds the set (or the slot) of the image
+	// and only its command buffer is recorded again
+	struct FrameImages {
+		VkImageView views[2];
+		VkSampler sampler;
+		// Of the images, bound by the frames without their own slot
+		VkDescriptorSet sets[2];
+		uint32_t tableIndices[2];
+		// The frame slots are written in place
+		bool ownSlots;
+		// Per swapchain image
+		std::vector<VkImageView> frameViews;
+		std::vector<VkDescriptorSet> frameSets;
+		std::vector<uint32_t> frameTableIndices;
+
+		FrameImages() :
+				views(),
+				sampler(VK_NULL_HANDLE),
+				sets(),
+				ownSlots(false) {
+			tableIndices[0] = tableIndices[1] = UINT32_MAX;
+		}
+	};
+	FrameImages frameImages;
 
 public:
+	enum MipmapMode {
+		MIPMAP_NONE,
+		// Blit chain on the GPU, or CPU box filter when the format doesn't
+		// support the linear blit
+		MIPMAP_GENERATE,
+		MIPMAP_GENERATE_CPU
+	};
+
+	// Drives the format of the decoded images: the grayscale images are
+	// stored in R8 and the grayscale with alpha in R8G8 (RGB is expanded to
+	// RGBA8, the devices rarely sample RGB8), and the view swizzle returns to
+	// the shaders the same RGBA of the RGBA8 texture.
+	enum Usage {
+		// Color sampled as stored, the swapchain is UNORM too
+		USAGE_COLOR,
+		// Color stored in sRGB, the shaders read linear values
+		USAGE_COLOR_SRGB,
+		// Not color (masks, normal maps), the channels are read as stored
+		// without swizzle: R8 gives (r, 0, 0, 1)
+		USAGE_DATA
+	};
+
 	Texture(VulkanServer *p_vulkanServer);
 	Texture(OldVisualServer *p_visualServer);
 	~Texture();
-	bool load(const std::string &p_path);
+	// The .ktx2 files are loaded by loadKTX2, and the mipmap mode is ignored
+	bool load(const std::string &p_path, MipmapMode p_mipmapMode = MIPMAP_GENERATE, Usage p_usage = USAGE_COLOR);
+	// Like load, from the bytes of the file already in memory. p_path is for
+	// the errors, its extension chooses the KTX2 loader
+	bool loadMemory(const uint8_t *p_data, size_t p_size, const std::string &p_path, MipmapMode p_mipmapMode = MIPMAP_GENERATE, Usage p_usage = USAGE_COLOR);
+
+	// Loads each texture like load, the images are decoded in parallel by the
+	// image decoder of the VulkanServer on its thread pool (with the CPU mip
+	// chains), then uploaded by the calling thread. Returns the textures
+	// loaded, a texture that fails is left empty
+	static uint32_t loadBatch(const std::vector<Texture *> &p_textures, const std::vector<std::string> &p_paths, MipmapMode p_mipmapMode = MIPMAP_GENERATE, Usage p_usage = USAGE_COLOR);
+
+	// The file is mapped and its blocks are copied in the staging buffer
+	// as they are, with all the levels stored by the cooker. The universal
+	// files are transcoded to the best format supported by the device
+	bool loadKTX2(const std::string &p_path);
+
+	// Must be set before the load. The texture is registered in the streamer
+	// of the VulkanServer, and only the tail of the chain is resident until
+	// the meshes on the screen want more. The decoded images generate the
+	// chain on the CPU. Without mip levels it has no effect
+	void setStreamed(bool p_streamed) { streamed = p_streamed; }
+	bool isStreamed() const { return streamed; }
+	uint32_t getResidentLevel() const { return residentLevel; }
+
+	// Creates a dynamic texture without mip levels, uncompressed formats
+	// only. p_data is the initial content, all zero when null
+	bool create(uint32_t p_width, uint32_t p_height, VkFormat p_format = VK_FORMAT_R8G8B8A8_UNORM, const void *p_data = nullptr, bool p_doubleBuffered = false);
+
+	// Writes the rectangle of a dynamic texture, the data is copied in the
+	// staging ring before the return and is visible from the next frame.
+	// p_rowPitch is the bytes between the rows of the data, 0 when packed
+	bool update(const Rect &p_rect, const void *p_data, uint32_t p_rowPitch = 0);
+
+	bool isDynamic() const { return dynamic; }
+	bool isDoubleBuffered() const { return doubleBuffered; }
+
+	uint32_t getMipLevels() const { return mipLevels; }
+	VkFormat getFormat() const { return format; }
+	// Bytes of all the levels, without the alignment of the device memory
+	uint64_t getDataSize() const { return dataSize; }
+	// Bytes the same levels would take in RGBA8
+	uint64_t getRGBA8DataSize() const;
 
 private:
+	static bool isKTX2Path(const std::string &p_path);
+	// The CPU part of load, run by any thread: chooses the format, decodes
+	// the file data and builds the mip chain when not blitted. The texture
+	// must be cleared
+	bool _decode(const uint8_t *p_data, size_t p_size, const std::string &p_path, MipmapMode p_mipmapMode, Usage p_usage, ImageDecoder::Image &r_image);
+	bool _loadKTX2(const uint8_t *p_data, size_t p_size, const std::string &p_path);
+	// Creates the image and enqueues the upload of the decoded data, the
+	// texture is cleared on failure
+	bool _upload(const ImageDecoder::Image &p_image);
+	// Falls back to RGBA8 when the device can't sample the smaller format
+	VkFormat _chooseFormat(int p_sourceChannels, Usage p_usage, int &r_channels, VkComponentMapping &r_swizzle) const;
+	// Copies the levels and creates the image with the tail
+	bool _initStreaming(const std::vector<TransferBatcher::ImageLevel> &p_levels);
+	// Creates the image with the levels from p_level and uploads them from
+	// the host copy, the current image is retired. The resident levels are
+	// uploaded again, they are a third of the new top level
+	bool _setResidentLevel(uint32_t p_level);
+	bool _createDynamicImage(const void *p_data, VkImage &r_image, VmaAllocation &r_allocation, VkImageView &r_imageView);
+	// Called by the draw, returns true when the back image becomes the front
+	bool _swapBuffers();
 	bool _createSampler();
 	void clear();
 };
@@ -0,0 +1,236 @@
+#include "texture_cache.h"
+
+#include "core/error_macros.h"
+#include "core/mapped_file.h"
+#include "core/print_string.h"
+#include "core/profiler.h"
+#include "core/string.h"
+
+#include <cstring>
+
+TextureCache::TextureCache() :
+		vulkanServer(nullptr) {}
+
+void TextureCache::create(VulkanServer *p_vulkanServer) {
+	vulkanServer = p_vulkanServer;
+}
+
+void TextureCache::destroy() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (textureEntries.size())
+		WARN_PRINTS("Texture cache destroyed with " + itos(textureEntries.size()) + " textures in use");
+
+	for (auto it = textureEntries.begin(); it != textureEntries.end(); ++it) {
+		delete it->second->texture;
+		delete it->second;
+	}
+
+	pathEntries.clear();
+	contentEntries.clear();
+	textureEntries.clear();
+	stats = Stats();
+}
+
+uint64_t TextureCache::hash(const uint8_t *p_data, size_t p_size) {
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < p_size; ++i) {
+		h ^= p_data[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+Texture *TextureCache::acquire(const std::string &p_path, Texture::MipmapMode p_mipmapMode, Texture::Usage p_usage) {
+	PROFILE_ZONE("TextureCache::acquire");
+
+	const PathKey pathKey(p_path, p_mipmapMode, p_usage);
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	auto pathIt = pathEntries.find(pathKey);
+	if (pathIt != pathEntries.end()) {
+		Entry *entry = pathIt->second;
+		++entry->refCount;
+		if (!_waitLoaded(entry, lock))
+			return nullptr;
+
+		++stats.pathHits;
+		stats.bytesSaved += entry->texture->getDataSize();
+		return entry->texture;
+	}
+
+	lock.unlock();
+
+	// The file stays mapped for the load, so it's decoded from the same bytes
+	MappedFile file;
+	if (!file.open(p_path)) {
+		ERR_EXPLAIN("Can't open the texture: " + p_path);
+		ERR_FAIL_V(nullptr);
+	}
+	const ContentKey contentKey(hash(file.getData(), file.getSize()), file.getSize(), p_mipmapMode, p_usage);
+
+	lock.lock();
+
+	// The lock was released, so the path can have been added meanwhile
+	bool collision = false;
+	while (true) {
+		pathIt = pathEntries.find(pathKey);
+		if (pathIt != pathEntries.end()) {
+			Entry *entry = pathIt->second;
+			++entry->refCount;
+			if (!_waitLoaded(entry, lock))
+				return nullptr;
+
+			++stats.pathHits;
+			stats.bytesSaved += entry->texture->getDataSize();
+			return entry->texture;
+		}
+
+		auto contentIt = contentEntries.find(contentKey);
+		if (collision || contentIt == contentEntries.end())
+			break;
+
+		Entry *entry = contentIt->second;
+		++entry->refCount;
+		if (!_waitLoaded(entry, lock))
+			return nullptr;
+
+		// The bytes are compared without the lock
+		const std::string entryPath = std::get<0>(entry->paths[0]);
+		lock.unlock();
+		const bool same = _compareFile(entryPath, file.getData(), file.getSize());
+		lock.lock();
+
+		if (same) {
+			// Same image with another path, the next acquire finds it by path
+			if (pathEntries.find(pathKey) == pathEntries.end()) {
+				entry->paths.push_back(pathKey);
+				pathEntries[pathKey] = entry;
+			}
+
+			++stats.contentHits;
+			stats.bytesSaved += entry->texture->getDataSize();
+			return entry->texture;
+		}
+
+		// Collision of the hash, the texture is loaded and shared by path only
+		_releaseEntry(entry);
+		collision = true;
+	}
+
+	Entry *entry = new Entry;
+	entry->texture = nullptr;
+	entry->refCount = 1;
+	entry->loading = true;
+	entry->contentKey = contentKey;
+	entry->paths.push_back(pathKey);
+
+	pathEntries[pathKey] = entry;
+	if (!collision) {
+		contentEntries[contentKey] = entry;
+	}
+	++stats.misses;
+
+	lock.unlock();
+
+	Texture *texture = new Texture(vulkanServer);
+	if (!texture->loadMemory(file.getData(), file.getSize(), p_path, p_mipmapMode, p_usage)) {
+		delete texture;
+		texture = nullptr;
+	}
+
+	lock.lock();
+
+	entry->loading = false;
+	loaded.notify_all();
+
+	if (!texture) {
+		// The waiting threads fail too, the last one deletes the entry
+		_eraseKeys(entry);
+		if (!--entry->refCount) {
+			delete entry;
+		}
+		ERR_EXPLAIN("Can't load the texture: " + p_path);
+		ERR_FAIL_V(nullptr);
+	}
+
+	entry->texture = texture;
+	textureEntries[texture] = entry;
+
+	++stats.liveTextures;
+	stats.liveBytes += texture->getDataSize();
+	stats.liveRGBA8Bytes += texture->getRGBA8DataSize();
+	return texture;
+}
+
+void TextureCache::release(Texture *p_texture) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto it = textureEntries.find(p_texture);
+	ERR_FAIL_COND(it == textureEntries.end());
+
+	_releaseEntry(it->second);
+}
+
+bool TextureCache::_waitLoaded(Entry *p_entry, std::unique_lock<std::mutex> &r_lock) {
+	loaded.wait(r_lock, [p_entry]() { return !p_entry->loading; });
+
+	if (p_entry->texture)
+		return true;
+
+	if (!--p_entry->refCount) {
+		delete p_entry;
+	}
+	return false;
+}
+
+void TextureCache::_eraseKeys(Entry *p_entry) {
+	for (size_t i = 0; i < p_entry->paths.size(); ++i) {
+		auto pathIt = pathEntries.find(p_entry->paths[i]);
+		if (pathIt != pathEntries.end() && pathIt->second == p_entry) {
+			pathEntries.erase(pathIt);
+		}
+	}
+
+	auto contentIt = contentEntries.find(p_entry->contentKey);
+	if (contentIt != contentEntries.end() && contentIt->second == p_entry) {
+		contentEntries.erase(contentIt);
+	}
+}
+
+void TextureCache::_releaseEntry(Entry *p_entry) {
+	if (--p_entry->refCount)
+		return;
+
+	_eraseKeys(p_entry);
+	textureEntries.erase(p_entry->texture);
+
+	stats.liveBytes -= p_entry->texture->getDataSize();
+	stats.liveRGBA8Bytes -= p_entry->texture->getRGBA8DataSize();
+
+	delete p_entry->texture;
+	delete p_entry;
+	--stats.liveTextures;
+}
+
+bool TextureCache::_compareFile(const std::string &p_path, const uint8_t *p_data, size_t p_size) {
+	MappedFile file;
+	if (!file.open(p_path))
+		return false;
+
+	return file.getSize() == p_size && 0 == memcmp(file.getData(), p_data, p_size);
+}
+
+TextureCache::Stats TextureCache::getStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void TextureCache::printStats() {
+	const Stats s = getStats();
+	print_line("Texture cache: " + itos(s.liveTextures) + " live, " + itos(s.pathHits) + " path hits, " +
+			   itos(s.contentHits) + " content hits, " + itos(s.misses) + " misses, " + itos(s.bytesSaved / 1024) + " KiB saved");
+	print_line("Texture formats: " + itos(s.liveBytes / 1024) + " KiB live, " + itos(s.liveRGBA8Bytes / 1024) + " KiB in RGBA8, " +
+			   itos((s.liveRGBA8Bytes - s.liveBytes) / 1024) + " KiB saved");
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "core/texture.h"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+class VulkanServer;
+
+// TEXTURE CACHE
+//		Returns shared textures, ref counted: the same file is loaded once.
+//		The textures are found by path first, then by the hash and the size
+// of the file content, so two paths of the same image (a copy, a link)
+// share the texture too. The bytes are compared on a content hit, so a
+// collision of the hash loads its own texture. The mipmap mode and the usage
+// are part of both keys.
+//		The bytes saved are the texture data that would have been uploaded
+// again without the cache.
+//		Thread safe. The file is read and hashed without the lock, and decoded
+// from the same bytes. A pending entry is added before the load, so the
+// other threads acquiring the texture wait for it instead of loading it
+// again, while the acquires of the other textures go on.
+class TextureCache {
+public:
+	struct Stats {
+		uint32_t liveTextures;
+		uint64_t pathHits;
+		uint64_t contentHits;
+		uint64_t misses;
+		uint64_t bytesSaved;
+		// Data of the live textures, and the same levels in RGBA8
+		uint64_t liveBytes;
+		uint64_t liveRGBA8Bytes;
+
+		Stats() :
+				liveTextures(0),
+				pathHits(0),
+				contentHits(0),
+				misses(0),
+				bytesSaved(0),
+				liveBytes(0),
+				liveRGBA8Bytes(0) {}
+	};
+
+private:
+	typedef std::tuple<std::string, Texture::MipmapMode, Texture::Usage> PathKey;
+	// Hash and size of the file
+	typedef std::tuple<uint64_t, uint64_t, Texture::MipmapMode, Texture::Usage> ContentKey;
+
+	struct Entry {
+		// nullptr while loading, and when the load failed
+		Texture *texture;
+		// The threads waiting the load hold a reference too
+		uint32_t refCount;
+		bool loading;
+		ContentKey contentKey;
+		std::vector<PathKey> paths;
+	};
+
+	VulkanServer *vulkanServer;
+
+	std::mutex mutex;
+	// Notified when a load ends
+	std::condition_variable loaded;
+	std::map<PathKey, Entry *> pathEntries;
+	std::map<ContentKey, Entry *> contentEntries;
+	std::map<const Texture *, Entry *> textureEntries;
+
+	Stats stats;
+
+public:
+	TextureCache();
+
+	void create(VulkanServer *p_vulkanServer);
+	// Deletes the textures still in the cache
+	void destroy();
+
+	// Returns nullptr when the file can't be loaded.
+	// Each acquire must be paired with a release
+	Texture *acquire(const std::string &p_path, Texture::MipmapMode p_mipmapMode = Texture::MIPMAP_GENERATE, Texture::Usage p_usage = Texture::USAGE_COLOR);
+	void release(Texture *p_texture);
+
+	Stats getStats();
+	void printStats();
+
+	// FNV-1a 64
+	static uint64_t hash(const uint8_t *p_data, size_t p_size);
+
+private:
+	// Waits the load of an entry the caller has referenced, the reference is
+	// dropped when the load failed. Called with the lock
+	bool _waitLoaded(Entry *p_entry, std::unique_lock<std::mutex> &r_lock);
+	// Removes the keys that still point to the entry. Called with the lock
+	void _eraseKeys(Entry *p_entry);
+	void _releaseEntry(Entry *p_entry);
+	static bool _compareFile(const std::string &p_path, const uint8_t *p_data, size_t p_size);
+};
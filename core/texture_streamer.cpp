@@ -0,0 +1,295 @@
+#include "texture_streamer.h"
+
+#include "core/error_macros.h"
+#include "core/print_string.h"
+#include "core/profiler.h"
+#include "core/string.h"
+#include "core/typedefs.h"
+#include <algorithm>
+#include <cmath>
+
+const uint32_t TextureStreamer::TAIL_SIZE = 64;
+const uint32_t TextureStreamer::NOT_REQUESTED = UINT32_MAX;
+
+TextureStreamer::TextureStreamer() :
+		deviceBudget(UINT64_MAX),
+		frame(0) {
+	stats.budget = config.budget;
+}
+
+void TextureStreamer::setConfig(const Config &p_config) {
+	std::lock_guard<std::mutex> lock(mutex);
+	config = p_config;
+	stats.budget = getBudget();
+}
+
+TextureStreamer::Config TextureStreamer::getConfig() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return config;
+}
+
+void TextureStreamer::setDeviceBudget(uint64_t p_budget) {
+	std::lock_guard<std::mutex> lock(mutex);
+	deviceBudget = p_budget;
+	stats.budget = getBudget();
+}
+
+uint32_t TextureStreamer::addTexture(uint32_t p_width, uint32_t p_height, const std::vector<uint64_t> &p_levelSizes, void *p_userData) {
+	ERR_FAIL_COND_V(p_levelSizes.empty(), NOT_REQUESTED);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint32_t id;
+	if (freeIds.size()) {
+		id = freeIds.back();
+		freeIds.pop_back();
+	} else {
+		id = entries.size();
+		entries.push_back(Entry());
+	}
+
+	Entry &entry = entries[id];
+	entry.active = true;
+	entry.userData = p_userData;
+	entry.levelSizes = p_levelSizes;
+	entry.wantedLevel = NOT_REQUESTED;
+	entry.lastUsedFrame = frame;
+	entry.evictedFrames.assign(p_levelSizes.size(), 0);
+
+	const uint32_t levels = p_levelSizes.size();
+	entry.tailLevel = levels - 1;
+	for (uint32_t level = 0; level < levels; ++level) {
+		if (MAX(MAX(p_width >> level, p_height >> level), 1u) <= TAIL_SIZE) {
+			entry.tailLevel = level;
+			break;
+		}
+	}
+
+	entry.residentLevel = entry.tailLevel;
+	for (uint32_t level = entry.tailLevel; level < levels; ++level) {
+		stats.residentBytes += p_levelSizes[level];
+	}
+	stats.peakResidentBytes = MAX(stats.peakResidentBytes, stats.residentBytes);
+	++stats.textures;
+
+	return id;
+}
+
+void TextureStreamer::removeTexture(uint32_t p_id) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	ERR_FAIL_COND(p_id >= entries.size() || !entries[p_id].active);
+
+	Entry &entry = entries[p_id];
+	for (uint32_t level = entry.residentLevel; level < entry.levelSizes.size(); ++level) {
+		stats.residentBytes -= entry.levelSizes[level];
+	}
+
+	entry.active = false;
+	entry.userData = nullptr;
+	entry.levelSizes.clear();
+	entry.evictedFrames.clear();
+
+	requested.erase(std::remove(requested.begin(), requested.end(), p_id), requested.end());
+	changed.erase(std::remove(changed.begin(), changed.end(), p_id), changed.end());
+
+	freeIds.push_back(p_id);
+	--stats.textures;
+}
+
+uint32_t TextureStreamer::getTailLevel(uint32_t p_id) {
+	std::lock_guard<std::mutex> lock(mutex);
+	ERR_FAIL_COND_V(p_id >= entries.size() || !entries[p_id].active, 0);
+	return entries[p_id].tailLevel;
+}
+
+uint32_t TextureStreamer::getResidentLevel(uint32_t p_id) {
+	std::lock_guard<std::mutex> lock(mutex);
+	ERR_FAIL_COND_V(p_id >= entries.size() || !entries[p_id].active, 0);
+	return entries[p_id].residentLevel;
+}
+
+void TextureStreamer::request(uint32_t p_id, uint32_t p_level) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	ERR_FAIL_COND(p_id >= entries.size() || !entries[p_id].active);
+
+	Entry &entry = entries[p_id];
+	if (NOT_REQUESTED == entry.wantedLevel)
+		requested.push_back(p_id);
+
+	entry.wantedLevel = MIN(entry.wantedLevel, MIN(p_level, uint32_t(entry.levelSizes.size() - 1)));
+}
+
+void TextureStreamer::update(std::vector<Change> &r_changes) {
+	PROFILE_ZONE("TextureStreamer::update");
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	++frame;
+	++stats.frames;
+
+	std::vector<uint32_t> candidates;
+	for (size_t i = 0; i < requested.size(); ++i) {
+		Entry &entry = entries[requested[i]];
+		entry.lastUsedFrame = frame;
+		if (entry.wantedLevel < entry.residentLevel)
+			candidates.push_back(requested[i]);
+	}
+
+	// The textures that miss more levels first
+	std::sort(candidates.begin(), candidates.end(), [this](uint32_t p_a, uint32_t p_b) {
+		const uint32_t missingA = entries[p_a].residentLevel - entries[p_a].wantedLevel;
+		const uint32_t missingB = entries[p_b].residentLevel - entries[p_b].wantedLevel;
+		return missingA != missingB ? missingA > missingB : p_a < p_b;
+	});
+
+	// One level per texture each pass, so a large texture doesn't take the
+	// whole upload of the frame
+	bool overBudget = false;
+	uint64_t uploaded = 0;
+	bool progress = true;
+	while (progress) {
+		progress = false;
+
+		for (size_t i = 0; i < candidates.size(); ++i) {
+			const Entry &entry = entries[candidates[i]];
+			if (entry.residentLevel <= entry.wantedLevel)
+				continue;
+
+			// A level larger than the upload limit is loaded alone
+			const uint64_t size = entry.levelSizes[entry.residentLevel - 1];
+			if (uploaded && uploaded + size > config.maxUploadPerFrame) {
+				progress = false;
+				break;
+			}
+
+			if (!makeRoom(size)) {
+				overBudget = true;
+				continue;
+			}
+
+			load(candidates[i]);
+			uploaded += size;
+			progress = true;
+		}
+	}
+
+	// The budget may be shrunk
+	if (!makeRoom(0))
+		overBudget = true;
+
+	if (overBudget)
+		++stats.overBudgetFrames;
+
+	for (size_t i = 0; i < requested.size(); ++i) {
+		Entry &entry = entries[requested[i]];
+		++stats.requests;
+		if (entry.residentLevel <= entry.wantedLevel)
+			++stats.satisfiedRequests;
+		entry.wantedLevel = NOT_REQUESTED;
+	}
+	requested.clear();
+
+	r_changes.clear();
+	for (size_t i = 0; i < changed.size(); ++i) {
+		Change change;
+		change.id = changed[i];
+		change.residentLevel = entries[changed[i]].residentLevel;
+		change.userData = entries[changed[i]].userData;
+		r_changes.push_back(change);
+	}
+	changed.clear();
+}
+
+void TextureStreamer::load(uint32_t p_id) {
+	Entry &entry = entries[p_id];
+	const uint32_t level = entry.residentLevel - 1;
+
+	const uint64_t evictedFrame = entry.evictedFrames[level];
+	if (evictedFrame && frame - evictedFrame <= config.thrashWindow)
+		++stats.thrashes;
+
+	entry.residentLevel = level;
+	stats.residentBytes += entry.levelSizes[level];
+	stats.peakResidentBytes = MAX(stats.peakResidentBytes, stats.residentBytes);
+	++stats.loads;
+	stats.loadedBytes += entry.levelSizes[level];
+
+	markChanged(p_id);
+}
+
+void TextureStreamer::evict(uint32_t p_id) {
+	Entry &entry = entries[p_id];
+	const uint32_t level = entry.residentLevel;
+
+	entry.evictedFrames[level] = frame;
+	entry.residentLevel = level + 1;
+	stats.residentBytes -= entry.levelSizes[level];
+	++stats.evictions;
+	stats.evictedBytes += entry.levelSizes[level];
+
+	markChanged(p_id);
+}
+
+bool TextureStreamer::makeRoom(uint64_t p_bytes) {
+	while (stats.residentBytes + p_bytes > getBudget()) {
+		const uint32_t id = findEvictable();
+		if (NOT_REQUESTED == id)
+			return false;
+		evict(id);
+	}
+	return true;
+}
+
+uint32_t TextureStreamer::findEvictable() const {
+	uint32_t best = NOT_REQUESTED;
+	for (uint32_t i = 0; i < entries.size(); ++i) {
+		const Entry &entry = entries[i];
+		if (!entry.active)
+			continue;
+
+		// The not requested textures have the wanted level NOT_REQUESTED,
+		// so they can be evicted down to the tail
+		if (entry.residentLevel >= MIN(entry.tailLevel, entry.wantedLevel))
+			continue;
+
+		if (NOT_REQUESTED == best || entry.lastUsedFrame < entries[best].lastUsedFrame)
+			best = i;
+	}
+	return best;
+}
+
+void TextureStreamer::markChanged(uint32_t p_id) {
+	if (std::find(changed.begin(), changed.end(), p_id) == changed.end())
+		changed.push_back(p_id);
+}
+
+uint32_t TextureStreamer::computeLevel(uint32_t p_width, uint32_t p_height, uint32_t p_levels, float p_screenPixels) {
+	ERR_FAIL_COND_V(!p_levels, 0);
+
+	const float texels = MAX(p_width, p_height);
+	if (p_screenPixels >= texels)
+		return 0;
+
+	if (p_screenPixels < 1.f)
+		return p_levels - 1;
+
+	const uint32_t level = uint32_t(std::floor(std::log2(texels / p_screenPixels)));
+	return MIN(level, p_levels - 1);
+}
+
+TextureStreamer::Stats TextureStreamer::getStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void TextureStreamer::printStats() {
+	const Stats s = getStats();
+	print_line("Texture streaming: " + itos(s.textures) + " textures, " + itos(s.residentBytes / 1024) + " KiB resident (peak " +
+			   itos(s.peakResidentBytes / 1024) + ") of " + itos(s.budget / 1024) + " KiB budget");
+	print_line("  residency " + rtos(s.getResidencyRate() * 100.f) + "% of " + itos(s.requests) + " requests, " +
+			   itos(s.loads) + " levels loaded (" + itos(s.loadedBytes / 1024) + " KiB), " +
+			   itos(s.evictions) + " evicted (" + itos(s.evictedBytes / 1024) + " KiB), thrash " +
+			   rtos(s.getThrashRate() * 100.f) + "% of the loads, " + itos(s.overBudgetFrames) + " frames over budget");
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "core/typedefs.h"
+#include "hellovulkan.h"
+#include <mutex>
+
+// TEXTURE STREAMER
+//		Decides which mip levels of the streamed textures are resident. Only
+// the policy is here, it doesn't touch the device: the renderer requests
+// each frame the level wanted by the meshes that use the texture, update
+// returns the textures whose resident level is changed, and the renderer
+// recreates their images. So the same policy is replayed on the CPU by the
+// streaming simulation of the benchmark.
+//		A texture is resident from its resident level down to the last one.
+// The tail (the levels not larger than TAIL_SIZE) is always resident and is
+// the only part loaded with the texture, the other levels are streamed on
+// demand, the most wanted first, with at most maxUploadPerFrame bytes each
+// frame.
+//		When the resident bytes exceed the budget the top levels of the least
+// recently used textures are evicted; the textures wanted in the current
+// frame lose only the levels above the wanted one.
+//		A level loaded again within thrashWindow frames from its eviction
+// counts as a thrash: the budget is too small for the scene.
+//		Thread safe, the textures are added by the loading threads.
+class TextureStreamer {
+public:
+	static const uint32_t TAIL_SIZE;
+	static const uint32_t NOT_REQUESTED;
+
+	struct Config {
+		uint64_t budget; // Bytes of all the resident levels
+		uint64_t maxUploadPerFrame;
+		uint32_t thrashWindow; // Frames
+
+		Config() :
+				budget(256 * 1024 * 1024),
+				maxUploadPerFrame(8 * 1024 * 1024),
+				thrashWindow(60) {}
+	};
+
+	struct Change {
+		uint32_t id;
+		uint32_t residentLevel;
+		void *userData;
+	};
+
+	struct Stats {
+		uint32_t textures;
+		uint64_t residentBytes;
+		uint64_t peakResidentBytes;
+		uint64_t budget;
+		uint64_t frames;
+		uint64_t requests; // Textures requested, summed over the frames
+		uint64_t satisfiedRequests; // With the wanted level resident
+		uint64_t loads; // Levels
+		uint64_t loadedBytes;
+		uint64_t evictions; // Levels
+		uint64_t evictedBytes;
+		uint64_t thrashes;
+		uint64_t overBudgetFrames; // The wanted levels don't fit the budget
+
+		Stats() :
+				textures(0),
+				residentBytes(0),
+				peakResidentBytes(0),
+				budget(0),
+				frames(0),
+				requests(0),
+				satisfiedRequests(0),
+				loads(0),
+				loadedBytes(0),
+				evictions(0),
+				evictedBytes(0),
+				thrashes(0),
+				overBudgetFrames(0) {}
+
+		float getResidencyRate() const { return requests ? float(double(satisfiedRequests) / requests) : 1; }
+		float getThrashRate() const { return loads ? float(double(thrashes) / loads) : 0; }
+	};
+
+private:
+	struct Entry {
+		bool active;
+		void *userData;
+		std::vector<uint64_t> levelSizes;
+		uint32_t tailLevel;
+		uint32_t residentLevel;
+		// The smallest level requested in the current frame
+		uint32_t wantedLevel;
+		uint64_t lastUsedFrame;
+		// Frame of the last eviction of each level, 0 never evicted
+		std::vector<uint64_t> evictedFrames;
+	};
+
+	std::mutex mutex;
+
+	Config config;
+	uint64_t deviceBudget;
+	uint64_t frame;
+
+	std::vector<Entry> entries;
+	std::vector<uint32_t> freeIds;
+	// Requested in the current frame
+	std::vector<uint32_t> requested;
+	std::vector<uint32_t> changed;
+
+	Stats stats;
+
+public:
+	TextureStreamer();
+
+	void setConfig(const Config &p_config);
+	Config getConfig();
+	// Set each frame by the renderer from the heap budget, the effective
+	// budget is the smaller of this and the configured one
+	void setDeviceBudget(uint64_t p_budget);
+
+	// p_levelSizes are the bytes of each level, from the level 0. The tail
+	// is resident from the add, so it counts in the budget immediately
+	uint32_t addTexture(uint32_t p_width, uint32_t p_height, const std::vector<uint64_t> &p_levelSizes, void *p_userData);
+	void removeTexture(uint32_t p_id);
+
+	uint32_t getTailLevel(uint32_t p_id);
+	uint32_t getResidentLevel(uint32_t p_id);
+
+	// The texture is wanted down to p_level, called for each mesh that uses
+	// the texture. The requests are consumed by update
+	void request(uint32_t p_id, uint32_t p_level);
+
+	// Streams in and evicts the levels, r_changes receives the textures with
+	// a new resident level
+	void update(std::vector<Change> &r_changes);
+
+	Stats getStats();
+	void printStats();
+
+	// The level whose texels match the pixels covered on the screen by the
+	// texture, clamped to the levels of the texture
+	static uint32_t computeLevel(uint32_t p_width, uint32_t p_height, uint32_t p_levels, float p_screenPixels);
+
+private:
+	void load(uint32_t p_id);
+	void evict(uint32_t p_id);
+	// Evicts until p_bytes more fit the budget, returns false when they can't
+	bool makeRoom(uint64_t p_bytes);
+	// The least recently used texture with an evictable level
+	uint32_t findEvictable() const;
+	void markChanged(uint32_t p_id);
+	uint64_t getBudget() const { return MIN(config.budget, deviceBudget); }
+};
@@ -0,0 +1,329 @@
+#include "texture_table.h"
+
+#include "core/error_macros.h"
+#include "core/print_string.h"
+#include "core/profiler.h"
+#include "core/string.h"
+#include "core/typedefs.h"
+
+const uint32_t TextureTable::INVALID_INDEX = UINT32_MAX;
+
+TextureTable::TextureTable() :
+		device(VK_NULL_HANDLE),
+		mode(MODE_ARRAY),
+		updateAfterBind(false),
+		layout(VK_NULL_HANDLE),
+		pool(VK_NULL_HANDLE),
+		set(VK_NULL_HANDLE),
+		fillImageView(VK_NULL_HANDLE),
+		fillSampler(VK_NULL_HANDLE) {}
+
+bool TextureTable::create(VkDevice p_device, Mode p_mode, uint32_t p_capacity, bool p_updateAfterBind) {
+	ERR_FAIL_COND_V(!p_capacity, false);
+	ERR_FAIL_COND_V(p_updateAfterBind && MODE_BINDLESS != p_mode, false);
+
+	device = p_device;
+	mode = p_mode;
+	updateAfterBind = p_updateAfterBind;
+
+	{ // Layout
+		VkDescriptorSetLayoutBinding binding = {};
+		binding.binding = 0;
+		binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		binding.descriptorCount = p_capacity;
+		binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+		layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutCreateInfo.bindingCount = 1;
+		layoutCreateInfo.pBindings = &binding;
+
+		// The slots not used by the draws may be not written
+		VkDescriptorBindingFlagsEXT bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+		if (updateAfterBind) {
+			bindingFlags |= VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+			layoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+		}
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCreateInfo = {};
+		bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		bindingFlagsCreateInfo.bindingCount = 1;
+		bindingFlagsCreateInfo.pBindingFlags = &bindingFlags;
+
+		if (MODE_BINDLESS == mode)
+			layoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+
+		VkResult res = vkCreateDescriptorSetLayout(
+				device,
+				&layoutCreateInfo,
+				nullptr,
+				&layout);
+
+		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	}
+
+	{ // Pool
+		VkDescriptorPoolSize poolSize = {};
+		poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSize.descriptorCount = p_capacity;
+
+		VkDescriptorPoolCreateInfo poolCreateInfo = {};
+		poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolCreateInfo.poolSizeCount = 1;
+		poolCreateInfo.pPoolSizes = &poolSize;
+		poolCreateInfo.maxSets = 1;
+		if (updateAfterBind)
+			poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+
+		VkResult res = vkCreateDescriptorPool(
+				device,
+				&poolCreateInfo,
+				nullptr,
+				&pool);
+
+		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	}
+
+	{ // Set
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = pool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &layout;
+
+		VkResult res = vkAllocateDescriptorSets(device, &allocInfo, &set);
+
+		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	}
+
+	Slot freeSlot;
+	freeSlot.imageView = VK_NULL_HANDLE;
+	freeSlot.sampler = VK_NULL_HANDLE;
+	freeSlot.refCount = 0;
+	freeSlot.dirty = false;
+	slots.resize(p_capacity, freeSlot);
+
+	// The lowest indices are used first
+	freeSlots.reserve(p_capacity);
+	for (int i = p_capacity - 1; 0 <= i; --i) {
+		freeSlots.push_back(i);
+	}
+
+	stats.capacity = p_capacity;
+
+	print_verbose(std::string("Texture table created, ") + (MODE_BINDLESS == mode ? "bindless" : "array") + " of " + itos(p_capacity) + " textures" +
+				  (updateAfterBind ? ", update after bind" : ""));
+	return true;
+}
+
+void TextureTable::destroy() {
+
+	if (slotIndices.size())
+		WARN_PRINTS("Texture table destroyed with " + itos(slotIndices.size()) + " textures in use");
+
+	if (VK_NULL_HANDLE != pool) {
+		// Frees the set too
+		vkDestroyDescriptorPool(device, pool, nullptr);
+		pool = VK_NULL_HANDLE;
+		set = VK_NULL_HANDLE;
+	}
+
+	if (VK_NULL_HANDLE != layout) {
+		vkDestroyDescriptorSetLayout(device, layout, nullptr);
+		layout = VK_NULL_HANDLE;
+		print_verbose("Texture table destroyed");
+	}
+
+	slots.clear();
+	freeSlots.clear();
+	slotIndices.clear();
+	dirtySlots.clear();
+	fillImageView = VK_NULL_HANDLE;
+	fillSampler = VK_NULL_HANDLE;
+	updateAfterBind = false;
+	stats = Stats();
+}
+
+void TextureTable::setFillImage(VkImageView p_imageView, VkSampler p_sampler) {
+	fillImageView = p_imageView;
+	fillSampler = p_sampler;
+
+	if (MODE_ARRAY != mode)
+		return;
+
+	for (size_t i = 0; i < freeSlots.size(); ++i) {
+		markDirty(freeSlots[i]);
+	}
+}
+
+uint32_t TextureTable::acquire(VkImageView p_imageView, VkSampler p_sampler) {
+
+	const ImageKey key(p_imageView, p_sampler);
+
+	auto it = slotIndices.find(key);
+	if (it != slotIndices.end()) {
+		++slots[it->second].refCount;
+		return it->second;
+	}
+
+	const uint32_t index = allocateSlot(p_imageView, p_sampler);
+	if (INVALID_INDEX != index)
+		slotIndices[key] = index;
+	return index;
+}
+
+void TextureTable::release(VkImageView p_imageView, VkSampler p_sampler) {
+
+	auto it = slotIndices.find(ImageKey(p_imageView, p_sampler));
+	ERR_FAIL_COND(it == slotIndices.end());
+
+	const uint32_t index = it->second;
+	if (--slots[index].refCount)
+		return;
+
+	slotIndices.erase(it);
+	freeSlot(index);
+}
+
+uint32_t TextureTable::acquireSlot(VkImageView p_imageView, VkSampler p_sampler) {
+	return allocateSlot(p_imageView, p_sampler);
+}
+
+void TextureTable::releaseSlot(uint32_t p_index) {
+	ERR_FAIL_INDEX(p_index, slots.size());
+	ERR_FAIL_COND(!slots[p_index].refCount);
+
+	// The shared slots are released by the image
+	const auto it = slotIndices.find(ImageKey(slots[p_index].imageView, slots[p_index].sampler));
+	ERR_FAIL_COND(it != slotIndices.end() && it->second == p_index);
+
+	slots[p_index].refCount = 0;
+	freeSlot(p_index);
+}
+
+void TextureTable::write(uint32_t p_index, VkImageView p_imageView, VkSampler p_sampler) {
+	ERR_FAIL_COND(!updateAfterBind);
+	ERR_FAIL_INDEX(p_index, slots.size());
+
+	// A pending write of the slot writes the same image again
+	slots[p_index].imageView = p_imageView;
+	slots[p_index].sampler = p_sampler;
+
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfo.imageView = p_imageView;
+	imageInfo.sampler = p_sampler;
+
+	VkWriteDescriptorSet writeDesc = {};
+	writeDesc.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writeDesc.dstSet = set;
+	writeDesc.dstBinding = 0;
+	writeDesc.dstArrayElement = p_index;
+	writeDesc.descriptorCount = 1;
+	writeDesc.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writeDesc.pImageInfo = &imageInfo;
+
+	vkUpdateDescriptorSets(device, 1, &writeDesc, 0, nullptr);
+	++stats.descriptorWrites;
+}
+
+uint32_t TextureTable::allocateSlot(VkImageView p_imageView, VkSampler p_sampler) {
+
+	if (freeSlots.empty()) {
+		++stats.failedAcquires;
+		return INVALID_INDEX;
+	}
+
+	const uint32_t index = freeSlots.back();
+	freeSlots.pop_back();
+
+	slots[index].imageView = p_imageView;
+	slots[index].sampler = p_sampler;
+	slots[index].refCount = 1;
+	markDirty(index);
+
+	++stats.usedSlots;
+	stats.peakSlots = MAX(stats.peakSlots, stats.usedSlots);
+	return index;
+}
+
+void TextureTable::freeSlot(uint32_t p_index) {
+	slots[p_index].imageView = VK_NULL_HANDLE;
+	slots[p_index].sampler = VK_NULL_HANDLE;
+
+	// The array slot must remain valid even if the image is destroyed
+	if (MODE_ARRAY == mode)
+		markDirty(p_index);
+
+	freeSlots.push_back(p_index);
+	--stats.usedSlots;
+}
+
+void TextureTable::markDirty(uint32_t p_index) {
+	if (slots[p_index].dirty)
+		return;
+
+	slots[p_index].dirty = true;
+	dirtySlots.push_back(p_index);
+}
+
+void TextureTable::flushWrites() {
+	if (dirtySlots.empty())
+		return;
+
+	PROFILE_ZONE("TextureTable::flushWrites");
+
+	std::vector<VkDescriptorImageInfo> imageInfos;
+	std::vector<VkWriteDescriptorSet> writes;
+	imageInfos.reserve(dirtySlots.size());
+	writes.reserve(dirtySlots.size());
+
+	for (size_t i = 0; i < dirtySlots.size(); ++i) {
+		Slot &slot = slots[dirtySlots[i]];
+		slot.dirty = false;
+
+		VkDescriptorImageInfo imageInfo = {};
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		if (slot.refCount) {
+			imageInfo.imageView = slot.imageView;
+			imageInfo.sampler = slot.sampler;
+		} else if (VK_NULL_HANDLE != fillImageView) {
+			imageInfo.imageView = fillImageView;
+			imageInfo.sampler = fillSampler;
+		} else {
+			// Written when the fill image is set
+			continue;
+		}
+
+		imageInfos.push_back(imageInfo);
+
+		VkWriteDescriptorSet writeDesc = {};
+		writeDesc.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writeDesc.dstSet = set;
+		writeDesc.dstBinding = 0;
+		writeDesc.dstArrayElement = dirtySlots[i];
+		writeDesc.descriptorCount = 1;
+		writeDesc.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writeDesc.pImageInfo = &imageInfos.back();
+		writes.push_back(writeDesc);
+	}
+
+	dirtySlots.clear();
+
+	if (writes.empty())
+		return;
+
+	vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
+	stats.descriptorWrites += writes.size();
+}
+
+TextureTable::Stats TextureTable::getStats() const {
+	return stats;
+}
+
+void TextureTable::printStats() const {
+	print_line(std::string("Texture table (") + (MODE_BINDLESS == mode ? "bindless" : "array") + "): " +
+			   itos(stats.usedSlots) + " / " + itos(stats.capacity) + " slots, peak " + itos(stats.peakSlots) + ", " +
+			   itos(stats.descriptorWrites) + " descriptor writes, " + itos(stats.failedAcquires) + " failed acquires");
+}
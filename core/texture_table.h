@@ -0,0 +1,119 @@
+#pragma once
+
+#include "hellovulkan.h"
+#include <map>
+
+// TEXTURE TABLE
+//		All the textures are stored in a single array of combined image
+// samplers, bound once per frame; each draw selects its texture with an
+// index passed as push constant, so there are no texture binds per draw.
+//		MODE_BINDLESS uses VK_EXT_descriptor_indexing: the array is large and
+// partially bound, so the unused slots don't need a valid descriptor.
+//		MODE_ARRAY is the fallback of the devices without the extension: the
+// array has a fixed size (a specialization constant of the shader) and all
+// its slots must be valid, the unused ones point to the fill image.
+//		The slots are ref counted by (image view, sampler), so the meshes that
+// use the same texture share one slot.
+//		The set is never updated while used by the pending frames: the changed
+// slots are written incrementally by flushWrites, that must be called when
+// the frames are completed (before recording the draw commands).
+//		With the update after bind (MODE_BINDLESS only) a slot not used by
+// the pending frames can be written by write at any time, the recorded
+// command buffers stay valid. The slots of acquireSlot are not shared, so a
+// slot used by a single frame is written once that frame is completed.
+class TextureTable {
+public:
+	enum Mode {
+		MODE_BINDLESS,
+		MODE_ARRAY
+	};
+
+	static const uint32_t INVALID_INDEX;
+
+	struct Stats {
+		uint32_t capacity;
+		uint32_t usedSlots;
+		uint32_t peakSlots;
+		uint64_t descriptorWrites;
+		uint64_t failedAcquires;
+
+		Stats() :
+				capacity(0),
+				usedSlots(0),
+				peakSlots(0),
+				descriptorWrites(0),
+				failedAcquires(0) {}
+	};
+
+private:
+	struct Slot {
+		VkImageView imageView;
+		VkSampler sampler;
+		uint32_t refCount;
+		bool dirty;
+	};
+
+	typedef std::pair<VkImageView, VkSampler> ImageKey;
+
+	VkDevice device;
+	Mode mode;
+	bool updateAfterBind;
+
+	VkDescriptorSetLayout layout;
+	VkDescriptorPool pool;
+	VkDescriptorSet set;
+
+	std::vector<Slot> slots;
+	std::vector<uint32_t> freeSlots;
+	std::map<ImageKey, uint32_t> slotIndices;
+	std::vector<uint32_t> dirtySlots;
+
+	VkImageView fillImageView;
+	VkSampler fillSampler;
+
+	Stats stats;
+
+public:
+	TextureTable();
+
+	bool create(VkDevice p_device, Mode p_mode, uint32_t p_capacity, bool p_updateAfterBind = false);
+	void destroy();
+
+	bool isCreated() const { return VK_NULL_HANDLE != set; }
+
+	// Used by the unused slots of MODE_ARRAY
+	void setFillImage(VkImageView p_imageView, VkSampler p_sampler);
+
+	// Returns INVALID_INDEX when the table is full.
+	// Each acquire must be paired with a release
+	uint32_t acquire(VkImageView p_imageView, VkSampler p_sampler);
+	void release(VkImageView p_imageView, VkSampler p_sampler);
+
+	// A slot of its own, not shared with the other acquires of the image.
+	// Returns INVALID_INDEX when the table is full
+	uint32_t acquireSlot(VkImageView p_imageView, VkSampler p_sampler);
+	void releaseSlot(uint32_t p_index);
+
+	// Writes the slot now, it must not be used by the pending frames.
+	// Requires the update after bind
+	void write(uint32_t p_index, VkImageView p_imageView, VkSampler p_sampler);
+
+	bool hasPendingWrites() const { return dirtySlots.size(); }
+
+	// The set must not be used by pending command buffers
+	void flushWrites();
+
+	Mode getMode() const { return mode; }
+	bool isUpdateAfterBind() const { return updateAfterBind; }
+	uint32_t getCapacity() const { return slots.size(); }
+	VkDescriptorSetLayout getLayout() const { return layout; }
+	VkDescriptorSet getSet() const { return set; }
+
+	Stats getStats() const;
+	void printStats() const;
+
+private:
+	uint32_t allocateSlot(VkImageView p_imageView, VkSampler p_sampler);
+	void freeSlot(uint32_t p_index);
+	void markDirty(uint32_t p_index);
+};
@@ -0,0 +1,119 @@
+#include "thread_pool.h"
+
+#include "core/print_string.h"
+#include "core/string.h"
+#include "core/typedefs.h"
+
+ThreadPool::ThreadPool() :
+		stopping(false) {}
+
+ThreadPool::~ThreadPool() {
+	destroy();
+}
+
+void ThreadPool::create(uint32_t p_threadCount) {
+	destroy();
+
+	if (!p_threadCount) {
+		const uint32_t hardwareThreads = std::thread::hardware_concurrency();
+		p_threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	stopping = false;
+	workers.reserve(p_threadCount);
+	for (uint32_t i = 0; i < p_threadCount; ++i) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+
+	print_verbose("Thread pool created with " + itos(p_threadCount) + " workers");
+}
+
+void ThreadPool::destroy() {
+	if (workers.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	taskAvailable.notify_all();
+
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+	workers.clear();
+	tasks.clear();
+}
+
+void ThreadPool::parallelFor(uint32_t p_count, uint32_t p_chunkSize, const RangeFunction &p_function) {
+	if (!p_count)
+		return;
+
+	p_chunkSize = MAX(p_chunkSize, 1u);
+	const uint32_t chunks = (p_count + p_chunkSize - 1) / p_chunkSize;
+
+	if (chunks == 1 || workers.empty()) {
+		p_function(0, p_count);
+		return;
+	}
+
+	// Shared with the workers, that may dequeue it after the completion
+	std::shared_ptr<Task> task(new Task);
+	task->function = p_function;
+	task->count = p_count;
+	task->chunkSize = p_chunkSize;
+	task->nextChunk = 0;
+	task->pendingChunks = chunks;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// One entry per worker that can take part
+		const uint32_t entries = MIN(uint32_t(workers.size()), chunks - 1);
+		for (uint32_t i = 0; i < entries; ++i) {
+			tasks.push_back(task);
+		}
+	}
+	taskAvailable.notify_all();
+
+	runChunks(*task);
+
+	std::unique_lock<std::mutex> lock(task->mutex);
+	task->completed.wait(lock, [&task] { return 0 == task->pendingChunks.load(); });
+}
+
+void ThreadPool::workerLoop() {
+	while (true) {
+		std::shared_ptr<Task> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			taskAvailable.wait(lock, [this] { return stopping || tasks.size(); });
+
+			if (stopping)
+				return;
+
+			task = tasks.front();
+			tasks.pop_front();
+		}
+
+		runChunks(*task);
+	}
+}
+
+void ThreadPool::runChunks(Task &r_task) {
+	const uint32_t chunks = (r_task.count + r_task.chunkSize - 1) / r_task.chunkSize;
+
+	while (true) {
+		const uint32_t chunk = r_task.nextChunk++;
+		if (chunk >= chunks)
+			return;
+
+		const uint32_t begin = chunk * r_task.chunkSize;
+		r_task.function(begin, MIN(begin + r_task.chunkSize, r_task.count));
+
+		if (1 == r_task.pendingChunks--) {
+			// The lock prevents the notify between the check and the wait
+			std::lock_guard<std::mutex> lock(r_task.mutex);
+			r_task.completed.notify_all();
+		}
+	}
+}
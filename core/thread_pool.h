@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// THREAD POOL
+//		Fixed set of worker threads that execute the ranges of parallelFor.
+//		The calling thread executes the ranges too, so parallelFor completes
+// even when all the workers are busy (or when it's called by a worker).
+class ThreadPool {
+public:
+	// The range [p_begin, p_end)
+	typedef std::function<void(uint32_t p_begin, uint32_t p_end)> RangeFunction;
+
+private:
+	struct Task {
+		RangeFunction function;
+		uint32_t count;
+		uint32_t chunkSize;
+		std::atomic<uint32_t> nextChunk;
+		std::atomic<uint32_t> pendingChunks;
+		std::mutex mutex;
+		std::condition_variable completed;
+	};
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable taskAvailable;
+	std::deque<std::shared_ptr<Task> > tasks;
+	bool stopping;
+
+public:
+	ThreadPool();
+	~ThreadPool();
+
+	// 0 uses a worker per hardware thread, except the calling one
+	void create(uint32_t p_threadCount = 0);
+	void destroy();
+
+	uint32_t getThreadCount() const { return workers.size(); }
+
+	// Splits [0, p_count) in chunks of p_chunkSize, and returns once all
+	// of them are executed
+	void parallelFor(uint32_t p_count, uint32_t p_chunkSize, const RangeFunction &p_function);
+
+private:
+	void workerLoop();
+	static void runChunks(Task &r_task);
+};
@@ -0,0 +1,447 @@
+#include "transcoder.h"
+
+#include "core/error_macros.h"
+#include "core/ktx2.h"
+#include "core/profiler.h"
+#include "core/thread_pool.h"
+#include "core/typedefs.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TRANSCODER_SSE2
+#endif
+
+// Rows of blocks transcoded by each job
+#define TRANSCODE_ROWS_PER_JOB 8
+
+const int Transcoder::MODIFIERS[8][2] = {
+	{ 2, 8 },
+	{ 5, 17 },
+	{ 9, 29 },
+	{ 13, 42 },
+	{ 18, 60 },
+	{ 24, 80 },
+	{ 33, 106 },
+	{ 47, 183 }
+};
+
+// ETC1 selector (msb lsb): 0 +small, 1 +large, 2 -small, 3 -large.
+// BC1 index: 0 color0 (+large), 1 color1 (-large), 2 and 3 the thirds
+static const uint8_t ETC1_TO_BC1_SELECTOR[4] = { 2, 0, 3, 1 };
+
+// The 8 values of BC3 go from +large (0) to -large (1) through the indices
+// 2..7, the small modifiers take the nearest: the index 1 + p, where
+// p = round(7 * (large - small) / (2 * large)) for +small and 7 - p for -small
+static const uint8_t ETC1_TO_BC3_SELECTOR[8][4] = {
+	{ 4, 0, 5, 1 },
+	{ 3, 0, 6, 1 },
+	{ 3, 0, 6, 1 },
+	{ 3, 0, 6, 1 },
+	{ 3, 0, 6, 1 },
+	{ 3, 0, 6, 1 },
+	{ 3, 0, 6, 1 },
+	{ 4, 0, 5, 1 }
+};
+
+struct UniversalBlock {
+	uint8_t base[3]; // Expanded to 8 bits
+	uint32_t table;
+	uint16_t msb; // Bit x * 4 + y
+	uint16_t lsb;
+};
+
+static inline void unpackBlock(const uint8_t *p_block, UniversalBlock &r_block) {
+	r_block.base[0] = (p_block[0] & 0xF8) | (p_block[0] >> 5);
+	r_block.base[1] = (p_block[1] & 0xF8) | (p_block[1] >> 5);
+	r_block.base[2] = (p_block[2] & 0xF8) | (p_block[2] >> 5);
+	r_block.table = p_block[3] >> 5;
+	r_block.msb = uint16_t((p_block[4] << 8) | p_block[5]);
+	r_block.lsb = uint16_t((p_block[6] << 8) | p_block[7]);
+}
+
+static inline uint32_t getSelector(const UniversalBlock &p_block, uint32_t p_x, uint32_t p_y) {
+	const uint32_t bit = p_x * 4 + p_y;
+	return (((p_block.msb >> bit) & 1) << 1) | ((p_block.lsb >> bit) & 1);
+}
+
+// The selector remaps below work on the 16 pixels at once, one bit each in
+// a plane of 16 bits, instead of pixel by pixel
+
+// The block stores the selector bits by column (x * 4 + y), the BC blocks by
+// row (y * 4 + x): the 4x4 bit matrix is transposed by two delta swaps
+static inline uint32_t transposeSelectorBits(uint32_t p_bits) {
+	uint32_t t = (p_bits ^ (p_bits >> 3)) & 0x0A0A;
+	p_bits ^= t ^ (t << 3);
+	t = (p_bits ^ (p_bits >> 6)) & 0x00CC;
+	p_bits ^= t ^ (t << 6);
+	return p_bits;
+}
+
+// The bit i moves to the bit 2 * i
+static inline uint32_t spreadBits2(uint32_t p_bits) {
+	p_bits = (p_bits | (p_bits << 8)) & 0x00FF00FF;
+	p_bits = (p_bits | (p_bits << 4)) & 0x0F0F0F0F;
+	p_bits = (p_bits | (p_bits << 2)) & 0x33333333;
+	p_bits = (p_bits | (p_bits << 1)) & 0x55555555;
+	return p_bits;
+}
+
+// The bit i moves to the bit 3 * i
+static inline uint64_t spreadBits3(uint64_t p_bits) {
+	p_bits = (p_bits | (p_bits << 16)) & 0x0000FF0000FFull;
+	p_bits = (p_bits | (p_bits << 8)) & 0x00F00F00F00Full;
+	p_bits = (p_bits | (p_bits << 4)) & 0x0C30C30C30C3ull;
+	p_bits = (p_bits | (p_bits << 2)) & 0x249249249249ull;
+	return p_bits;
+}
+
+// The 4 colors of the block, RGBA8 with alpha 255
+static inline void computePalette(const UniversalBlock &p_block, uint32_t r_palette[4]) {
+	const int small = Transcoder::MODIFIERS[p_block.table][0];
+	const int large = Transcoder::MODIFIERS[p_block.table][1];
+
+#ifdef TRANSCODER_SSE2
+	// The modifiers are added to all the channels and clamped, which is the
+	// saturated arithmetic of the unsigned bytes
+	const __m128i base = _mm_set1_epi32(int(0xFF000000u | (p_block.base[2] << 16) | (p_block.base[1] << 8) | p_block.base[0]));
+	const __m128i add = _mm_setr_epi8(
+			small, small, small, 0,
+			char(large), char(large), char(large), 0,
+			0, 0, 0, 0,
+			0, 0, 0, 0);
+	const __m128i sub = _mm_setr_epi8(
+			0, 0, 0, 0,
+			0, 0, 0, 0,
+			small, small, small, 0,
+			char(large), char(large), char(large), 0);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(r_palette), _mm_subs_epu8(_mm_adds_epu8(base, add), sub));
+#else
+	const int modifiers[4] = { small, large, -small, -large };
+	for (int i = 0; i < 4; ++i) {
+		const uint32_t r = CLAMP(p_block.base[0] + modifiers[i], 0, 255);
+		const uint32_t g = CLAMP(p_block.base[1] + modifiers[i], 0, 255);
+		const uint32_t b = CLAMP(p_block.base[2] + modifiers[i], 0, 255);
+		r_palette[i] = 0xFF000000u | (b << 16) | (g << 8) | r;
+	}
+#endif
+}
+
+static inline uint16_t packRGB565(int p_r, int p_g, int p_b) {
+	return uint16_t(((p_r * 31 + 127) / 255) << 11 | ((p_g * 63 + 127) / 255) << 5 | ((p_b * 31 + 127) / 255));
+}
+
+static uint32_t remapBC1SelectorsScalar(const UniversalBlock &p_block) {
+	uint32_t indices = 0;
+	for (uint32_t y = 0; y < 4; ++y) {
+		for (uint32_t x = 0; x < 4; ++x) {
+			indices |= uint32_t(ETC1_TO_BC1_SELECTOR[getSelector(p_block, x, y)]) << ((y * 4 + x) * 2);
+		}
+	}
+	return indices;
+}
+
+// ETC1_TO_BC1_SELECTOR as bit planes: the low bit of the index is the msb of
+// the selector, the high bit is the negated lsb
+static inline uint32_t remapBC1Selectors(const UniversalBlock &p_block) {
+	const uint32_t msb = transposeSelectorBits(p_block.msb);
+	const uint32_t lsb = transposeSelectorBits(p_block.lsb);
+	return spreadBits2(msb) | (spreadBits2(~lsb & 0xFFFF) << 1);
+}
+
+static void transcodeBC1Block(const uint8_t *p_block, bool p_simd, uint8_t *r_bc1) {
+	UniversalBlock block;
+	unpackBlock(p_block, block);
+
+	const int large = Transcoder::MODIFIERS[block.table][1];
+	const uint16_t color0 = packRGB565(MIN(block.base[0] + large, 255), MIN(block.base[1] + large, 255), MIN(block.base[2] + large, 255));
+	const uint16_t color1 = packRGB565(MAX(block.base[0] - large, 0), MAX(block.base[1] - large, 0), MAX(block.base[2] - large, 0));
+
+	// color0 >= color1 for each channel, so the block is in 4 colors mode
+	// unless the colors are equal, then the index 0 is used by all
+	uint32_t indices = 0;
+	if (color0 != color1)
+		indices = p_simd ? remapBC1Selectors(block) : remapBC1SelectorsScalar(block);
+
+	r_bc1[0] = color0 & 0xFF;
+	r_bc1[1] = color0 >> 8;
+	r_bc1[2] = color1 & 0xFF;
+	r_bc1[3] = color1 >> 8;
+	memcpy(r_bc1 + 4, &indices, 4);
+}
+
+static uint64_t remapBC3SelectorsScalar(const UniversalBlock &p_block) {
+	uint64_t indices = 0;
+	for (uint32_t y = 0; y < 4; ++y) {
+		for (uint32_t x = 0; x < 4; ++x) {
+			indices |= uint64_t(ETC1_TO_BC3_SELECTOR[p_block.table][getSelector(p_block, x, y)]) << ((y * 4 + x) * 3);
+		}
+	}
+	return indices;
+}
+
+// The two rows of ETC1_TO_BC3_SELECTOR as bit planes
+static inline uint64_t remapBC3Selectors(const UniversalBlock &p_block) {
+	const uint32_t msb = transposeSelectorBits(p_block.msb);
+	const uint32_t lsb = transposeSelectorBits(p_block.lsb);
+	const uint32_t notLsb = ~lsb & 0xFFFF;
+
+	uint32_t bit0;
+	uint32_t bit1;
+	uint32_t bit2;
+	if (4 == ETC1_TO_BC3_SELECTOR[p_block.table][0]) {
+		// 4 0 5 1
+		bit0 = msb;
+		bit1 = 0;
+		bit2 = notLsb;
+	} else {
+		// 3 0 6 1
+		bit0 = ~(msb ^ lsb) & 0xFFFF;
+		bit1 = notLsb;
+		bit2 = notLsb & msb;
+	}
+	return spreadBits3(bit0) | (spreadBits3(bit1) << 1) | (spreadBits3(bit2) << 2);
+}
+
+static void transcodeBC3AlphaBlock(const uint8_t *p_block, bool p_simd, uint8_t *r_bc3) {
+	UniversalBlock block;
+	unpackBlock(p_block, block);
+
+	// The alpha is stored as gray
+	const int large = Transcoder::MODIFIERS[block.table][1];
+	const int alpha0 = MIN(block.base[1] + large, 255);
+	const int alpha1 = MAX(block.base[1] - large, 0);
+
+	uint64_t indices = 0;
+	if (alpha0 != alpha1)
+		indices = p_simd ? remapBC3Selectors(block) : remapBC3SelectorsScalar(block);
+
+	r_bc3[0] = alpha0;
+	r_bc3[1] = alpha1;
+	for (int i = 0; i < 6; ++i) {
+		r_bc3[2 + i] = (indices >> (i * 8)) & 0xFF;
+	}
+}
+
+#ifdef TRANSCODER_SSE2
+static inline __m128i selectSSE2(__m128i p_mask, __m128i p_a, __m128i p_b) {
+	return _mm_or_si128(_mm_and_si128(p_mask, p_a), _mm_andnot_si128(p_mask, p_b));
+}
+
+// Lanes set where the selector bit of the pixels (x, p_y) is set
+static inline __m128i selectorMaskSSE2(uint16_t p_bits, uint32_t p_y) {
+	const __m128i bits = _mm_setr_epi32(1 << p_y, 1 << (4 + p_y), 1 << (8 + p_y), 1 << (12 + p_y));
+	return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(p_bits), bits), bits);
+}
+
+// A row of 4 pixels per iteration, the selector bits of the row pick the
+// palette colors with masks
+static void transcodeRGBA8BlockSSE2(const uint8_t *p_block, const uint8_t *p_alphaBlock, uint32_t p_pixelX, uint32_t p_pixelY, uint32_t p_width, uint32_t p_height, uint8_t *r_data) {
+	UniversalBlock block;
+	unpackBlock(p_block, block);
+
+	uint32_t palette[4];
+	computePalette(block, palette);
+
+	UniversalBlock alphaBlock = {};
+	__m128i alphas[4];
+	if (p_alphaBlock) {
+		unpackBlock(p_alphaBlock, alphaBlock);
+
+		uint32_t alphaPalette[4];
+		computePalette(alphaBlock, alphaPalette);
+
+		// The alpha is stored as gray, the green goes in the alpha byte
+		for (int i = 0; i < 4; ++i) {
+			alphas[i] = _mm_set1_epi32(int((alphaPalette[i] & 0xFF00) << 16));
+		}
+	}
+
+	const __m128i colors[4] = {
+		_mm_set1_epi32(int(palette[0])),
+		_mm_set1_epi32(int(palette[1])),
+		_mm_set1_epi32(int(palette[2])),
+		_mm_set1_epi32(int(palette[3]))
+	};
+	const __m128i colorMask = _mm_set1_epi32(0x00FFFFFF);
+
+	const uint32_t width = MIN(p_width - p_pixelX, 4u);
+	const uint32_t height = MIN(p_height - p_pixelY, 4u);
+
+	for (uint32_t y = 0; y < height; ++y) {
+		const __m128i lsb = selectorMaskSSE2(block.lsb, y);
+		__m128i pixels = selectSSE2(
+				selectorMaskSSE2(block.msb, y),
+				selectSSE2(lsb, colors[3], colors[2]),
+				selectSSE2(lsb, colors[1], colors[0]));
+
+		if (p_alphaBlock) {
+			const __m128i alphaLsb = selectorMaskSSE2(alphaBlock.lsb, y);
+			const __m128i alpha = selectSSE2(
+					selectorMaskSSE2(alphaBlock.msb, y),
+					selectSSE2(alphaLsb, alphas[3], alphas[2]),
+					selectSSE2(alphaLsb, alphas[1], alphas[0]));
+			pixels = _mm_or_si128(_mm_and_si128(pixels, colorMask), alpha);
+		}
+
+		uint8_t *row = r_data + (size_t(p_pixelY + y) * p_width + p_pixelX) * 4;
+		if (4 == width) {
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(row), pixels);
+		} else {
+			// The last column of blocks of a size not multiple of 4
+			alignas(16) uint8_t rowPixels[16];
+			_mm_store_si128(reinterpret_cast<__m128i *>(rowPixels), pixels);
+			memcpy(row, rowPixels, width * 4);
+		}
+	}
+}
+#endif
+
+static void transcodeRGBA8Block(const uint8_t *p_block, const uint8_t *p_alphaBlock, uint32_t p_pixelX, uint32_t p_pixelY, uint32_t p_width, uint32_t p_height, uint8_t *r_data) {
+	UniversalBlock block;
+	unpackBlock(p_block, block);
+
+	uint32_t palette[4];
+	computePalette(block, palette);
+
+	const uint32_t width = MIN(p_width - p_pixelX, 4u);
+	const uint32_t height = MIN(p_height - p_pixelY, 4u);
+
+	for (uint32_t y = 0; y < height; ++y) {
+		uint32_t *row = reinterpret_cast<uint32_t *>(r_data) + size_t(p_pixelY + y) * p_width + p_pixelX;
+		for (uint32_t x = 0; x < width; ++x) {
+			row[x] = palette[getSelector(block, x, y)];
+		}
+	}
+
+	if (!p_alphaBlock)
+		return;
+
+	UniversalBlock alphaBlock;
+	unpackBlock(p_alphaBlock, alphaBlock);
+
+	uint32_t alphaPalette[4];
+	computePalette(alphaBlock, alphaPalette);
+
+	for (uint32_t y = 0; y < height; ++y) {
+		uint8_t *row = r_data + (size_t(p_pixelY + y) * p_width + p_pixelX) * 4;
+		for (uint32_t x = 0; x < width; ++x) {
+			row[x * 4 + 3] = (alphaPalette[getSelector(alphaBlock, x, y)] >> 8) & 0xFF;
+		}
+	}
+}
+
+void Transcoder::getTargetFormats(bool p_alpha, std::vector<VkFormat> &r_formats) {
+	r_formats.clear();
+	if (p_alpha) {
+		r_formats.push_back(VK_FORMAT_BC3_UNORM_BLOCK);
+	} else {
+		r_formats.push_back(VK_FORMAT_BC1_RGB_UNORM_BLOCK);
+		r_formats.push_back(VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK);
+	}
+	r_formats.push_back(VK_FORMAT_R8G8B8A8_UNORM);
+}
+
+bool Transcoder::isTargetSupported(VkFormat p_target, bool p_alpha) {
+	std::vector<VkFormat> formats;
+	getTargetFormats(p_alpha, formats);
+	return formats.end() != std::find(formats.begin(), formats.end(), p_target);
+}
+
+uint64_t Transcoder::getTranscodedSize(VkFormat p_target, uint32_t p_width, uint32_t p_height) {
+	if (VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK == p_target)
+		return KTX2::getUniversalLevelSize(p_width, p_height, 0, false);
+	return KTX2::getLevelSize(p_target, p_width, p_height, 0);
+}
+
+#ifdef TRANSCODER_SSE2
+#define transcodeRGBA8BlockSIMD transcodeRGBA8BlockSSE2
+#else
+#define transcodeRGBA8BlockSIMD transcodeRGBA8Block
+#endif
+
+void Transcoder::transcodeRows(const uint8_t *p_blocks, uint32_t p_width, uint32_t p_height, bool p_alpha, VkFormat p_target, uint32_t p_blockRowBegin, uint32_t p_blockRowEnd, uint8_t *r_data, bool p_simd) {
+
+	const uint32_t blocksX = (p_width + 3) / 4;
+	const uint32_t blocksY = (p_height + 3) / 4;
+	const uint8_t *alphaBlocks = p_alpha ? p_blocks + size_t(blocksX) * blocksY * KTX2::UNIVERSAL_BLOCK_SIZE : nullptr;
+
+	for (uint32_t blockY = p_blockRowBegin; blockY < p_blockRowEnd; ++blockY) {
+		const size_t rowOffset = size_t(blockY) * blocksX;
+
+		switch (p_target) {
+			case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+				// ETC1S is a subset of ETC2
+				memcpy(r_data + rowOffset * 8, p_blocks + rowOffset * KTX2::UNIVERSAL_BLOCK_SIZE, blocksX * 8);
+				break;
+			case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+				for (uint32_t blockX = 0; blockX < blocksX; ++blockX) {
+					transcodeBC1Block(p_blocks + (rowOffset + blockX) * KTX2::UNIVERSAL_BLOCK_SIZE, p_simd, r_data + (rowOffset + blockX) * 8);
+				}
+				break;
+			case VK_FORMAT_BC3_UNORM_BLOCK:
+				for (uint32_t blockX = 0; blockX < blocksX; ++blockX) {
+					uint8_t *bc3 = r_data + (rowOffset + blockX) * 16;
+					transcodeBC3AlphaBlock(alphaBlocks + (rowOffset + blockX) * KTX2::UNIVERSAL_BLOCK_SIZE, p_simd, bc3);
+					transcodeBC1Block(p_blocks + (rowOffset + blockX) * KTX2::UNIVERSAL_BLOCK_SIZE, p_simd, bc3 + 8);
+				}
+				break;
+			default: // RGBA8
+				for (uint32_t blockX = 0; blockX < blocksX; ++blockX) {
+					(p_simd ? transcodeRGBA8BlockSIMD : transcodeRGBA8Block)(
+							p_blocks + (rowOffset + blockX) * KTX2::UNIVERSAL_BLOCK_SIZE,
+							alphaBlocks ? alphaBlocks + (rowOffset + blockX) * KTX2::UNIVERSAL_BLOCK_SIZE : nullptr,
+							blockX * 4,
+							blockY * 4,
+							p_width,
+							p_height,
+							r_data);
+				}
+		}
+	}
+}
+
+bool Transcoder::transcodeLevel(ThreadPool *p_threadPool, const uint8_t *p_blocks, uint32_t p_width, uint32_t p_height, bool p_alpha, VkFormat p_target, std::vector<uint8_t> &r_data, bool p_simd) {
+	PROFILE_ZONE("Transcoder::transcodeLevel");
+
+	if (!isTargetSupported(p_target, p_alpha)) {
+		ERR_EXPLAIN("The universal texture can't be transcoded to the format " + std::to_string(p_target));
+		ERR_FAIL_V(false);
+	}
+
+	r_data.resize(getTranscodedSize(p_target, p_width, p_height));
+
+	const uint32_t blocksY = (p_height + 3) / 4;
+	if (p_threadPool) {
+		uint8_t *data = r_data.data();
+		p_threadPool->parallelFor(blocksY, TRANSCODE_ROWS_PER_JOB, [=](uint32_t p_begin, uint32_t p_end) {
+			transcodeRows(p_blocks, p_width, p_height, p_alpha, p_target, p_begin, p_end, data, p_simd);
+		});
+	} else {
+		transcodeRows(p_blocks, p_width, p_height, p_alpha, p_target, 0, blocksY, r_data.data(), p_simd);
+	}
+	return true;
+}
+
+void Transcoder::packBlock(const uint8_t p_base555[3], uint32_t p_table, const uint8_t p_selectors[16], uint8_t r_block[8]) {
+	uint16_t msb = 0;
+	uint16_t lsb = 0;
+	for (uint32_t y = 0; y < 4; ++y) {
+		for (uint32_t x = 0; x < 4; ++x) {
+			const uint32_t selector = p_selectors[y * 4 + x];
+			msb |= ((selector >> 1) & 1) << (x * 4 + y);
+			lsb |= (selector & 1) << (x * 4 + y);
+		}
+	}
+
+	// Differential mode with zero deltas, the flip bit is irrelevant
+	r_block[0] = p_base555[0] << 3;
+	r_block[1] = p_base555[1] << 3;
+	r_block[2] = p_base555[2] << 3;
+	r_block[3] = (p_table << 5) | (p_table << 2) | 0x2;
+	r_block[4] = msb >> 8;
+	r_block[5] = msb & 0xFF;
+	r_block[6] = lsb >> 8;
+	r_block[7] = lsb & 0xFF;
+}
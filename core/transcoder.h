@@ -0,0 +1,48 @@
+#pragma once
+
+#include "libs/vulkan/vulkan_core.h"
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// TRANSCODER
+//		The universal textures are cooked once and converted at load time to
+// the best block format supported by the device.
+//		Each 4x4 block is ETC1S: an ETC1 block in differential mode with the
+// deltas at zero and the same modifier table in both halves, so the block
+// is one base color (555), one table and 16 selectors. The images with
+// alpha have a second slice of ETC1S blocks that store the alpha as gray.
+//		Being a subset of ETC1, a block is already a valid ETC2 RGB block.
+// The four colors of a block lie on a line, so the conversion to BC1 is
+// only a requantization of the extremes and a remap of the selectors, and
+// the alpha slice maps on the BC3 alpha block the same way. The other
+// devices receive RGBA8.
+//		The selectors are remapped for the 16 pixels of a block at once, as
+// bit planes, and the RGBA8 rows are expanded 4 pixels at a time with SSE2.
+// The scalar paths are kept as the reference of the benchmark.
+//		Each level is split in rows of blocks, transcoded in parallel by the
+// thread pool.
+class Transcoder {
+public:
+	// ETC1 intensity modifiers, the small and the large of each table
+	static const int MODIFIERS[8][2];
+
+	// Ordered from the best, RGBA8 is always the last
+	static void getTargetFormats(bool p_alpha, std::vector<VkFormat> &r_formats);
+
+	static bool isTargetSupported(VkFormat p_target, bool p_alpha);
+
+	// Size of the transcoded level
+	static uint64_t getTranscodedSize(VkFormat p_target, uint32_t p_width, uint32_t p_height);
+
+	// Transcodes the rows of blocks [p_blockRowBegin, p_blockRowEnd) of the
+	// universal level; r_data is the whole destination level
+	static void transcodeRows(const uint8_t *p_blocks, uint32_t p_width, uint32_t p_height, bool p_alpha, VkFormat p_target, uint32_t p_blockRowBegin, uint32_t p_blockRowEnd, uint8_t *r_data, bool p_simd = true);
+
+	// Without the pool the level is transcoded by the calling thread
+	static bool transcodeLevel(ThreadPool *p_threadPool, const uint8_t *p_blocks, uint32_t p_width, uint32_t p_height, bool p_alpha, VkFormat p_target, std::vector<uint8_t> &r_data, bool p_simd = true);
+
+	// Packs an ETC1S block, the selectors are indexed by y * 4 + x
+	static void packBlock(const uint8_t p_base555[3], uint32_t p_table, const uint8_t p_selectors[16], uint8_t r_block[8]);
+};
@@ -0,0 +1,623 @@
+#include "transfer_batcher.h"
+
+#include "VisualServer.h"
+#include "core/error_macros.h"
+#include "core/ktx2.h"
+#include "core/print_string.h"
+#include "core/profiler.h"
+#include "core/render_graph.h"
+#include "core/string.h"
+#include "core/typedefs.h"
+
+#define WAIT_TIMEOUT_NANOSEC 3.6e+12 // 1 hour
+
+const VkDeviceSize TransferBatcher::MAX_PENDING_STAGING_SIZE = 64 * 1024 * 1024;
+const VkDeviceSize TransferBatcher::STAGING_LEVEL_ALIGNMENT = 16;
+const VkDeviceSize TransferBatcher::STAGING_RING_SIZE = 16 * 1024 * 1024;
+
+TransferBatcher::TransferBatcher() :
+		vulkanServer(nullptr),
+		commandPool(VK_NULL_HANDLE),
+		pendingId(1),
+		hasPending(false),
+		pendingStagingSize(0),
+		ringData(nullptr),
+		ringHead(0),
+		ringTail(0) {
+	ring.buffer = VK_NULL_HANDLE;
+	ring.allocation = VK_NULL_HANDLE;
+	ring.allocator = VK_NULL_HANDLE;
+}
+
+bool TransferBatcher::create(VulkanServer *p_vulkanServer) {
+	vulkanServer = p_vulkanServer;
+
+	VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+	commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolCreateInfo.queueFamilyIndex = vulkanServer->findQueueFamilies(vulkanServer->physicalDevice).graphicsFamilyIndex;
+	commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	VkResult res = vkCreateCommandPool(
+			vulkanServer->device,
+			&commandPoolCreateInfo,
+			nullptr,
+			&commandPool);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	print_verbose("Transfer batcher created");
+	return true;
+}
+
+void TransferBatcher::destroy() {
+	if (VK_NULL_HANDLE == commandPool)
+		return;
+
+	waitAll();
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (size_t i = 0; i < freeFences.size(); ++i) {
+		vkDestroyFence(vulkanServer->device, freeFences[i], nullptr);
+	}
+	freeFences.clear();
+
+	if (ringData) {
+		vmaUnmapMemory(ring.allocator, ring.allocation);
+		vulkanServer->destroyBuffer(ring.allocator, ring.buffer, ring.allocation);
+		ringData = nullptr;
+		ringHead = 0;
+		ringTail = 0;
+	}
+
+	// Frees the command buffers too
+	vkDestroyCommandPool(vulkanServer->device, commandPool, nullptr);
+	commandPool = VK_NULL_HANDLE;
+	freeCommands.clear();
+}
+
+uint64_t TransferBatcher::uploadImage(VkImage p_image, VkFormat p_format, uint32_t p_width, uint32_t p_height, const void *p_data, VkDeviceSize p_size, uint32_t p_mipLevels) {
+	PROFILE_ZONE("TransferBatcher::uploadImage");
+
+	std::vector<ImageLevel> levels;
+	ERR_FAIL_COND_V(!splitLevels(p_width, p_height, p_data, p_size, p_mipLevels, levels), 0);
+	return enqueueUpload(p_image, p_format, p_width, p_height, levels, p_mipLevels);
+}
+
+uint64_t TransferBatcher::uploadImageLevels(VkImage p_image, VkFormat p_format, uint32_t p_width, uint32_t p_height, const std::vector<ImageLevel> &p_levels) {
+	PROFILE_ZONE("TransferBatcher::uploadImageLevels");
+	return enqueueUpload(p_image, p_format, p_width, p_height, p_levels, p_levels.size());
+}
+
+uint64_t TransferBatcher::uploadImageGenerateMips(VkImage p_image, VkFormat p_format, uint32_t p_width, uint32_t p_height, const void *p_data, VkDeviceSize p_size, uint32_t p_mipLevels) {
+	PROFILE_ZONE("TransferBatcher::uploadImageGenerateMips");
+
+	std::vector<ImageLevel> levels(1);
+	levels[0].data = p_data;
+	levels[0].size = p_size;
+	return enqueueUpload(p_image, p_format, p_width, p_height, levels, p_mipLevels);
+}
+
+bool TransferBatcher::splitLevels(uint32_t p_width, uint32_t p_height, const void *p_data, VkDeviceSize p_size, uint32_t p_levelCount, std::vector<ImageLevel> &r_levels) {
+
+	// The data is tightly packed, so the texel size is derived from it
+	VkDeviceSize texels = 0;
+	for (uint32_t level = 0; level < p_levelCount; ++level) {
+		texels += VkDeviceSize(MAX(p_width >> level, 1u)) * MAX(p_height >> level, 1u);
+	}
+	ERR_FAIL_COND_V(!texels, false);
+	const VkDeviceSize texelSize = p_size / texels;
+	ERR_FAIL_COND_V(texelSize * texels != p_size, false);
+
+	r_levels.resize(p_levelCount);
+	const uint8_t *data = static_cast<const uint8_t *>(p_data);
+	for (uint32_t level = 0; level < p_levelCount; ++level) {
+		r_levels[level].data = data;
+		r_levels[level].size = VkDeviceSize(MAX(p_width >> level, 1u)) * MAX(p_height >> level, 1u) * texelSize;
+		data += r_levels[level].size;
+	}
+	return true;
+}
+
+uint64_t TransferBatcher::enqueueUpload(VkImage p_image, VkFormat p_format, uint32_t p_width, uint32_t p_height, const std::vector<ImageLevel> &p_levels, uint32_t p_mipLevels) {
+	const uint32_t copyLevels = p_levels.size();
+	ERR_FAIL_COND_V(!copyLevels || copyLevels > p_mipLevels, 0);
+
+	// Each level starts aligned, as required by the block compressed formats
+	VkDeviceSize stagingSize = 0;
+	for (uint32_t level = 0; level < copyLevels; ++level) {
+		stagingSize = (stagingSize + STAGING_LEVEL_ALIGNMENT - 1) / STAGING_LEVEL_ALIGNMENT * STAGING_LEVEL_ALIGNMENT;
+		stagingSize += p_levels[level].size;
+	}
+
+	StagingBuffer staging;
+	if (!vulkanServer->createImageLoadBuffer(stagingSize, staging.buffer, staging.allocation, staging.allocator)) {
+		print_error("Failed to create the staging buffer of the image upload");
+		return 0;
+	}
+
+	const VkImageAspectFlags aspect = RenderGraph::getFormatAspect(p_format);
+
+	// The copy in the staging buffer is done without lock
+	void *data;
+	vmaMapMemory(staging.allocator, staging.allocation, &data);
+
+	std::vector<Copy> levelCopies(copyLevels);
+	VkDeviceSize offset = 0;
+	for (uint32_t level = 0; level < copyLevels; ++level) {
+		offset = (offset + STAGING_LEVEL_ALIGNMENT - 1) / STAGING_LEVEL_ALIGNMENT * STAGING_LEVEL_ALIGNMENT;
+		memcpy(static_cast<uint8_t *>(data) + offset, p_levels[level].data, p_levels[level].size);
+
+		// The extent is in texels also for the block compressed formats
+		Copy &copy = levelCopies[level];
+		copy.buffer = staging.buffer;
+		copy.image = p_image;
+		copy.region = {};
+		copy.region.bufferOffset = offset;
+		copy.region.imageSubresource.aspectMask = aspect;
+		copy.region.imageSubresource.mipLevel = level;
+		copy.region.imageSubresource.layerCount = 1;
+		copy.region.imageExtent = { MAX(p_width >> level, 1u), MAX(p_height >> level, 1u), 1 };
+
+		offset += p_levels[level].size;
+	}
+
+	vmaUnmapMemory(staging.allocator, staging.allocation);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	const uint64_t id = _addTransition(p_image, p_format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, p_mipLevels);
+	ERR_FAIL_COND_V(!id, 0);
+
+	copies.insert(copies.end(), levelCopies.begin(), levelCopies.end());
+	pendingStagingBuffers.push_back(staging);
+	pendingStagingSize += stagingSize;
+	stats.copies += copyLevels;
+	stats.stagingBytes += stagingSize;
+
+	if (copyLevels < p_mipLevels) {
+		MipChain chain;
+		chain.image = p_image;
+		chain.aspect = aspect;
+		chain.width = p_width;
+		chain.height = p_height;
+		chain.levels = p_mipLevels;
+		mipChains.push_back(chain);
+
+		// The blit chain leaves the last level as destination and the others
+		// as source
+		_addTransition(p_image, p_format, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 0, p_mipLevels - 1);
+		_addTransition(p_image, p_format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, p_mipLevels - 1, 1);
+	} else {
+		_addTransition(p_image, p_format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 0, p_mipLevels);
+	}
+
+	if (pendingStagingSize >= MAX_PENDING_STAGING_SIZE)
+		_flush();
+
+	return id;
+}
+
+uint64_t TransferBatcher::updateImage(VkImage p_image, VkFormat p_format, const std::vector<ImageRegion> &p_regions) {
+	PROFILE_ZONE("TransferBatcher::updateImage");
+
+	const uint32_t texelSize = KTX2::getBlockSize(p_format);
+	ERR_FAIL_COND_V(!texelSize || KTX2::isBlockCompressed(p_format), 0);
+	ERR_FAIL_COND_V(p_regions.empty(), 0);
+
+	// The rows are packed in the staging, each region aligned
+	std::vector<VkDeviceSize> regionOffsets(p_regions.size());
+	VkDeviceSize stagingSize = 0;
+	for (size_t i = 0; i < p_regions.size(); ++i) {
+		stagingSize = (stagingSize + STAGING_LEVEL_ALIGNMENT - 1) / STAGING_LEVEL_ALIGNMENT * STAGING_LEVEL_ALIGNMENT;
+		regionOffsets[i] = stagingSize;
+		stagingSize += VkDeviceSize(p_regions[i].extent.width) * p_regions[i].extent.height * texelSize;
+	}
+
+	// Unlike enqueueUpload the data is copied under the lock: the ring space
+	// is reclaimed by batch, so it must be filled by the batch that reserves it
+	std::lock_guard<std::mutex> lock(mutex);
+
+	StagingBuffer staging;
+	uint8_t *data;
+	VkDeviceSize baseOffset;
+	const bool inRing = _allocateRing(stagingSize, baseOffset);
+	if (inRing) {
+		staging = ring;
+		data = ringData + baseOffset;
+		stats.ringBytes += stagingSize;
+	} else {
+		if (!vulkanServer->createImageLoadBuffer(stagingSize, staging.buffer, staging.allocation, staging.allocator)) {
+			print_error("Failed to create the staging buffer of the image update");
+			return 0;
+		}
+		void *mapped;
+		vmaMapMemory(staging.allocator, staging.allocation, &mapped);
+		data = static_cast<uint8_t *>(mapped);
+		baseOffset = 0;
+		++stats.ringFallbacks;
+	}
+
+	const VkImageAspectFlags aspect = RenderGraph::getFormatAspect(p_format);
+
+	for (size_t i = 0; i < p_regions.size(); ++i) {
+		const ImageRegion &region = p_regions[i];
+		const size_t rowSize = size_t(region.extent.width) * texelSize;
+
+		const uint8_t *src = static_cast<const uint8_t *>(region.data);
+		uint8_t *dst = data + regionOffsets[i];
+		for (uint32_t row = 0; row < region.extent.height; ++row) {
+			memcpy(dst, src, rowSize);
+			dst += rowSize;
+			src += region.rowPitch;
+		}
+
+		Copy copy;
+		copy.buffer = staging.buffer;
+		copy.image = p_image;
+		copy.region = {};
+		copy.region.bufferOffset = baseOffset + regionOffsets[i];
+		copy.region.imageSubresource.aspectMask = aspect;
+		copy.region.imageSubresource.layerCount = 1;
+		copy.region.imageOffset = { region.offset.x, region.offset.y, 0 };
+		copy.region.imageExtent = { region.extent.width, region.extent.height, 1 };
+		copies.push_back(copy);
+	}
+
+	if (!inRing) {
+		vmaUnmapMemory(staging.allocator, staging.allocation);
+		pendingStagingBuffers.push_back(staging);
+		pendingStagingSize += stagingSize;
+	}
+
+	// The image may be already uploaded or updated by this batch: it stays
+	// in transfer destination for all the copies
+	if (!pendingImages.count(p_image)) {
+		_addTransition(p_image, p_format, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+		_addTransition(p_image, p_format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	}
+
+	hasPending = true;
+	stats.copies += p_regions.size();
+	stats.regionUpdates += p_regions.size();
+	stats.stagingBytes += stagingSize;
+
+	const uint64_t id = pendingId;
+
+	if (pendingStagingSize >= MAX_PENDING_STAGING_SIZE)
+		_flush();
+
+	return id;
+}
+
+bool TransferBatcher::_allocateRing(VkDeviceSize p_size, VkDeviceSize &r_offset) {
+	if (p_size > STAGING_RING_SIZE)
+		return false;
+
+	if (!ringData) {
+		if (!vulkanServer->createImageLoadBuffer(STAGING_RING_SIZE, ring.buffer, ring.allocation, ring.allocator)) {
+			print_error("Failed to create the staging ring");
+			return false;
+		}
+		void *mapped;
+		vmaMapMemory(ring.allocator, ring.allocation, &mapped);
+		ringData = static_cast<uint8_t *>(mapped);
+	}
+
+	uint64_t begin = (ringHead + STAGING_LEVEL_ALIGNMENT - 1) / STAGING_LEVEL_ALIGNMENT * STAGING_LEVEL_ALIGNMENT;
+	// The allocation is contiguous, so it skips the end of the buffer
+	if (begin % STAGING_RING_SIZE + p_size > STAGING_RING_SIZE)
+		begin = (begin / STAGING_RING_SIZE + 1) * STAGING_RING_SIZE;
+
+	if (begin + p_size - ringTail > STAGING_RING_SIZE) {
+		// Reclaim the space of the completed batches
+		_collect(false);
+		if (begin + p_size - ringTail > STAGING_RING_SIZE)
+			return false;
+	}
+
+	ringHead = begin + p_size;
+	r_offset = begin % STAGING_RING_SIZE;
+	return true;
+}
+
+uint64_t TransferBatcher::addTransition(VkImage p_image, VkFormat p_format, VkImageLayout p_oldLayout, VkImageLayout p_newLayout, uint32_t p_baseLevel, uint32_t p_levelCount) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return _addTransition(p_image, p_format, p_oldLayout, p_newLayout, p_baseLevel, p_levelCount);
+}
+
+uint64_t TransferBatcher::_addTransition(VkImage p_image, VkFormat p_format, VkImageLayout p_oldLayout, VkImageLayout p_newLayout, uint32_t p_baseLevel, uint32_t p_levelCount) {
+
+	VkPipelineStageFlags srcStages;
+	VkPipelineStageFlags dstStages;
+	VkAccessFlags srcAccess;
+	VkAccessFlags dstAccess;
+
+	if (!RenderGraph::getLayoutAccess(p_oldLayout, srcStages, srcAccess) ||
+			!RenderGraph::getLayoutAccess(p_newLayout, dstStages, dstAccess)) {
+		ERR_EXPLAIN("Layout transition not supported");
+		ERR_FAIL_V(0);
+	}
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = p_oldLayout;
+	barrier.newLayout = p_newLayout;
+	// The source waits only the writes
+	barrier.srcAccessMask = srcAccess & (VK_ACCESS_TRANSFER_WRITE_BIT |
+												VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+												VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+	barrier.dstAccessMask = dstAccess;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = p_image;
+	barrier.subresourceRange.aspectMask = RenderGraph::getFormatAspect(p_format);
+	barrier.subresourceRange.baseMipLevel = p_baseLevel;
+	barrier.subresourceRange.levelCount = p_levelCount;
+	barrier.subresourceRange.layerCount = 1;
+
+	// The transitions to a transfer layout prepare the copies, the others
+	// consume them
+	const bool preCopy = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL == p_newLayout || VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL == p_newLayout;
+	BarrierGroups &groups = preCopy ? preCopyBarriers : postCopyBarriers;
+	groups[StagePair(srcStages, dstStages)].push_back(barrier);
+
+	if (preCopy)
+		pendingImages.insert(p_image);
+
+	++stats.transitions;
+	hasPending = true;
+	return pendingId;
+}
+
+bool TransferBatcher::flush() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return _flush();
+}
+
+void TransferBatcher::_recordBarriers(VkCommandBuffer p_command, const BarrierGroups &p_groups) {
+	for (auto it = p_groups.begin(); it != p_groups.end(); ++it) {
+		vkCmdPipelineBarrier(
+				p_command,
+				it->first.first,
+				it->first.second,
+				0,
+				0,
+				nullptr,
+				0,
+				nullptr,
+				it->second.size(),
+				it->second.data());
+		++stats.barrierCalls;
+	}
+}
+
+void TransferBatcher::_recordMipChains(VkCommandBuffer p_command) {
+
+	uint32_t maxLevels = 0;
+	for (size_t i = 0; i < mipChains.size(); ++i) {
+		maxLevels = MAX(maxLevels, mipChains[i].levels);
+	}
+
+	std::vector<VkImageMemoryBarrier> barriers;
+	barriers.reserve(mipChains.size());
+
+	// All the images proceed level by level, so each level needs one barrier
+	// call for all of them
+	for (uint32_t level = 1; level < maxLevels; ++level) {
+
+		barriers.clear();
+		for (size_t i = 0; i < mipChains.size(); ++i) {
+			if (level >= mipChains[i].levels)
+				continue;
+
+			// The previous level is written by the copy or by the last blit
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = mipChains[i].image;
+			barrier.subresourceRange.aspectMask = mipChains[i].aspect;
+			barrier.subresourceRange.baseMipLevel = level - 1;
+			barrier.subresourceRange.levelCount = 1;
+			barrier.subresourceRange.layerCount = 1;
+			barriers.push_back(barrier);
+		}
+
+		vkCmdPipelineBarrier(
+				p_command,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				0,
+				0,
+				nullptr,
+				0,
+				nullptr,
+				barriers.size(),
+				barriers.data());
+		++stats.barrierCalls;
+
+		for (size_t i = 0; i < mipChains.size(); ++i) {
+			const MipChain &chain = mipChains[i];
+			if (level >= chain.levels)
+				continue;
+
+			VkImageBlit blit = {};
+			blit.srcSubresource.aspectMask = chain.aspect;
+			blit.srcSubresource.mipLevel = level - 1;
+			blit.srcSubresource.layerCount = 1;
+			blit.srcOffsets[1] = { int32_t(MAX(chain.width >> (level - 1), 1u)), int32_t(MAX(chain.height >> (level - 1), 1u)), 1 };
+			blit.dstSubresource.aspectMask = chain.aspect;
+			blit.dstSubresource.mipLevel = level;
+			blit.dstSubresource.layerCount = 1;
+			blit.dstOffsets[1] = { int32_t(MAX(chain.width >> level, 1u)), int32_t(MAX(chain.height >> level, 1u)), 1 };
+
+			vkCmdBlitImage(
+					p_command,
+					chain.image,
+					VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					chain.image,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					1,
+					&blit,
+					VK_FILTER_LINEAR);
+			++stats.blits;
+		}
+	}
+}
+
+bool TransferBatcher::_flush() {
+	if (!hasPending)
+		return true;
+
+	PROFILE_ZONE("TransferBatcher::flush");
+
+	// Recycle the objects of the completed batches
+	_collect(false);
+
+	Batch batch;
+	batch.id = pendingId;
+	batch.ringEnd = ringHead;
+
+	if (freeCommands.size()) {
+		batch.command = freeCommands.back();
+		freeCommands.pop_back();
+	} else {
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = 1;
+		ERR_FAIL_COND_V(VK_SUCCESS != vkAllocateCommandBuffers(vulkanServer->device, &allocateInfo, &batch.command), false);
+	}
+
+	if (freeFences.size()) {
+		batch.fence = freeFences.back();
+		freeFences.pop_back();
+	} else {
+		VkFenceCreateInfo fenceCreateInfo = {};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		ERR_FAIL_COND_V(VK_SUCCESS != vkCreateFence(vulkanServer->device, &fenceCreateInfo, nullptr, &batch.fence), false);
+	}
+
+	// The command pool has the reset bit, so the begin resets the command
+	vulkanServer->beginOneTimeCommand(batch.command);
+
+	_recordBarriers(batch.command, preCopyBarriers);
+
+	for (size_t i = 0; i < copies.size(); ++i) {
+		vkCmdCopyBufferToImage(
+				batch.command,
+				copies[i].buffer,
+				copies[i].image,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				1,
+				&copies[i].region);
+	}
+
+	_recordMipChains(batch.command);
+
+	_recordBarriers(batch.command, postCopyBarriers);
+
+	bool success = vulkanServer->endCommand(batch.command) &&
+				   vulkanServer->submitCommand(batch.command, batch.fence);
+
+	batch.stagingBuffers.swap(pendingStagingBuffers);
+
+	preCopyBarriers.clear();
+	copies.clear();
+	mipChains.clear();
+	postCopyBarriers.clear();
+	pendingImages.clear();
+	pendingStagingSize = 0;
+	hasPending = false;
+	++pendingId;
+
+	if (!success) {
+		print_error("Transfer batch submission failed");
+		_releaseStagingBuffers(batch.stagingBuffers);
+		freeCommands.push_back(batch.command);
+		freeFences.push_back(batch.fence);
+		return false;
+	}
+
+	++stats.submissions;
+	inFlight.push_back(batch);
+	return true;
+}
+
+void TransferBatcher::collect() {
+	std::lock_guard<std::mutex> lock(mutex);
+	_collect(false);
+}
+
+void TransferBatcher::_collect(bool p_wait) {
+
+	while (inFlight.size()) {
+		Batch &batch = inFlight.front();
+
+		if (p_wait) {
+			vkWaitForFences(vulkanServer->device, 1, &batch.fence, VK_TRUE, WAIT_TIMEOUT_NANOSEC);
+		} else if (VK_SUCCESS != vkGetFenceStatus(vulkanServer->device, batch.fence)) {
+			// The batches complete in submission order
+			break;
+		}
+
+		_releaseStagingBuffers(batch.stagingBuffers);
+		ringTail = MAX(ringTail, batch.ringEnd);
+		vkResetFences(vulkanServer->device, 1, &batch.fence);
+		freeFences.push_back(batch.fence);
+		freeCommands.push_back(batch.command);
+		inFlight.pop_front();
+	}
+}
+
+void TransferBatcher::wait(uint64_t p_batchId) {
+	if (!p_batchId)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (hasPending && p_batchId == pendingId)
+		_flush();
+
+	for (auto it = inFlight.begin(); it != inFlight.end(); ++it) {
+		if (it->id == p_batchId) {
+			vkWaitForFences(vulkanServer->device, 1, &it->fence, VK_TRUE, WAIT_TIMEOUT_NANOSEC);
+			break;
+		}
+	}
+
+	_collect(false);
+}
+
+void TransferBatcher::waitAll() {
+	std::lock_guard<std::mutex> lock(mutex);
+	_flush();
+	_collect(true);
+}
+
+void TransferBatcher::_releaseStagingBuffers(std::vector<StagingBuffer> &r_buffers) {
+	for (size_t i = 0; i < r_buffers.size(); ++i) {
+		vulkanServer->destroyBuffer(r_buffers[i].allocator, r_buffers[i].buffer, r_buffers[i].allocation);
+	}
+	r_buffers.clear();
+}
+
+TransferBatcher::Stats TransferBatcher::getStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void TransferBatcher::printStats() {
+	const Stats s = getStats();
+	print_line("Transfers: " + itos(s.submissions) + " submissions, " + itos(s.barrierCalls) + " barrier calls, " +
+			   itos(s.transitions) + " transitions, " + itos(s.copies) + " copies, " + itos(s.blits) + " mip blits, " + itos(s.stagingBytes / 1024) + " KiB staged");
+	if (s.regionUpdates)
+		print_line("  " + itos(s.regionUpdates) + " region updates, " + itos(s.ringBytes / 1024) + " KiB in the staging ring, " +
+				   itos(s.ringFallbacks) + " ring fallbacks");
+}
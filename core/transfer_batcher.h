@@ -0,0 +1,196 @@
+#pragma once
+
+#include "hellovulkan.h"
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+
+class VulkanServer;
+
+// TRANSFER BATCHER
+//		Collects the layout transitions and the buffer to image copies of many
+// resources, and records them in a single command buffer:
+//
+//		pre copy barriers (one vkCmdPipelineBarrier per stage pair)
+//		copies
+//		mip chains (per level, one barrier and the blits of all the images)
+//		post copy barriers (one vkCmdPipelineBarrier per stage pair)
+//
+//		The batch is submitted by flush without waiting it, the fence is
+// checked by collect that releases the staging buffers of the completed
+// batches. The draw flushes the pending batch before its submission, so
+// the uploads are always executed before the frames that use them.
+//		All the functions are thread safe, the loading threads enqueue while
+// the render thread flushes.
+//		Each enqueue returns the id of the batch that contains it, wait(id)
+// blocks until that batch is executed (e.g. before destroying the image).
+//		The updates of the dynamic textures are small and frequent, so their
+// data goes in a persistently mapped staging ring instead of a buffer per
+// upload: the space of a batch is reused when the batch is completed, and
+// the ring falls back to a dedicated buffer when it's full.
+class TransferBatcher {
+public:
+	struct Stats {
+		uint64_t submissions;
+		uint64_t barrierCalls; // vkCmdPipelineBarrier
+		uint64_t transitions;
+		uint64_t copies;
+		uint64_t blits;
+		uint64_t stagingBytes;
+		uint64_t regionUpdates; // Copies of updateImage
+		uint64_t ringBytes;
+		uint64_t ringFallbacks; // Updates that didn't fit the ring
+
+		Stats() :
+				submissions(0),
+				barrierCalls(0),
+				transitions(0),
+				copies(0),
+				blits(0),
+				stagingBytes(0),
+				regionUpdates(0),
+				ringBytes(0),
+				ringFallbacks(0) {}
+	};
+
+	// Above this pending staging size the batch is flushed by the enqueue
+	static const VkDeviceSize MAX_PENDING_STAGING_SIZE;
+	// Of each level in the staging buffer, multiple of the texel blocks
+	static const VkDeviceSize STAGING_LEVEL_ALIGNMENT;
+	static const VkDeviceSize STAGING_RING_SIZE;
+
+	// The data of one mip level, not copied until the upload is enqueued
+	struct ImageLevel {
+		const void *data;
+		VkDeviceSize size;
+	};
+
+	// A rectangle of the level 0, the data points to its first texel
+	struct ImageRegion {
+		VkOffset2D offset;
+		VkExtent2D extent;
+		const void *data;
+		uint32_t rowPitch; // Bytes between the rows of the data
+	};
+
+private:
+	struct StagingBuffer {
+		VkBuffer buffer;
+		VmaAllocation allocation;
+		VmaAllocator allocator;
+	};
+
+	struct Copy {
+		VkBuffer buffer;
+		VkImage image;
+		VkBufferImageCopy region;
+	};
+
+	struct MipChain {
+		VkImage image;
+		VkImageAspectFlags aspect;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levels;
+	};
+
+	// Keyed by source and destination stages
+	typedef std::pair<VkPipelineStageFlags, VkPipelineStageFlags> StagePair;
+	typedef std::map<StagePair, std::vector<VkImageMemoryBarrier> > BarrierGroups;
+
+	struct Batch {
+		uint64_t id;
+		VkCommandBuffer command;
+		VkFence fence;
+		std::vector<StagingBuffer> stagingBuffers;
+		uint64_t ringEnd; // The ring head when submitted
+	};
+
+	VulkanServer *vulkanServer;
+	VkCommandPool commandPool;
+
+	std::mutex mutex;
+
+	// Pending batch
+	uint64_t pendingId;
+	bool hasPending;
+	BarrierGroups preCopyBarriers;
+	std::vector<Copy> copies;
+	std::vector<MipChain> mipChains;
+	BarrierGroups postCopyBarriers;
+	std::vector<StagingBuffer> pendingStagingBuffers;
+	VkDeviceSize pendingStagingSize;
+	// With a transition to transfer destination in the pending batch
+	std::set<VkImage> pendingImages;
+
+	// Created by the first updateImage. The head and the tail grow forever,
+	// the offset in the buffer is modulo the size
+	StagingBuffer ring;
+	uint8_t *ringData;
+	uint64_t ringHead;
+	uint64_t ringTail;
+
+	// Submitted batches, in submission order
+	std::deque<Batch> inFlight;
+
+	std::vector<VkCommandBuffer> freeCommands;
+	std::vector<VkFence> freeFences;
+
+	Stats stats;
+
+public:
+	TransferBatcher();
+
+	bool create(VulkanServer *p_vulkanServer);
+	// Waits all the batches
+	void destroy();
+
+	// Copy the data in a staging buffer and enqueue the transition to
+	// transfer destination, the copy and the transition to shader read.
+	// The data contains all the mip levels, tightly packed from the level 0.
+	// Returns 0 on failure
+	uint64_t uploadImage(VkImage p_image, VkFormat p_format, uint32_t p_width, uint32_t p_height, const void *p_data, VkDeviceSize p_size, uint32_t p_mipLevels = 1);
+
+	// Like uploadImage but each level has its own data, e.g. the blocks of a
+	// compressed format mapped from the file. The levels start from the level 0
+	uint64_t uploadImageLevels(VkImage p_image, VkFormat p_format, uint32_t p_width, uint32_t p_height, const std::vector<ImageLevel> &p_levels);
+
+	// Like uploadImage but the data contains only the level 0, the others are
+	// generated by a blit chain. The image must be usable as transfer source,
+	// and its format must support the linear blit
+	uint64_t uploadImageGenerateMips(VkImage p_image, VkFormat p_format, uint32_t p_width, uint32_t p_height, const void *p_data, VkDeviceSize p_size, uint32_t p_mipLevels);
+
+	// Copies the regions in the level 0 of an image already uploaded, in
+	// shader read layout; only uncompressed formats. The data is copied
+	// before the return
+	uint64_t updateImage(VkImage p_image, VkFormat p_format, const std::vector<ImageRegion> &p_regions);
+
+	// The stages and the accesses are derived from the layouts
+	uint64_t addTransition(VkImage p_image, VkFormat p_format, VkImageLayout p_oldLayout, VkImageLayout p_newLayout, uint32_t p_baseLevel = 0, uint32_t p_levelCount = 1);
+
+	// Submit the pending batch, without waiting it
+	bool flush();
+
+	// Release the resources of the completed batches
+	void collect();
+
+	void wait(uint64_t p_batchId);
+	void waitAll();
+
+	Stats getStats();
+	void printStats();
+
+private:
+	uint64_t _addTransition(VkImage p_image, VkFormat p_format, VkImageLayout p_oldLayout, VkImageLayout p_newLayout, uint32_t p_baseLevel = 0, uint32_t p_levelCount = 1);
+	static bool splitLevels(uint32_t p_width, uint32_t p_height, const void *p_data, VkDeviceSize p_size, uint32_t p_levelCount, std::vector<ImageLevel> &r_levels);
+	// Copies the levels, and blits the others up to p_mipLevels
+	uint64_t enqueueUpload(VkImage p_image, VkFormat p_format, uint32_t p_width, uint32_t p_height, const std::vector<ImageLevel> &p_levels, uint32_t p_mipLevels);
+	// Returns the offset in the ring buffer, false when the size doesn't fit
+	bool _allocateRing(VkDeviceSize p_size, VkDeviceSize &r_offset);
+	bool _flush();
+	void _collect(bool p_wait);
+	void _recordBarriers(VkCommandBuffer p_command, const BarrierGroups &p_groups);
+	void _recordMipChains(VkCommandBuffer p_command);
+	void _releaseStagingBuffers(std::vector<StagingBuffer> &r_buffers);
+};
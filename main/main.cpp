@@ -5,6 +5,7 @@
 #include "core/error_macros.h"
 #include "core/mesh.h"
 #include "core/print_string.h"
+#include "core/profiler.h"
 #include "core/texture.h"
 #include "libs/glm/gtc/random.hpp"
 #include "modules/glfw/glfw_window_server.h"
@@ -15,6 +16,14 @@
 #define TEXTURE_TEST 0
 #define LOAD_TEST 0
 
+// When enabled the rendering is executed in a dedicated thread
+#define THREADED_RENDER 0
+
+// When enabled the CPU zones are recorded and exported at exit in
+// chrome trace format (requires the build argument profiler=yes)
+#define CPU_PROFILER 0
+#define CPU_PROFILER_TRACE_PATH "cpu_trace.json"
+
 class Ticker {
 
 public:
@@ -37,28 +46,28 @@ private:
 Ticker ticker;
 OldVisualServer *vm;
 
-void cubeMaker(Mesh *mesh) {
-
-	mesh->vertices.push_back(Vertex({ { -1.0f, -1.0f, 1.0f }, { 0.0f, 1.0f } }));
-	mesh->vertices.push_back(Vertex({ { 1.0f, -1.0f, 1.0f }, { 1.0f, 0.0f } }));
-	mesh->vertices.push_back(Vertex({ { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f } }));
-	mesh->vertices.push_back(Vertex({ { -1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f } }));
-	mesh->vertices.push_back(Vertex({ { -1.0f, -1.0f, -1.0f }, { 0.0f, 1.0f } }));
-	mesh->vertices.push_back(Vertex({ { 1.0f, -1.0f, -1.0f }, { 1.0f, 1.0f } }));
-	mesh->vertices.push_back(Vertex({ { 1.0f, 1.0f, -1.0f }, { 1.0f, 0.0f } }));
-	mesh->vertices.push_back(Vertex({ { -1.0f, 1.0f, -1.0f }, { 0.0f, 0.0f } }));
-	mesh->triangles.push_back(Triangle({ 0, 1, 2 }));
-	mesh->triangles.push_back(Triangle({ 2, 3, 0 }));
-	mesh->triangles.push_back(Triangle({ 1, 5, 6 }));
-	mesh->triangles.push_back(Triangle({ 6, 2, 1 }));
-	mesh->triangles.push_back(Triangle({ 7, 6, 5 }));
-	mesh->triangles.push_back(Triangle({ 5, 4, 7 }));
-	mesh->triangles.push_back(Triangle({ 4, 0, 3 }));
-	mesh->triangles.push_back(Triangle({ 3, 7, 4 }));
-	mesh->triangles.push_back(Triangle({ 4, 5, 1 }));
-	mesh->triangles.push_back(Triangle({ 1, 0, 4 }));
-	mesh->triangles.push_back(Triangle({ 3, 2, 6 }));
-	mesh->triangles.push_back(Triangle({ 6, 7, 3 }));
+void cubeMaker(Geometry *geometry) {
+
+	geometry->vertices.push_back(Vertex({ { -1.0f, -1.0f, 1.0f }, { 0.0f, 1.0f } }));
+	geometry->vertices.push_back(Vertex({ { 1.0f, -1.0f, 1.0f }, { 1.0f, 0.0f } }));
+	geometry->vertices.push_back(Vertex({ { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f } }));
+	geometry->vertices.push_back(Vertex({ { -1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f } }));
+	geometry->vertices.push_back(Vertex({ { -1.0f, -1.0f, -1.0f }, { 0.0f, 1.0f } }));
+	geometry->vertices.push_back(Vertex({ { 1.0f, -1.0f, -1.0f }, { 1.0f, 1.0f } }));
+	geometry->vertices.push_back(Vertex({ { 1.0f, 1.0f, -1.0f }, { 1.0f, 0.0f } }));
+	geometry->vertices.push_back(Vertex({ { -1.0f, 1.0f, -1.0f }, { 0.0f, 0.0f } }));
+	geometry->triangles.push_back(Triangle({ 0, 1, 2 }));
+	geometry->triangles.push_back(Triangle({ 2, 3, 0 }));
+	geometry->triangles.push_back(Triangle({ 1, 5, 6 }));
+	geometry->triangles.push_back(Triangle({ 6, 2, 1 }));
+	geometry->triangles.push_back(Triangle({ 7, 6, 5 }));
+	geometry->triangles.push_back(Triangle({ 5, 4, 7 }));
+	geometry->triangles.push_back(Triangle({ 4, 0, 3 }));
+	geometry->triangles.push_back(Triangle({ 3, 7, 4 }));
+	geometry->triangles.push_back(Triangle({ 4, 5, 1 }));
+	geometry->triangles.push_back(Triangle({ 1, 0, 4 }));
+	geometry->triangles.push_back(Triangle({ 3, 2, 6 }));
+	geometry->triangles.push_back(Triangle({ 6, 7, 3 }));
 }
 
 glm::mat4 cameraBoom;
@@ -93,27 +102,31 @@ Texture *planeTexture;
 void ready() {
 
 	// Update camera view
-	vm->getVulkanServer()->getCamera().setNearFar(0.1, 100.);
+	vm->cameraSetNearFar(0.1, 100.);
 
 	cameraBoom = glm::mat4(1.);
 
-	Camera &cam = vm->getVulkanServer()->getCamera();
 	glm::mat4 camTransform(glm::translate(glm::mat4(1.), glm::vec3(0., 0., cameraBoomLenght)));
-	cam.setTransform(cameraBoom * camTransform);
+	vm->cameraSetTransform(cameraBoom * camTransform);
 
 #if TWO_CUBES_TEST
 
-	texture = new Texture(vm);
-	texture->load("/home/andrea/Workspace/git/HelloVulkan/assets/TestText.jpg");
+	texture = vm->getTextureCache().acquire("/home/andrea/Workspace/git/HelloVulkan/assets/TestText.jpg");
+
+	Geometry *cubeGeometry = new Geometry;
+	cubeMaker(cubeGeometry);
 
 	mesh_1 = new Mesh;
 	mesh_1->setTransform(glm::translate(glm::mat4(1.0), glm::vec3(5, 0, 0)));
-	cubeMaker(mesh_1);
+	mesh_1->setGeometry(cubeGeometry);
 
 	mesh_2 = new Mesh;
 	mesh_2->setTransform(glm::translate(glm::mat4(1.0), glm::vec3(-5, 0, 0)));
 	mesh_2->setColorTexture(texture);
-	cubeMaker(mesh_2);
+	mesh_2->setGeometry(cubeGeometry);
+
+	// Owned by the meshes
+	cubeGeometry->unreference();
 
 	vm->addMesh(mesh_1);
 	vm->addMesh(mesh_2);
@@ -122,48 +135,49 @@ void ready() {
 
 #if CLOUDY_CUBES_TEST
 
-	texture = new Texture(vm);
-	texture->load("/home/andrea/Workspace/git/HelloVulkan/assets/TestText.jpg");
+	texture = vm->getTextureCache().acquire("/home/andrea/Workspace/git/HelloVulkan/assets/TestText.jpg");
 
 	meshes.resize(50);
 	float ballRadius = 20.;
 
-	// Create cubes
+	// Create cubes, all instances of the same geometry
+	Geometry *cubeGeometry = new Geometry;
+	cubeMaker(cubeGeometry);
+
 	for (int i = meshes.size() - 1; 0 <= i; --i) {
 		meshes[i] = new Mesh;
 		meshes[i]->setColorTexture(texture);
-		cubeMaker(meshes[i]);
+		meshes[i]->setGeometry(cubeGeometry);
 		meshes[i]->setTransform(glm::translate(glm::mat4(1.), glm::ballRand(ballRadius)));
 		vm->addMesh(meshes[i]);
 	}
+	cubeGeometry->unreference();
 #endif
 
 #if TEXTURE_TEST
 
-	texture = new Texture(vm);
-	texture->load("/home/andrea/Workspace/git/HelloVulkan/assets/TestText.jpg");
+	texture = vm->getTextureCache().acquire("/home/andrea/Workspace/git/HelloVulkan/assets/TestText.jpg");
 
 	triangleMesh = new Mesh;
-	triangleMesh->vertices.push_back(Vertex({ { -1.0f, -1.0f, 1.0f }, { 0., 1. } }));
-	triangleMesh->vertices.push_back(Vertex({ { 1.0f, -1.0f, 1.0f }, { 1., 0. } }));
-	triangleMesh->vertices.push_back(Vertex({ { 1.0f, 1.0f, 1.0f }, { 1., 1. } }));
-	triangleMesh->triangles.push_back(Triangle({ 0, 1, 2 }));
+	Geometry *triangle = triangleMesh->getGeometry();
+	triangle->vertices.push_back(Vertex({ { -1.0f, -1.0f, 1.0f }, { 0., 1. } }));
+	triangle->vertices.push_back(Vertex({ { 1.0f, -1.0f, 1.0f }, { 1., 0. } }));
+	triangle->vertices.push_back(Vertex({ { 1.0f, 1.0f, 1.0f }, { 1., 1. } }));
+	triangle->triangles.push_back(Triangle({ 0, 1, 2 }));
 	triangleMesh->setColorTexture(texture);
 	vm->addMesh(triangleMesh);
 
 #endif
 
 #if LOAD_TEST
-	texture = new Texture(vm);
-	texture->load("/home/andrea/Workspace/git/HelloVulkan/assets/deagle/ESe_Material__106_color.png");
+	texture = vm->getTextureCache().acquire("/home/andrea/Workspace/git/HelloVulkan/assets/deagle/ESe_Material__106_color.png");
 
 	mesh = new Mesh;
 	mesh->loadObj("assets/deagle/ESe.obj");
 	mesh->setColorTexture(texture);
 	vm->addMesh(mesh);
 
-	planeTexture = new Texture(vm);
-	planeTexture->load("/home/andrea/Workspace/git/HelloVulkan/assets/default.png");
+	planeTexture = vm->getTextureCache().acquire("/home/andrea/Workspace/git/HelloVulkan/assets/default.png");
 
 	planeMesh = new Mesh;
 	planeMesh->loadObj("/home/andrea/Workspace/git/HelloVulkan/assets/quad.obj");
@@ -183,7 +197,7 @@ void exit() {
 	vm->removeMesh(mesh_2);
 	delete mesh_2;
 
-	delete texture;
+	vm->getTextureCache().release(texture);
 #endif
 
 #if CLOUDY_CUBES_TEST
@@ -191,6 +205,9 @@ void exit() {
 		vm->removeMesh(meshes[i]);
 		delete meshes[i];
 	}
+
+	vm->getTextureCache().release(texture);
+	texture = nullptr;
 #endif
 
 #if TEXTURE_TEST
@@ -198,7 +215,7 @@ void exit() {
 	delete triangleMesh;
 	triangleMesh;
 
-	delete texture;
+	vm->getTextureCache().release(texture);
 	texture = nullptr;
 #endif
 
@@ -208,13 +225,13 @@ void exit() {
 	delete mesh;
 	mesh = nullptr;
 
-	delete texture;
+	vm->getTextureCache().release(texture);
 	texture = nullptr;
 
 	delete planeMesh;
 	planeMesh = nullptr;
 
-	delete planeTexture;
+	vm->getTextureCache().release(planeTexture);
 	planeTexture = nullptr;
 #endif
 }
@@ -224,10 +241,9 @@ void tick(float deltaTime) {
 
 #if CLOUDY_CUBES_TEST
 
-	Camera &cam = vm->getVulkanServer()->getCamera();
 	glm::mat4 camTransform(glm::translate(glm::mat4(1.), glm::vec3(0., 0., cameraBoomLenght)));
 	cameraBoom = glm::rotate(cameraBoom, deltaTime * glm::radians(20.f), glm::vec3(0, 1, 0));
-	cam.setTransform(cameraBoom * camTransform);
+	vm->cameraSetTransform(cameraBoom * camTransform);
 
 	for (int i = meshes.size() - 1; 0 <= i; --i) {
 		meshes[i]->setTransform(glm::rotate(meshes[i]->getTransform(), deltaTime * glm::radians(90.0f), glm::vec3(1.0f, .0f, .0f)));
@@ -262,19 +278,30 @@ void Main::start() {
 	// OLD CODE
 
 	vm = new OldVisualServer();
-	CRASH_COND(!vm->init());
+	CRASH_COND(!vm->init(THREADED_RENDER));
+
+	Profiler::set_enabled(CPU_PROFILER);
+	Profiler::set_thread_name("Main thread");
 
 	ticker.init();
 
 	ready();
 	while (vm->can_step()) {
 		ticker.step();
-		tick(ticker.getDeltaTime());
+		{
+			PROFILE_ZONE("tick");
+			tick(ticker.getDeltaTime());
+		}
 		vm->step();
 	}
 
 	exit();
 
+	if (Profiler::is_enabled()) {
+		Profiler::set_enabled(false);
+		Profiler::export_chrome_trace(CPU_PROFILER_TRACE_PATH);
+	}
+
 	vm->terminate();
 	delete vm;
 	vm = NULL;
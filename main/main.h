@@ -1,6 +1,12 @@
 
 #pragma once
 
+class Geometry;
+
+/// Fill the geometry with a textured cube of size 2, used by the test scenes
+/// and by the benchmark
+void cubeMaker(Geometry *geometry);
+
 class Main {
 public:
 	void start();
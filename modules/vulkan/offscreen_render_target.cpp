@@ -0,0 +1,510 @@
+#include "offscreen_render_target.h"
+
+#include "core/error_macros.h"
+#include "core/print_string.h"
+#include "core/string.h"
+#include "vulkan_visual_server.h"
+#include <cstring>
+
+#define FENCE_TIMEOUT_NANOSEC 3.6e+12 // 1 hour
+
+OffscreenRenderTarget::OffscreenRenderTarget() :
+		RenderTarget(),
+		width(0),
+		height(0),
+		color_format(VK_FORMAT_R8G8B8A8_UNORM),
+		readback_enabled(false),
+		frames_submitted(0) {}
+
+bool OffscreenRenderTarget::init_offscreen(
+		uint32_t p_width,
+		uint32_t p_height,
+		uint32_t p_frames_in_flight,
+		bool p_readback) {
+
+	ERR_FAIL_COND_V(0 == p_width || 0 == p_height, false);
+	ERR_FAIL_COND_V(0 == p_frames_in_flight, false);
+
+	width = p_width;
+	height = p_height;
+	readback_enabled = p_readback;
+
+	// No window, so no swapchain
+	ERR_FAIL_COND_V(!init(RID()), false);
+
+	ERR_FAIL_COND_V(!create_render_pass(), false);
+
+	frames.resize(p_frames_in_flight);
+	for (size_t i = 0; i < frames.size(); ++i) {
+		ERR_FAIL_COND_V(!create_frame(frames[i]), false);
+	}
+
+	print_verbose("Offscreen render target created " + itos(width) + "x" + itos(height));
+	return true;
+}
+
+void OffscreenRenderTarget::terminate() {
+
+	if (logical_device != VK_NULL_HANDLE) {
+		wait_idle();
+
+		for (size_t i = 0; i < frames.size(); ++i) {
+			free_frame(frames[i]);
+		}
+		frames.clear();
+
+		free_render_pass();
+	}
+
+	RenderTarget::terminate();
+}
+
+uint64_t OffscreenRenderTarget::draw(const float p_clear_color[4]) {
+
+	ERR_FAIL_COND_V(frames.empty(), 0);
+
+	const uint64_t frame_number = frames_submitted + 1;
+	Frame &frame = frames[frames_submitted % frames.size()];
+
+	// Make sure the GPU has finished with the oldest frame, this is the only
+	// point where the CPU may wait
+	vkWaitForFences(logical_device, 1, &frame.fence, VK_TRUE, FENCE_TIMEOUT_NANOSEC);
+	vkResetFences(logical_device, 1, &frame.fence);
+
+	ERR_FAIL_COND_V(!record_frame(frame, p_clear_color), 0);
+
+	VkSubmitInfo submit_info = {};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &frame.command_buffer;
+
+	VkResult res = vkQueueSubmit(graphics_queue, 1, &submit_info, frame.fence);
+	ERR_FAIL_COND_V(VK_SUCCESS != res, 0);
+
+	frame.frame_number = frame_number;
+	frames_submitted = frame_number;
+
+	return frame_number;
+}
+
+bool OffscreenRenderTarget::fetch_readback(
+		uint64_t p_frame,
+		std::vector<uint8_t> &r_pixels) {
+
+	ERR_FAIL_COND_V(!readback_enabled, false);
+	ERR_FAIL_COND_V(0 == p_frame || p_frame > frames_submitted, false);
+
+	Frame &frame = frames[(p_frame - 1) % frames.size()];
+
+	ERR_EXPLAIN("The frame " + itos(p_frame) + " is overwritten by a newer one, fetch it before submit other frames.");
+	ERR_FAIL_COND_V(frame.frame_number != p_frame, false);
+
+	if (VK_SUCCESS != vkGetFenceStatus(logical_device, frame.fence))
+		return false;
+
+	const VkDeviceSize size = width * height * 4;
+
+	if (!frame.readback_coherent) {
+		VkMappedMemoryRange range = {};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = frame.readback_memory;
+		range.offset = 0;
+		range.size = VK_WHOLE_SIZE;
+		vkInvalidateMappedMemoryRanges(logical_device, 1, &range);
+	}
+
+	r_pixels.resize(size);
+	memcpy(r_pixels.data(), frame.readback_data, size);
+	return true;
+}
+
+void OffscreenRenderTarget::wait_idle() {
+	for (size_t i = 0; i < frames.size(); ++i) {
+		if (frames[i].fence != VK_NULL_HANDLE)
+			vkWaitForFences(logical_device, 1, &frames[i].fence, VK_TRUE, FENCE_TIMEOUT_NANOSEC);
+	}
+}
+
+bool OffscreenRenderTarget::create_render_pass() {
+
+	VkAttachmentDescription color_attachment = {};
+	color_attachment.format = color_format;
+	color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	// Ready to be copied in the readback buffer
+	color_attachment.finalLayout = readback_enabled
+										   ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+										   : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference color_attachment_ref = {};
+	color_attachment_ref.attachment = 0;
+	color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &color_attachment_ref;
+
+	// The copy to the readback buffer must wait the color writes
+	VkSubpassDependency dependency = {};
+	dependency.srcSubpass = 0;
+	dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	dependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	VkRenderPassCreateInfo render_pass_create_info = {};
+	render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	render_pass_create_info.attachmentCount = 1;
+	render_pass_create_info.pAttachments = &color_attachment;
+	render_pass_create_info.subpassCount = 1;
+	render_pass_create_info.pSubpasses = &subpass;
+	render_pass_create_info.dependencyCount = readback_enabled ? 1 : 0;
+	render_pass_create_info.pDependencies = &dependency;
+
+	VkResult res = vkCreateRenderPass(
+			logical_device,
+			&render_pass_create_info,
+			nullptr,
+			&render_pass);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	return true;
+}
+
+void OffscreenRenderTarget::free_render_pass() {
+	if (render_pass == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyRenderPass(logical_device, render_pass, nullptr);
+	render_pass = VK_NULL_HANDLE;
+}
+
+bool OffscreenRenderTarget::create_frame(Frame &r_frame) {
+
+	ERR_FAIL_COND_V(!create_image(r_frame), false);
+
+	VkFramebufferCreateInfo framebuffer_create_info = {};
+	framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebuffer_create_info.renderPass = render_pass;
+	framebuffer_create_info.attachmentCount = 1;
+	framebuffer_create_info.pAttachments = &r_frame.color_image_view;
+	framebuffer_create_info.width = width;
+	framebuffer_create_info.height = height;
+	framebuffer_create_info.layers = 1;
+
+	VkResult res = vkCreateFramebuffer(
+			logical_device,
+			&framebuffer_create_info,
+			nullptr,
+			&r_frame.framebuffer);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	VkCommandBufferAllocateInfo allocate_info = {};
+	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocate_info.commandPool = graphics_command_pool;
+	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocate_info.commandBufferCount = 1;
+
+	res = vkAllocateCommandBuffers(
+			logical_device,
+			&allocate_info,
+			&r_frame.command_buffer);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	// Signaled, so the first wait doesn't block
+	VkFenceCreateInfo fence_create_info = {};
+	fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	res = vkCreateFence(
+			logical_device,
+			&fence_create_info,
+			nullptr,
+			&r_frame.fence);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	if (readback_enabled) {
+		ERR_FAIL_COND_V(!create_readback_buffer(r_frame), false);
+	}
+
+	return true;
+}
+
+void OffscreenRenderTarget::free_frame(Frame &r_frame) {
+
+	if (r_frame.readback_memory != VK_NULL_HANDLE) {
+		vkUnmapMemory(logical_device, r_frame.readback_memory);
+		vkFreeMemory(logical_device, r_frame.readback_memory, nullptr);
+		r_frame.readback_memory = VK_NULL_HANDLE;
+		r_frame.readback_data = nullptr;
+	}
+
+	if (r_frame.readback_buffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(logical_device, r_frame.readback_buffer, nullptr);
+		r_frame.readback_buffer = VK_NULL_HANDLE;
+	}
+
+	if (r_frame.fence != VK_NULL_HANDLE) {
+		vkDestroyFence(logical_device, r_frame.fence, nullptr);
+		r_frame.fence = VK_NULL_HANDLE;
+	}
+
+	if (r_frame.command_buffer != VK_NULL_HANDLE) {
+		vkFreeCommandBuffers(logical_device, graphics_command_pool, 1, &r_frame.command_buffer);
+		r_frame.command_buffer = VK_NULL_HANDLE;
+	}
+
+	if (r_frame.framebuffer != VK_NULL_HANDLE) {
+		vkDestroyFramebuffer(logical_device, r_frame.framebuffer, nullptr);
+		r_frame.framebuffer = VK_NULL_HANDLE;
+	}
+
+	if (r_frame.color_image_view != VK_NULL_HANDLE) {
+		vkDestroyImageView(logical_device, r_frame.color_image_view, nullptr);
+		r_frame.color_image_view = VK_NULL_HANDLE;
+	}
+
+	if (r_frame.color_image != VK_NULL_HANDLE) {
+		vkDestroyImage(logical_device, r_frame.color_image, nullptr);
+		r_frame.color_image = VK_NULL_HANDLE;
+	}
+
+	if (r_frame.color_memory != VK_NULL_HANDLE) {
+		vkFreeMemory(logical_device, r_frame.color_memory, nullptr);
+		r_frame.color_memory = VK_NULL_HANDLE;
+	}
+}
+
+bool OffscreenRenderTarget::create_image(Frame &r_frame) {
+
+	VkImageCreateInfo image_create_info = {};
+	image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_create_info.imageType = VK_IMAGE_TYPE_2D;
+	image_create_info.format = color_format;
+	image_create_info.extent.width = width;
+	image_create_info.extent.height = height;
+	image_create_info.extent.depth = 1;
+	image_create_info.mipLevels = 1;
+	image_create_info.arrayLayers = 1;
+	image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_create_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VkResult res = vkCreateImage(
+			logical_device,
+			&image_create_info,
+			nullptr,
+			&r_frame.color_image);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(logical_device, r_frame.color_image, &requirements);
+
+	const int32_t memory_type = find_memory_type(
+			requirements.memoryTypeBits,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	ERR_FAIL_COND_V(memory_type < 0, false);
+
+	VkMemoryAllocateInfo allocate_info = {};
+	allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocate_info.allocationSize = requirements.size;
+	allocate_info.memoryTypeIndex = memory_type;
+
+	res = vkAllocateMemory(
+			logical_device,
+			&allocate_info,
+			nullptr,
+			&r_frame.color_memory);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	vkBindImageMemory(logical_device, r_frame.color_image, r_frame.color_memory, 0);
+
+	VkImageViewCreateInfo view_create_info = {};
+	view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_create_info.image = r_frame.color_image;
+	view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_create_info.format = color_format;
+	view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	view_create_info.subresourceRange.baseMipLevel = 0;
+	view_create_info.subresourceRange.levelCount = 1;
+	view_create_info.subresourceRange.baseArrayLayer = 0;
+	view_create_info.subresourceRange.layerCount = 1;
+
+	res = vkCreateImageView(
+			logical_device,
+			&view_create_info,
+			nullptr,
+			&r_frame.color_image_view);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	return true;
+}
+
+bool OffscreenRenderTarget::create_readback_buffer(Frame &r_frame) {
+
+	VkBufferCreateInfo buffer_create_info = {};
+	buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_create_info.size = width * height * 4;
+	buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkResult res = vkCreateBuffer(
+			logical_device,
+			&buffer_create_info,
+			nullptr,
+			&r_frame.readback_buffer);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(logical_device, r_frame.readback_buffer, &requirements);
+
+	// The CPU reads this memory, so cached is preferred
+	int32_t memory_type = find_memory_type(
+			requirements.memoryTypeBits,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+
+	if (memory_type < 0) {
+		memory_type = find_memory_type(
+				requirements.memoryTypeBits,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	}
+
+	ERR_FAIL_COND_V(memory_type < 0, false);
+
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	vkGetPhysicalDeviceMemoryProperties(
+			VulkanVisualServer::get_singleton()->get_physical_device(),
+			&memory_properties);
+
+	r_frame.readback_coherent =
+			memory_properties.memoryTypes[memory_type].propertyFlags &
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+	VkMemoryAllocateInfo allocate_info = {};
+	allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocate_info.allocationSize = requirements.size;
+	allocate_info.memoryTypeIndex = memory_type;
+
+	res = vkAllocateMemory(
+			logical_device,
+			&allocate_info,
+			nullptr,
+			&r_frame.readback_memory);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	vkBindBufferMemory(logical_device, r_frame.readback_buffer, r_frame.readback_memory, 0);
+
+	// Persistently mapped
+	res = vkMapMemory(
+			logical_device,
+			r_frame.readback_memory,
+			0,
+			VK_WHOLE_SIZE,
+			0,
+			&r_frame.readback_data);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	return true;
+}
+
+bool OffscreenRenderTarget::record_frame(
+		Frame &r_frame,
+		const float p_clear_color[4]) {
+
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	// The command pool is created with the reset bit, so the begin resets it
+	ERR_FAIL_COND_V(VK_SUCCESS != vkBeginCommandBuffer(r_frame.command_buffer, &begin_info), false);
+
+	VkClearValue clear_value = {};
+	clear_value.color.float32[0] = p_clear_color[0];
+	clear_value.color.float32[1] = p_clear_color[1];
+	clear_value.color.float32[2] = p_clear_color[2];
+	clear_value.color.float32[3] = p_clear_color[3];
+
+	VkRenderPassBeginInfo render_pass_begin_info = {};
+	render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	render_pass_begin_info.renderPass = render_pass;
+	render_pass_begin_info.framebuffer = r_frame.framebuffer;
+	render_pass_begin_info.renderArea.offset = { 0, 0 };
+	render_pass_begin_info.renderArea.extent = { width, height };
+	render_pass_begin_info.clearValueCount = 1;
+	render_pass_begin_info.pClearValues = &clear_value;
+
+	vkCmdBeginRenderPass(
+			r_frame.command_buffer,
+			&render_pass_begin_info,
+			VK_SUBPASS_CONTENTS_INLINE);
+
+	if (record_callback)
+		record_callback(r_frame.command_buffer, record_user_data);
+
+	vkCmdEndRenderPass(r_frame.command_buffer);
+
+	if (readback_enabled) {
+
+		// The image is already in TRANSFER_SRC layout thanks to the render pass
+		VkBufferImageCopy region = {};
+		region.bufferOffset = 0;
+		region.bufferRowLength = 0; // Tightly packed
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { width, height, 1 };
+
+		vkCmdCopyImageToBuffer(
+				r_frame.command_buffer,
+				r_frame.color_image,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				r_frame.readback_buffer,
+				1,
+				&region);
+
+		// Make the copy visible to the host once the fence is signaled
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = r_frame.readback_buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+
+		vkCmdPipelineBarrier(
+				r_frame.command_buffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_HOST_BIT,
+				0,
+				0,
+				nullptr,
+				1,
+				&barrier,
+				0,
+				nullptr);
+	}
+
+	ERR_FAIL_COND_V(VK_SUCCESS != vkEndCommandBuffer(r_frame.command_buffer), false);
+	return true;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "render_target.h"
+
+#include <cstdint>
+
+// Offscreen render target
+//
+//		Renders into plain VkImages, so it doesn't need a window, a surface nor
+//		a swapchain. It's used to run the renderer on headless machines, also
+//		with a software ICD (lavapipe, SwiftShader).
+//
+//		Each frame in flight has its own color image, command buffer and
+//		fence. When the readback is enabled, the color image is copied into a
+//		host visible buffer by the same command buffer, so the readback never
+//		stalls the submission: the pixels can be fetched once the fence of that
+//		frame is signaled.
+//
+//		frame N:   | record | submit | .... GPU .... | fence |
+//		                                                     |-> fetch_readback(N)
+//
+class OffscreenRenderTarget : public RenderTarget {
+
+private:
+	struct Frame {
+		VkImage color_image;
+		VkDeviceMemory color_memory;
+		VkImageView color_image_view;
+		VkFramebuffer framebuffer;
+
+		VkCommandBuffer command_buffer;
+		VkFence fence;
+
+		VkBuffer readback_buffer;
+		VkDeviceMemory readback_memory;
+		bool readback_coherent;
+		void *readback_data;
+
+		// 0 means never submitted
+		uint64_t frame_number;
+
+		Frame() :
+				color_image(VK_NULL_HANDLE),
+				color_memory(VK_NULL_HANDLE),
+				color_image_view(VK_NULL_HANDLE),
+				framebuffer(VK_NULL_HANDLE),
+				command_buffer(VK_NULL_HANDLE),
+				fence(VK_NULL_HANDLE),
+				readback_buffer(VK_NULL_HANDLE),
+				readback_memory(VK_NULL_HANDLE),
+				readback_coherent(true),
+				readback_data(nullptr),
+				frame_number(0) {}
+	};
+
+	uint32_t width;
+	uint32_t height;
+	VkFormat color_format;
+	bool readback_enabled;
+
+	std::vector<Frame> frames;
+	uint64_t frames_submitted;
+
+public:
+	OffscreenRenderTarget();
+
+	bool init_offscreen(
+			uint32_t p_width,
+			uint32_t p_height,
+			uint32_t p_frames_in_flight,
+			bool p_readback);
+
+	virtual void terminate();
+
+	/// Record and submit a frame, waits only if the oldest frame in flight is
+	/// still executed by the GPU.
+	/// Returns the frame number, used to fetch the readback, or 0 on failure
+	uint64_t draw(const float p_clear_color[4]);
+
+	/// Non blocking, returns false if the frame is not yet finished.
+	/// The pixels are tightly packed RGBA8 rows
+	bool fetch_readback(uint64_t p_frame, std::vector<uint8_t> &r_pixels);
+
+	/// Waits all the frames in flight
+	void wait_idle();
+
+	uint32_t get_width() const { return width; }
+	uint32_t get_height() const { return height; }
+	VkFormat get_color_format() const { return color_format; }
+	uint64_t get_frames_submitted() const { return frames_submitted; }
+
+private:
+	bool create_render_pass();
+	void free_render_pass();
+
+	bool create_frame(Frame &r_frame);
+	void free_frame(Frame &r_frame);
+
+	bool create_image(Frame &r_frame);
+	bool create_readback_buffer(Frame &r_frame);
+
+	bool record_frame(Frame &r_frame, const float p_clear_color[4]);
+};
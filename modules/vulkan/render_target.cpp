@@ -1,133 +1,466 @@
 #include "render_target.h"
 
+#include "servers/window_server.h"
 #include "vulkan_visual_server.h"
 
-RenderTarget::RenderTarget() :
-		ResourceData() {}
+#define ACQUIRE_TIMEOUT_NANOSEC 1e+8 // 100 ms
 
-void RenderTarget::init(RID p_window) {
+RenderTarget::RenderTarget() :
+		ResourceData(),
+		logical_device(VK_NULL_HANDLE),
+		graphics_queue(VK_NULL_HANDLE),
+		graphics_command_pool(VK_NULL_HANDLE),
+		render_pass(VK_NULL_HANDLE),
+		record_callback(nullptr),
+		record_user_data(nullptr),
+		clear_color{ 0, 0, 0, 1 },
+		surface(VK_NULL_HANDLE),
+		swapchain(VK_NULL_HANDLE),
+		swapchain_format(VK_FORMAT_UNDEFINED),
+		swapchain_extent({ 0, 0 }),
+		acquired_image(0),
+		swapchain_out_of_date(false) {}
+
+bool RenderTarget::init(RID p_window) {
 	window = p_window;
 
-	create_logical_device();
-	lockup_queues();
+	VulkanVisualServer *vs = VulkanVisualServer::get_singleton();
+	logical_device = vs->get_logical_device();
+	graphics_queue = vs->get_graphics_queue();
+	graphics_command_pool = vs->get_graphics_command_pool();
+
+	ERR_FAIL_COND_V(logical_device == VK_NULL_HANDLE, false);
+
+	if (!window.get_data()) {
+		// Offscreen, nothing is presented
+		return true;
+	}
+
+	surface = WindowServer::get_singleton()->window_get_vulkan_surface(window);
+	ERR_FAIL_COND_V(surface == VK_NULL_HANDLE, false);
+
+	ERR_FAIL_COND_V(!create_swapchain(VK_NULL_HANDLE), false);
+	ERR_FAIL_COND_V(!create_sync_objects(), false);
+
+	return true;
+}
+
+void RenderTarget::terminate() {
+
+	if (logical_device == VK_NULL_HANDLE)
+		return;
+
+	if (swapchain != VK_NULL_HANDLE) {
+		// The device is shared, but the swapchain may be still in use by
+		// the frames in flight
+		vkDeviceWaitIdle(logical_device);
+
+		free_swapchain_resources();
+		vkDestroySwapchainKHR(logical_device, swapchain, nullptr);
+		swapchain = VK_NULL_HANDLE;
+	}
+
+	free_sync_objects();
+
+	if (render_pass != VK_NULL_HANDLE) {
+		vkDestroyRenderPass(logical_device, render_pass, nullptr);
+		render_pass = VK_NULL_HANDLE;
+	}
+
+	// The surface is owned by the window
+	surface = VK_NULL_HANDLE;
+
+	// Owned by the VulkanVisualServer
+	logical_device = VK_NULL_HANDLE;
+	graphics_queue = VK_NULL_HANDLE;
+	graphics_command_pool = VK_NULL_HANDLE;
 }
 
 RID RenderTarget::get_window() {
 	return window;
 }
 
-void RenderTarget::create_logical_device() {
+void RenderTarget::set_record_callback(
+		RecordCallback p_callback,
+		void *p_user_data) {
+
+	record_callback = p_callback;
+	record_user_data = p_user_data;
+}
+
+void RenderTarget::set_clear_color(const float p_color[4]) {
+	for (int i = 0; i < 4; ++i) {
+		clear_color[i] = p_color[i];
+	}
+}
 
-	const VulkanVisualServer::QueueFamilyIndices &queue_families =
-			VulkanVisualServer::get_singleton()->get_queue_families();
+bool RenderTarget::acquire(uint32_t p_frame_index, VkSemaphore *r_image_available) {
 
-	std::vector<VkDeviceQueueCreateInfo> queueCreateInfoArray;
+	ERR_FAIL_COND_V(swapchain == VK_NULL_HANDLE && !swapchain_out_of_date, false);
 
-	float priority = 1.f;
+	if (swapchain_out_of_date) {
+		if (!recreate_swapchain())
+			return false;
+	}
 
-	// Information to create graphycs queue
+	VkResult res = vkAcquireNextImageKHR(
+			logical_device,
+			swapchain,
+			ACQUIRE_TIMEOUT_NANOSEC,
+			image_available_semaphores[p_frame_index],
+			VK_NULL_HANDLE,
+			&acquired_image);
+
+	if (VK_ERROR_OUT_OF_DATE_KHR == res) {
+		swapchain_out_of_date = true;
+		return false;
+	}
 
-	VkDeviceQueueCreateInfo graphicsQueueCreateInfo = {};
-	graphicsQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	graphicsQueueCreateInfo.queueFamilyIndex = queue_families.graphics_family_index;
-	graphicsQueueCreateInfo.queueCount = 1;
-	graphicsQueueCreateInfo.pQueuePriorities = &priority;
+	if (VK_TIMEOUT == res || VK_NOT_READY == res) {
+		// Skipped this frame, the other windows are not stalled
+		return false;
+	}
 
-	queueCreateInfoArray.push_back(graphicsQueueCreateInfo);
+	ERR_FAIL_COND_V(VK_SUCCESS != res && VK_SUBOPTIMAL_KHR != res, false);
 
-	if (queue_families.graphics_family_index != queue_families.presentation_family_index) {
+	// The suboptimal image is presented, and the swapchain recreated later
+	if (VK_SUBOPTIMAL_KHR == res)
+		swapchain_out_of_date = true;
 
-		// Create dedicated presentation queue in case the graphycs queue doesn't
-		// support presentation
+	*r_image_available = image_available_semaphores[p_frame_index];
+	return true;
+}
 
-		VkDeviceQueueCreateInfo presentationQueueCreateInfo = {};
-		presentationQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		presentationQueueCreateInfo.queueFamilyIndex = queue_families.presentation_family_index;
-		presentationQueueCreateInfo.queueCount = 1;
-		presentationQueueCreateInfo.pQueuePriorities = &priority;
+void RenderTarget::record(VkCommandBuffer p_command_buffer) {
 
-		queueCreateInfoArray.push_back(presentationQueueCreateInfo);
+	VkClearValue clear_value = {};
+	for (int i = 0; i < 4; ++i) {
+		clear_value.color.float32[i] = clear_color[i];
 	}
 
-	// Request physica device feature.
-	VkPhysicalDeviceFeatures physicalDeviceFeatures = {};
-	physicalDeviceFeatures.samplerAnisotropy = VK_TRUE;
+	VkRenderPassBeginInfo render_pass_begin_info = {};
+	render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	render_pass_begin_info.renderPass = render_pass;
+	render_pass_begin_info.framebuffer = framebuffers[acquired_image];
+	render_pass_begin_info.renderArea.offset = { 0, 0 };
+	render_pass_begin_info.renderArea.extent = swapchain_extent;
+	render_pass_begin_info.clearValueCount = 1;
+	render_pass_begin_info.pClearValues = &clear_value;
+
+	vkCmdBeginRenderPass(
+			p_command_buffer,
+			&render_pass_begin_info,
+			VK_SUBPASS_CONTENTS_INLINE);
+
+	if (record_callback)
+		record_callback(p_command_buffer, record_user_data);
+
+	vkCmdEndRenderPass(p_command_buffer);
+}
+
+void RenderTarget::notify_present_result(VkResult p_result) {
+	if (VK_ERROR_OUT_OF_DATE_KHR == p_result || VK_SUBOPTIMAL_KHR == p_result)
+		swapchain_out_of_date = true;
+}
+
+int32_t RenderTarget::find_memory_type(
+		uint32_t p_type_bits,
+		VkMemoryPropertyFlags p_properties) const {
 
-	// Information to create logical device
-	VkDeviceCreateInfo ldevice_create_infos = {};
-	ldevice_create_infos.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	ldevice_create_infos.queueCreateInfoCount = queueCreateInfoArray.size();
-	ldevice_create_infos.pQueueCreateInfos = queueCreateInfoArray.data();
-	ldevice_create_infos.pEnabledFeatures = &physicalDeviceFeatures;
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	vkGetPhysicalDeviceMemoryProperties(
+			VulkanVisualServer::get_singleton()->get_physical_device(),
+			&memory_properties);
+
+	for (uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i) {
+		if (!(p_type_bits & (1 << i)))
+			continue;
+
+		if ((memory_properties.memoryTypes[i].propertyFlags & p_properties) == p_properties)
+			return i;
+	}
+
+	return -1;
+}
 
-	ldevice_create_infos.enabledExtensionCount =
-			VulkanVisualServer::get_singleton()->get_device_extensions().size();
+bool RenderTarget::create_swapchain(VkSwapchainKHR p_old_swapchain) {
 
-	ldevice_create_infos.ppEnabledExtensionNames =
-			VulkanVisualServer::get_singleton()->get_device_extensions().data();
+	VulkanVisualServer *vs = VulkanVisualServer::get_singleton();
 
-	if (VulkanVisualServer::get_singleton()->is_validation_layer_enabled()) {
+	VulkanVisualServer::PhysicalDeviceSwapChainDetails details;
+	VulkanVisualServer::get_physical_device_swap_chain_details(
+			vs->get_physical_device(),
+			surface,
+			&details);
 
-		ldevice_create_infos.enabledLayerCount =
-				VulkanVisualServer::get_singleton()->get_layers().size();
+	ERR_FAIL_COND_V(details.formats.empty(), false);
 
-		ldevice_create_infos.ppEnabledLayerNames =
-				VulkanVisualServer::get_singleton()->get_layers().data();
+	// Format
+	VkSurfaceFormatKHR surface_format = details.formats[0];
+	if (details.formats.size() == 1 && details.formats[0].format == VK_FORMAT_UNDEFINED) {
+		// The surface has no preferred format
+		surface_format = { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
 	} else {
-		ldevice_create_infos.enabledLayerCount = 0;
+		for (size_t i = 0; i < details.formats.size(); ++i) {
+			if (details.formats[i].format == VK_FORMAT_B8G8R8A8_UNORM &&
+					details.formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+				surface_format = details.formats[i];
+				break;
+			}
+		}
 	}
 
-	VkResult res = vkCreateDevice(
-			VulkanVisualServer::get_singleton()->get_physical_device(),
-			&ldevice_create_infos,
-			nullptr,
-			&logical_device);
+	// Extent
+	const VkSurfaceCapabilitiesKHR &capabilities = details.capabilities;
+	VkExtent2D extent = capabilities.currentExtent;
+	if (extent.width == UINT32_MAX) {
+		int width;
+		int height;
+		WindowServer::get_singleton()->get_window_size(window, &width, &height);
+		extent.width = CLAMP(uint32_t(width), capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+		extent.height = CLAMP(uint32_t(height), capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
+	}
 
-	ERR_FAIL_COND(res != VK_SUCCESS);
-}
+	if (0 == extent.width || 0 == extent.height) {
+		// Minimized, retried at the next frame
+		swapchain_out_of_date = true;
+		return true;
+	}
 
-void RenderTarget::lockup_queues() {
+	uint32_t image_count = capabilities.minImageCount + 1;
+	if (capabilities.maxImageCount > 0)
+		image_count = MIN(image_count, capabilities.maxImageCount);
+
+	const VulkanVisualServer::QueueFamilyIndices &queue_families = vs->get_queue_families();
+	uint32_t family_indices[] = {
+		(uint32_t)queue_families.graphics_family_index,
+		(uint32_t)queue_families.presentation_family_index
+	};
+
+	VkSwapchainCreateInfoKHR create_info = {};
+	create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	create_info.surface = surface;
+	create_info.minImageCount = image_count;
+	create_info.imageFormat = surface_format.format;
+	create_info.imageColorSpace = surface_format.colorSpace;
+	create_info.imageExtent = extent;
+	create_info.imageArrayLayers = 1;
+	create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+	if (family_indices[0] != family_indices[1]) {
+		create_info.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+		create_info.queueFamilyIndexCount = 2;
+		create_info.pQueueFamilyIndices = family_indices;
+	} else {
+		create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	}
 
-	const VulkanVisualServer::QueueFamilyIndices &queue_families =
-			VulkanVisualServer::get_singleton()->get_queue_families();
+	create_info.preTransform = capabilities.currentTransform;
+	create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	// Always supported
+	create_info.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+	create_info.clipped = VK_TRUE;
+	create_info.oldSwapchain = p_old_swapchain;
 
-	vkGetDeviceQueue(
+	VkResult res = vkCreateSwapchainKHR(
 			logical_device,
-			queue_families.graphics_family_index,
-			0,
-			&graphics_queue);
+			&create_info,
+			nullptr,
+			&swapchain);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+	swapchain_extent = extent;
+
+	// The render pass depends only on the format
+	if (render_pass == VK_NULL_HANDLE || swapchain_format != surface_format.format) {
+		if (render_pass != VK_NULL_HANDLE) {
+			vkDestroyRenderPass(logical_device, render_pass, nullptr);
+			render_pass = VK_NULL_HANDLE;
+		}
+		swapchain_format = surface_format.format;
+		ERR_FAIL_COND_V(!create_swapchain_render_pass(), false);
+	}
+
+	uint32_t count = 0;
+	vkGetSwapchainImagesKHR(logical_device, swapchain, &count, nullptr);
+	swapchain_images.resize(count);
+	vkGetSwapchainImagesKHR(logical_device, swapchain, &count, swapchain_images.data());
+
+	swapchain_image_views.resize(count, VK_NULL_HANDLE);
+	framebuffers.resize(count, VK_NULL_HANDLE);
 
-	if (queue_families.graphics_family_index !=
-			queue_families.presentation_family_index) {
+	for (uint32_t i = 0; i < count; ++i) {
 
-		// Lockup dedicated presentation queue
-		vkGetDeviceQueue(
+		VkImageViewCreateInfo view_create_info = {};
+		view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		view_create_info.image = swapchain_images[i];
+		view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		view_create_info.format = swapchain_format;
+		view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		view_create_info.subresourceRange.levelCount = 1;
+		view_create_info.subresourceRange.layerCount = 1;
+
+		res = vkCreateImageView(
 				logical_device,
-				queue_families.presentation_family_index,
-				0,
-				&presentation_queue);
-	} else {
-		presentation_queue = graphics_queue;
+				&view_create_info,
+				nullptr,
+				&swapchain_image_views[i]);
+
+		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+		VkFramebufferCreateInfo framebuffer_create_info = {};
+		framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebuffer_create_info.renderPass = render_pass;
+		framebuffer_create_info.attachmentCount = 1;
+		framebuffer_create_info.pAttachments = &swapchain_image_views[i];
+		framebuffer_create_info.width = extent.width;
+		framebuffer_create_info.height = extent.height;
+		framebuffer_create_info.layers = 1;
+
+		res = vkCreateFramebuffer(
+				logical_device,
+				&framebuffer_create_info,
+				nullptr,
+				&framebuffers[i]);
+
+		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
 	}
 
-	WARN_PRINT("Make sure to use a dedicated queue for presentation.");
+	swapchain_out_of_date = false;
+	return true;
 }
 
-void RenderTarget::create_command_pool() {
+void RenderTarget::free_swapchain_resources() {
+
+	for (size_t i = 0; i < framebuffers.size(); ++i) {
+		if (framebuffers[i] != VK_NULL_HANDLE)
+			vkDestroyFramebuffer(logical_device, framebuffers[i], nullptr);
+	}
+	framebuffers.clear();
 
-	const VulkanVisualServer::QueueFamilyIndices &queue_families =
-			VulkanVisualServer::get_singleton()->get_queue_families();
+	for (size_t i = 0; i < swapchain_image_views.size(); ++i) {
+		if (swapchain_image_views[i] != VK_NULL_HANDLE)
+			vkDestroyImageView(logical_device, swapchain_image_views[i], nullptr);
+	}
+	swapchain_image_views.clear();
 
-	VkCommandPoolCreateInfo command_pool_create_info = {};
-	command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	command_pool_create_info.queueFamilyIndex = queue_families.graphics_family_index;
-	command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	// Owned by the swapchain
+	swapchain_images.clear();
+}
 
-	VkResult res = vkCreateCommandPool(
-			VulkanVisualServer::get_singleton()->get_physical_device(),
-			&command_pool_create_info,
+bool RenderTarget::recreate_swapchain() {
+
+	// The old swapchain resources may be used by the frames in flight
+	vkDeviceWaitIdle(logical_device);
+
+	free_swapchain_resources();
+
+	VkSwapchainKHR old_swapchain = swapchain;
+	swapchain = VK_NULL_HANDLE;
+
+	const bool created = create_swapchain(old_swapchain);
+
+	if (old_swapchain != VK_NULL_HANDLE)
+		vkDestroySwapchainKHR(logical_device, old_swapchain, nullptr);
+
+	ERR_FAIL_COND_V(!created, false);
+
+	// Still minimized
+	return swapchain != VK_NULL_HANDLE;
+}
+
+bool RenderTarget::create_swapchain_render_pass() {
+
+	VkAttachmentDescription color_attachment = {};
+	color_attachment.format = swapchain_format;
+	color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	VkAttachmentReference color_attachment_ref = {};
+	color_attachment_ref.attachment = 0;
+	color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &color_attachment_ref;
+
+	// The image available semaphore is waited at the color output stage,
+	// so the layout transition must wait it too
+	VkSubpassDependency dependency = {};
+	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependency.dstSubpass = 0;
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependency.srcAccessMask = 0;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	VkRenderPassCreateInfo render_pass_create_info = {};
+	render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	render_pass_create_info.attachmentCount = 1;
+	render_pass_create_info.pAttachments = &color_attachment;
+	render_pass_create_info.subpassCount = 1;
+	render_pass_create_info.pSubpasses = &subpass;
+	render_pass_create_info.dependencyCount = 1;
+	render_pass_create_info.pDependencies = &dependency;
+
+	VkResult res = vkCreateRenderPass(
+			logical_device,
+			&render_pass_create_info,
 			nullptr,
-			&graphics_command_pool);
+			&render_pass);
 
 	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	return true;
+}
+
+bool RenderTarget::create_sync_objects() {
+
+	VkSemaphoreCreateInfo semaphore_create_info = {};
+	semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	image_available_semaphores.resize(VulkanVisualServer::FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+	render_finished_semaphores.resize(VulkanVisualServer::FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+
+	for (uint32_t i = 0; i < VulkanVisualServer::FRAMES_IN_FLIGHT; ++i) {
+
+		VkResult res = vkCreateSemaphore(
+				logical_device,
+				&semaphore_create_info,
+				nullptr,
+				&image_available_semaphores[i]);
+
+		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+
+		res = vkCreateSemaphore(
+				logical_device,
+				&semaphore_create_info,
+				nullptr,
+				&render_finished_semaphores[i]);
+
+		ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	}
+
+	return true;
+}
+
+void RenderTarget::free_sync_objects() {
+
+	for (size_t i = 0; i < image_available_semaphores.size(); ++i) {
+		if (image_available_semaphores[i] != VK_NULL_HANDLE)
+			vkDestroySemaphore(logical_device, image_available_semaphores[i], nullptr);
+	}
+	image_available_semaphores.clear();
+
+	for (size_t i = 0; i < render_finished_semaphores.size(); ++i) {
+		if (render_finished_semaphores[i] != VK_NULL_HANDLE)
+			vkDestroySemaphore(logical_device, render_finished_semaphores[i], nullptr);
+	}
+	render_finished_semaphores.clear();
 }
@@ -4,26 +4,108 @@
 #include "thirdparty/vulkan/vulkan.h"
 #include <vector>
 
+// Render target
+//
+//		The logical device, the queues and the command pool are owned by the
+//		VulkanVisualServer and shared by all the render targets, so the
+//		resources can be used by any window.
+//		The render target owns only the state that depends on its surface:
+//		swapchain, image views, render pass and framebuffers.
+//
+//		The window render targets are drawn by VulkanVisualServer::draw, that
+//		records all of them in one command buffer, submits once and presents
+//		all the swapchains with one present.
+//
 class RenderTarget : public ResourceData {
 
+public:
+	/// Called inside the render pass of the frame, used to record the draw
+	/// commands
+	typedef void (*RecordCallback)(
+			VkCommandBuffer p_command_buffer,
+			void *p_user_data);
+
+protected:
 	RID window;
 
+	// Owned by the VulkanVisualServer
 	VkDevice logical_device;
 	VkQueue graphics_queue;
-	VkQueue presentation_queue;
-
 	VkCommandPool graphics_command_pool;
 
+	VkRenderPass render_pass;
+
+	RecordCallback record_callback;
+	void *record_user_data;
+	float clear_color[4];
+
+	/** WINDOW STATE */
+
+	VkSurfaceKHR surface;
+	VkSwapchainKHR swapchain;
+	VkFormat swapchain_format;
+	VkExtent2D swapchain_extent;
+	std::vector<VkImage> swapchain_images;
+	std::vector<VkImageView> swapchain_image_views;
+	std::vector<VkFramebuffer> framebuffers;
+
+	// One per frame in flight
+	std::vector<VkSemaphore> image_available_semaphores;
+	std::vector<VkSemaphore> render_finished_semaphores;
+
+	// Index of the image acquired this frame
+	uint32_t acquired_image;
+	bool swapchain_out_of_date;
+
 public:
 	RenderTarget();
 
-	void init(RID p_window);
+	/// The window is optional, without it no swapchain is created
+	/// (offscreen rendering)
+	bool init(RID p_window);
+	virtual void terminate();
 
 	RID get_window();
 
+	void set_record_callback(RecordCallback p_callback, void *p_user_data);
+	void set_clear_color(const float p_color[4]);
+
+	VkRenderPass get_render_pass() const { return render_pass; }
+
+	/** FRAME SUBMISSION, used by the VulkanVisualServer */
+
+	/// Acquire the next swapchain image, the returned semaphore must be
+	/// waited by the submission.
+	/// Returns false when the render target is skipped this frame
+	bool acquire(uint32_t p_frame_index, VkSemaphore *r_image_available);
+
+	/// Record the render pass of the acquired image
+	void record(VkCommandBuffer p_command_buffer);
+
+	VkSemaphore get_render_finished_semaphore(uint32_t p_frame_index) const {
+		return render_finished_semaphores[p_frame_index];
+	}
+
+	VkSwapchainKHR get_swapchain() const { return swapchain; }
+	uint32_t get_acquired_image() const { return acquired_image; }
+
+	/// The swapchain is recreated at the next acquire when out of date
+	void notify_present_result(VkResult p_result);
+
+protected:
+	/// Returns -1 when no memory type is suitable
+	int32_t find_memory_type(
+			uint32_t p_type_bits,
+			VkMemoryPropertyFlags p_properties) const;
+
 private:
-	void create_logical_device();
-	void lockup_queues();
+	bool create_swapchain(VkSwapchainKHR p_old_swapchain);
+	void free_swapchain_resources();
+
+	bool recreate_swapchain();
+
+	bool create_swapchain_render_pass();
 
-	void create_command_pool();
+	bool create_sync_objects();
+	void free_sync_objects();
 };
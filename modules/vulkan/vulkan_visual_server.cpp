@@ -4,6 +4,9 @@
 #include "core/print_string.h"
 #include "core/string.h"
 #include "servers/window_server.h"
+#include <cstring>
+
+#define FENCE_TIMEOUT_NANOSEC 3.6e+12 // 1 hour
 
 VulkanVisualServer *VulkanVisualServer::singleton = nullptr;
 
@@ -21,10 +24,25 @@ VKAPI_ATTR VkBool32 VKAPI_CALL debugCallbackFnc(
 	return VK_FALSE;
 }
 
-VulkanVisualServer::VulkanVisualServer() :
-		VisualServer() {
+VulkanVisualServer::VulkanVisualServer(bool p_headless) :
+		VisualServer(),
+		headless(p_headless),
+		vulkan_instance(VK_NULL_HANDLE),
+		debug_callback_handle(VK_NULL_HANDLE),
+		physical_device(VK_NULL_HANDLE),
+		logical_device(VK_NULL_HANDLE),
+		graphics_queue(VK_NULL_HANDLE),
+		presentation_queue(VK_NULL_HANDLE),
+		graphics_command_pool(VK_NULL_HANDLE),
+		allocator(VK_NULL_HANDLE),
+		frame_count(0),
+		upload_command_buffer(VK_NULL_HANDLE),
+		upload_fence(VK_NULL_HANDLE) {
 
 	singleton = this;
+
+	if (!headless)
+		device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 	// TODO Please initialize all parameters here
 }
 
@@ -33,6 +51,25 @@ void VulkanVisualServer::init() {
 	CRASH_COND(!create_vulkan_instance());
 	CRASH_COND(!initialize_debug_callback());
 
+	if (headless) {
+		// No surface, the device is selected only for rendering
+		CRASH_COND(!select_physical_device(VK_NULL_HANDLE));
+		queue_families = filter_queue_families(
+				physical_device,
+				VK_NULL_HANDLE);
+	} else {
+		init_with_window();
+	}
+
+	CRASH_COND(!create_logical_device());
+	lockup_queues();
+	CRASH_COND(!create_command_pool());
+	CRASH_COND(!create_allocator());
+	CRASH_COND(!create_frames());
+}
+
+void VulkanVisualServer::init_with_window() {
+
 	// Create a surface just to get some information
 	RID initialization_window = WindowServer::get_singleton()->window_create(
 			"InitializationWindow",
@@ -57,21 +94,66 @@ void VulkanVisualServer::init() {
 }
 
 void VulkanVisualServer::terminate() {
+
+	if (logical_device != VK_NULL_HANDLE)
+		vkDeviceWaitIdle(logical_device);
+
+	// The render targets not destroyed by the user, they use the allocator
+	// and the device
+	while (render_targets.size()) {
+		destroy_render_target(render_targets.back());
+	}
+
+	free_frames();
+	free_allocator();
+	free_command_pool();
+	free_logical_device();
 	free_debug_callback();
 	free_vulkan_instance();
 }
 
 RID VulkanVisualServer::create_render_target(RID p_window) {
 
+	ERR_EXPLAIN("The headless visual server can only create offscreen render targets");
+	ERR_FAIL_COND_V(headless, RID());
+
 	RenderTarget *rt = new RenderTarget();
 
 	WindowServer::get_singleton()->window_set_vulkan_instance(
 			p_window,
 			vulkan_instance);
 
-	rt->init(p_window);
+	if (!rt->init(p_window)) {
+		rt->terminate();
+		delete rt;
+		ERR_FAIL_V(RID());
+	}
+
+	window_render_targets.push_back(rt);
+
+	const RID rid = render_target_owner.make_rid(rt);
+	render_targets.push_back(rid);
+	return rid;
+}
+
+RID VulkanVisualServer::create_offscreen_render_target(
+		int p_width,
+		int p_height,
+		bool p_readback) {
+
+	OffscreenRenderTarget *rt = new OffscreenRenderTarget();
+
+	// Two frames in flight, so the CPU records a frame while the GPU
+	// executes the previous one
+	if (!rt->init_offscreen(p_width, p_height, 2, p_readback)) {
+		rt->terminate();
+		delete rt;
+		ERR_FAIL_V(RID());
+	}
 
-	return render_target_owner.make_rid(rt);
+	const RID rid = render_target_owner.make_rid(rt);
+	render_targets.push_back(rid);
+	return rid;
 }
 
 void VulkanVisualServer::destroy_render_target(RID p_render_target) {
@@ -79,14 +161,207 @@ void VulkanVisualServer::destroy_render_target(RID p_render_target) {
 	RenderTarget *rt = render_target_owner.get(p_render_target);
 	ERR_FAIL_COND(!rt);
 
-	WindowServer::get_singleton()->window_set_vulkan_instance(
-			rt->get_window(),
-			VK_NULL_HANDLE);
+	for (size_t i = 0; i < window_render_targets.size(); ++i) {
+		if (window_render_targets[i] == rt) {
+			window_render_targets.erase(window_render_targets.begin() + i);
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < render_targets.size(); ++i) {
+		if (render_targets[i].get_data() == p_render_target.get_data()) {
+			render_targets.erase(render_targets.begin() + i);
+			break;
+		}
+	}
+
+	rt->terminate();
+
+	if (rt->get_window().get_data()) {
+		WindowServer::get_singleton()->window_set_vulkan_instance(
+				rt->get_window(),
+				VK_NULL_HANDLE);
+	}
 
 	render_target_owner.release(p_render_target);
 	delete rt;
 }
 
+void VulkanVisualServer::draw() {
+
+	if (window_render_targets.empty())
+		return;
+
+	const uint32_t frame_index = frame_count % FRAMES_IN_FLIGHT;
+	Frame &frame = frames[frame_index];
+
+	// Make sure the GPU has finished with this frame resources
+	vkWaitForFences(logical_device, 1, &frame.fence, VK_TRUE, FENCE_TIMEOUT_NANOSEC);
+
+	std::vector<RenderTarget *> targets;
+	std::vector<VkSemaphore> wait_semaphores;
+	std::vector<VkPipelineStageFlags> wait_stages;
+	std::vector<VkSemaphore> signal_semaphores;
+	std::vector<VkSwapchainKHR> swapchains;
+	std::vector<uint32_t> image_indices;
+
+	for (size_t i = 0; i < window_render_targets.size(); ++i) {
+		RenderTarget *rt = window_render_targets[i];
+
+		VkSemaphore image_available;
+		if (!rt->acquire(frame_index, &image_available))
+			continue;
+
+		targets.push_back(rt);
+		wait_semaphores.push_back(image_available);
+		wait_stages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+		signal_semaphores.push_back(rt->get_render_finished_semaphore(frame_index));
+		swapchains.push_back(rt->get_swapchain());
+		image_indices.push_back(rt->get_acquired_image());
+	}
+
+	if (targets.empty())
+		return;
+
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	// The command pool is created with the reset bit, so the begin resets it
+	ERR_FAIL_COND(VK_SUCCESS != vkBeginCommandBuffer(frame.command_buffer, &begin_info));
+
+	for (size_t i = 0; i < targets.size(); ++i) {
+		targets[i]->record(frame.command_buffer);
+	}
+
+	ERR_FAIL_COND(VK_SUCCESS != vkEndCommandBuffer(frame.command_buffer));
+
+	// One submission for all the windows
+	VkSubmitInfo submit_info = {};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.waitSemaphoreCount = wait_semaphores.size();
+	submit_info.pWaitSemaphores = wait_semaphores.data();
+	submit_info.pWaitDstStageMask = wait_stages.data();
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &frame.command_buffer;
+	submit_info.signalSemaphoreCount = signal_semaphores.size();
+	submit_info.pSignalSemaphores = signal_semaphores.data();
+
+	vkResetFences(logical_device, 1, &frame.fence);
+
+	VkResult res = vkQueueSubmit(graphics_queue, 1, &submit_info, frame.fence);
+	ERR_FAIL_COND(VK_SUCCESS != res);
+
+	// One present for all the swapchains
+	std::vector<VkResult> results(targets.size(), VK_SUCCESS);
+
+	VkPresentInfoKHR present_info = {};
+	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	present_info.waitSemaphoreCount = signal_semaphores.size();
+	present_info.pWaitSemaphores = signal_semaphores.data();
+	present_info.swapchainCount = swapchains.size();
+	present_info.pSwapchains = swapchains.data();
+	present_info.pImageIndices = image_indices.data();
+	present_info.pResults = results.data();
+
+	vkQueuePresentKHR(presentation_queue, &present_info);
+
+	for (size_t i = 0; i < targets.size(); ++i) {
+		targets[i]->notify_present_result(results[i]);
+	}
+
+	++frame_count;
+}
+
+RenderTarget *VulkanVisualServer::get_render_target(RID p_render_target) {
+	return render_target_owner.get(p_render_target);
+}
+
+VkCommandBuffer VulkanVisualServer::begin_upload() {
+
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	ERR_FAIL_COND_V(VK_SUCCESS != vkBeginCommandBuffer(upload_command_buffer, &begin_info), VK_NULL_HANDLE);
+	return upload_command_buffer;
+}
+
+bool VulkanVisualServer::end_upload() {
+
+	ERR_FAIL_COND_V(VK_SUCCESS != vkEndCommandBuffer(upload_command_buffer), false);
+
+	VkSubmitInfo submit_info = {};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &upload_command_buffer;
+
+	vkResetFences(logical_device, 1, &upload_fence);
+	ERR_FAIL_COND_V(VK_SUCCESS != vkQueueSubmit(graphics_queue, 1, &submit_info, upload_fence), false);
+
+	vkWaitForFences(logical_device, 1, &upload_fence, VK_TRUE, FENCE_TIMEOUT_NANOSEC);
+	return true;
+}
+
+bool VulkanVisualServer::upload_buffer(
+		VkBuffer p_buffer,
+		VkDeviceSize p_offset,
+		const void *p_data,
+		VkDeviceSize p_size) {
+
+	VkBufferCreateInfo buffer_create_info = {};
+	buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_create_info.size = p_size;
+	buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VmaAllocationCreateInfo allocation_create_info = {};
+	allocation_create_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+
+	VkBuffer staging_buffer;
+	VmaAllocation staging_allocation;
+
+	ERR_FAIL_COND_V(
+			VK_SUCCESS != vmaCreateBuffer(
+								  allocator,
+								  &buffer_create_info,
+								  &allocation_create_info,
+								  &staging_buffer,
+								  &staging_allocation,
+								  nullptr),
+			false);
+
+	void *data;
+	vmaMapMemory(allocator, staging_allocation, &data);
+	memcpy(data, p_data, p_size);
+	vmaUnmapMemory(allocator, staging_allocation);
+
+	bool success = false;
+	VkCommandBuffer command_buffer = begin_upload();
+	if (command_buffer != VK_NULL_HANDLE) {
+
+		VkBufferCopy region = {};
+		region.srcOffset = 0;
+		region.dstOffset = p_offset;
+		region.size = p_size;
+		vkCmdCopyBuffer(command_buffer, staging_buffer, p_buffer, 1, &region);
+
+		success = end_upload();
+	}
+
+	vmaDestroyBuffer(allocator, staging_buffer, staging_allocation);
+	return success;
+}
+
+OffscreenRenderTarget *VulkanVisualServer::get_offscreen_render_target(
+		RID p_render_target) {
+
+	RenderTarget *rt = render_target_owner.get(p_render_target);
+	ERR_FAIL_COND_V(!rt, nullptr);
+
+	return dynamic_cast<OffscreenRenderTarget *>(rt);
+}
+
 bool VulkanVisualServer::is_validation_layer_enabled() const {
 #ifdef DEBUG_ENABLED
 	return true;
@@ -124,7 +399,8 @@ bool VulkanVisualServer::create_vulkan_instance() {
 		requiredExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 	}
 
-	WindowServer::get_singleton()->get_required_extensions(requiredExtensions);
+	if (!headless)
+		WindowServer::get_singleton()->get_required_extensions(requiredExtensions);
 
 	if (!check_instance_extensions_support(requiredExtensions)) {
 		return false;
@@ -198,6 +474,201 @@ void VulkanVisualServer::free_debug_callback() {
 	print_verbose("Debug callback destroyed");
 }
 
+bool VulkanVisualServer::create_logical_device() {
+
+	std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
+
+	float priority = 1.f;
+
+	// Information to create graphycs queue
+
+	VkDeviceQueueCreateInfo graphics_queue_create_info = {};
+	graphics_queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	graphics_queue_create_info.queueFamilyIndex = queue_families.graphics_family_index;
+	graphics_queue_create_info.queueCount = 1;
+	graphics_queue_create_info.pQueuePriorities = &priority;
+
+	queue_create_infos.push_back(graphics_queue_create_info);
+
+	if (!headless &&
+			queue_families.graphics_family_index != queue_families.presentation_family_index) {
+
+		// Create dedicated presentation queue in case the graphycs queue doesn't
+		// support presentation
+
+		VkDeviceQueueCreateInfo presentation_queue_create_info = {};
+		presentation_queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		presentation_queue_create_info.queueFamilyIndex = queue_families.presentation_family_index;
+		presentation_queue_create_info.queueCount = 1;
+		presentation_queue_create_info.pQueuePriorities = &priority;
+
+		queue_create_infos.push_back(presentation_queue_create_info);
+	}
+
+	// Request physica device feature.
+	VkPhysicalDeviceFeatures physical_device_features = {};
+	physical_device_features.samplerAnisotropy = VK_TRUE;
+
+	// Information to create logical device
+	VkDeviceCreateInfo ldevice_create_infos = {};
+	ldevice_create_infos.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	ldevice_create_infos.queueCreateInfoCount = queue_create_infos.size();
+	ldevice_create_infos.pQueueCreateInfos = queue_create_infos.data();
+	ldevice_create_infos.pEnabledFeatures = &physical_device_features;
+	ldevice_create_infos.enabledExtensionCount = device_extensions.size();
+	ldevice_create_infos.ppEnabledExtensionNames = device_extensions.data();
+
+	if (is_validation_layer_enabled()) {
+		ldevice_create_infos.enabledLayerCount = layers.size();
+		ldevice_create_infos.ppEnabledLayerNames = layers.data();
+	} else {
+		ldevice_create_infos.enabledLayerCount = 0;
+	}
+
+	VkResult res = vkCreateDevice(
+			physical_device,
+			&ldevice_create_infos,
+			nullptr,
+			&logical_device);
+
+	ERR_FAIL_COND_V(res != VK_SUCCESS, false);
+	print_verbose("Logical device created");
+	return true;
+}
+
+void VulkanVisualServer::free_logical_device() {
+	if (logical_device == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyDevice(logical_device, nullptr);
+	logical_device = VK_NULL_HANDLE;
+	print_verbose("Logical device destroyed");
+}
+
+void VulkanVisualServer::lockup_queues() {
+
+	vkGetDeviceQueue(
+			logical_device,
+			queue_families.graphics_family_index,
+			0,
+			&graphics_queue);
+
+	if (headless) {
+		// Nothing is presented
+		presentation_queue = VK_NULL_HANDLE;
+		return;
+	}
+
+	if (queue_families.graphics_family_index !=
+			queue_families.presentation_family_index) {
+
+		// Lockup dedicated presentation queue
+		vkGetDeviceQueue(
+				logical_device,
+				queue_families.presentation_family_index,
+				0,
+				&presentation_queue);
+	} else {
+		presentation_queue = graphics_queue;
+	}
+}
+
+bool VulkanVisualServer::create_command_pool() {
+
+	VkCommandPoolCreateInfo command_pool_create_info = {};
+	command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	command_pool_create_info.queueFamilyIndex = queue_families.graphics_family_index;
+	command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	VkResult res = vkCreateCommandPool(
+			logical_device,
+			&command_pool_create_info,
+			nullptr,
+			&graphics_command_pool);
+
+	ERR_FAIL_COND_V(VK_SUCCESS != res, false);
+	return true;
+}
+
+void VulkanVisualServer::free_command_pool() {
+	if (graphics_command_pool == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyCommandPool(logical_device, graphics_command_pool, nullptr);
+	graphics_command_pool = VK_NULL_HANDLE;
+}
+
+bool VulkanVisualServer::create_allocator() {
+
+	VmaAllocatorCreateInfo allocator_create_info = {};
+	allocator_create_info.physicalDevice = physical_device;
+	allocator_create_info.device = logical_device;
+
+	ERR_FAIL_COND_V(
+			VK_SUCCESS != vmaCreateAllocator(
+								  &allocator_create_info,
+								  &allocator),
+			false);
+
+	return true;
+}
+
+void VulkanVisualServer::free_allocator() {
+	if (allocator == VK_NULL_HANDLE)
+		return;
+
+	vmaDestroyAllocator(allocator);
+	allocator = VK_NULL_HANDLE;
+}
+
+bool VulkanVisualServer::create_frames() {
+
+	VkCommandBufferAllocateInfo allocate_info = {};
+	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocate_info.commandPool = graphics_command_pool;
+	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocate_info.commandBufferCount = 1;
+
+	// Signaled, so the first wait doesn't block
+	VkFenceCreateInfo fence_create_info = {};
+	fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		ERR_FAIL_COND_V(VK_SUCCESS != vkAllocateCommandBuffers(logical_device, &allocate_info, &frames[i].command_buffer), false);
+		ERR_FAIL_COND_V(VK_SUCCESS != vkCreateFence(logical_device, &fence_create_info, nullptr, &frames[i].fence), false);
+	}
+
+	ERR_FAIL_COND_V(VK_SUCCESS != vkAllocateCommandBuffers(logical_device, &allocate_info, &upload_command_buffer), false);
+	ERR_FAIL_COND_V(VK_SUCCESS != vkCreateFence(logical_device, &fence_create_info, nullptr, &upload_fence), false);
+
+	return true;
+}
+
+void VulkanVisualServer::free_frames() {
+
+	for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		if (frames[i].fence != VK_NULL_HANDLE) {
+			vkDestroyFence(logical_device, frames[i].fence, nullptr);
+			frames[i].fence = VK_NULL_HANDLE;
+		}
+		if (frames[i].command_buffer != VK_NULL_HANDLE) {
+			vkFreeCommandBuffers(logical_device, graphics_command_pool, 1, &frames[i].command_buffer);
+			frames[i].command_buffer = VK_NULL_HANDLE;
+		}
+	}
+
+	if (upload_fence != VK_NULL_HANDLE) {
+		vkDestroyFence(logical_device, upload_fence, nullptr);
+		upload_fence = VK_NULL_HANDLE;
+	}
+
+	if (upload_command_buffer != VK_NULL_HANDLE) {
+		vkFreeCommandBuffers(logical_device, graphics_command_pool, 1, &upload_command_buffer);
+		upload_command_buffer = VK_NULL_HANDLE;
+	}
+}
+
 bool VulkanVisualServer::select_physical_device(
 		VkSurfaceKHR p_initialization_surface) {
 
@@ -287,10 +758,14 @@ int VulkanVisualServer::filter_physical_devices(
 		if (device_props.deviceType != p_device_type)
 			continue;
 
-		if (!device_features.geometryShader || !device_features.samplerAnisotropy)
+		// The geometry shader is not used, and it's not supported by the
+		// software implementations
+		if (!device_features.samplerAnisotropy)
 			continue;
 
-		if (!filter_queue_families(p_devices[i], p_surface).is_complete())
+		const bool presentation = p_surface != VK_NULL_HANDLE;
+
+		if (!filter_queue_families(p_devices[i], p_surface).is_complete(presentation))
 			continue;
 
 		if (!are_extensions_supported(
@@ -298,6 +773,9 @@ int VulkanVisualServer::filter_physical_devices(
 					available_extensions))
 			continue;
 
+		if (!presentation)
+			return i;
+
 		// Check if swap chain is supported by this device
 		PhysicalDeviceSwapChainDetails details;
 		get_physical_device_swap_chain_details(
@@ -387,6 +865,9 @@ VulkanVisualServer::QueueFamilyIndices VulkanVisualServer::filter_queue_families
 			indices.graphics_family_index = i;
 		}
 
+		if (p_surface == VK_NULL_HANDLE)
+			continue;
+
 		VkBool32 supported = false;
 		vkGetPhysicalDeviceSurfaceSupportKHR(
 				p_device,
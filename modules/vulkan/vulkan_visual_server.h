@@ -2,8 +2,11 @@
 
 #include "servers/visual_server.h"
 
+#include "offscreen_render_target.h"
 #include "render_target.h"
 #include "thirdparty/vulkan/vulkan.h"
+
+#include "libs/vma/vk_mem_alloc.h"
 #include <vector>
 
 // Physical device and Queue Family
@@ -44,6 +47,10 @@
 //			Create images and Buffers, set pipeline, Load shaders,
 //			record commands, etc...
 //
+//		There is only one Logical Device, owned by the VulkanVisualServer and
+//		shared by all the render targets, so any resource can be used by any
+//		window.
+//
 
 class VulkanVisualServer : public VisualServer {
 
@@ -52,12 +59,12 @@ public:
 		int graphics_family_index = -1;
 		int presentation_family_index = -1;
 
-		bool is_complete() {
+		bool is_complete(bool p_presentation = true) {
 
 			if (graphics_family_index == -1)
 				return false;
 
-			if (presentation_family_index == -1)
+			if (p_presentation && presentation_family_index == -1)
 				return false;
 
 			return true;
@@ -70,9 +77,32 @@ public:
 		std::vector<VkPresentModeKHR> present_modes;
 	};
 
+	// The CPU records a frame while the GPU executes the previous one
+	static const uint32_t FRAMES_IN_FLIGHT = 2;
+
 private:
+	struct Frame {
+		VkCommandBuffer command_buffer;
+		VkFence fence;
+
+		Frame() :
+				command_buffer(VK_NULL_HANDLE),
+				fence(VK_NULL_HANDLE) {}
+	};
+
 	mutable RID_owner<RenderTarget> render_target_owner;
 
+	// All the render targets, the offscreen ones included, so terminate
+	// frees the ones not destroyed by the user
+	std::vector<RID> render_targets;
+
+	// Drawn by draw, in creation order
+	std::vector<RenderTarget *> window_render_targets;
+
+	// When headless the window server is never used, so no surface
+	// nor swapchain can be created
+	bool headless;
+
 	VkInstance vulkan_instance;
 	std::vector<const char *> layers;
 	std::vector<const char *> device_extensions;
@@ -82,23 +112,50 @@ private:
 	VkDeviceSize physical_device_min_uniform_buffer_offset_alignment;
 	QueueFamilyIndices queue_families;
 
+	VkDevice logical_device;
+	VkQueue graphics_queue;
+	VkQueue presentation_queue;
+	VkCommandPool graphics_command_pool;
+	VmaAllocator allocator;
+
+	Frame frames[FRAMES_IN_FLIGHT];
+	uint64_t frame_count;
+
+	// Upload path, the upload is submitted and waited
+	VkCommandBuffer upload_command_buffer;
+	VkFence upload_fence;
+
 	static VulkanVisualServer *singleton;
 
 public:
 	static VulkanVisualServer *get_singleton() { return singleton; }
 
 public:
-	VulkanVisualServer();
+	VulkanVisualServer(bool p_headless = false);
 
 	virtual void init();
 	virtual void terminate();
 
 	virtual RID create_render_target(RID p_window);
+	virtual RID create_offscreen_render_target(
+			int p_width,
+			int p_height,
+			bool p_readback);
+
 	virtual void destroy_render_target(RID p_render_target);
 
+	/// Records all the window render targets in one command buffer, then
+	/// submits and presents them once
+	virtual void draw();
+
+	OffscreenRenderTarget *get_offscreen_render_target(RID p_render_target);
+	RenderTarget *get_render_target(RID p_render_target);
+
 public:
 	bool is_validation_layer_enabled() const;
 
+	bool is_headless() const { return headless; }
+
 	const std::vector<const char *> &get_layers() const {
 		return layers;
 	}
@@ -119,6 +176,29 @@ public:
 		return queue_families;
 	}
 
+	VkDevice get_logical_device() const { return logical_device; }
+	VkQueue get_graphics_queue() const { return graphics_queue; }
+	VkQueue get_presentation_queue() const { return presentation_queue; }
+	VkCommandPool get_graphics_command_pool() const { return graphics_command_pool; }
+	VmaAllocator get_allocator() const { return allocator; }
+
+	/// The returned command buffer is submitted by end_upload, that waits
+	/// its execution
+	VkCommandBuffer begin_upload();
+	bool end_upload();
+
+	/// Copy the data in a device local buffer, using a staging buffer
+	bool upload_buffer(
+			VkBuffer p_buffer,
+			VkDeviceSize p_offset,
+			const void *p_data,
+			VkDeviceSize p_size);
+
+	static void get_physical_device_swap_chain_details(
+			VkPhysicalDevice p_device,
+			VkSurfaceKHR p_surface,
+			PhysicalDeviceSwapChainDetails *r_details);
+
 private:
 	/** VULKAN INSTANCE */
 
@@ -132,20 +212,35 @@ private:
 
 	bool select_physical_device(VkSurfaceKHR p_initialization_surface);
 
+	/// Uses a temporary window to select a device that can present
+	void init_with_window();
+
 	/// Returns the index in the array with best device,
-	/// depending on device_type
+	/// depending on device_type.
+	/// When the surface is null the presentation support is not checked
 	/// The r_device_props will contains the properties of device
 	int filter_physical_devices(
 			const std::vector<VkPhysicalDevice> &p_devices,
 			VkSurfaceKHR p_surface,
 			VkPhysicalDeviceType p_device_type);
 
-	/** MISCELLANEOUS */
+	/** LOGICAL DEVICE */
 
-	static void get_physical_device_swap_chain_details(
-			VkPhysicalDevice p_device,
-			VkSurfaceKHR p_surface,
-			PhysicalDeviceSwapChainDetails *r_details);
+	bool create_logical_device();
+	void free_logical_device();
+
+	void lockup_queues();
+
+	bool create_command_pool();
+	void free_command_pool();
+
+	bool create_allocator();
+	void free_allocator();
+
+	bool create_frames();
+	void free_frames();
+
+	/** MISCELLANEOUS */
 
 	/// Real the queue families of device and returns
 	/// the indices of queue family if they provide the features
@@ -15,5 +15,15 @@ public:
 	virtual void terminate() = 0;
 
 	virtual RID create_render_target(RID p_window) = 0;
+
+	/// Render target without window, used to render on headless machines
+	virtual RID create_offscreen_render_target(
+			int p_width,
+			int p_height,
+			bool p_readback) = 0;
+
 	virtual void destroy_render_target(RID p_render_target) = 0;
+
+	/// Draw and present all the window render targets
+	virtual void draw() = 0;
 };
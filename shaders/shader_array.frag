@@ -0,0 +1,19 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec2 textCoord;
+
+// The size of the texture table is set by the renderer
+layout(constant_id = 0) const uint TEXTURE_COUNT = 16;
+
+layout(set = 2, binding = 0) uniform sampler2D textures[TEXTURE_COUNT];
+
+layout(push_constant) uniform DrawConstants {
+	uint textureIndex;
+} draw;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	outColor = texture(textures[draw.textureIndex], textCoord);
+}
@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+layout(location = 0) in vec2 textCoord;
+
+// Partially bound, only the slots used by the draws are valid
+layout(set = 2, binding = 0) uniform sampler2D textures[];
+
+layout(push_constant) uniform DrawConstants {
+	uint textureIndex;
+} draw;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	outColor = texture(textures[draw.textureIndex], textCoord);
+}
@@ -0,0 +1,204 @@
+#include "bc_encoder.h"
+
+#include "core/typedefs.h"
+#include <cmath>
+#include <cstring>
+
+static void fetchBlock(const uint8_t *p_rgba, uint32_t p_width, uint32_t p_height, uint32_t p_blockX, uint32_t p_blockY, uint8_t r_block[64]) {
+	for (uint32_t y = 0; y < 4; ++y) {
+		const uint32_t srcY = MIN(p_blockY * 4 + y, p_height - 1);
+		for (uint32_t x = 0; x < 4; ++x) {
+			const uint32_t srcX = MIN(p_blockX * 4 + x, p_width - 1);
+			memcpy(r_block + (y * 4 + x) * 4, p_rgba + (srcY * p_width + srcX) * 4, 4);
+		}
+	}
+}
+
+static uint16_t packRGB565(const float p_color[3]) {
+	const uint16_t r = uint16_t(CLAMP(int(p_color[0] * 31.f / 255.f + 0.5f), 0, 31));
+	const uint16_t g = uint16_t(CLAMP(int(p_color[1] * 63.f / 255.f + 0.5f), 0, 63));
+	const uint16_t b = uint16_t(CLAMP(int(p_color[2] * 31.f / 255.f + 0.5f), 0, 31));
+	return (r << 11) | (g << 5) | b;
+}
+
+static void unpackRGB565(uint16_t p_color, int r_color[3]) {
+	const int r = (p_color >> 11) & 31;
+	const int g = (p_color >> 5) & 63;
+	const int b = p_color & 31;
+	r_color[0] = (r << 3) | (r >> 2);
+	r_color[1] = (g << 2) | (g >> 4);
+	r_color[2] = (b << 3) | (b >> 2);
+}
+
+static void encodeColorBlock(const uint8_t p_block[64], uint8_t r_encoded[8]) {
+
+	float mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i) {
+		for (int c = 0; c < 3; ++c) {
+			mean[c] += p_block[i * 4 + c];
+		}
+	}
+	for (int c = 0; c < 3; ++c) {
+		mean[c] /= 16.f;
+	}
+
+	float covariance[6] = { 0, 0, 0, 0, 0, 0 }; // rr rg rb gg gb bb
+	for (int i = 0; i < 16; ++i) {
+		const float r = p_block[i * 4 + 0] - mean[0];
+		const float g = p_block[i * 4 + 1] - mean[1];
+		const float b = p_block[i * 4 + 2] - mean[2];
+		covariance[0] += r * r;
+		covariance[1] += r * g;
+		covariance[2] += r * b;
+		covariance[3] += g * g;
+		covariance[4] += g * b;
+		covariance[5] += b * b;
+	}
+
+	// Principal axis by power iteration, starting from the luminance
+	float axis[3] = { 0.3f, 0.59f, 0.11f };
+	for (int iteration = 0; iteration < 8; ++iteration) {
+		const float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+		const float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+		const float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+		const float length = std::sqrt(x * x + y * y + z * z);
+		if (length < 1e-6f)
+			break;
+		axis[0] = x / length;
+		axis[1] = y / length;
+		axis[2] = z / length;
+	}
+
+	float minProjection = 1e9f;
+	float maxProjection = -1e9f;
+	for (int i = 0; i < 16; ++i) {
+		const float projection = (p_block[i * 4 + 0] - mean[0]) * axis[0] +
+								 (p_block[i * 4 + 1] - mean[1]) * axis[1] +
+								 (p_block[i * 4 + 2] - mean[2]) * axis[2];
+		minProjection = MIN(minProjection, projection);
+		maxProjection = MAX(maxProjection, projection);
+	}
+
+	float maxColor[3];
+	float minColor[3];
+	for (int c = 0; c < 3; ++c) {
+		maxColor[c] = mean[c] + axis[c] * maxProjection;
+		minColor[c] = mean[c] + axis[c] * minProjection;
+	}
+
+	uint16_t color0 = packRGB565(maxColor);
+	uint16_t color1 = packRGB565(minColor);
+
+	// color0 > color1 selects the 4 colors mode
+	if (color0 < color1) {
+		const uint16_t tmp = color0;
+		color0 = color1;
+		color1 = tmp;
+	}
+
+	uint32_t indices = 0;
+	if (color0 != color1) {
+		int palette[4][3];
+		unpackRGB565(color0, palette[0]);
+		unpackRGB565(color1, palette[1]);
+		for (int c = 0; c < 3; ++c) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		for (int i = 0; i < 16; ++i) {
+			int bestIndex = 0;
+			int bestDistance = INT32_MAX;
+			for (int p = 0; p < 4; ++p) {
+				int distance = 0;
+				for (int c = 0; c < 3; ++c) {
+					const int d = p_block[i * 4 + c] - palette[p][c];
+					distance += d * d;
+				}
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					bestIndex = p;
+				}
+			}
+			indices |= uint32_t(bestIndex) << (i * 2);
+		}
+	}
+
+	r_encoded[0] = color0 & 0xFF;
+	r_encoded[1] = color0 >> 8;
+	r_encoded[2] = color1 & 0xFF;
+	r_encoded[3] = color1 >> 8;
+	for (int i = 0; i < 4; ++i) {
+		r_encoded[4 + i] = (indices >> (i * 8)) & 0xFF;
+	}
+}
+
+static void encodeAlphaBlock(const uint8_t p_block[64], uint8_t r_encoded[8]) {
+
+	int alpha0 = 0;
+	int alpha1 = 255;
+	for (int i = 0; i < 16; ++i) {
+		alpha0 = MAX(alpha0, int(p_block[i * 4 + 3]));
+		alpha1 = MIN(alpha1, int(p_block[i * 4 + 3]));
+	}
+
+	// alpha0 > alpha1 selects the 8 values mode
+	uint64_t indices = 0;
+	if (alpha0 != alpha1) {
+		int palette[8];
+		palette[0] = alpha0;
+		palette[1] = alpha1;
+		for (int p = 1; p < 7; ++p) {
+			palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+		}
+
+		for (int i = 0; i < 16; ++i) {
+			int bestIndex = 0;
+			int bestDistance = INT32_MAX;
+			for (int p = 0; p < 8; ++p) {
+				const int distance = ABS(int(p_block[i * 4 + 3]) - palette[p]);
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					bestIndex = p;
+				}
+			}
+			indices |= uint64_t(bestIndex) << (i * 3);
+		}
+	}
+
+	r_encoded[0] = alpha0;
+	r_encoded[1] = alpha1;
+	for (int i = 0; i < 6; ++i) {
+		r_encoded[2 + i] = (indices >> (i * 8)) & 0xFF;
+	}
+}
+
+void encodeBC1(const uint8_t *p_rgba, uint32_t p_width, uint32_t p_height, std::vector<uint8_t> &r_blocks) {
+	const uint32_t blocksX = (p_width + 3) / 4;
+	const uint32_t blocksY = (p_height + 3) / 4;
+	r_blocks.resize(size_t(blocksX) * blocksY * 8);
+
+	uint8_t block[64];
+	for (uint32_t y = 0; y < blocksY; ++y) {
+		for (uint32_t x = 0; x < blocksX; ++x) {
+			fetchBlock(p_rgba, p_width, p_height, x, y, block);
+			encodeColorBlock(block, r_blocks.data() + (size_t(y) * blocksX + x) * 8);
+		}
+	}
+}
+
+void encodeBC3(const uint8_t *p_rgba, uint32_t p_width, uint32_t p_height, std::vector<uint8_t> &r_blocks) {
+	const uint32_t blocksX = (p_width + 3) / 4;
+	const uint32_t blocksY = (p_height + 3) / 4;
+	r_blocks.resize(size_t(blocksX) * blocksY * 16);
+
+	uint8_t block[64];
+	for (uint32_t y = 0; y < blocksY; ++y) {
+		for (uint32_t x = 0; x < blocksX; ++x) {
+			fetchBlock(p_rgba, p_width, p_height, x, y, block);
+			uint8_t *encoded = r_blocks.data() + (size_t(y) * blocksX + x) * 16;
+			encodeAlphaBlock(block, encoded);
+			encodeColorBlock(block, encoded + 8);
+		}
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// BC ENCODER
+//		Minimal block encoder used by the texture cooker, it favours the
+// simplicity over the quality: the color endpoints are the extremes of the
+// block along its principal axis, and each texel takes the nearest value of
+// the palette.
+//		The input is RGBA 8 bits per channel, the blocks on the right and on
+// the bottom edges repeat the last texel.
+
+// 8 bytes per block, 4 colors mode (no punch through alpha)
+void encodeBC1(const uint8_t *p_rgba, uint32_t p_width, uint32_t p_height, std::vector<uint8_t> &r_blocks);
+
+// 16 bytes per block, the alpha block followed by a BC1 color block
+void encodeBC3(const uint8_t *p_rgba, uint32_t p_width, uint32_t p_height, std::vector<uint8_t> &r_blocks);
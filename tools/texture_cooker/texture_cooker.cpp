@@ -0,0 +1,188 @@
+#include "bc_encoder.h"
+#include "universal_encoder.h"
+#include "core/console_handlers.h"
+#include "core/error_macros.h"
+#include "core/image_utils.h"
+#include "core/ktx2.h"
+#include "core/print_string.h"
+#include "core/string.h"
+#include "libs/stb/stb_image.h"
+#include <cstring>
+#include <fstream>
+
+// TEXTURE COOKER
+//		Converts a PNG or JPG image in a KTX2 container with the full mip
+// chain, block compressed:
+//
+//		hello_vulkan_texture_cooker --format=auto assets/TestText.jpg
+//
+//		The mips are filtered before the compression, so the runtime copies
+// the blocks of the file in the staging buffer without decoding them.
+//		BC1 is used by the opaque images (8 times smaller than RGBA8), BC3 by
+// the images with alpha (4 times smaller).
+//		The universal format (ETC1S blocks, see Transcoder) is transcoded at
+// load time, so one file serves the devices without BC.
+
+enum CookFormat {
+	COOK_FORMAT_AUTO,
+	COOK_FORMAT_BC1,
+	COOK_FORMAT_BC3,
+	COOK_FORMAT_UNIVERSAL
+};
+
+struct CookerConfig {
+	CookFormat format;
+	std::string inputPath;
+	std::string outputPath; // Empty to replace the extension of the input
+
+	CookerConfig() :
+			format(COOK_FORMAT_AUTO) {}
+};
+
+static void printUsage() {
+	print_line("Usage: hello_vulkan_texture_cooker [options] INPUT");
+	print_line("  --format=F           auto, bc1, bc3 or universal (default auto, bc3 only when the image has alpha)");
+	print_line("  --output=PATH        Output file (default INPUT with the .ktx2 extension)");
+}
+
+static bool parseArgument(const char *p_arg, const char *p_name, std::string &r_value) {
+	const size_t len = strlen(p_name);
+	if (strncmp(p_arg, p_name, len) != 0 || p_arg[len] != '=')
+		return false;
+
+	r_value = p_arg + len + 1;
+	return true;
+}
+
+static bool parseArguments(int argc, char **argv, CookerConfig &r_config) {
+
+	for (int i = 1; i < argc; ++i) {
+		std::string value;
+
+		if (parseArgument(argv[i], "--format", value)) {
+			if (value == "auto") {
+				r_config.format = COOK_FORMAT_AUTO;
+			} else if (value == "bc1") {
+				r_config.format = COOK_FORMAT_BC1;
+			} else if (value == "bc3") {
+				r_config.format = COOK_FORMAT_BC3;
+			} else if (value == "universal") {
+				r_config.format = COOK_FORMAT_UNIVERSAL;
+			} else {
+				print_error("Unknown format: " + value);
+				return false;
+			}
+		} else if (parseArgument(argv[i], "--output", value)) {
+			r_config.outputPath = value;
+		} else if (argv[i][0] != '-' && r_config.inputPath.empty()) {
+			r_config.inputPath = argv[i];
+		} else {
+			print_error(std::string("Unknown argument: ") + argv[i]);
+			return false;
+		}
+	}
+
+	if (r_config.inputPath.empty()) {
+		print_error("Missing input");
+		return false;
+	}
+
+	if (r_config.outputPath.empty()) {
+		const size_t dot = r_config.inputPath.find_last_of('.');
+		r_config.outputPath = r_config.inputPath.substr(0, dot) + ".ktx2";
+	}
+
+	return true;
+}
+
+static bool hasAlpha(const uint8_t *p_rgba, size_t p_texels) {
+	for (size_t i = 0; i < p_texels; ++i) {
+		if (p_rgba[i * 4 + 3] != 255)
+			return true;
+	}
+	return false;
+}
+
+static int cook(const CookerConfig &p_config) {
+
+	int width;
+	int height;
+	int channels;
+	unsigned char *imageData = stbi_load(p_config.inputPath.c_str(), &width, &height, &channels, 4);
+	if (!imageData) {
+		print_error("Can't load the image: " + p_config.inputPath);
+		return 1;
+	}
+
+	const size_t texels = size_t(width) * height;
+	std::vector<uint8_t> chain(imageData, imageData + texels * 4);
+	stbi_image_free(imageData);
+
+	const bool alpha = hasAlpha(chain.data(), texels);
+	const bool universal = COOK_FORMAT_UNIVERSAL == p_config.format;
+
+	bool bc3 = COOK_FORMAT_BC3 == p_config.format;
+	if (COOK_FORMAT_AUTO == p_config.format)
+		bc3 = alpha;
+
+	const VkFormat format = bc3 ? VK_FORMAT_BC3_UNORM_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+
+	const uint32_t levelCount = computeMipLevels(width, height);
+	buildMipChain(width, height, 4, levelCount, chain);
+
+	std::vector<std::vector<uint8_t> > levels(levelCount);
+	size_t offset = 0;
+	for (uint32_t level = 0; level < levelCount; ++level) {
+		const uint32_t levelWidth = MAX(uint32_t(width) >> level, 1u);
+		const uint32_t levelHeight = MAX(uint32_t(height) >> level, 1u);
+
+		if (universal) {
+			encodeUniversal(chain.data() + offset, levelWidth, levelHeight, alpha, levels[level]);
+		} else if (bc3) {
+			encodeBC3(chain.data() + offset, levelWidth, levelHeight, levels[level]);
+		} else {
+			encodeBC1(chain.data() + offset, levelWidth, levelHeight, levels[level]);
+		}
+
+		offset += size_t(levelWidth) * levelHeight * 4;
+	}
+
+	std::vector<uint8_t> file;
+	if (universal) {
+		KTX2::writeUniversal(width, height, alpha, levels, file);
+	} else {
+		KTX2::write(format, width, height, levels, file);
+	}
+	ERR_FAIL_COND_V(file.empty(), 1);
+
+	std::ofstream output(p_config.outputPath.c_str(), std::ios::binary | std::ios::trunc);
+	if (!output.is_open()) {
+		print_error("Can't write: " + p_config.outputPath);
+		return 1;
+	}
+	output.write(reinterpret_cast<const char *>(file.data()), file.size());
+	output.close();
+
+	print_line(p_config.inputPath + " -> " + p_config.outputPath + " (" + (universal ? (alpha ? "universal with alpha" : "universal") : (bc3 ? "BC3" : "BC1")) + ", " +
+			   itos(width) + "x" + itos(height) + ", " + itos(levelCount) + " levels, " +
+			   itos(chain.size() / 1024) + " KiB RGBA8 -> " + itos(file.size() / 1024) + " KiB)");
+	return 0;
+}
+
+int main(int argc, char **argv) {
+
+	ConsoleHandlers consoleHandlers;
+
+	int result = 1;
+	CookerConfig config;
+	if (argc > 1 && strcmp(argv[1], "--help") == 0) {
+		printUsage();
+		result = 0;
+	} else if (parseArguments(argc, argv, config)) {
+		result = cook(config);
+	} else {
+		printUsage();
+	}
+
+	return result;
+}
@@ -0,0 +1,105 @@
+#include "universal_encoder.h"
+
+#include "core/ktx2.h"
+#include "core/transcoder.h"
+#include "core/typedefs.h"
+
+// p_texels are 16 RGB triplets, the channels not used are equal
+static void encodeBlock(const int p_texels[16][3], uint8_t r_block[8]) {
+
+	int sum[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i) {
+		for (int c = 0; c < 3; ++c) {
+			sum[c] += p_texels[i][c];
+		}
+	}
+
+	uint8_t base555[3];
+	int base[3];
+	for (int c = 0; c < 3; ++c) {
+		base555[c] = uint8_t(CLAMP((sum[c] * 31 + 255 * 8) / (255 * 16), 0, 31));
+		base[c] = (base555[c] << 3) | (base555[c] >> 2);
+	}
+
+	uint32_t bestTable = 0;
+	int bestError = INT32_MAX;
+	uint8_t bestSelectors[16] = {};
+
+	for (uint32_t table = 0; table < 8; ++table) {
+		const int modifiers[4] = {
+			Transcoder::MODIFIERS[table][0],
+			Transcoder::MODIFIERS[table][1],
+			-Transcoder::MODIFIERS[table][0],
+			-Transcoder::MODIFIERS[table][1]
+		};
+
+		int palette[4][3];
+		for (int s = 0; s < 4; ++s) {
+			for (int c = 0; c < 3; ++c) {
+				palette[s][c] = CLAMP(base[c] + modifiers[s], 0, 255);
+			}
+		}
+
+		uint8_t selectors[16];
+		int error = 0;
+		for (int i = 0; i < 16 && error < bestError; ++i) {
+			int bestTexelError = INT32_MAX;
+			for (int s = 0; s < 4; ++s) {
+				int texelError = 0;
+				for (int c = 0; c < 3; ++c) {
+					const int d = p_texels[i][c] - palette[s][c];
+					texelError += d * d;
+				}
+				if (texelError < bestTexelError) {
+					bestTexelError = texelError;
+					selectors[i] = s;
+				}
+			}
+			error += bestTexelError;
+		}
+
+		if (error < bestError) {
+			bestError = error;
+			bestTable = table;
+			for (int i = 0; i < 16; ++i) {
+				bestSelectors[i] = selectors[i];
+			}
+		}
+	}
+
+	Transcoder::packBlock(base555, bestTable, bestSelectors, r_block);
+}
+
+void encodeUniversal(const uint8_t *p_rgba, uint32_t p_width, uint32_t p_height, bool p_alpha, std::vector<uint8_t> &r_blocks) {
+	const uint32_t blocksX = (p_width + 3) / 4;
+	const uint32_t blocksY = (p_height + 3) / 4;
+	const size_t sliceSize = size_t(blocksX) * blocksY * KTX2::UNIVERSAL_BLOCK_SIZE;
+	r_blocks.resize(p_alpha ? sliceSize * 2 : sliceSize);
+
+	int colors[16][3];
+	int alphas[16][3];
+	for (uint32_t blockY = 0; blockY < blocksY; ++blockY) {
+		for (uint32_t blockX = 0; blockX < blocksX; ++blockX) {
+
+			// The edge blocks repeat the last texel
+			for (uint32_t y = 0; y < 4; ++y) {
+				const uint32_t srcY = MIN(blockY * 4 + y, p_height - 1);
+				for (uint32_t x = 0; x < 4; ++x) {
+					const uint32_t srcX = MIN(blockX * 4 + x, p_width - 1);
+					const uint8_t *texel = p_rgba + (size_t(srcY) * p_width + srcX) * 4;
+					colors[y * 4 + x][0] = texel[0];
+					colors[y * 4 + x][1] = texel[1];
+					colors[y * 4 + x][2] = texel[2];
+					alphas[y * 4 + x][0] = texel[3];
+					alphas[y * 4 + x][1] = texel[3];
+					alphas[y * 4 + x][2] = texel[3];
+				}
+			}
+
+			const size_t offset = (size_t(blockY) * blocksX + blockX) * KTX2::UNIVERSAL_BLOCK_SIZE;
+			encodeBlock(colors, r_blocks.data() + offset);
+			if (p_alpha)
+				encodeBlock(alphas, r_blocks.data() + sliceSize + offset);
+		}
+	}
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// UNIVERSAL ENCODER
+//		Encodes the ETC1S blocks of the universal textures (see Transcoder).
+// The base color of each block is its average, and the table is the one
+// with the least error once each texel takes its nearest selector.
+//		With p_alpha the alpha slice follows the color blocks.
+void encodeUniversal(const uint8_t *p_rgba, uint32_t p_width, uint32_t p_height, bool p_alpha, std::vector<uint8_t> &r_blocks);